@@ -0,0 +1,494 @@
+/*
+ * Random read or write rate of a file through io_submit() and through
+ * the AIO submission ring, in the manner of fio.
+ *
+ * Each run keeps depth blocks of size bytes in flight on random,
+ * aligned offsets of the file for secs seconds, resubmitting each block
+ * as it completes. The io_submit run reaps with io_getevents(). The
+ * ring runs put the iocbs on the submission ring and reap the events
+ * off the event ring, calling io_ring_enter() to submit and to wait;
+ * with -P a third run lets a kernel thread poll the submission ring
+ * (this needs CAP_SYS_ADMIN). For each run it prints the rate, the
+ * system calls made and the CPU time used per I/O, and how long the
+ * submitting calls took: average, median, 99th percentile and maximum.
+ *
+ *	./aio_ring -f file [-d] [-w] [-P] [-C] [-c cpu] [-s size] [-b bs]
+ *		   [-q depth] [-t secs]
+ *
+ * The file is created, or extended, to size bytes first. Buffered
+ * reads of a file that fits in memory only measure the page cache,
+ * use -C to drop its pages before each run or -d for O_DIRECT. Cold
+ * buffered reads show whether io_submit() waits for the disk: when it
+ * does, the submit latency is the device latency times the batch.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <linux/aio_abi.h>
+
+#ifndef __NR_io_ring_setup
+# if defined(__x86_64__)
+#  define __NR_io_ring_setup		309
+#  define __NR_io_ring_enter		310
+# elif defined(__i386__)
+#  define __NR_io_ring_setup		347
+#  define __NR_io_ring_enter		348
+# elif defined(__powerpc__)
+#  define __NR_io_ring_setup		351
+#  define __NR_io_ring_enter		352
+# else
+#  error "define __NR_io_ring_setup and __NR_io_ring_enter"
+# endif
+#endif
+
+#ifndef IORING_SETUP_SQPOLL
+# define IORING_SETUP_SQPOLL		(1 << 0)
+# define IORING_SETUP_SQ_AFF		(1 << 1)
+# define IORING_SQ_NEED_WAKEUP		(1 << 0)
+# define IORING_ENTER_GETEVENTS		(1 << 0)
+# define IORING_ENTER_SQ_WAKEUP		(1 << 1)
+
+struct io_ring_params {
+	__u32	sq_entries;
+	__u32	flags;
+	__u32	sq_thread_cpu;
+	__u32	sq_thread_idle;
+	__u64	ctx_id;
+	__u64	sq_ring;
+	__u64	resv[4];
+};
+
+struct aio_sq_ring {
+	__u32	head;
+	__u32	tail;
+	__u32	nr;
+	__u32	flags;
+	__u32	magic;
+	__u32	header_length;
+	__u32	resv[10];
+	struct iocb	iocbs[0];
+};
+#endif
+
+/* the event ring at the aio_context_t address, as in linux/aio.h */
+struct aio_ring {
+	unsigned	id;
+	unsigned	nr;
+	unsigned	head;
+	unsigned	tail;
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;
+	struct io_event	io_events[0];
+};
+
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#define mb()		__sync_synchronize()
+
+enum { RUN_SUBMIT, RUN_RING, RUN_SQPOLL };
+static const char *run_name[] = { "io_submit", "ring", "sqpoll" };
+
+static const char *cfg_file;
+static int cfg_direct;
+static int cfg_write;
+static int cfg_sqpoll;
+static int cfg_cold;
+static int cfg_cpu = -1;
+static long long cfg_size = 256LL << 20;
+static int cfg_bs = 4096;
+static int cfg_depth = 32;
+static int cfg_secs = 5;
+
+struct run_stats {
+	unsigned long long	ios;
+	unsigned long		syscalls;
+	unsigned long		submits;	/* timed submitting calls */
+	double			submit_us;
+	double			submit_max_us;
+	unsigned long		submit_hist[32];	/* log2 of us */
+};
+
+static void usage(const char *prog)
+{
+	error(1, 0, "usage: %s -f file [-d] [-w] [-P] [-C] [-c cpu] "
+		    "[-s size] [-b bs] [-q depth] [-t secs]", prog);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b:Cc:df:Pq:s:t:w")) != -1) {
+		switch (c) {
+		case 'b':
+			cfg_bs = atoi(optarg);
+			break;
+		case 'C':
+			cfg_cold = 1;
+			break;
+		case 'c':
+			cfg_cpu = atoi(optarg);
+			break;
+		case 'd':
+			cfg_direct = 1;
+			break;
+		case 'f':
+			cfg_file = optarg;
+			break;
+		case 'P':
+			cfg_sqpoll = 1;
+			break;
+		case 'q':
+			cfg_depth = atoi(optarg);
+			break;
+		case 's':
+			cfg_size = atoll(optarg);
+			break;
+		case 't':
+			cfg_secs = atoi(optarg);
+			break;
+		case 'w':
+			cfg_write = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || !cfg_file || cfg_bs <= 0 || cfg_bs % 512 ||
+	    cfg_depth <= 0 || cfg_secs <= 0 || cfg_size < cfg_bs)
+		usage(argv[0]);
+}
+
+static double tv_us(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+static double now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv_us(&tv);
+}
+
+/* create the file, or fill it up to cfg_size, so that reads hit data */
+static void prepare_file(void)
+{
+	long long off;
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(cfg_file, O_WRONLY | O_CREAT, 0644);
+	if (fd == -1)
+		error(1, errno, "open %s", cfg_file);
+	if (fstat(fd, &st))
+		error(1, errno, "fstat");
+
+	buf = malloc(1 << 20);
+	if (!buf)
+		error(1, errno, "malloc");
+	memset(buf, 'a', 1 << 20);
+
+	for (off = st.st_size & ~((1LL << 20) - 1); off < cfg_size;
+	     off += 1 << 20) {
+		if (pwrite(fd, buf, 1 << 20, off) != 1 << 20)
+			error(1, errno, "pwrite");
+	}
+	if (fsync(fd))
+		error(1, errno, "fsync");
+	free(buf);
+	close(fd);
+}
+
+static void prep_iocb(struct iocb *cb, int fd, void *buf, int idx)
+{
+	long long blocks = cfg_size / cfg_bs;
+
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_data = idx;
+	cb->aio_lio_opcode = cfg_write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+	cb->aio_fildes = fd;
+	cb->aio_buf = (unsigned long)buf;
+	cb->aio_nbytes = cfg_bs;
+	cb->aio_offset = (random() % blocks) * cfg_bs;
+}
+
+static void check_event(const struct io_event *ev)
+{
+	if (ev->res != cfg_bs)
+		error(1, ev->res < 0 ? -ev->res : 0,
+		      "short or failed I/O: %lld", (long long)ev->res);
+}
+
+static void time_submit(struct run_stats *st, double start)
+{
+	double us = now_us() - start;
+	int bucket = 0;
+
+	st->submits++;
+	st->submit_us += us;
+	if (us > st->submit_max_us)
+		st->submit_max_us = us;
+	while (us >= 1 && bucket < 31) {
+		us /= 2;
+		bucket++;
+	}
+	st->submit_hist[bucket]++;
+}
+
+/* upper bound, in us, of the bucket holding the pct percentile */
+static unsigned long submit_pct(const struct run_stats *st, int pct)
+{
+	unsigned long seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < 31; bucket++) {
+		seen += st->submit_hist[bucket];
+		if (seen * 100 >= st->submits * pct)
+			break;
+	}
+	return 1UL << bucket;
+}
+
+static void run_submit(int fd, char **bufs, struct run_stats *st)
+{
+	struct io_event *events;
+	struct iocb *cbs, **ptrs;
+	aio_context_t ctx = 0;
+	double start, end;
+	int i, n, ret;
+
+	cbs = calloc(cfg_depth, sizeof(*cbs));
+	ptrs = calloc(cfg_depth, sizeof(*ptrs));
+	events = calloc(cfg_depth, sizeof(*events));
+	if (!cbs || !ptrs || !events)
+		error(1, errno, "calloc");
+	if (syscall(__NR_io_setup, cfg_depth, &ctx))
+		error(1, errno, "io_setup");
+
+	for (i = 0; i < cfg_depth; i++) {
+		prep_iocb(&cbs[i], fd, bufs[i], i);
+		ptrs[i] = &cbs[i];
+	}
+	n = cfg_depth;
+
+	end = now_us() + cfg_secs * 1e6;
+	do {
+		start = now_us();
+		ret = syscall(__NR_io_submit, ctx, n, ptrs);
+		if (ret != n)
+			error(1, ret == -1 ? errno : 0, "io_submit");
+		time_submit(st, start);
+		st->syscalls++;
+
+		n = syscall(__NR_io_getevents, ctx, 1, cfg_depth, events,
+			    NULL);
+		if (n < 0)
+			error(1, errno, "io_getevents");
+		st->syscalls++;
+
+		for (i = 0; i < n; i++) {
+			struct iocb *cb = &cbs[events[i].data];
+
+			check_event(&events[i]);
+			prep_iocb(cb, fd, bufs[events[i].data],
+				  events[i].data);
+			ptrs[i] = cb;
+		}
+		st->ios += n;
+	} while (now_us() < end);
+
+	/* let the rest complete before the buffers go */
+	if (syscall(__NR_io_destroy, ctx))
+		error(1, errno, "io_destroy");
+	free(events);
+	free(ptrs);
+	free(cbs);
+}
+
+/* take the events off the event ring, leaves their indexes in idx */
+static int reap_events(struct aio_ring *ring, int *idx)
+{
+	unsigned head = ring->head, tail;
+	int n = 0;
+
+	tail = *(volatile unsigned *)&ring->tail;
+	mb();	/* read the tail before the events */
+	while (head != tail) {
+		check_event(&ring->io_events[head]);
+		idx[n++] = ring->io_events[head].data;
+		head = (head + 1) % ring->nr;
+	}
+	mb();	/* done with the events before handing them back */
+	ring->head = head;
+	return n;
+}
+
+static void run_ring(int fd, char **bufs, int sqpoll, struct run_stats *st)
+{
+	struct io_ring_params p;
+	struct aio_sq_ring *sq;
+	struct aio_ring *cq;
+	double start, end;
+	unsigned tail;
+	int *idx;
+	int i, n;
+
+	idx = calloc(cfg_depth, sizeof(*idx));
+	if (!idx)
+		error(1, errno, "calloc");
+
+	memset(&p, 0, sizeof(p));
+	p.sq_entries = cfg_depth;
+	if (sqpoll) {
+		p.flags = IORING_SETUP_SQPOLL;
+		if (cfg_cpu >= 0) {
+			p.flags |= IORING_SETUP_SQ_AFF;
+			p.sq_thread_cpu = cfg_cpu;
+		}
+	}
+	if (syscall(__NR_io_ring_setup, cfg_depth, &p))
+		error(1, errno, "io_ring_setup");
+	sq = (struct aio_sq_ring *)(unsigned long)p.sq_ring;
+	cq = (struct aio_ring *)(unsigned long)p.ctx_id;
+
+	for (i = 0; i < cfg_depth; i++)
+		idx[i] = i;
+	n = cfg_depth;
+
+	end = now_us() + cfg_secs * 1e6;
+	do {
+		tail = sq->tail;
+		for (i = 0; i < n; i++, tail++)
+			prep_iocb(&sq->iocbs[tail & (sq->nr - 1)], fd,
+				  bufs[idx[i]], idx[i]);
+		mb();	/* the iocbs before the tail */
+		sq->tail = tail;
+
+		if (sqpoll) {
+			mb();	/* the tail before the flag */
+			if (sq->flags & IORING_SQ_NEED_WAKEUP) {
+				if (syscall(__NR_io_ring_enter, p.ctx_id, 0, 0,
+					    IORING_ENTER_SQ_WAKEUP) < 0)
+					error(1, errno, "io_ring_enter");
+				st->syscalls++;
+			}
+		} else {
+			start = now_us();
+			if (syscall(__NR_io_ring_enter, p.ctx_id, n, 0,
+				    0) != n)
+				error(1, errno, "io_ring_enter submit");
+			time_submit(st, start);
+			st->syscalls++;
+		}
+
+		n = reap_events(cq, idx);
+		if (!n) {
+			if (syscall(__NR_io_ring_enter, p.ctx_id, 0, 1,
+				    IORING_ENTER_GETEVENTS) < 0)
+				error(1, errno, "io_ring_enter wait");
+			st->syscalls++;
+			n = reap_events(cq, idx);
+		}
+		st->ios += n;
+	} while (now_us() < end);
+
+	if (syscall(__NR_io_destroy, p.ctx_id))
+		error(1, errno, "io_destroy");
+	free(idx);
+}
+
+static void do_run(int run)
+{
+	struct rusage ru_start, ru_end;
+	struct run_stats st;
+	double start, us, cpu_us;
+	char **bufs;
+	int fd, i;
+
+	memset(&st, 0, sizeof(st));
+	fd = open(cfg_file, (cfg_write ? O_WRONLY : O_RDONLY) |
+			    (cfg_direct ? O_DIRECT : 0));
+	if (fd == -1)
+		error(1, errno, "open %s", cfg_file);
+
+	bufs = calloc(cfg_depth, sizeof(*bufs));
+	if (!bufs)
+		error(1, errno, "calloc");
+	for (i = 0; i < cfg_depth; i++) {
+		if (posix_memalign((void **)&bufs[i], 4096, cfg_bs))
+			error(1, 0, "posix_memalign");
+		memset(bufs[i], 'b', cfg_bs);
+	}
+
+	/* clean pages after prepare_file(), so this drops them all */
+	if (cfg_cold && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		error(1, 0, "posix_fadvise");
+
+	srandom(1);
+	getrusage(RUSAGE_SELF, &ru_start);
+	start = now_us();
+	if (run == RUN_SUBMIT)
+		run_submit(fd, bufs, &st);
+	else
+		run_ring(fd, bufs, run == RUN_SQPOLL, &st);
+	us = now_us() - start;
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	cpu_us = tv_us(&ru_end.ru_utime) - tv_us(&ru_start.ru_utime) +
+		 tv_us(&ru_end.ru_stime) - tv_us(&ru_start.ru_stime);
+
+	printf("%-9s %8.0f IOPS %8.1f MB/s  %5.3f syscalls, %6.2f us cpu "
+	       "per I/O", run_name[run], st.ios / us * 1e6,
+	       st.ios * cfg_bs / us, (double)st.syscalls / st.ios,
+	       cpu_us / st.ios);
+	if (st.submits)
+		printf("  submit %.2f us avg, p50 <%lu, p99 <%lu, %.0f us max",
+		       st.submit_us / st.submits, submit_pct(&st, 50),
+		       submit_pct(&st, 99), st.submit_max_us);
+	printf("\n");
+
+	for (i = 0; i < cfg_depth; i++)
+		free(bufs[i]);
+	free(bufs);
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	parse_opts(argc, argv);
+	prepare_file();
+
+	printf("%s%s %s of %d bytes, depth %d, over %lld MB of %s, %d secs "
+	       "per run\n", cfg_cold && !cfg_direct ? "cold " : "",
+	       cfg_direct ? "O_DIRECT" : "buffered",
+	       cfg_write ? "writes" : "reads", cfg_bs, cfg_depth,
+	       cfg_size >> 20, cfg_file, cfg_secs);
+	do_run(RUN_SUBMIT);
+	do_run(RUN_RING);
+	if (cfg_sqpoll)
+		do_run(RUN_SQPOLL);
+	return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * Accept storm on one listening socket watched by many epoll waiters.
+ *
+ * A number of worker processes accept connections from the same
+ * listening socket, each calling epoll_wait() and then accept() once
+ * per wakeup, while client processes connect to it over loopback as
+ * fast as they can. Three runs are made:
+ *
+ *	shared		all the workers wait on one epoll fd
+ *	per-worker	each worker has its own epoll fd
+ *	exclusive	each worker has its own epoll fd, the listening
+ *			socket added with EPOLLEXCLUSIVE
+ *
+ * For each run it prints the connections accepted per second, the
+ * times the workers went to sleep and the CPU time they used per
+ * connection, and the share of epoll_wait() returns which found nothing
+ * to accept. Without EPOLLEXCLUSIVE every connection wakes up a worker
+ * in each epoll fd; most of them find the socket empty already in
+ * epoll_wait() and go back to sleep without returning, so the herd
+ * shows in the sleeps and the CPU time of the per-worker run.
+ *
+ *	./epoll_accept [-w workers] [-c clients] [-t secs] [-m maxevents]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifndef EPOLLEXCLUSIVE
+# define EPOLLEXCLUSIVE			(1 << 28)
+#endif
+
+enum { RUN_SHARED, RUN_PER_WORKER, RUN_EXCLUSIVE };
+static const char *run_name[] = { "shared", "per-worker", "exclusive" };
+
+static int cfg_workers = 32;
+static int cfg_clients = 4;
+static int cfg_secs = 5;
+static int cfg_maxevents = 1;
+
+/* one per worker, in memory shared with the parent */
+struct worker_stats {
+	unsigned long		returns;	/* from epoll_wait() */
+	unsigned long		empty;		/* accept() found nothing */
+	unsigned long		accepts;
+	unsigned long		sleeps;		/* voluntary switches */
+	double			cpu_us;
+} __attribute__((aligned(64)));
+
+static volatile int *stop;
+static struct worker_stats *stats;
+
+static void usage(const char *prog)
+{
+	error(1, 0, "usage: %s [-w workers] [-c clients] [-t secs] "
+		    "[-m maxevents]", prog);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "c:m:t:w:")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg_clients = atoi(optarg);
+			break;
+		case 'm':
+			cfg_maxevents = atoi(optarg);
+			break;
+		case 't':
+			cfg_secs = atoi(optarg);
+			break;
+		case 'w':
+			cfg_workers = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || cfg_workers <= 0 || cfg_clients <= 0 ||
+	    cfg_secs <= 0 || cfg_maxevents <= 0)
+		usage(argv[0]);
+}
+
+static double tv_us(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+static double now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv_us(&tv);
+}
+
+static int listen_socket(struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (void *)addr, sizeof(*addr)))
+		error(1, errno, "bind");
+	if (listen(fd, 4096))
+		error(1, errno, "listen");
+	if (getsockname(fd, (void *)addr, &len))
+		error(1, errno, "getsockname");
+	return fd;
+}
+
+static int epoll_add(int lfd, int exclusive)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	int epfd;
+
+	if (exclusive)
+		ev.events |= EPOLLEXCLUSIVE;
+
+	epfd = epoll_create1(0);
+	if (epfd == -1)
+		error(1, errno, "epoll_create1");
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev))
+		error(1, errno, "epoll_ctl");
+	return epfd;
+}
+
+static void do_worker(int lfd, int epfd, struct worker_stats *st)
+{
+	struct epoll_event *events;
+	struct rusage ru;
+	int n, fd;
+
+	events = calloc(cfg_maxevents, sizeof(*events));
+	if (!events)
+		error(1, errno, "calloc");
+
+	while (!*stop) {
+		n = epoll_wait(epfd, events, cfg_maxevents, 100);
+		if (n == -1 && errno != EINTR)
+			error(1, errno, "epoll_wait");
+		if (n <= 0)
+			continue;
+
+		st->returns++;
+		fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd == -1) {
+			if (errno == EAGAIN || errno == ECONNABORTED)
+				st->empty++;
+			else
+				error(1, errno, "accept4");
+			continue;
+		}
+		close(fd);
+		st->accepts++;
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	st->sleeps = ru.ru_nvcsw;
+	st->cpu_us = tv_us(&ru.ru_utime) + tv_us(&ru.ru_stime);
+	free(events);
+}
+
+/* connect and reset right away, so that no TIME_WAIT sockets pile up */
+static void do_client(const struct sockaddr_in *addr)
+{
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	int fd;
+
+	while (!*stop) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1)
+			error(1, errno, "socket");
+		if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin)))
+			error(1, errno, "setsockopt SO_LINGER");
+		if (connect(fd, (void *)addr, sizeof(*addr)) &&
+		    errno != EINTR && errno != ECONNREFUSED)
+			error(1, errno, "connect");
+		close(fd);
+	}
+}
+
+static pid_t start(int lfd, int epfd, int worker,
+		   const struct sockaddr_in *addr)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1)
+		error(1, errno, "fork");
+	if (pid)
+		return pid;
+
+	if (worker >= 0)
+		do_worker(lfd, epfd, &stats[worker]);
+	else
+		do_client(addr);
+	exit(0);
+}
+
+static void do_run(int run)
+{
+	unsigned long returns = 0, empty = 0, accepts = 0, sleeps = 0;
+	struct sockaddr_in addr;
+	double start_us, us, cpu_us = 0;
+	int lfd, epfd = -1, i, status;
+	pid_t *pids;
+
+	pids = calloc(cfg_workers + cfg_clients, sizeof(*pids));
+	if (!pids)
+		error(1, errno, "calloc");
+	memset(stats, 0, cfg_workers * sizeof(*stats));
+	*stop = 0;
+
+	lfd = listen_socket(&addr);
+	if (run == RUN_SHARED)
+		epfd = epoll_add(lfd, 0);
+	for (i = 0; i < cfg_workers; i++) {
+		int fd = run == RUN_SHARED ? epfd :
+			 epoll_add(lfd, run == RUN_EXCLUSIVE);
+
+		pids[i] = start(lfd, fd, i, NULL);
+		if (run != RUN_SHARED)
+			close(fd);
+	}
+	/* let the workers reach epoll_wait() */
+	usleep(100000);
+
+	start_us = now_us();
+	for (i = 0; i < cfg_clients; i++)
+		pids[cfg_workers + i] = start(-1, -1, -1, &addr);
+	sleep(cfg_secs);
+	*stop = 1;
+	us = now_us() - start_us;
+
+	for (i = 0; i < cfg_workers + cfg_clients; i++) {
+		if (waitpid(pids[i], &status, 0) != pids[i])
+			error(1, errno, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error(1, 0, "child %d failed", pids[i]);
+	}
+	if (epfd != -1)
+		close(epfd);
+	close(lfd);
+
+	for (i = 0; i < cfg_workers; i++) {
+		returns += stats[i].returns;
+		empty += stats[i].empty;
+		accepts += stats[i].accepts;
+		sleeps += stats[i].sleeps;
+		cpu_us += stats[i].cpu_us;
+	}
+	if (!accepts)
+		error(1, 0, "%s: no connection accepted", run_name[run]);
+
+	printf("%-10s %8.0f conns/s  %6.2f sleeps, %6.2f us cpu per conn, "
+	       "%5.1f%% empty returns\n", run_name[run], accepts / us * 1e6,
+	       (double)sleeps / accepts, cpu_us / accepts,
+	       returns ? 100.0 * empty / returns : 0.0);
+	free(pids);
+}
+
+int main(int argc, char **argv)
+{
+	void *shm;
+
+	parse_opts(argc, argv);
+
+	shm = mmap(NULL, sizeof(int) + 63 + cfg_workers * sizeof(*stats),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		error(1, errno, "mmap");
+	stop = shm;
+	stats = (void *)(((unsigned long)shm + sizeof(int) + 63) & ~63UL);
+
+	/* a client killed by a reset is not an error */
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%d workers accepting one connection per wakeup, %d clients, "
+	       "maxevents %d, %d secs per run\n", cfg_workers, cfg_clients,
+	       cfg_maxevents, cfg_secs);
+	do_run(RUN_SHARED);
+	do_run(RUN_PER_WORKER);
+	do_run(RUN_EXCLUSIVE);
+	return 0;
+}
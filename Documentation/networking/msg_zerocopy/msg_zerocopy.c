@@ -0,0 +1,335 @@
+/*
+ * Throughput and CPU cost of TCP sends with and without MSG_ZEROCOPY.
+ *
+ * The sender connects twice and sends size byte buffers for secs
+ * seconds each time, first copying and then with MSG_ZEROCOPY, reading
+ * the completions off the error queue as they come. For each run it
+ * prints the rate, the CPU time the sending process used per MB and,
+ * for the zero copy run, how many sends there were, how many
+ * notifications covered them and how many had been copied anyway.
+ *
+ * Without -D the receiver is a child process on loopback. Local
+ * receive copies the user pages of the sender, so every completion is
+ * reported as copied and the zero copy run shows the overhead only.
+ * For the gain, run the receiver on another host:
+ *
+ *	host1$ ./msg_zerocopy -r [-6] [-p port]
+ *	host2$ ./msg_zerocopy -D host1 [-6] [-p port] [-s size] [-t secs]
+ *
+ * The payload is never looked at, so the same buffer is sent over and
+ * over; a real application has to wait for the notification before it
+ * writes to a buffer again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <unistd.h>
+#include <signal.h>
+#include <netdb.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+# define SO_ZEROCOPY			60
+#endif
+
+#ifndef MSG_ZEROCOPY
+# define MSG_ZEROCOPY			0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+# define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+# define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+static int cfg_family = AF_INET;
+static const char *cfg_host;
+static const char *cfg_port = "8000";
+static int cfg_rx;
+static int cfg_size = 64 * 1024;
+static int cfg_secs = 4;
+
+struct zc_stats {
+	unsigned long	sends;		/* MSG_ZEROCOPY sends that queued data */
+	unsigned long	completed;	/* of those, notified */
+	unsigned long	copied;		/* of those, copied after all */
+	unsigned long	notifications;
+};
+
+static void usage(const char *prog)
+{
+	error(1, 0, "usage: %s [-4|-6] [-r | -D host] [-p port] [-s size] "
+		    "[-t secs]", prog);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46D:p:rs:t:")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = AF_INET;
+			break;
+		case '6':
+			cfg_family = AF_INET6;
+			break;
+		case 'D':
+			cfg_host = optarg;
+			break;
+		case 'p':
+			cfg_port = optarg;
+			break;
+		case 'r':
+			cfg_rx = 1;
+			break;
+		case 's':
+			cfg_size = atoi(optarg);
+			break;
+		case 't':
+			cfg_secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || cfg_size <= 0 || cfg_secs <= 0 ||
+	    (cfg_rx && cfg_host))
+		usage(argv[0]);
+}
+
+static struct addrinfo *get_addr(const char *host, int passive)
+{
+	struct addrinfo hints, *ai;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = cfg_family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	ret = getaddrinfo(host, cfg_port, &hints, &ai);
+	if (ret)
+		error(1, 0, "getaddrinfo %s: %s", host ? host : "any",
+		      gai_strerror(ret));
+	return ai;
+}
+
+static int do_listen(void)
+{
+	struct addrinfo *ai = get_addr(cfg_host, 1);
+	int fd, one = 1;
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+		error(1, errno, "socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		error(1, errno, "setsockopt reuseaddr");
+	if (bind(fd, ai->ai_addr, ai->ai_addrlen))
+		error(1, errno, "bind");
+	if (listen(fd, 1))
+		error(1, errno, "listen");
+
+	freeaddrinfo(ai);
+	return fd;
+}
+
+/* read and drop whatever each connection brings, until killed */
+static void do_rx(int fd)
+{
+	char *buf = malloc(cfg_size);
+	int conn;
+
+	if (!buf)
+		error(1, errno, "malloc");
+
+	for (;;) {
+		conn = accept(fd, NULL, NULL);
+		if (conn == -1)
+			error(1, errno, "accept");
+		while (read(conn, buf, cfg_size) > 0)
+			;
+		close(conn);
+	}
+}
+
+/* read the notifications that are queued, returns how many there were */
+static int read_completions(int fd, struct zc_stats *st)
+{
+	struct sock_extended_err *serr;
+	char control[100];
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	int n = 0;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno == EAGAIN)
+				return n;
+			error(1, errno, "recvmsg notification");
+		}
+		if (msg.msg_flags & MSG_CTRUNC)
+			error(1, 0, "recvmsg notification: truncated");
+
+		cm = CMSG_FIRSTHDR(&msg);
+		if (!cm || !((cm->cmsg_level == SOL_IP &&
+			      cm->cmsg_type == IP_RECVERR) ||
+			     (cm->cmsg_level == SOL_IPV6 &&
+			      cm->cmsg_type == IPV6_RECVERR)))
+			error(1, 0, "unexpected cmsg");
+
+		serr = (void *)CMSG_DATA(cm);
+		if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			error(1, 0, "unexpected origin %u", serr->ee_origin);
+		if (serr->ee_errno)
+			error(1, 0, "notification errno %u", serr->ee_errno);
+
+		st->completed += serr->ee_data - serr->ee_info + 1;
+		if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			st->copied += serr->ee_data - serr->ee_info + 1;
+		st->notifications++;
+		n++;
+	}
+}
+
+static void wait_completions(int fd, struct zc_stats *st, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = 0 };
+
+	if (poll(&pfd, 1, timeout_ms) == -1)
+		error(1, errno, "poll");
+	if (pfd.revents & POLLERR)
+		read_completions(fd, st);
+}
+
+static double tv_ms(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+static void do_tx(int zerocopy)
+{
+	struct addrinfo *ai = get_addr(cfg_host, 0);
+	struct rusage ru_start, ru_end;
+	struct timeval start, now;
+	unsigned long long bytes = 0;
+	struct zc_stats st;
+	double ms, cpu_ms;
+	int fd, one = 1;
+	char *buf;
+	ssize_t ret;
+
+	memset(&st, 0, sizeof(st));
+	buf = malloc(cfg_size);
+	if (!buf)
+		error(1, errno, "malloc");
+	memset(buf, 'a', cfg_size);
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+		error(1, errno, "socket");
+	if (zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		error(1, errno, "setsockopt zerocopy");
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen))
+		error(1, errno, "connect");
+	freeaddrinfo(ai);
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	gettimeofday(&start, NULL);
+	do {
+		ret = send(fd, buf, cfg_size, zerocopy ? MSG_ZEROCOPY : 0);
+		if (ret == -1 && errno == ENOBUFS && zerocopy) {
+			/* out of notification memory */
+			wait_completions(fd, &st, -1);
+			continue;
+		}
+		if (ret == -1)
+			error(1, errno, "send");
+
+		bytes += ret;
+		if (zerocopy) {
+			st.sends++;
+			read_completions(fd, &st);
+		}
+		gettimeofday(&now, NULL);
+	} while (tv_ms(&now) - tv_ms(&start) < cfg_secs * 1000.0);
+
+	/* the buffers are not free before all sends are notified */
+	while (st.completed < st.sends)
+		wait_completions(fd, &st, 1000);
+	getrusage(RUSAGE_SELF, &ru_end);
+	gettimeofday(&now, NULL);
+	close(fd);
+	free(buf);
+
+	ms = tv_ms(&now) - tv_ms(&start);
+	cpu_ms = tv_ms(&ru_end.ru_utime) - tv_ms(&ru_start.ru_utime) +
+		 tv_ms(&ru_end.ru_stime) - tv_ms(&ru_start.ru_stime);
+
+	printf("%-8s %8.0f MB/s  cpu %6.0f ms, %6.3f ms per MB",
+	       zerocopy ? "zerocopy" : "copy", bytes / 1e3 / ms, cpu_ms,
+	       cpu_ms / (bytes / 1e6));
+	if (zerocopy)
+		printf("  %lu sends, %lu notifications, %lu copied",
+		       st.sends, st.notifications, st.copied);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	pid_t pid = 0;
+	int fd;
+
+	parse_opts(argc, argv);
+
+	if (cfg_rx) {
+		do_rx(do_listen());
+		return 0;
+	}
+
+	if (!cfg_host) {
+		cfg_host = cfg_family == AF_INET ? "127.0.0.1" : "::1";
+		fd = do_listen();
+		pid = fork();
+		if (pid == -1)
+			error(1, errno, "fork");
+		if (!pid)
+			do_rx(fd);
+		close(fd);
+	}
+
+	printf("%d byte sends to %s port %s, %d secs per run\n",
+	       cfg_size, cfg_host, cfg_port, cfg_secs);
+	do_tx(0);
+	do_tx(1);
+
+	if (pid) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
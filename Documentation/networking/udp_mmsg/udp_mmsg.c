@@ -0,0 +1,293 @@
+/*
+ * UDP packet rate with sendmmsg() and recvmmsg() at 1 to 64 datagrams
+ * per call.
+ *
+ * For each batch size, doubling from 1 up to -b, the sender sends size
+ * byte datagrams for secs seconds from an unconnected socket, naming
+ * the destination in each message, and a receiver reads them with the
+ * same batch size. The rate of each side is printed in kpps. Sending
+ * faster than the receiver keeps up with is normal, the difference is
+ * dropped on the receive queue.
+ *
+ * Without -D the receiver is a child process on loopback. To take the
+ * device into account, run it on another host; it then prints what it
+ * received every second until killed:
+ *
+ *	host1$ ./udp_mmsg -r [-6] [-p port] [-b batch]
+ *	host2$ ./udp_mmsg -D host1 [-6] [-p port] [-b batch] [-s size]
+ *		[-t secs]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#define MAX_BATCH	1024
+
+static int cfg_family = AF_INET;
+static const char *cfg_host;
+static const char *cfg_port = "8001";
+static int cfg_rx;
+static int cfg_batch = 64;
+static int cfg_size = 18;
+static int cfg_secs = 2;
+
+static char payload[65536];
+static struct mmsghdr msgs[MAX_BATCH];
+static struct iovec iovs[MAX_BATCH];
+
+static void usage(const char *prog)
+{
+	error(1, 0, "usage: %s [-4|-6] [-r | -D host] [-p port] [-b batch] "
+		    "[-s size] [-t secs]", prog);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46b:D:p:rs:t:")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = AF_INET;
+			break;
+		case '6':
+			cfg_family = AF_INET6;
+			break;
+		case 'b':
+			cfg_batch = atoi(optarg);
+			break;
+		case 'D':
+			cfg_host = optarg;
+			break;
+		case 'p':
+			cfg_port = optarg;
+			break;
+		case 'r':
+			cfg_rx = 1;
+			break;
+		case 's':
+			cfg_size = atoi(optarg);
+			break;
+		case 't':
+			cfg_secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || cfg_batch < 1 || cfg_batch > MAX_BATCH ||
+	    cfg_size < 0 || cfg_size > (int)sizeof(payload) ||
+	    cfg_secs <= 0 || (cfg_rx && cfg_host))
+		usage(argv[0]);
+}
+
+static struct addrinfo *get_addr(const char *host, int passive)
+{
+	struct addrinfo hints, *ai;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = cfg_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	ret = getaddrinfo(host, cfg_port, &hints, &ai);
+	if (ret)
+		error(1, 0, "getaddrinfo %s: %s", host ? host : "any",
+		      gai_strerror(ret));
+	return ai;
+}
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int rx_socket(void)
+{
+	struct addrinfo *ai = get_addr(NULL, 1);
+	struct timeval tv = { .tv_usec = 200 * 1000 };
+	int fd, rcvbuf = 4 << 20;
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+		error(1, errno, "socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		error(1, errno, "setsockopt rcvbuf");
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		error(1, errno, "setsockopt rcvtimeo");
+	if (bind(fd, ai->ai_addr, ai->ai_addrlen))
+		error(1, errno, "bind");
+
+	freeaddrinfo(ai);
+	return fd;
+}
+
+static void setup_msgs(int batch, struct sockaddr *addr, socklen_t addrlen)
+{
+	int i;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < batch; i++) {
+		iovs[i].iov_base = payload;
+		iovs[i].iov_len = addr ? cfg_size : sizeof(payload);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = addr;
+		msgs[i].msg_hdr.msg_namelen = addrlen;
+	}
+}
+
+/*
+ * Read with batch datagrams per call until nothing came for the receive
+ * timeout, or forever if report is set. Returns the rate in kpps
+ * between the first and the last datagram.
+ */
+static double do_rx(int fd, int batch, int report)
+{
+	double first = 0, last = 0, mark = 0;
+	unsigned long total = 0, since = 0;
+	int ret;
+
+	setup_msgs(batch, NULL, 0);
+	for (;;) {
+		ret = recvmmsg(fd, msgs, batch, 0, NULL);
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (total && !report)
+				break;
+			continue;
+		}
+		if (ret == -1)
+			error(1, errno, "recvmmsg");
+
+		last = now_ms();
+		if (!total)
+			first = mark = last;
+		total += ret;
+		since += ret;
+
+		if (report && last - mark >= 1000) {
+			printf("%8.0f kpps\n", since / (last - mark));
+			fflush(stdout);
+			since = 0;
+			mark = last;
+		}
+	}
+
+	return last > first ? total / (last - first) : 0;
+}
+
+static double do_tx(struct addrinfo *ai, int batch)
+{
+	unsigned long total = 0;
+	double start, end;
+	int fd, ret;
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	setup_msgs(batch, ai->ai_addr, ai->ai_addrlen);
+	start = now_ms();
+	do {
+		ret = sendmmsg(fd, msgs, batch, 0);
+		if (ret == -1 && errno != ENOBUFS && errno != ECONNREFUSED)
+			error(1, errno, "sendmmsg");
+		if (ret > 0)
+			total += ret;
+		end = now_ms();
+	} while (end - start < cfg_secs * 1000.0);
+
+	close(fd);
+	return total / (end - start);
+}
+
+/* one run against a local receiver, which reports back through a pipe */
+static void run_local(struct addrinfo *ai, int batch)
+{
+	double tx, rx;
+	int pfd[2], fd;
+	pid_t pid;
+
+	if (pipe(pfd))
+		error(1, errno, "pipe");
+
+	fd = rx_socket();
+	pid = fork();
+	if (pid == -1)
+		error(1, errno, "fork");
+	if (!pid) {
+		close(pfd[0]);
+		rx = do_rx(fd, batch, 0);
+		if (write(pfd[1], &rx, sizeof(rx)) != sizeof(rx))
+			error(1, errno, "write");
+		exit(0);
+	}
+	close(fd);
+	close(pfd[1]);
+
+	tx = do_tx(ai, batch);
+	if (read(pfd[0], &rx, sizeof(rx)) != sizeof(rx))
+		error(1, 0, "no result from the receiver");
+	waitpid(pid, NULL, 0);
+	close(pfd[0]);
+
+	printf("batch %4d: tx %8.0f kpps  rx %8.0f kpps\n", batch, tx, rx);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct addrinfo *ai;
+	int batch, local;
+
+	parse_opts(argc, argv);
+
+	if (cfg_rx) {
+		do_rx(rx_socket(), cfg_batch, 1);
+		return 0;
+	}
+
+	local = !cfg_host;
+	if (local)
+		cfg_host = cfg_family == AF_INET ? "127.0.0.1" : "::1";
+	ai = get_addr(cfg_host, 0);
+
+	printf("%d byte datagrams to %s port %s, %d secs per run\n",
+	       cfg_size, cfg_host, cfg_port, cfg_secs);
+	fflush(stdout);
+	for (batch = 1; ; batch *= 2) {
+		if (batch > cfg_batch)
+			batch = cfg_batch;
+		if (local)
+			run_local(ai, batch);
+		else
+			printf("batch %4d: tx %8.0f kpps\n", batch,
+			       do_tx(ai, batch));
+		if (batch == cfg_batch)
+			break;
+	}
+
+	freeaddrinfo(ai);
+	return 0;
+}
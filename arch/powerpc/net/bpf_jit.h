@@ -0,0 +1,184 @@
+/* bpf_jit.h: BPF JIT compiler for PPC32
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#ifndef _BPF_JIT_H
+#define _BPF_JIT_H
+
+/*
+ * Stack frame of the generated code, from r1 up: the back chain, the LR
+ * save word of the functions it calls, BPF_MEMWORDS words of M[] and,
+ * at the top, the non volatile registers it uses.
+ */
+#define BPF_PPC_STACK_MEM	8
+#define BPF_PPC_STACKFRAME	96
+
+/*
+ * The helpers that call out to C push a frame of their own, with room
+ * for the bytes skb_copy_bits() returns.
+ */
+#define BPF_PPC_SLOWPATH_BUF	8
+#define BPF_PPC_SLOWPATH_FRAME	16
+
+/*
+ * Registers of the generated code. Everything that has to survive a
+ * call to a helper lives in non volatile registers.
+ */
+#define r_ret		3	/* return value, skb on entry */
+#define r_addr		4	/* offset passed to the load helpers */
+#define r_scratch1	11
+#define r_HL		27	/* skb headlen */
+#define r_D		28	/* skb->data */
+#define r_X		29
+#define r_A		30
+#define r_skb		31
+
+#ifndef __ASSEMBLY__
+
+/*
+ * Assembly helpers from arch/powerpc/net/bpf_jit.S
+ */
+#define DECLARE_LOAD_FUNC(func)	\
+	extern u8 func[], func##_negative_offset[], func##_positive_offset[]
+
+DECLARE_LOAD_FUNC(sk_load_word);
+DECLARE_LOAD_FUNC(sk_load_half);
+DECLARE_LOAD_FUNC(sk_load_byte);
+DECLARE_LOAD_FUNC(sk_load_byte_msh);
+
+#define PLANT_INSTR(d, idx, instr)					      \
+	do { if (d) { (d)[idx] = instr; } idx++; } while (0)
+#define EMIT(instr)		PLANT_INSTR(image, ctx->idx, instr)
+
+#define IMM_H(i)		((uintptr_t)(i)>>16)
+#define IMM_HA(i)		(((uintptr_t)(i)>>16) +			      \
+				 (((uintptr_t)(i) & 0x8000) >> 15))
+#define IMM_L(i)		((uintptr_t)(i) & 0xffff)
+
+#define PPC_ADD(d, a, b)	EMIT(PPC_INST_ADD | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | __PPC_RB(b))
+/* d = a - b */
+#define PPC_SUB(d, a, b)	EMIT(PPC_INST_SUBF | __PPC_RT(d) |	      \
+				     __PPC_RB(a) | __PPC_RA(b))
+#define PPC_ADDI(d, a, i)	EMIT(PPC_INST_ADDI | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | IMM_L(i))
+#define PPC_ADDIS(d, a, i)	EMIT(PPC_INST_ADDIS | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | IMM_L(i))
+#define PPC_LI(r, i)		PPC_ADDI(r, 0, i)
+#define PPC_LIS(r, i)		PPC_ADDIS(r, 0, i)
+#define PPC_MUL(d, a, b)	EMIT(PPC_INST_MULLW | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | __PPC_RB(b))
+#define PPC_MULHWU(d, a, b)	EMIT(PPC_INST_MULHWU | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | __PPC_RB(b))
+#define PPC_MULI(d, a, i)	EMIT(PPC_INST_MULLI | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | IMM_L(i))
+#define PPC_DIVWU(d, a, b)	EMIT(PPC_INST_DIVWU | __PPC_RT(d) |	      \
+				     __PPC_RA(a) | __PPC_RB(b))
+#define PPC_NEG(d, a)		EMIT(PPC_INST_NEG | __PPC_RT(d) | __PPC_RA(a))
+
+/* the logical ones take the destination in RA and the source in RS */
+#define PPC_AND(d, a, b)	EMIT(PPC_INST_AND | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | __PPC_RB(b))
+#define PPC_AND_DOT(d, a, b)	EMIT(PPC_INST_ANDDOT | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | __PPC_RB(b))
+#define PPC_ANDI(d, a, i)	EMIT(PPC_INST_ANDI | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | IMM_L(i))
+#define PPC_ANDIS(d, a, i)	EMIT(PPC_INST_ANDIS | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | IMM_L(i))
+#define PPC_OR(d, a, b)		EMIT(PPC_INST_OR | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | __PPC_RB(b))
+#define PPC_MR(d, a)		PPC_OR(d, a, a)
+#define PPC_ORI(d, a, i)	EMIT(PPC_INST_ORI | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | IMM_L(i))
+#define PPC_ORIS(d, a, i)	EMIT(PPC_INST_ORIS | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | IMM_L(i))
+#define PPC_SLW(d, a, s)	EMIT(PPC_INST_SLW | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | __PPC_RB(s))
+#define PPC_SRW(d, a, s)	EMIT(PPC_INST_SRW | __PPC_RA(d) |	      \
+				     __PPC_RS(a) | __PPC_RB(s))
+#define PPC_RLWINM(d, a, i, mb, me)	EMIT(PPC_INST_RLWINM | __PPC_RA(d) |  \
+					__PPC_RS(a) | __PPC_SH(i) |	      \
+					__PPC_MB(mb) | __PPC_ME(me))
+#define PPC_SLWI(d, a, i)	PPC_RLWINM(d, a, i, 0, 31-(i))
+#define PPC_SRWI(d, a, i)	PPC_RLWINM(d, a, 32-(i), i, 31)
+
+#define PPC_LWZ(r, base, i)	EMIT(PPC_INST_LWZ | __PPC_RT(r) |	      \
+				     __PPC_RA(base) | IMM_L(i))
+#define PPC_LHZ(r, base, i)	EMIT(PPC_INST_LHZ | __PPC_RT(r) |	      \
+				     __PPC_RA(base) | IMM_L(i))
+#define PPC_LBZ(r, base, i)	EMIT(PPC_INST_LBZ | __PPC_RT(r) |	      \
+				     __PPC_RA(base) | IMM_L(i))
+#define PPC_STW(r, base, i)	EMIT(PPC_INST_STW | __PPC_RS(r) |	      \
+				     __PPC_RA(base) | IMM_L(i))
+#define PPC_STWU(r, base, i)	EMIT(PPC_INST_STWU | __PPC_RS(r) |	      \
+				     __PPC_RA(base) | IMM_L(i))
+
+#define PPC_CMPWI(a, i)		EMIT(PPC_INST_CMPWI | __PPC_RA(a) | IMM_L(i))
+#define PPC_CMPLWI(a, i)	EMIT(PPC_INST_CMPLWI | __PPC_RA(a) | IMM_L(i))
+#define PPC_CMPLW(a, b)		EMIT(PPC_INST_CMPLW | __PPC_RA(a) | __PPC_RB(b))
+
+#define PPC_MFLR(r)		EMIT(PPC_INST_MFLR | __PPC_RT(r))
+#define PPC_MTLR(r)		EMIT(PPC_INST_MTLR | __PPC_RT(r))
+#define PPC_MTCTR(r)		EMIT(PPC_INST_MTCTR | __PPC_RT(r))
+#define PPC_BCTRL()		EMIT(PPC_INST_BCTR | 0x1)
+#define PPC_BLR()		EMIT(PPC_INST_BLR)
+
+/* dest is a byte offset from the start of the image */
+#define PPC_JMP(dest)		EMIT(PPC_INST_BRANCH |			      \
+				     (((dest) - (ctx->idx * 4)) & 0x03fffffc))
+#define PPC_BCC_SHORT(cond, dest)	EMIT(PPC_INST_BRANCH_COND |	      \
+					(((cond) & 0x3ff) << 16) |	      \
+					(((dest) - (ctx->idx * 4)) &	      \
+					 0xfffc))
+
+#define PPC_LI32(d, i)		do { PPC_LI(d, IMM_L(i));		      \
+		if (IMM_HA(i) & 0xffff) {				      \
+			PPC_ADDIS(d, d, IMM_HA(i));			      \
+		} } while (0)
+
+/*
+ * Conditional branches on cr0: the BI field is the bit tested, the
+ * second bit of BO says whether to branch if it is set or clear.
+ */
+#define CR0_LT		0
+#define CR0_GT		1
+#define CR0_EQ		2
+#define COND_CMP_TRUE	0x100
+#define COND_CMP_FALSE	0x000
+
+#define COND_GT		(CR0_GT | COND_CMP_TRUE)
+#define COND_GE		(CR0_LT | COND_CMP_FALSE)
+#define COND_EQ		(CR0_EQ | COND_CMP_TRUE)
+#define COND_NE		(CR0_EQ | COND_CMP_FALSE)
+#define COND_LT		(CR0_LT | COND_CMP_TRUE)
+
+#define is_nearbranch(offset)	((offset) < 0x8000 && (offset) >= -0x8000)
+
+/* past 32K, invert the condition and jump over an unconditional branch */
+#define PPC_BCC(cond, dest)	do {					      \
+		if (is_nearbranch((int)(dest) - (int)(ctx->idx * 4))) {	      \
+			PPC_BCC_SHORT(cond, dest);			      \
+		} else {						      \
+			PPC_BCC_SHORT((cond) ^ COND_CMP_TRUE,		      \
+				      (ctx->idx + 2) * 4);		      \
+			PPC_JMP(dest);					      \
+		} } while (0)
+
+#define SEEN_DATAREF	0x10000	/* might call the load helpers */
+#define SEEN_XREG	0x20000	/* X is used */
+#define SEEN_MEM	0x40000	/* M[] is used */
+#define SEEN_SKB	0x80000	/* skb is kept in r_skb */
+#define SEEN_FUNC	0x100000 /* calls out, so LR has to be saved */
+
+struct codegen_context {
+	unsigned int	seen;
+	unsigned int	idx;
+	unsigned int	epilogue;	/* of the last pass, in bytes */
+};
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _BPF_JIT_H */
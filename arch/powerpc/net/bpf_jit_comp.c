@@ -0,0 +1,638 @@
+/* bpf_jit_comp.c: BPF JIT compiler for PPC32
+ *
+ * Same structure as the x86_64 one: a few passes over the filter until
+ * the code size settles, then one more to write it out. Packet loads
+ * go through the helpers in bpf_jit.S.
+ *
+ * The code sticks to the 32-bit user instruction set that every PPC32
+ * core implements, so e500/e500mc and the classic and 4xx cores run
+ * the same code.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <asm/cacheflush.h>
+#include <asm/ppc-opcode.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include "bpf_jit.h"
+
+int bpf_jit_enable __read_mostly;
+
+static inline void bpf_flush_icache(void *start, void *end)
+{
+	smp_wmb();
+	flush_icache_range((unsigned long)start, (unsigned long)end);
+}
+
+/* non volatile registers the generated code uses, per seen bit */
+static bool bpf_jit_saves(unsigned int seen, int reg)
+{
+	switch (reg) {
+	case r_A:
+		return true;
+	case r_X:
+		return seen & SEEN_XREG;
+	case r_skb:
+		return seen & SEEN_SKB;
+	case r_D:
+	case r_HL:
+		return seen & SEEN_DATAREF;
+	}
+	return false;
+}
+
+static void bpf_jit_build_prologue(struct sk_filter *fp, u32 *image,
+				   struct codegen_context *ctx)
+{
+	int i;
+
+	if (ctx->seen & SEEN_FUNC) {
+		/* into the LR save word of our caller's frame */
+		PPC_MFLR(0);
+		PPC_STW(0, 1, 4);
+	}
+	PPC_STWU(1, 1, -BPF_PPC_STACKFRAME);
+	for (i = r_HL; i <= r_skb; i++)
+		if (bpf_jit_saves(ctx->seen, i))
+			PPC_STW(i, 1, BPF_PPC_STACKFRAME - 4 * (32 - i));
+
+	if (ctx->seen & SEEN_SKB)
+		PPC_MR(r_skb, 3);
+	if (ctx->seen & SEEN_DATAREF) {
+		/* r_HL = skb->len - skb->data_len, r_D = skb->data */
+		PPC_LWZ(r_HL, 3, offsetof(struct sk_buff, len));
+		PPC_LWZ(r_scratch1, 3, offsetof(struct sk_buff, data_len));
+		PPC_SUB(r_HL, r_HL, r_scratch1);
+		PPC_LWZ(r_D, 3, offsetof(struct sk_buff, data));
+	}
+	if (ctx->seen & SEEN_XREG)
+		PPC_LI(r_X, 0);
+	PPC_LI(r_A, 0);
+}
+
+static void bpf_jit_build_epilogue(u32 *image, struct codegen_context *ctx)
+{
+	int i;
+
+	/* r3 has the return value */
+	for (i = r_HL; i <= r_skb; i++)
+		if (bpf_jit_saves(ctx->seen, i))
+			PPC_LWZ(i, 1, BPF_PPC_STACKFRAME - 4 * (32 - i));
+	PPC_ADDI(1, 1, BPF_PPC_STACKFRAME);
+	if (ctx->seen & SEEN_FUNC) {
+		PPC_LWZ(0, 1, 4);
+		PPC_MTLR(0);
+	}
+	PPC_BLR();
+}
+
+/*
+ * Kernel text and the image are further apart than the 32MB a relative
+ * branch reaches, so calls go through CTR.
+ */
+static void bpf_jit_emit_func_call(u32 *image, struct codegen_context *ctx,
+				   void *func)
+{
+	PPC_LI32(r_scratch1, func);
+	PPC_MTCTR(r_scratch1);
+	PPC_BCTRL();
+}
+
+/*
+ * pkt_type is a bitfield: find its byte and bits by setting it in a
+ * blank sk_buff.
+ */
+static int pkt_type_offset(unsigned int *shift)
+{
+	struct sk_buff skb_probe;
+	u8 *ct = (u8 *)&skb_probe;
+	unsigned int off;
+
+	memset(&skb_probe, 0, sizeof(skb_probe));
+	skb_probe.pkt_type = 7;
+	for (off = 0; off < sizeof(skb_probe); off++) {
+		if (ct[off]) {
+			*shift = ffs(ct[off]) - 1;
+			return off;
+		}
+	}
+	return -1;
+}
+
+#define CHOOSE_LOAD_FUNC(K, func)					\
+	((int)K < 0 ? ((int)K >= SKF_LL_OFF ? func##_negative_offset : func) : \
+	 func##_positive_offset)
+
+/* Assemble the body code between the prologue & epilogue. */
+static int bpf_jit_build_body(struct sk_filter *fp, u32 *image,
+			      struct codegen_context *ctx,
+			      unsigned int *addrs)
+{
+	const struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+	unsigned int true_cond, shift = 0;
+	u8 *func;
+	int i, off;
+
+	/* Start of epilogue code, from the last pass */
+	unsigned int exit_addr = ctx->epilogue;
+
+	for (i = 0; i < flen; i++) {
+		unsigned int K = filter[i].k;
+
+		/*
+		 * addrs[] maps a BPF bytecode address into a real offset from
+		 * the start of the image.
+		 */
+		addrs[i] = ctx->idx * 4;
+
+		switch (filter[i].code) {
+			/*** ALU ops ***/
+		case BPF_S_ALU_ADD_X: /* A += X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_ADD(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_ADD_K: /* A += K; */
+			if (!K)
+				break;
+			if (IMM_L(K))
+				PPC_ADDI(r_A, r_A, IMM_L(K));
+			if (IMM_HA(K) & 0xffff)
+				PPC_ADDIS(r_A, r_A, IMM_HA(K));
+			break;
+		case BPF_S_ALU_SUB_X: /* A -= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SUB(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_SUB_K: /* A -= K */
+			if (!K)
+				break;
+			K = -K;
+			if (IMM_L(K))
+				PPC_ADDI(r_A, r_A, IMM_L(K));
+			if (IMM_HA(K) & 0xffff)
+				PPC_ADDIS(r_A, r_A, IMM_HA(K));
+			break;
+		case BPF_S_ALU_MUL_X: /* A *= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_MUL(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_MUL_K: /* A *= K */
+			if (K < 32768)
+				PPC_MULI(r_A, r_A, K);
+			else {
+				PPC_LI32(r_scratch1, K);
+				PPC_MUL(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_S_ALU_DIV_X: /* A /= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_CMPWI(r_X, 0);
+			PPC_LI(r_ret, 0);
+			PPC_BCC(COND_EQ, exit_addr);
+			PPC_DIVWU(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_DIV_K: /* A = reciprocal_divide(A, K); */
+			PPC_LI32(r_scratch1, K);
+			/* Top 32 bits of 64bit result -> A */
+			PPC_MULHWU(r_A, r_A, r_scratch1);
+			break;
+		case BPF_S_ALU_AND_X:
+			ctx->seen |= SEEN_XREG;
+			PPC_AND(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_AND_K:
+			if (!IMM_H(K))
+				PPC_ANDI(r_A, r_A, K);
+			else if (!IMM_L(K))
+				PPC_ANDIS(r_A, r_A, IMM_H(K));
+			else {
+				PPC_LI32(r_scratch1, K);
+				PPC_AND(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_S_ALU_OR_X:
+			ctx->seen |= SEEN_XREG;
+			PPC_OR(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_OR_K:
+			if (IMM_L(K))
+				PPC_ORI(r_A, r_A, IMM_L(K));
+			if (IMM_H(K))
+				PPC_ORIS(r_A, r_A, IMM_H(K));
+			break;
+		case BPF_S_ALU_LSH_X: /* A <<= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SLW(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_LSH_K:
+			if (!K)
+				break;
+			if (K < 32)
+				PPC_SLWI(r_A, r_A, K);
+			else {
+				/* as the interpreter does, slw looks at 6 bits */
+				PPC_LI32(r_scratch1, K);
+				PPC_SLW(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_S_ALU_RSH_X: /* A >>= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SRW(r_A, r_A, r_X);
+			break;
+		case BPF_S_ALU_RSH_K: /* A >>= K; */
+			if (!K)
+				break;
+			if (K < 32)
+				PPC_SRWI(r_A, r_A, K);
+			else {
+				PPC_LI32(r_scratch1, K);
+				PPC_SRW(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_S_ALU_NEG:
+			PPC_NEG(r_A, r_A);
+			break;
+		case BPF_S_RET_K:
+			PPC_LI32(r_ret, K);
+			if (i != flen - 1)
+				PPC_JMP(exit_addr);
+			break;
+		case BPF_S_RET_A:
+			PPC_MR(r_ret, r_A);
+			if (i != flen - 1)
+				PPC_JMP(exit_addr);
+			break;
+		case BPF_S_MISC_TAX: /* X = A */
+			ctx->seen |= SEEN_XREG;
+			PPC_MR(r_X, r_A);
+			break;
+		case BPF_S_MISC_TXA: /* A = X */
+			ctx->seen |= SEEN_XREG;
+			PPC_MR(r_A, r_X);
+			break;
+
+			/*** Constant loads/M[] access ***/
+		case BPF_S_LD_IMM: /* A = K */
+			PPC_LI32(r_A, K);
+			break;
+		case BPF_S_LDX_IMM: /* X = K */
+			ctx->seen |= SEEN_XREG;
+			PPC_LI32(r_X, K);
+			break;
+		case BPF_S_LD_MEM: /* A = mem[K] */
+			ctx->seen |= SEEN_MEM;
+			PPC_LWZ(r_A, 1, BPF_PPC_STACK_MEM + K * 4);
+			break;
+		case BPF_S_LDX_MEM: /* X = mem[K] */
+			ctx->seen |= SEEN_MEM | SEEN_XREG;
+			PPC_LWZ(r_X, 1, BPF_PPC_STACK_MEM + K * 4);
+			break;
+		case BPF_S_ST: /* mem[K] = A */
+			ctx->seen |= SEEN_MEM;
+			PPC_STW(r_A, 1, BPF_PPC_STACK_MEM + K * 4);
+			break;
+		case BPF_S_STX: /* mem[K] = X */
+			ctx->seen |= SEEN_MEM | SEEN_XREG;
+			PPC_STW(r_X, 1, BPF_PPC_STACK_MEM + K * 4);
+			break;
+		case BPF_S_LD_W_LEN: /* A = skb->len; */
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+			PPC_LWZ(r_A, r_skb, offsetof(struct sk_buff, len));
+			break;
+		case BPF_S_LDX_W_LEN: /* X = skb->len; */
+			ctx->seen |= SEEN_SKB | SEEN_XREG;
+			PPC_LWZ(r_X, r_skb, offsetof(struct sk_buff, len));
+			break;
+
+			/*** Ancillary info loads ***/
+		case BPF_S_ANC_PROTOCOL: /* A = ntohs(skb->protocol); */
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+						  protocol) != 2);
+			PPC_LHZ(r_A, r_skb, offsetof(struct sk_buff, protocol));
+			break;
+		case BPF_S_ANC_PKTTYPE:
+			off = pkt_type_offset(&shift);
+			if (off < 0)
+				return -1;
+			ctx->seen |= SEEN_SKB;
+			PPC_LBZ(r_A, r_skb, off);
+			PPC_RLWINM(r_A, r_A, (32 - shift) & 31, 29, 31);
+			break;
+		case BPF_S_ANC_IFINDEX:
+		case BPF_S_ANC_HATYPE:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+						  ifindex) != 4);
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+						  type) != 2);
+			PPC_LWZ(r_scratch1, r_skb, offsetof(struct sk_buff, dev));
+			/* no device, return 0 */
+			PPC_CMPLWI(r_scratch1, 0);
+			PPC_LI(r_ret, 0);
+			PPC_BCC(COND_EQ, exit_addr);
+			if (filter[i].code == BPF_S_ANC_IFINDEX)
+				PPC_LWZ(r_A, r_scratch1,
+					offsetof(struct net_device, ifindex));
+			else
+				PPC_LHZ(r_A, r_scratch1,
+					offsetof(struct net_device, type));
+			break;
+		case BPF_S_ANC_MARK:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+			PPC_LWZ(r_A, r_skb, offsetof(struct sk_buff, mark));
+			break;
+		case BPF_S_ANC_RXHASH:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+			PPC_LWZ(r_A, r_skb, offsetof(struct sk_buff, rxhash));
+			break;
+		case BPF_S_ANC_QUEUE:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+						  queue_mapping) != 2);
+			PPC_LHZ(r_A, r_skb, offsetof(struct sk_buff,
+						     queue_mapping));
+			break;
+		case BPF_S_ANC_CPU:
+#ifdef CONFIG_SMP
+			/* A = current_thread_info()->cpu */
+			BUILD_BUG_ON(FIELD_SIZEOF(struct thread_info, cpu) != 4);
+			PPC_RLWINM(r_A, 1, 0, 0, 31 - THREAD_SHIFT);
+			PPC_LWZ(r_A, r_A, offsetof(struct thread_info, cpu));
+#else
+			PPC_LI(r_A, 0);
+#endif
+			break;
+		case BPF_S_ANC_NLATTR:
+		case BPF_S_ANC_NLATTR_NEST:
+			ctx->seen |= SEEN_SKB | SEEN_XREG | SEEN_FUNC;
+			PPC_MR(3, r_skb);
+			PPC_MR(4, r_A);
+			PPC_MR(5, r_X);
+			bpf_jit_emit_func_call(image, ctx,
+				filter[i].code == BPF_S_ANC_NLATTR ?
+				(void *)sk_filter_nlattr :
+				(void *)sk_filter_nlattr_nest);
+			/* negative: the filter returns 0 */
+			PPC_CMPWI(3, 0);
+			PPC_MR(r_A, 3);
+			PPC_LI(r_ret, 0);
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+			/*** Absolute loads from packet header/data ***/
+		case BPF_S_LD_W_ABS:
+			func = CHOOSE_LOAD_FUNC(K, sk_load_word);
+			goto common_load;
+		case BPF_S_LD_H_ABS:
+			func = CHOOSE_LOAD_FUNC(K, sk_load_half);
+			goto common_load;
+		case BPF_S_LD_B_ABS:
+			func = CHOOSE_LOAD_FUNC(K, sk_load_byte);
+			goto common_load;
+		case BPF_S_LDX_B_MSH:
+			func = CHOOSE_LOAD_FUNC(K, sk_load_byte_msh);
+			ctx->seen |= SEEN_XREG;
+common_load:
+			/* Load from [K]. */
+			ctx->seen |= SEEN_DATAREF | SEEN_SKB | SEEN_FUNC;
+			PPC_LI32(r_addr, K);
+			bpf_jit_emit_func_call(image, ctx, func);
+			/*
+			 * Helper returns 'lt' condition on error, and an
+			 * appropriate return value in r3
+			 */
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+			/*** Indirect loads from packet header/data ***/
+		case BPF_S_LD_W_IND:
+			func = sk_load_word;
+			goto common_load_ind;
+		case BPF_S_LD_H_IND:
+			func = sk_load_half;
+			goto common_load_ind;
+		case BPF_S_LD_B_IND:
+			func = sk_load_byte;
+common_load_ind:
+			/*
+			 * Load from [X + K]. Negative offsets are tested for
+			 * in the helper functions.
+			 */
+			ctx->seen |= SEEN_DATAREF | SEEN_SKB | SEEN_FUNC |
+				     SEEN_XREG;
+			if (K < 32768)
+				PPC_ADDI(r_addr, r_X, K);
+			else {
+				PPC_LI32(r_addr, K);
+				PPC_ADD(r_addr, r_addr, r_X);
+			}
+			bpf_jit_emit_func_call(image, ctx, func);
+			/* If error, cr0.LT set */
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+			/*** Jump and branches ***/
+		case BPF_S_JMP_JA:
+			if (K != 0)
+				PPC_JMP(addrs[i + 1 + K]);
+			break;
+
+		case BPF_S_JMP_JGT_K:
+		case BPF_S_JMP_JGT_X:
+			true_cond = COND_GT;
+			goto cond_branch;
+		case BPF_S_JMP_JGE_K:
+		case BPF_S_JMP_JGE_X:
+			true_cond = COND_GE;
+			goto cond_branch;
+		case BPF_S_JMP_JEQ_K:
+		case BPF_S_JMP_JEQ_X:
+			true_cond = COND_EQ;
+			goto cond_branch;
+		case BPF_S_JMP_JSET_K:
+		case BPF_S_JMP_JSET_X:
+			true_cond = COND_NE;
+			/* Fall through */
+cond_branch:
+			/* same targets, can avoid doing the test :) */
+			if (filter[i].jt == filter[i].jf) {
+				if (filter[i].jt > 0)
+					PPC_JMP(addrs[i + 1 + filter[i].jt]);
+				break;
+			}
+
+			switch (filter[i].code) {
+			case BPF_S_JMP_JGT_X:
+			case BPF_S_JMP_JGE_X:
+			case BPF_S_JMP_JEQ_X:
+				ctx->seen |= SEEN_XREG;
+				PPC_CMPLW(r_A, r_X);
+				break;
+			case BPF_S_JMP_JSET_X:
+				ctx->seen |= SEEN_XREG;
+				PPC_AND_DOT(r_scratch1, r_A, r_X);
+				break;
+			case BPF_S_JMP_JEQ_K:
+			case BPF_S_JMP_JGT_K:
+			case BPF_S_JMP_JGE_K:
+				if (K < 65536)
+					PPC_CMPLWI(r_A, K);
+				else {
+					PPC_LI32(r_scratch1, K);
+					PPC_CMPLW(r_A, r_scratch1);
+				}
+				break;
+			case BPF_S_JMP_JSET_K:
+				/* andi. and andis. set cr0 */
+				if (!IMM_H(K))
+					PPC_ANDI(r_scratch1, r_A, K);
+				else if (!IMM_L(K))
+					PPC_ANDIS(r_scratch1, r_A, IMM_H(K));
+				else {
+					PPC_LI32(r_scratch1, K);
+					PPC_AND_DOT(r_scratch1, r_A,
+						    r_scratch1);
+				}
+				break;
+			}
+			/* Sometimes branches are constructed "backward", with
+			 * the false path being the branch and true path being
+			 * a fallthrough to the next instruction.
+			 */
+			if (filter[i].jt == 0)
+				/* Swap the sense of the branch */
+				PPC_BCC(true_cond ^ COND_CMP_TRUE,
+					addrs[i + 1 + filter[i].jf]);
+			else {
+				PPC_BCC(true_cond, addrs[i + 1 + filter[i].jt]);
+				if (filter[i].jf != 0)
+					PPC_JMP(addrs[i + 1 + filter[i].jf]);
+			}
+			break;
+		default:
+			/* The filter contains something cruel & unusual.
+			 * We don't handle it, but also there shouldn't be
+			 * anything missing from our list.
+			 */
+			if (printk_ratelimit())
+				pr_err("BPF filter opcode %04x (@%d) unsupported\n",
+				       filter[i].code, i);
+			return -ENOTSUPP;
+		}
+	}
+
+	return 0;
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	unsigned int proglen, oldproglen = 0;
+	struct codegen_context cgctx;
+	unsigned int *addrs;
+	u32 *image = NULL;
+	int flen = fp->len;
+	int i, pass;
+
+	BUILD_BUG_ON(BPF_PPC_STACK_MEM + BPF_MEMWORDS * 4 + 5 * 4 >
+		     BPF_PPC_STACKFRAME);
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/*
+	 * Before the first pass, make a rough estimation of addrs[]: each
+	 * BPF instruction is translated to less than 16 PPC ones, and so
+	 * are the prologue and the epilogue. Code only shrinks from one
+	 * pass to the next, as branches that were too far to be short
+	 * come into reach.
+	 */
+	for (i = 0; i < flen; i++)
+		addrs[i] = (i + 1) * 64;
+	memset(&cgctx, 0, sizeof(struct codegen_context));
+	cgctx.seen = SEEN_DATAREF | SEEN_XREG | SEEN_MEM | SEEN_SKB |
+		     SEEN_FUNC;
+	cgctx.epilogue = (flen + 1) * 64;
+
+	for (pass = 0; pass < 10; pass++) {
+		/* prologue and epilogue go by what the last pass saw */
+		unsigned int seen = cgctx.seen, body_seen;
+
+		cgctx.idx = 0;
+		bpf_jit_build_prologue(fp, image, &cgctx);
+		cgctx.seen = 0;
+		if (bpf_jit_build_body(fp, image, &cgctx, addrs))
+			goto out;
+		body_seen = cgctx.seen;
+		cgctx.seen = seen;
+		cgctx.epilogue = cgctx.idx * 4;
+		bpf_jit_build_epilogue(image, &cgctx);
+		proglen = cgctx.idx * 4;
+
+		if (image) {
+			if (proglen != oldproglen) {
+				pr_err("bpf_jit_compile proglen=%u != oldproglen=%u\n",
+				       proglen, oldproglen);
+				goto out;
+			}
+			break;
+		}
+		if (proglen == oldproglen && body_seen == seen) {
+			image = module_alloc(max_t(unsigned int, proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+		cgctx.seen = body_seen;
+	}
+	if (pass == 10)
+		goto out;
+	if (bpf_jit_enable > 1)
+		pr_err("flen=%d proglen=%u pass=%d image=%p\n",
+		       flen, proglen, pass, image);
+
+	if (bpf_jit_enable > 1)
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 1, image, proglen, false);
+
+	bpf_flush_icache(image, (u8 *)image + proglen);
+
+	fp->bpf_func = (void *)image;
+	image = NULL;
+out:
+	if (image)
+		module_free(NULL, image);
+	kfree(addrs);
+	return;
+}
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func != sk_run_filter) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
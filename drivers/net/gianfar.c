@@ -102,6 +102,8 @@
 #include <linux/of.h>
 #include <linux/of_net.h>
 
+#include <net/busy_poll.h>
+
 #include "gianfar.h"
 #include "fsl_pq_mdio.h"
 #ifdef CONFIG_GIANFAR_L2SRAM
@@ -177,6 +179,9 @@ static int gfar_poll_tx(struct napi_struct *napi, int budget);
 #ifdef CONFIG_NET_POLL_CONTROLLER
 static void gfar_netpoll(struct net_device *dev);
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static int gfar_busy_poll(struct napi_struct *napi);
+#endif
 static void gfar_schedule_rx_cleanup(struct gfar_priv_grp *gfargrp);
 static void gfar_schedule_tx_cleanup(struct gfar_priv_grp *gfargrp);
 int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit);
@@ -184,7 +189,7 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue,
 		int tx_work_limit);
 
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull);
+			      int amount_pull, struct napi_struct *napi);
 void gfar_halt(struct net_device *dev);
 static void gfar_halt_nodisable(struct net_device *dev);
 void gfar_start(struct net_device *dev);
@@ -563,6 +568,9 @@ static const struct net_device_ops gfar_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller = gfar_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll = gfar_busy_poll,
+#endif
 };
 
 void lock_rx_qs(struct gfar_private *priv)
@@ -1331,6 +1339,7 @@ static int gfar_probe(struct platform_device *ofdev)
 	for (i = 0; i < priv->num_grps; i++) {
 		netif_napi_add(dev, &priv->gfargrp[i].napi_rx, gfar_poll_rx,
 					rx_napi_weight);
+		napi_hash_add(&priv->gfargrp[i].napi_rx);
 		if (likely(tx_napi_enabled))
 			netif_napi_add(dev, &priv->gfargrp[i].napi_tx,
 					gfar_poll_tx,
@@ -1552,6 +1561,7 @@ register_fail:
 static int gfar_remove(struct platform_device *ofdev)
 {
 	struct gfar_private *priv = dev_get_drvdata(&ofdev->dev);
+	int i;
 
 	if (priv->phy_node)
 		of_node_put(priv->phy_node);
@@ -1560,6 +1570,9 @@ static int gfar_remove(struct platform_device *ofdev)
 
 	dev_set_drvdata(&ofdev->dev, NULL);
 
+	/* unregister_netdev() waits for the busy pollers to go away */
+	for (i = 0; i < priv->num_grps; i++)
+		napi_hash_del(&priv->gfargrp[i].napi_rx);
 	unregister_netdev(priv->ndev);
 	unmap_group_regs(priv);
 	free_netdev(priv->ndev);
@@ -2212,6 +2225,8 @@ static void free_skb_tx_queue(struct gfar_priv_tx_q *tx_queue)
 		tx_queue->tx_skbuff[i] = NULL;
 	}
 	kfree(tx_queue->tx_skbuff);
+	netdev_tx_reset_queue(netdev_get_tx_queue(tx_queue->dev,
+						  tx_queue->qindex));
 }
 
 static void free_skb_rx_queue(struct gfar_priv_rx_q *rx_queue)
@@ -3104,6 +3119,11 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		lstatus |= BD_LFLAG(TXBD_CRC | TXBD_READY) | skb_headlen(skb);
 	}
 
+#ifndef CONFIG_RX_TX_BUFF_XCHG
+	/* with the FCB, as gfar_clean_tx_ring() will see it */
+	netdev_tx_sent_queue(txq, skb->len);
+#endif
+
 	/*
 	 * We can work in parallel with gfar_clean_tx_ring(), except
 	 * when modifying num_txbdfree. Note that we didn't grab the lock
@@ -3168,9 +3188,14 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct net_device *dev = skb->dev;
 	struct gfar_private *priv = netdev_priv(dev);
 
-	if (!skb_is_recycleable(skb, priv->rx_buffer_size + RXBUF_ALIGNMENT))
+	if (!skb_is_recycleable(skb, priv->rx_buffer_size + RXBUF_ALIGNMENT)) {
+		/* Not freed before the ring wraps round to this slot, so do
+		 * not keep it charged to its socket: TCP small queues would
+		 * wait for it.
+		 */
+		skb_orphan(skb);
 		skb->owner = KER_PKT_ID;
-	else {
+	} else {
 #ifdef CONFIG_AS_FASTPATH
 		if (skb->pkt_type == PACKET_FASTROUTE)
 			gfar_asf_reclaim_skb(skb);
@@ -3287,6 +3312,10 @@ int gfar_fast_xmit(struct sk_buff *skb, struct net_device *dev)
 			skb_headlen(skb), DMA_TO_DEVICE);
 
 	lstatus |= BD_LFLAG(TXBD_CRC | TXBD_READY) | skb_headlen(skb);
+
+#ifndef CONFIG_RX_TX_BUFF_XCHG
+	netdev_tx_sent_queue(txq, skb->len);
+#endif
 	/*
 	 * We can work in parallel with gfar_clean_tx_ring(), except
 	 * when modifying num_txbdfree. Note that we didn't grab the lock
@@ -3555,6 +3584,7 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue,
 	int frags = 0, nr_txbds = 0;
 	int i;
 	int howmany = 0;
+	unsigned int bytes_sent = 0;
 	u32 lstatus;
 	size_t buflen;
 
@@ -3585,6 +3615,9 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue,
 				(lstatus & BD_LENGTH_MASK))
 			break;
 
+		/* before the time stamping FCB is pulled */
+		bytes_sent += skb->len;
+
 		if (unlikely(skb_shinfo(skb)->tx_flags & SKBTX_IN_PROGRESS)) {
 			next = next_txbd(bdp, base, tx_ring_size);
 			buflen = next->length + GMAC_FCB_LEN;
@@ -3662,6 +3695,11 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue,
 		spin_unlock_irqrestore(&tx_queue->txlock, flags);
 	}
 
+#ifndef CONFIG_RX_TX_BUFF_XCHG
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, tx_queue->qindex),
+				  howmany, bytes_sent);
+#endif
+
 	/* If we freed a buffer, we can restart transmission, if necessary */
 	if (__netif_subqueue_stopped(dev, tx_queue->qindex) && tx_queue->num_txbdfree)
 		netif_wake_subqueue(dev, tx_queue->qindex);
@@ -4021,13 +4059,11 @@ static inline void gfar_rx_checksum(struct sk_buff *skb, struct rxfcb *fcb)
 /* gfar_process_frame() -- handle one incoming packet if skb
  * isn't NULL.  */
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull)
+			      int amount_pull, struct napi_struct *napi)
 {
 	struct gfar_private *priv = netdev_priv(dev);
 	struct rxfcb *fcb = NULL;
 
-	int ret;
-
 	/* fcb is at the beginning if exists */
 	fcb = (struct rxfcb *)skb->data;
 
@@ -4096,10 +4132,16 @@ static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
 		__vlan_hwaccel_put_tag(skb, fcb->vlctl);
 
 	/* Send the packet up the stack */
-	ret = netif_receive_skb(skb);
-
-	if (NET_RX_DROP == ret)
+#ifdef CONFIG_RX_TX_BUFF_XCHG
+	/* gfar_clean_rx_ring() takes the exchanged buffer off the skb once
+	 * it is through, GRO could hold it back or free it
+	 */
+	if (netif_receive_skb(skb) == NET_RX_DROP)
+		priv->extra_stats.kernel_dropped++;
+#else
+	if (napi_gro_receive(napi, skb) == GRO_DROP)
 		priv->extra_stats.kernel_dropped++;
+#endif
 
 	return 0;
 }
@@ -4123,7 +4165,8 @@ static inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 	 */
 	skb->gfar_dev = priv->ndev;
 	if ((tcp_chan_idx < 0) || !priv->hw_tcp.chan[tcp_chan_idx]) {
-		gfar_process_frame(priv->ndev, skb, GMAC_FCB_LEN);
+		gfar_process_frame(priv->ndev, skb, GMAC_FCB_LEN,
+				   &rx_queue->grp->napi_rx);
 		return;
 	}
 
@@ -4140,7 +4183,8 @@ static inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 
 	if (iph->ihl > 5 || (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
 		(gfar_sk->sk_state != TCP_ESTABLISHED)) {
-		gfar_process_frame(priv->ndev, skb, GMAC_FCB_LEN);
+		gfar_process_frame(priv->ndev, skb, GMAC_FCB_LEN,
+				   &rx_queue->grp->napi_rx);
 		return;
 	}
 
@@ -4244,6 +4288,7 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 				skb_put(skb, pkt_len);
 				rx_queue->stats.rx_bytes += pkt_len;
 				skb_record_rx_queue(skb, rx_queue->qindex);
+				skb_mark_napi_id(skb, &rx_queue->grp->napi_rx);
 #ifdef CONFIG_RX_TX_BUFF_XCHG
 				skb->owner = RT_PKT_ID;
 #endif
@@ -4253,7 +4298,8 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 							(priv, rx_queue, skb);
 				else
 #endif
-				gfar_process_frame(dev, skb, amount_pull);
+				gfar_process_frame(dev, skb, amount_pull,
+						   &rx_queue->grp->napi_rx);
 #ifdef CONFIG_RX_TX_BUFF_XCHG
 				newskb = skb->new_skb;
 				skb->owner = 0;
@@ -4317,7 +4363,8 @@ static int gfar_poll_rx(struct napi_struct *napi, int budget)
 		num_act_qs++;
 		rstat_local &= (rstat_local - 1);
 	}
-	budget_per_queue = budget/num_act_qs;
+	/* a busy poller may have emptied the rings already */
+	budget_per_queue = budget / max(num_act_qs, 1);
 
 	gfar_write(&regs->rstat, rstat_rxf);
 	gfar_write(&gfargrp->regs->ievent, IEVENT_RX_MASK);
@@ -4345,7 +4392,7 @@ static int gfar_poll_rx(struct napi_struct *napi, int budget)
 
 
 	if (napi_done) {
-		napi_complete(napi);
+		napi_complete_done(napi, rx_cleaned);
 		gfar_configure_rx_coalescing(priv, gfargrp->rx_bit_map);
 		spin_lock_irq(&gfargrp->grplock);
 		imask = gfar_read(&regs->imask);
@@ -4365,6 +4412,61 @@ static int gfar_poll_rx(struct napi_struct *napi, int budget)
 	return rx_cleaned;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* Called from sk_busy_loop() with bottom halves disabled. The group is
+ * claimed like gfar_schedule_rx_cleanup() does, but the rx interrupt
+ * stays unmasked, and the rings are cleaned the way gfar_poll_rx() does
+ * it, a few frames per queue at a time.
+ */
+static int gfar_busy_poll(struct napi_struct *napi)
+{
+	struct gfar_priv_grp *gfargrp = container_of(napi,
+			struct gfar_priv_grp, napi_rx);
+	struct gfar_private *priv = gfargrp->priv;
+	struct gfar __iomem *regs = gfargrp->regs;
+	u32 rstat_rxf, rstat_rhalt = 0, pending, mask;
+	int i, rx_cleaned = 0, rx_cleaned_per_queue;
+
+	if (!napi_schedule_prep(napi))
+		return LL_FLUSH_BUSY;
+
+	rstat_rxf = gfar_read(&regs->rstat) & RSTAT_RXF_ALL_MASK;
+	gfar_write(&regs->rstat, rstat_rxf);
+	rstat_rxf |= gfargrp->rstat_prev;
+	gfargrp->rstat_prev = rstat_rxf;
+
+	for_each_set_bit(i, &gfargrp->rx_bit_map, priv->num_rx_queues) {
+		mask = RSTAT_RXF0_MASK >> i;
+		if (!(rstat_rxf & mask))
+			continue;
+		rx_cleaned_per_queue = gfar_clean_rx_ring(priv->rx_queue[i],
+				GFAR_BUSY_POLL_BUDGET);
+		if (rx_cleaned_per_queue < GFAR_BUSY_POLL_BUDGET) {
+			gfargrp->rstat_prev &= ~(mask);
+			rstat_rhalt |= RSTAT_CLEAR_RHALT >> i;
+		}
+		rx_cleaned += rx_cleaned_per_queue;
+	}
+
+	if (rstat_rhalt)
+		gfar_write(&regs->rstat, rstat_rhalt);
+
+	pending = gfargrp->rstat_prev;
+	smp_mb__before_clear_bit();
+	clear_bit(NAPI_STATE_SCHED, &napi->state);
+	smp_mb__after_clear_bit();
+
+	/* An rx interrupt taken while the group was ours only acked the
+	 * event, but the frame it announced is still flagged in rstat:
+	 * hand anything left over to NAPI, as the interrupt would have.
+	 */
+	if (pending || (gfar_read(&regs->rstat) & RSTAT_RXF_ALL_MASK))
+		gfar_schedule_rx_cleanup(gfargrp);
+
+	return rx_cleaned;
+}
+#endif
+
 static int gfar_poll_tx(struct napi_struct *napi, int budget)
 {
 	struct gfar_priv_grp *gfargrp = container_of(napi,
@@ -52,6 +52,8 @@
 #define GFAR_DEV_RX_WEIGHT 64
 /* The maximum number of packets to be handled in one call of gfar_poll_tx */
 #define GFAR_DEV_TX_WEIGHT 64
+/* The maximum number of packets per queue in one call of gfar_busy_poll */
+#define GFAR_BUSY_POLL_BUDGET 4
 
 /* Length for FCB */
 #define GMAC_FCB_LEN 8
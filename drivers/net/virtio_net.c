@@ -59,6 +59,9 @@ struct virtnet_info {
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Reclaims sent skbs when the send queue calls back. */
+	struct tasklet_struct tx_tasklet;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 
@@ -124,6 +127,22 @@ static void skb_xmit_done(struct virtqueue *svq)
 	/* Suppress further interrupts. */
 	virtqueue_disable_cb(svq);
 
+	/* Sent skbs are otherwise only freed from start_xmit, which is not
+	 * called again while byte queue limits hold the queue stopped. */
+	tasklet_schedule(&vi->tx_tasklet);
+}
+
+static unsigned int free_old_xmit_skbs(struct virtnet_info *vi);
+
+static void tx_tasklet(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+	__netif_tx_unlock(txq);
+
 	/* We were probably waiting for more output buffers. */
 	netif_wake_queue(vi->dev);
 }
@@ -513,14 +532,18 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int bytes = 0, pkts = 0;
 
 	while ((skb = virtqueue_get_buf(vi->svq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
-		vi->dev->stats.tx_bytes += skb->len;
-		vi->dev->stats.tx_packets++;
+		bytes += skb->len;
+		pkts++;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	vi->dev->stats.tx_bytes += bytes;
+	vi->dev->stats.tx_packets += pkts;
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
@@ -599,6 +622,7 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		kfree_skb(skb);
 		return NETDEV_TX_OK;
 	}
+	netdev_sent_queue(dev, skb->len);
 	virtqueue_kick(vi->svq);
 
 	/* Don't wait up for transmitted skbs to be freed. */
@@ -617,6 +641,12 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 				virtqueue_disable_cb(vi->svq);
 			}
 		}
+	} else if (netif_xmit_stopped(netdev_get_tx_queue(dev, 0))) {
+		/* Stopped by byte queue limits: only a completion restarts
+		 * the queue, so ask to be called back once the host has
+		 * caught up. */
+		if (unlikely(!virtqueue_enable_cb_delayed(vi->svq)))
+			free_old_xmit_skbs(vi);
 	}
 
 	return NETDEV_TX_OK;
@@ -938,6 +968,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 	vdev->priv = vi;
 	vi->pages = NULL;
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_tasklet, tx_tasklet, (unsigned long)vi);
 	sg_init_table(vi->rx_sg, ARRAY_SIZE(vi->rx_sg));
 	sg_init_table(vi->tx_sg, ARRAY_SIZE(vi->tx_sg));
 
@@ -999,6 +1030,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 unregister:
 	unregister_netdev(dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_tasklet);
 free_vqs:
 	vdev->config->del_vqs(vdev);
 free:
@@ -1015,6 +1047,7 @@ static void free_unused_bufs(struct virtnet_info *vi)
 			break;
 		dev_kfree_skb(buf);
 	}
+	netdev_reset_queue(vi->dev);
 	while (1) {
 		buf = virtqueue_detach_unused_buf(vi->rvq);
 		if (!buf)
@@ -1038,6 +1071,7 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	unregister_netdev(vi->dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_tasklet);
 
 	/* Free unused buffers in both send and recv, if any. */
 	free_unused_bufs(vi);
@@ -35,6 +35,11 @@
 #include <linux/eventfd.h>
 #include <linux/blkdev.h>
 #include <linux/compat.h>
+#include <linux/kthread.h>
+#include <linux/fdtable.h>
+#include <linux/cred.h>
+#include <linux/pagemap.h>
+#include <linux/poll.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -55,6 +60,7 @@ static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
 static struct workqueue_struct *aio_wq;
+static struct workqueue_struct *aio_punt_wq;
 
 /* Used for rare fput completion. */
 static void aio_fput_routine(struct work_struct *);
@@ -65,6 +71,7 @@ static LIST_HEAD(fput_head);
 
 static void aio_kick_handler(struct work_struct *);
 static void aio_queue_work(struct kioctx *);
+static int aio_wake_function(wait_queue_t *, unsigned, int, void *);
 
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
@@ -77,6 +84,9 @@ static int __init aio_setup(void)
 
 	aio_wq = alloc_workqueue("aio", 0, 1);	/* used to limit concurrency */
 	BUG_ON(!aio_wq);
+	/* blocking submissions off the submission rings, see aio_punt_iocb */
+	aio_punt_wq = alloc_workqueue("aio_punt", WQ_UNBOUND, 0);
+	BUG_ON(!aio_punt_wq);
 
 	pr_debug("aio_setup: sizeof(struct page) = %d\n", (int)sizeof(struct page));
 
@@ -104,6 +114,38 @@ static void aio_free_ring(struct kioctx *ctx)
 	info->nr = 0;
 }
 
+/* aio_sq_stop
+ *	Stops the polling thread of a submission ring, if there is one.
+ *	Must be done before the requests are cancelled, so that no more
+ *	come in behind.
+ */
+static void aio_sq_stop(struct kioctx *ctx)
+{
+	struct task_struct *thread = xchg(&ctx->sq_info.thread, NULL);
+
+	if (thread)
+		kthread_stop(thread);
+}
+
+static void aio_free_sq(struct kioctx *ctx)
+{
+	struct aio_sq_info *info = &ctx->sq_info;
+
+	if (info->mmap_size) {
+		down_write(&ctx->mm->mmap_sem);
+		do_munmap(ctx->mm, info->mmap_base, info->mmap_size);
+		up_write(&ctx->mm->mmap_sem);
+		info->mmap_size = 0;
+	}
+	if (info->files)
+		put_files_struct(info->files);
+	if (info->creds)
+		put_cred(info->creds);
+	info->files = NULL;
+	info->creds = NULL;
+	info->nr = 0;
+}
+
 static int aio_setup_ring(struct kioctx *ctx)
 {
 	struct aio_ring *ring;
@@ -222,6 +264,7 @@ static void __put_ioctx(struct kioctx *ctx)
 	cancel_delayed_work(&ctx->wq);
 	cancel_work_sync(&ctx->wq.work);
 	aio_free_ring(ctx);
+	aio_free_sq(ctx);
 	mmdrop(ctx->mm);
 	ctx->mm = NULL;
 	pr_debug("__put_ioctx: freeing %p\n", ctx);
@@ -404,6 +447,7 @@ void exit_aio(struct mm_struct *mm)
 		ctx = hlist_entry(mm->ioctx_list.first, struct kioctx, list);
 		hlist_del_rcu(&ctx->list);
 
+		aio_sq_stop(ctx);
 		aio_cancel_all(ctx);
 
 		wait_for_all_aios(ctx);
@@ -452,6 +496,10 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
 	req->ki_eventfd = NULL;
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait.key.flags = NULL;
+	req->ki_poll_head = NULL;
 
 	/* Check if the completion queue has enough free space to
 	 * accept an event from this io.
@@ -559,8 +607,9 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 	 * schedule work in case it is not final fput() time. In normal cases,
 	 * we would not be holding the last reference to the file*, so
 	 * this function will be executed w/out any aio kthread wakeup.
+	 * Requests failed off a submission ring may have no file at all.
 	 */
-	if (unlikely(!fput_atomic(req->ki_filp))) {
+	if (unlikely(req->ki_filp && !fput_atomic(req->ki_filp))) {
 		spin_lock(&fput_lock);
 		list_add(&req->ki_list, &fput_head);
 		spin_unlock(&fput_lock);
@@ -785,17 +834,13 @@ static int __aio_run_iocbs(struct kioctx *ctx)
 
 static void aio_queue_work(struct kioctx * ctx)
 {
-	unsigned long timeout;
 	/*
-	 * if someone is waiting, get the work started right
-	 * away, otherwise, use a longer delay
+	 * Most kicks come from the unlock of a page that a buffered
+	 * read waits for: the data is in, so get the work started
+	 * right away, whether anybody waits in io_getevents() yet
+	 * or reaps the event ring itself later.
 	 */
-	smp_mb();
-	if (waitqueue_active(&ctx->wait))
-		timeout = 1;
-	else
-		timeout = HZ/10;
-	queue_delayed_work(aio_wq, &ctx->wq, timeout);
+	queue_delayed_work(aio_wq, &ctx->wq, 0);
 }
 
 /*
@@ -887,6 +932,32 @@ void kick_iocb(struct kiocb *iocb)
 }
 EXPORT_SYMBOL(kick_iocb);
 
+/*
+ * aio_wake_function:
+ *	Wake function of kiocb->ki_wait, queued on the bit wait
+ *	queue of a page by wait_on_page_locked_async().  Takes
+ *	the kiocb off the queue and kicks it once the bit it is
+ *	waiting for clears.  Called with the wait queue locked,
+ *	possibly from the interrupt completing the read.
+ */
+static int aio_wake_function(wait_queue_t *wait, unsigned mode, int sync,
+			     void *arg)
+{
+	struct wait_bit_queue *wait_bit =
+		container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+	struct wait_bit_key *key = arg;
+
+	if (!key || wait_bit->key.flags != key->flags ||
+	    wait_bit->key.bit_nr != key->bit_nr ||
+	    test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
 /* aio_complete
  *	Called when the io request on the given iocb is complete.
  *	Returns true if this is the last user of the request.  The 
@@ -1208,6 +1279,7 @@ static void io_destroy(struct kioctx *ioctx)
 	if (likely(!was_dead))
 		put_ioctx(ioctx);	/* twice for the list */
 
+	aio_sq_stop(ioctx);
 	aio_cancel_all(ioctx);
 	wait_for_all_aios(ioctx);
 
@@ -1376,6 +1448,14 @@ static ssize_t aio_fsync(struct kiocb *iocb)
 	return ret;
 }
 
+/* fsync for the submission rings where the file has no aio_fsync,
+ * always run from aio_punt_wq.
+ */
+static ssize_t aio_vfs_fsync(struct kiocb *iocb)
+{
+	return vfs_fsync(iocb->ki_filp, iocb->ki_opcode == IOCB_CMD_FDSYNC);
+}
+
 static ssize_t aio_setup_vectored_rw(int type, struct kiocb *kiocb, bool compat)
 {
 	ssize_t ret;
@@ -1430,8 +1510,10 @@ static ssize_t aio_setup_single_vector(int type, struct file * file, struct kioc
  * aio_setup_iocb:
  *	Performs the initial checks and aio retry method
  *	setup for the kiocb at the time of io submission.
+ *	Submission rings can also fsync files which have
+ *	no aio_fsync, from a worker.
  */
-static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
+static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat, bool ring)
 {
 	struct file *file = kiocb->ki_filp;
 	ssize_t ret = 0;
@@ -1493,11 +1575,15 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 		ret = -EINVAL;
 		if (file->f_op->aio_fsync)
 			kiocb->ki_retry = aio_fdsync;
+		else if (ring && file->f_op->fsync)
+			kiocb->ki_retry = aio_vfs_fsync;
 		break;
 	case IOCB_CMD_FSYNC:
 		ret = -EINVAL;
 		if (file->f_op->aio_fsync)
 			kiocb->ki_retry = aio_fsync;
+		else if (ring && file->f_op->fsync)
+			kiocb->ki_retry = aio_vfs_fsync;
 		break;
 	default:
 		dprintk("EINVAL: io_submit: no operation provided\n");
@@ -1510,12 +1596,330 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 	return 0;
 }
 
+/* Buffered reads are only worth a worker when they would go to the
+ * disk, ranges this long are assumed to.
+ */
+#define AIO_PUNT_MAX_CACHED	16
+
+static bool aio_pages_cached(struct address_space *mapping, loff_t pos,
+			     size_t count)
+{
+	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
+	pgoff_t last = (pos + count - 1) >> PAGE_CACHE_SHIFT;
+	struct page *page;
+	bool uptodate;
+
+	if (last - index >= AIO_PUNT_MAX_CACHED)
+		return false;
+
+	for (; index <= last; index++) {
+		page = find_get_page(mapping, index);
+		if (!page)
+			return false;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return false;
+	}
+	return true;
+}
+
+/* Requests of a context on aio_punt_wq at once; past that the
+ * submitter runs them itself.
+ */
+#define AIO_PUNT_MAX	16
+
+/* aio_should_punt
+ *	Whether a request taken off a submission ring would block the
+ *	submitter for a while.  O_DIRECT queues the bios and returns,
+ *	and so does generic_file_aio_read() for buffered reads, retrying
+ *	them once the pages are in.  Other buffered reads of cold pages
+ *	wait for them and the vfs fsync fallback waits for the writeback.
+ *	These all end by themselves, which is what makes them safe to
+ *	hand to a worker.
+ */
+static bool aio_should_punt(struct kiocb *req)
+{
+	struct file *file = req->ki_filp;
+	umode_t mode = file->f_path.dentry->d_inode->i_mode;
+
+	switch (req->ki_opcode) {
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+		return S_ISREG(mode) && !(file->f_flags & O_DIRECT) &&
+		       req->ki_left &&
+		       file->f_op->aio_read != generic_file_aio_read &&
+		       !aio_pages_cached(file->f_mapping, req->ki_pos,
+					 req->ki_left);
+	case IOCB_CMD_FSYNC:
+	case IOCB_CMD_FDSYNC:
+		return req->ki_retry == aio_vfs_fsync;
+	}
+	return false;
+}
+
+/* aio_poll_events
+ *	The poll events a read or write taken off a submission ring
+ *	waits for, if it is for a socket, pipe or device in blocking
+ *	mode.  Such a request could wait forever, for the submitter as
+ *	well as for a worker, so aio_poll_retry waits for the file to
+ *	be ready instead.  Returns 0 for any other request.
+ */
+static unsigned int aio_poll_events(struct kiocb *req)
+{
+	struct file *file = req->ki_filp;
+	umode_t mode = file->f_path.dentry->d_inode->i_mode;
+
+	if (S_ISREG(mode) || S_ISBLK(mode) || (file->f_flags & O_NONBLOCK) ||
+	    !file->f_op->poll)
+		return 0;
+
+	switch (req->ki_opcode) {
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+		return POLLIN | POLLRDNORM | POLLERR | POLLHUP;
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV:
+		return POLLOUT | POLLWRNORM | POLLERR | POLLHUP;
+	}
+	return 0;
+}
+
+/*
+ * aio_poll_wake:
+ *	Wake function of kiocb->ki_wait while aio_poll_retry has it
+ *	on the poll wait queue of a file.  Takes the kiocb off the
+ *	queue and kicks it once the file has an event it waits for.
+ *	Called with the wait queue locked.
+ */
+static int aio_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			 void *key)
+{
+	struct wait_bit_queue *wait_bit =
+		container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+	unsigned long events = (unsigned long)key;
+
+	if (events && !(events & aio_poll_events(iocb)))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+struct aio_poll_table {
+	poll_table		pt;
+	struct kiocb		*iocb;
+	int			error;
+};
+
+/*
+ * aio_poll_queue_proc:
+ *	Queues kiocb->ki_wait on the wait queue the poll method of
+ *	the file passes in.  There is one entry per kiocb, files that
+ *	pass in a second queue cannot be waited for.
+ */
+static void aio_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+				poll_table *pt)
+{
+	struct aio_poll_table *apt = container_of(pt, struct aio_poll_table, pt);
+	struct kiocb *iocb = apt->iocb;
+	unsigned long flags;
+
+	if (iocb->ki_poll_head && iocb->ki_poll_head != head) {
+		apt->error = -EAGAIN;
+		return;
+	}
+	iocb->ki_poll_head = head;
+	spin_lock_irqsave(&head->lock, flags);
+	if (list_empty(&iocb->ki_wait.wait.task_list))
+		__add_wait_queue(head, &iocb->ki_wait.wait);
+	spin_unlock_irqrestore(&head->lock, flags);
+}
+
+/* aio_poll_dequeue
+ *	Takes kiocb->ki_wait off the poll wait queue of the file.
+ *	Returns true if it was still queued, false if aio_poll_wake
+ *	took it off and kicked the kiocb already.
+ */
+static bool aio_poll_dequeue(struct kiocb *iocb)
+{
+	wait_queue_head_t *head = ACCESS_ONCE(iocb->ki_poll_head);
+	unsigned long flags;
+	bool queued;
+
+	if (!head)
+		return false;
+	spin_lock_irqsave(&head->lock, flags);
+	queued = !list_empty(&iocb->ki_wait.wait.task_list);
+	list_del_init(&iocb->ki_wait.wait.task_list);
+	spin_unlock_irqrestore(&head->lock, flags);
+	return queued;
+}
+
+/*
+ * aio_poll_retry:
+ *	ki_retry of the requests aio_poll_events() picks.  Queues the
+ *	kiocb on the poll wait queue of the file and runs the read or
+ *	write once the file is ready, waiting for the next kick with
+ *	-EIOCBRETRY until then.  Reads return what is there.  A write
+ *	larger than the room the file has still waits for the rest in
+ *	the retry, as a blocking write() does.
+ */
+static ssize_t aio_poll_retry(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct aio_poll_table apt;
+	unsigned int mask;
+
+	apt.iocb = iocb;
+	apt.error = 0;
+	init_poll_funcptr(&apt.pt, aio_poll_queue_proc);
+	mask = file->f_op->poll(file, &apt.pt);
+
+	if (mask & aio_poll_events(iocb)) {
+		aio_poll_dequeue(iocb);
+		iocb->ki_poll_head = NULL;
+		return aio_rw_vect_retry(iocb);
+	}
+	if (apt.error || !iocb->ki_poll_head) {
+		aio_poll_dequeue(iocb);
+		iocb->ki_poll_head = NULL;
+		return -EAGAIN;
+	}
+
+	/* pairs with kiocbSetCancelled() before aio_poll_cancel() */
+	smp_mb();
+	if (kiocbIsCancelled(iocb) && aio_poll_dequeue(iocb))
+		return -EINTR;
+	return -EIOCBRETRY;
+}
+
+/*
+ * aio_poll_cancel:
+ *	ki_cancel of a request run by aio_poll_retry.  A request still
+ *	waiting for its file is taken off the wait queue and kicked,
+ *	aio_run_iocb then completes it as cancelled.  One that is
+ *	kicked already completes the same way, or not at all if its
+ *	read or write has started.
+ */
+static int aio_poll_cancel(struct kiocb *req, struct io_event *res)
+{
+	int ret = -EAGAIN;
+
+	if (aio_poll_dequeue(req)) {
+		kick_iocb(req);
+		res->res = -ECANCELED;
+		ret = 0;
+	}
+	aio_put_req(req);	/* drop the ref io_cancel took */
+	return ret;
+}
+
+struct aio_punt {
+	struct work_struct	work;
+	struct kiocb		*req;
+};
+
+/*
+ * aio_punt_cancel:
+ *	ki_cancel of a request waiting on aio_punt_wq.  The request is
+ *	flagged as cancelled already, aio_punt_handler completes it
+ *	without running it.
+ */
+static int aio_punt_cancel(struct kiocb *req, struct io_event *res)
+{
+	res->res = -ECANCELED;
+	aio_put_req(req);	/* drop the ref io_cancel took */
+	return 0;
+}
+
+/*
+ * aio_punt_handler:
+ *	Runs a request handed over by aio_punt_iocb in the
+ *	issuer's mm context, like aio_kick_handler does for
+ *	retries, then drops the submission reference.  A
+ *	request cancelled meanwhile is only completed.
+ */
+static void aio_punt_handler(struct work_struct *work)
+{
+	struct aio_punt *punt = container_of(work, struct aio_punt, work);
+	struct kiocb *req = punt->req;
+	struct kioctx *ctx = req->ki_ctx;
+	mm_segment_t oldfs = get_fs();
+	bool cancelled;
+
+	kfree(punt);
+
+	/* from here on it cannot be cancelled, as with io_submit() */
+	spin_lock_irq(&ctx->ctx_lock);
+	req->ki_cancel = NULL;
+	cancelled = kiocbIsCancelled(req);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (!cancelled) {
+		set_fs(USER_DS);
+		use_mm(ctx->mm);
+	}
+	spin_lock_irq(&ctx->ctx_lock);
+	aio_run_iocb(req);
+	if (!list_empty(&ctx->run_list)) {
+		while (__aio_run_iocbs(ctx))
+			;
+	}
+	ctx->sq_info.punted--;
+	spin_unlock_irq(&ctx->ctx_lock);
+	if (!cancelled) {
+		unuse_mm(ctx->mm);
+		set_fs(oldfs);
+	}
+
+	aio_put_req(req);	/* drop extra ref to req */
+}
+
+/* aio_punt_iocb
+ *	Hands a request over to aio_punt_wq along with the extra
+ *	reference of the submission.  Returns false if it could not,
+ *	because of memory or because the context has AIO_PUNT_MAX
+ *	requests there already: the caller then runs it itself.
+ *	Called with ctx_lock held.
+ */
+static bool aio_punt_iocb(struct kiocb *req)
+{
+	struct kioctx *ctx = req->ki_ctx;
+	struct aio_punt *punt;
+
+	if (ctx->sq_info.punted >= AIO_PUNT_MAX)
+		return false;
+	punt = kmalloc(sizeof(*punt), GFP_ATOMIC);
+	if (unlikely(!punt))
+		return false;
+
+	ctx->sq_info.punted++;
+	req->ki_cancel = aio_punt_cancel;
+	punt->req = req;
+	INIT_WORK(&punt->work, aio_punt_handler);
+	queue_work(aio_punt_wq, &punt->work);
+	return true;
+}
+
+/*
+ * io_submit_one:
+ *	Sets up and runs one iocb.  From a submission ring (ring is
+ *	true) the requests that would block on the disk are handed to
+ *	a worker instead, those on files which are not ready wait for
+ *	them on the poll wait queue of the file, and errors past the
+ *	allocation of the request go to the event ring, there being
+ *	nobody to return them to.
+ */
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
-			 struct iocb *iocb, bool compat)
+			 struct iocb *iocb, bool compat, bool ring)
 {
 	struct kiocb *req;
 	struct file *file;
 	ssize_t ret;
+	bool punt;
 
 	/* enforce forwards compatibility on users */
 	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2)) {
@@ -1543,6 +1947,8 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		return -EAGAIN;
 	}
 	req->ki_filp = file;
+	req->ki_obj.user = user_iocb;
+	req->ki_user_data = iocb->aio_data;
 	if (iocb->aio_flags & IOCB_FLAG_RESFD) {
 		/*
 		 * If the IOCB_FLAG_RESFD flag of aio_flags is set, get an
@@ -1564,19 +1970,24 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		goto out_put_req;
 	}
 
-	req->ki_obj.user = user_iocb;
-	req->ki_user_data = iocb->aio_data;
 	req->ki_pos = iocb->aio_offset;
 
 	req->ki_buf = (char __user *)(unsigned long)iocb->aio_buf;
 	req->ki_left = req->ki_nbytes = iocb->aio_nbytes;
 	req->ki_opcode = iocb->aio_lio_opcode;
 
-	ret = aio_setup_iocb(req, compat);
+	ret = aio_setup_iocb(req, compat, ring);
 
 	if (ret)
 		goto out_put_req;
 
+	if (ring && aio_poll_events(req)) {
+		req->ki_wait.wait.func = aio_poll_wake;
+		req->ki_retry = aio_poll_retry;
+		req->ki_cancel = aio_poll_cancel;
+	}
+	punt = ring && aio_should_punt(req);
+
 	spin_lock_irq(&ctx->ctx_lock);
 	/*
 	 * We could have raced with io_destroy() and are currently holding a
@@ -1595,6 +2006,10 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		ret = -EINVAL;
 		goto out_put_req;
 	}
+	if (punt && aio_punt_iocb(req)) {
+		spin_unlock_irq(&ctx->ctx_lock);
+		return 0;
+	}
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
 		/* drain the run list */
@@ -1607,6 +2022,11 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	return 0;
 
 out_put_req:
+	if (ring) {
+		aio_complete(req, ret, 0);
+		aio_put_req(req);	/* drop extra ref to req */
+		return 0;
+	}
 	aio_put_req(req);	/* drop extra ref to req */
 	aio_put_req(req);	/* drop i/o ref to req */
 	return ret;
@@ -1655,7 +2075,7 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 			break;
 		}
 
-		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
+		ret = io_submit_one(ctx, user_iocb, &tmp, compat, false);
 		if (ret)
 			break;
 	}
@@ -1793,3 +2213,356 @@ SYSCALL_DEFINE5(io_getevents, aio_context_t, ctx_id,
 	asmlinkage_protect(5, ret, ctx_id, min_nr, nr, events, timeout);
 	return ret;
 }
+
+#define AIO_SQ_MAX_ENTRIES	4096
+#define AIO_SQ_IDLE_MSECS	1000
+
+/* aio_sq_fail
+ *	Posts the event of an iocb off a submission ring which failed
+ *	before it got a request: a reserved field set or a bad file
+ *	descriptor.  Returns -EAGAIN if there is no room for it.
+ */
+static int aio_sq_fail(struct kioctx *ctx, struct iocb __user *user_iocb,
+		       struct iocb *iocb, long res)
+{
+	struct kiocb *req;
+
+	req = aio_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	req->ki_filp = NULL;
+	req->ki_obj.user = user_iocb;
+	req->ki_user_data = iocb->aio_data;
+	aio_complete(req, res, 0);
+	aio_put_req(req);	/* drop extra ref to req */
+	return 0;
+}
+
+/* aio_sq_submit
+ *	Submits up to nr iocbs off the submission ring of ctx.  The ring
+ *	is only ever looked at from process context with the owner's mm,
+ *	so unlike the event ring it goes through the user accessors and
+ *	needs no pinning.  Returns the number of iocbs taken, or the error
+ *	if none was: -EAGAIN if the event ring has no room left.
+ */
+static int aio_sq_submit(struct kioctx *ctx, unsigned nr)
+{
+	struct aio_sq_info *info = &ctx->sq_info;
+	struct aio_sq_ring __user *ring;
+	struct blk_plug plug;
+	unsigned tail;
+	int i = 0;
+	int ret;
+
+	ring = (struct aio_sq_ring __user *)info->mmap_base;
+
+	mutex_lock(&info->lock);
+	ret = get_user(tail, &ring->tail);
+	if (unlikely(ret))
+		goto out;
+	if (unlikely(tail - info->head > info->nr)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	smp_rmb();	/* read the tail before the iocbs it covers */
+
+	blk_start_plug(&plug);
+	while (i < nr && info->head != tail) {
+		struct iocb __user *user_iocb;
+		struct iocb tmp;
+
+		user_iocb = &ring->iocbs[info->head & (info->nr - 1)];
+		if (unlikely(copy_from_user(&tmp, user_iocb, sizeof(tmp)))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = io_submit_one(ctx, user_iocb, &tmp, info->compat, true);
+		if (unlikely(ret && ret != -EAGAIN))
+			ret = aio_sq_fail(ctx, user_iocb, &tmp, ret);
+		if (ret)
+			break;
+
+		info->head++;
+		i++;
+	}
+	blk_finish_plug(&plug);
+
+	if (i) {
+		smp_mb();	/* done with the iocbs before handing them back */
+		if (unlikely(put_user(info->head, &ring->head)))
+			ret = -EFAULT;
+	}
+out:
+	mutex_unlock(&info->lock);
+	return i ? i : ret;
+}
+
+static bool aio_sq_pending(struct kioctx *ctx)
+{
+	struct aio_sq_info *info = &ctx->sq_info;
+	struct aio_sq_ring __user *ring;
+	unsigned tail;
+
+	ring = (struct aio_sq_ring __user *)info->mmap_base;
+	return !get_user(tail, &ring->tail) && tail != info->head;
+}
+
+static void aio_sq_set_flags(struct kioctx *ctx, unsigned flags)
+{
+	struct aio_sq_ring __user *ring;
+
+	ring = (struct aio_sq_ring __user *)ctx->sq_info.mmap_base;
+	if (put_user(flags, &ring->flags))
+		pr_debug("aio_sq_set_flags: ring %p is gone\n", ring);
+}
+
+/*
+ * aio_sq_thread:
+ *	Polls the submission ring of a context set up with
+ *	IORING_SETUP_SQPOLL, so that userland can submit without
+ *	a system call.  It runs with the files, the credentials
+ *	and the mm of the task which set the ring up.  Once the
+ *	ring has been empty for sq_thread_idle it flags
+ *	IORING_SQ_NEED_WAKEUP and sleeps, until io_ring_enter()
+ *	is called with IORING_ENTER_SQ_WAKEUP.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	struct aio_sq_info *info = &ctx->sq_info;
+	struct files_struct *old_files = current->files;
+	mm_segment_t oldfs = get_fs();
+	const struct cred *old_cred;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+
+	task_lock(current);
+	current->files = info->files;
+	task_unlock(current);
+	old_cred = override_creds(info->creds);
+	set_fs(USER_DS);
+	use_mm(ctx->mm);
+
+	timeout = jiffies + info->idle;
+	while (!kthread_should_stop()) {
+		if (aio_sq_submit(ctx, info->nr) > 0) {
+			timeout = jiffies + info->idle;
+			cond_resched();
+			continue;
+		}
+		if (time_before(jiffies, timeout)) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		/*
+		 * Userland advances the tail before it looks at the flag,
+		 * we set the flag before we look at the tail: either it
+		 * wakes us up or we see the new iocbs.
+		 */
+		aio_sq_set_flags(ctx, IORING_SQ_NEED_WAKEUP);
+		smp_mb();
+		prepare_to_wait(&info->wait, &wait, TASK_INTERRUPTIBLE);
+		if (!aio_sq_pending(ctx) && !kthread_should_stop())
+			schedule();
+		finish_wait(&info->wait, &wait);
+		aio_sq_set_flags(ctx, 0);
+		timeout = jiffies + info->idle;
+	}
+
+	unuse_mm(ctx->mm);
+	set_fs(oldfs);
+	revert_creds(old_cred);
+	task_lock(current);
+	current->files = old_files;
+	task_unlock(current);
+	return 0;
+}
+
+static int aio_sq_setup(struct kioctx *ctx, struct io_ring_params *p)
+{
+	struct aio_sq_info *info = &ctx->sq_info;
+	struct task_struct *thread;
+	struct aio_sq_ring ring;
+	unsigned long base, size;
+	unsigned nr;
+
+	mutex_init(&info->lock);
+	init_waitqueue_head(&info->wait);
+
+	nr = roundup_pow_of_two(p->sq_entries);
+	size = PAGE_ALIGN(sizeof(struct aio_sq_ring) +
+			  nr * sizeof(struct iocb));
+	down_write(&ctx->mm->mmap_sem);
+	base = do_mmap(NULL, 0, size, PROT_READ|PROT_WRITE,
+		       MAP_ANONYMOUS|MAP_PRIVATE, 0);
+	up_write(&ctx->mm->mmap_sem);
+	if (IS_ERR((void *)base))
+		return -EAGAIN;
+
+	info->mmap_base = base;
+	info->mmap_size = size;
+	info->nr = nr;
+	info->flags = p->flags;
+	info->compat = is_compat_task();
+
+	memset(&ring, 0, sizeof(ring));
+	ring.nr = nr;
+	ring.magic = AIO_SQ_RING_MAGIC;
+	ring.header_length = sizeof(ring);
+	if (copy_to_user((void __user *)base, &ring, sizeof(ring)))
+		return -EFAULT;
+
+	if (!(p->flags & IORING_SETUP_SQPOLL))
+		return 0;
+
+	info->files = get_files_struct(current);
+	info->creds = get_current_cred();
+	info->idle = msecs_to_jiffies(p->sq_thread_idle ? : AIO_SQ_IDLE_MSECS);
+
+	thread = kthread_create(aio_sq_thread, ctx, "aio_sq/%d",
+				task_pid_nr(current));
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+	if (p->flags & IORING_SETUP_SQ_AFF)
+		kthread_bind(thread, p->sq_thread_cpu);
+	info->thread = thread;
+	wake_up_process(thread);
+	return 0;
+}
+
+/* sys_io_ring_setup:
+ *	Like io_setup, creates an aio_context capable of receiving at
+ *	least nr_events, and with it a submission ring of at least
+ *	params->sq_entries iocbs mapped into the caller.  The context,
+ *	which is also the address of the event ring, and the address of
+ *	the submission ring are returned in *params.  With
+ *	IORING_SETUP_SQPOLL, which needs CAP_SYS_ADMIN, a kernel thread
+ *	takes the iocbs off the ring as they come, bound to
+ *	params->sq_thread_cpu with IORING_SETUP_SQ_AFF.  May fail with
+ *	-EINVAL if the flags, sizes or cpu are invalid, with -EPERM, and
+ *	like io_setup otherwise.
+ */
+SYSCALL_DEFINE2(io_ring_setup, unsigned, nr_events,
+		struct io_ring_params __user *, params)
+{
+	struct io_ring_params p;
+	struct kioctx *ioctx;
+	long ret;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+	if (!nr_events || !p.sq_entries || p.sq_entries > AIO_SQ_MAX_ENTRIES)
+		return -EINVAL;
+	if ((p.flags & IORING_SETUP_SQ_AFF) &&
+	    (!(p.flags & IORING_SETUP_SQPOLL) ||
+	     p.sq_thread_cpu >= nr_cpu_ids || !cpu_online(p.sq_thread_cpu)))
+		return -EINVAL;
+	if ((p.flags & IORING_SETUP_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	ioctx = ioctx_alloc(nr_events);
+	if (IS_ERR(ioctx))
+		return PTR_ERR(ioctx);
+
+	ret = aio_sq_setup(ioctx, &p);
+	if (!ret) {
+		p.sq_entries = ioctx->sq_info.nr;
+		p.ctx_id = ioctx->user_id;
+		p.sq_ring = ioctx->sq_info.mmap_base;
+		if (copy_to_user(params, &p, sizeof(p)))
+			ret = -EFAULT;
+	}
+	if (ret) {
+		io_destroy(ioctx);
+		return ret;
+	}
+
+	put_ioctx(ioctx);
+	return 0;
+}
+
+/* number of events in the event ring, for io_ring_enter */
+static unsigned aio_ring_events(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	unsigned head, tail;
+
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	head = ring->head;
+	tail = ring->tail;
+	kunmap_atomic(ring, KM_USER0);
+
+	return (tail + info->nr - head) % info->nr;
+}
+
+/* sys_io_ring_enter:
+ *	Submits up to to_submit iocbs off the submission ring of the
+ *	aio_context specified by ctx_id, unless a kernel thread polls
+ *	it: then this only wakes the thread up if IORING_ENTER_SQ_WAKEUP
+ *	is given.  With IORING_ENTER_GETEVENTS, then waits until there
+ *	are at least min_complete events in the event ring, from where
+ *	userland reaps them itself.  Returns the number of iocbs
+ *	submitted.  May fail with -EINVAL if ctx_id is not a context with
+ *	a submission ring or the flags are invalid, with -EAGAIN if there
+ *	is no room for more events, with -EFAULT if the ring is gone, or
+ *	with -EINTR if interrupted before any iocb was submitted.
+ */
+SYSCALL_DEFINE4(io_ring_enter, aio_context_t, ctx_id, unsigned, to_submit,
+		unsigned, min_complete, unsigned, flags)
+{
+	struct kioctx *ctx;
+	long ret = -EINVAL;
+	int submitted = 0;
+
+	if (unlikely(flags & ~(IORING_ENTER_GETEVENTS |
+			       IORING_ENTER_SQ_WAKEUP)))
+		return -EINVAL;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx))
+		return -EINVAL;
+	if (unlikely(!ctx->sq_info.nr))
+		goto out;
+
+	if (ctx->sq_info.flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sq_info.wait);
+		submitted = min(to_submit, ctx->sq_info.nr);
+	} else if (to_submit) {
+		submitted = aio_sq_submit(ctx, to_submit);
+		if (submitted < 0) {
+			ret = submitted;
+			goto out;
+		}
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->ring_info.nr - 1);
+		if (unlikely(!list_empty(&ctx->run_list)))
+			aio_run_all_iocbs(ctx);
+		ret = wait_event_interruptible(ctx->wait,
+				aio_ring_events(ctx) >= min_complete ||
+				ctx->dead);
+		if (ret && !submitted) {
+			ret = -EINTR;
+			goto out;
+		}
+	}
+	ret = submitted;
+out:
+	put_ioctx(ctx);
+	return ret;
+}
@@ -52,11 +52,19 @@
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
- * user space) we could end up sleeping due a copy_to_user(), so
- * we need a lock that will allow us to sleep. This lock is a
- * mutex (ep->mtx). It is acquired during the event transfer loop,
- * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
+ * a spinlock. When the ready list is scanned for f_op->poll() of
+ * the epoll file itself we could end up sleeping, so we need a lock
+ * that will allow us to sleep. This lock is a mutex (ep->mtx). It is
+ * acquired during that scan, during epoll_ctl() and during
+ * eventpoll_release_file().
+ * The event transfer loop of epoll_wait() does not take ep->mtx, so
+ * that several tasks waiting on the same epoll fd do not serialize on
+ * it. Each takes items off the ready list under ep->lock, up to the
+ * events still wanted, and owns them (epi->xfer, counted in ep->nxfer)
+ * while it calls f_op->poll() and copies the events to user space
+ * without locks. epoll_ctl() and
+ * eventpoll_release_file() wait on ep->xfer_wait for the owner to put
+ * an item back before changing or freeing it.
  * Then we also need a global mutex to serialize eventpoll_release_file()
  * and ep_free().
  * This mutex is acquired by ep_free() during the epoll file
@@ -88,7 +96,11 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Events which may be combined with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLERR | POLLHUP | \
+				EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -97,6 +109,10 @@
 
 #define EP_UNACTIVE_PTR ((void *) -1L)
 
+/* epitem->xfer: owned by an epoll_wait() caller, and got events meanwhile */
+#define EP_XFER_BUSY	1
+#define EP_XFER_AGAIN	2
+
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
 struct epoll_filefd {
@@ -146,6 +162,9 @@ struct epitem {
 	/* Number of active wait queue attached to poll operations */
 	int nwait;
 
+	/* EP_XFER_* while an epoll_wait() caller owns the item, under ->lock */
+	int xfer;
+
 	/* List containing poll wait queues */
 	struct list_head pwqlist;
 
@@ -170,15 +189,18 @@ struct eventpoll {
 
 	/*
 	 * This mutex is used to ensure that files are not removed
-	 * while epoll is using them. This is held during the event
-	 * collection loop, the file cleanup path, the epoll file exit
-	 * code and the ctl operations.
+	 * while epoll is using them. This is held during the ready
+	 * list scan of ep_eventpoll_poll(), the file cleanup path, the
+	 * epoll file exit code and the ctl operations.
 	 */
 	struct mutex mtx;
 
 	/* Wait queue used by sys_epoll_wait() */
 	wait_queue_head_t wq;
 
+	/* Wait queue used to wait for items owned by sys_epoll_wait() */
+	wait_queue_head_t xfer_wait;
+
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
@@ -195,6 +217,9 @@ struct eventpoll {
 	 */
 	struct epitem *ovflist;
 
+	/* Number of items owned by epoll_wait() callers, under ->lock */
+	int nxfer;
+
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
 
@@ -229,12 +254,6 @@ struct ep_pqueue {
 	struct epitem *epi;
 };
 
-/* Used by the ep_send_events() function as callback private data */
-struct ep_send_events_data {
-	int maxevents;
-	struct epoll_event __user *events;
-};
-
 /*
  * Configuration options available inside /proc/sys/fs/epoll/
  */
@@ -503,6 +522,30 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/*
+ * Waits for the epoll_wait() caller which owns the item, if any, to
+ * put it back. Must be called with "mtx" held and "ep->lock" taken with
+ * spin_lock_irq(), which is dropped while sleeping.
+ */
+static void ep_wait_xfer(struct eventpoll *ep, struct epitem *epi)
+{
+	wait_queue_t wait;
+
+	if (likely(!epi->xfer))
+		return;
+
+	init_waitqueue_entry(&wait, current);
+	__add_wait_queue(&ep->xfer_wait, &wait);
+	do {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		spin_unlock_irq(&ep->lock);
+		schedule();
+		spin_lock_irq(&ep->lock);
+	} while (epi->xfer);
+	__remove_wait_queue(&ep->xfer_wait, &wait);
+	__set_current_state(TASK_RUNNING);
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -563,8 +606,12 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * During the "sproc" callback execution time, items are
 		 * queued into ->ovflist but the "txlist" might already
 		 * contain them, and the list_splice() below takes care of them.
+		 * An epoll_wait() caller may also have taken the item off
+		 * the ready list since, it requeues it when it is done.
 		 */
-		if (!ep_is_linked(&epi->rdllink))
+		if (epi->xfer)
+			epi->xfer = EP_XFER_AGAIN;
+		else if (!ep_is_linked(&epi->rdllink))
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 	}
 	/*
@@ -606,7 +653,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
@@ -627,10 +673,11 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	spin_lock_irq(&ep->lock);
+	ep_wait_xfer(ep, epi);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	spin_unlock_irq(&ep->lock);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -730,6 +777,14 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	/* Insert inside our poll wait queue */
 	poll_wait(file, &ep->poll_wait, wait);
 
+	/*
+	 * Items owned by epoll_wait() callers are off the ready list. They
+	 * may well be ready, and are requeued or consumed shortly, so say
+	 * we might have events rather than miss them.
+	 */
+	if (ACCESS_ONCE(ep->nxfer))
+		return POLLIN | POLLRDNORM;
+
 	/*
 	 * Proceed to find out if wanted events are really available inside
 	 * the ready list. This need to be done under ep_call_nested()
@@ -803,6 +858,7 @@ static int ep_alloc(struct eventpoll **pep)
 	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
+	init_waitqueue_head(&ep->xfer_wait);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
@@ -854,7 +910,7 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -890,6 +946,15 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	if (key && !((unsigned long) key & epi->event.events))
 		goto out_unlock;
 
+	/*
+	 * An epoll_wait() caller owns the item and is about to poll it, or
+	 * has just done so. Make it queue the item again when it is done.
+	 */
+	if (epi->xfer) {
+		epi->xfer = EP_XFER_AGAIN;
+		goto out_unlock;
+	}
+
 	/*
 	 * If we are transferring events to userspace, we can hold no locks
 	 * (because we're accessing user memory, and because of linux f_op->poll()
@@ -912,8 +977,10 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
+	if (waitqueue_active(&ep->wq)) {
 		wake_up_locked(&ep->wq);
+		ewake = 1;
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
@@ -924,7 +991,15 @@ out_unlock:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	/*
+	 * An EPOLLEXCLUSIVE entry ends the wakeup of the file's exclusive
+	 * waiters only if a task of this eventpoll was woken up: with all of
+	 * them busy the next eventpoll on the file gets the event too.
+	 */
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -941,7 +1016,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1092,6 +1170,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
+	epi->xfer = 0;
 	epi->next = EP_UNACTIVE_PTR;
 
 	/* Initialize the poll table using the queue callback */
@@ -1135,8 +1214,12 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	/* We have to drop the new item inside our item list to keep track of it */
 	spin_lock_irqsave(&ep->lock, flags);
 
-	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
+	/*
+	 * If the file is already "ready" we drop it inside the ready list,
+	 * unless an epoll_wait() caller already owns it, and polls it.
+	 */
+	if ((revents & event->events) && !epi->xfer &&
+	    !ep_is_linked(&epi->rdllink)) {
 		list_add_tail(&epi->rdllink, &ep->rdllist);
 
 		/* Notify waiting tasks that events are available */
@@ -1169,14 +1252,16 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
+	 * allocated wait queue, and an epoll_wait() caller may have taken the
+	 * item already. Note that we don't care about the ep->ovflist list,
+	 * since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	spin_lock_irq(&ep->lock);
+	ep_wait_xfer(ep, epi);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	spin_unlock_irq(&ep->lock);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -1195,10 +1280,15 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	/*
 	 * Set the new event interest mask before calling f_op->poll();
 	 * otherwise we might miss an event that happens between the
-	 * f_op->poll() call and the new event set registering.
+	 * f_op->poll() call and the new event set registering. An
+	 * epoll_wait() caller owning the item must be done with the old
+	 * mask first, or it could disable an EPOLLONESHOT item we rearm.
 	 */
+	spin_lock_irq(&ep->lock);
+	ep_wait_xfer(ep, epi);
 	epi->event.events = event->events;
-	epi->event.data = event->data; /* protected by mtx */
+	epi->event.data = event->data; /* protected by mtx and lock */
+	spin_unlock_irq(&ep->lock);
 
 	/*
 	 * Get current event bits. We can safely use the file* here because
@@ -1212,7 +1302,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	if (revents & event->events) {
 		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
+		if (!epi->xfer && !ep_is_linked(&epi->rdllink)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 
 			/* Notify waiting tasks that events are available */
@@ -1231,74 +1321,141 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	return 0;
 }
 
-static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
-			       void *priv)
+/*
+ * Transfers up to @maxevents ready events to user space. The items are
+ * taken off the ready list in batches and owned by the caller until
+ * they are put back, so that neither "mtx" nor "ep->lock" are held
+ * while calling f_op->poll() and copying to user space, and several
+ * tasks in epoll_wait() on the same eventpoll each work on their own
+ * items. Items found not ready do not count against @maxevents: we go
+ * on taking more until @maxevents events are copied or the ready list
+ * is empty.
+ */
+static int ep_send_events(struct eventpoll *ep,
+			  struct epoll_event __user *events, int maxevents)
 {
-	struct ep_send_events_data *esed = priv;
-	int eventcnt;
+	int eventcnt, n, nxfer = 0, pwake = 0;
+	unsigned long flags;
 	unsigned int revents;
-	struct epitem *epi;
+	struct epitem *epi, *tmp;
 	struct epoll_event __user *uevent;
+	LIST_HEAD(txlist);
+	LIST_HEAD(sent);
+	LIST_HEAD(idle);
+
+	spin_lock_irqsave(&ep->lock, flags);
 
 	/*
-	 * We can loop without lock because we are passed a task private list.
-	 * Items cannot vanish during the loop because ep_scan_ready_list() is
-	 * holding "mtx" during this call.
+	 * ep_scan_ready_list() has the ready list, wait for it to give it
+	 * back rather than spinning in ep_poll().
 	 */
-	for (eventcnt = 0, uevent = esed->events;
-	     !list_empty(head) && eventcnt < esed->maxevents;) {
-		epi = list_first_entry(head, struct epitem, rdllink);
-
-		list_del_init(&epi->rdllink);
+	if (list_empty(&ep->rdllist) && ep->ovflist != EP_UNACTIVE_PTR) {
+		spin_unlock_irqrestore(&ep->lock, flags);
+		mutex_lock_nested(&ep->mtx, 0);
+		mutex_unlock(&ep->mtx);
+		return 0;
+	}
 
-		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
-			epi->event.events;
+	eventcnt = 0;
+	uevent = events;
+	while (eventcnt < maxevents && !list_empty(&ep->rdllist)) {
+		for (n = eventcnt; n < maxevents && !list_empty(&ep->rdllist);
+		     n++) {
+			epi = list_first_entry(&ep->rdllist, struct epitem,
+					       rdllink);
+			epi->xfer = EP_XFER_BUSY;
+			list_move_tail(&epi->rdllink, &txlist);
+		}
+		nxfer += n - eventcnt;
+		ep->nxfer += n - eventcnt;
+		spin_unlock_irqrestore(&ep->lock, flags);
 
 		/*
-		 * If the event mask intersect the caller-requested one,
-		 * deliver the event to userspace. Again, ep_scan_ready_list()
-		 * is holding "mtx", so no operations coming from userspace
-		 * can change the item.
+		 * We can loop without lock because the items are ours: the
+		 * poll callback only flags them, and epoll_ctl() and the file
+		 * cleanup path wait for us before changing or removing them.
 		 */
-		if (revents) {
+		while (!list_empty(&txlist)) {
+			epi = list_first_entry(&txlist, struct epitem, rdllink);
+
+			revents = epi->ffd.file->f_op->poll(epi->ffd.file,
+							    NULL) &
+				epi->event.events;
+
+			/*
+			 * If the event mask intersect the caller-requested one,
+			 * deliver the event to userspace.
+			 */
+			if (!revents) {
+				list_move_tail(&epi->rdllink, &idle);
+				continue;
+			}
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
-				list_add(&epi->rdllink, head);
-				return eventcnt ? eventcnt : -EFAULT;
+				if (!eventcnt)
+					eventcnt = -EFAULT;
+				break;
 			}
+			list_move_tail(&epi->rdllink, &sent);
 			eventcnt++;
 			uevent++;
-			if (epi->event.events & EPOLLONESHOT)
-				epi->event.events &= EP_PRIVATE_BITS;
-			else if (!(epi->event.events & EPOLLET)) {
-				/*
-				 * If this file has been added with Level
-				 * Trigger mode, we need to insert back inside
-				 * the ready list, so that the next call to
-				 * epoll_wait() will check again the events
-				 * availability. At this point, no one can insert
-				 * into ep->rdllist besides us. The epoll_ctl()
-				 * callers are locked out by
-				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
-				 */
-				list_add_tail(&epi->rdllink, &ep->rdllist);
-			}
 		}
+
+		spin_lock_irqsave(&ep->lock, flags);
+		if (!list_empty(&txlist))
+			break;
 	}
 
-	return eventcnt;
-}
+	/* Those we did not get to go back to the head of the ready list */
+	list_for_each_entry(epi, &txlist, rdllink)
+		epi->xfer = 0;
+	list_splice(&txlist, &ep->rdllist);
 
-static int ep_send_events(struct eventpoll *ep,
-			  struct epoll_event __user *events, int maxevents)
-{
-	struct ep_send_events_data esed;
+	list_for_each_entry_safe(epi, tmp, &sent, rdllink) {
+		list_del_init(&epi->rdllink);
+		if (epi->event.events & EPOLLONESHOT)
+			epi->event.events &= EP_PRIVATE_BITS;
+		else if (!(epi->event.events & EPOLLET) ||
+			 epi->xfer == EP_XFER_AGAIN) {
+			/*
+			 * If this file has been added with Level Trigger
+			 * mode, we need to insert back inside the ready
+			 * list, so that the next call to epoll_wait() will
+			 * check again the events availability.
+			 */
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		}
+		epi->xfer = 0;
+	}
+
+	/* Not ready after all, unless the poll callback said otherwise since */
+	list_for_each_entry_safe(epi, tmp, &idle, rdllink) {
+		list_del_init(&epi->rdllink);
+		if (epi->xfer == EP_XFER_AGAIN)
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		epi->xfer = 0;
+	}
+	ep->nxfer -= nxfer;
+
+	if (!list_empty(&ep->rdllist)) {
+		/*
+		 * Wake up (if active) both the eventpoll wait list and
+		 * the ->poll() wait list (delayed after we release the lock).
+		 */
+		if (waitqueue_active(&ep->wq))
+			wake_up_locked(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
+	}
+	if (waitqueue_active(&ep->xfer_wait))
+		wake_up_all_locked(&ep->xfer_wait);
+	spin_unlock_irqrestore(&ep->lock, flags);
 
-	esed.maxevents = maxevents;
-	esed.events = events;
+	/* We have to call this outside the lock */
+	if (pwake)
+		ep_poll_safewake(&ep->poll_wait);
 
-	return ep_scan_ready_list(ep, ep_send_events_proc, &esed, 0);
+	return eventcnt;
 }
 
 static inline struct timespec ep_set_mstimeout(long ms)
@@ -1604,6 +1761,17 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE is set when the item hooks on the wait queues of
+	 * the file, so it cannot be changed by EPOLL_CTL_MOD. It is not
+	 * supported on nested epoll files, nor with EPOLLONESHOT.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD || is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1661,6 +1829,8 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 			error = -ENOENT;
 		break;
 	case EPOLL_CTL_MOD:
+		if (epi && (epi->event.events & EPOLLEXCLUSIVE))
+			break;
 		if (epi) {
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
@@ -2,6 +2,8 @@
 #define __LINUX__AIO_H
 
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
@@ -13,6 +15,8 @@
 #define AIO_KIOGRP_NR_ATOMIC	8
 
 struct kioctx;
+struct files_struct;
+struct cred;
 
 /* Notes on cancelling a kiocb:
  *	If a kiocb is cancelled, aio_complete may return 0 to indicate 
@@ -77,12 +81,13 @@ struct kioctx;
  *
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
- * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
- * with custom tracking and manual calls to kick_iocb(), though that is
- * discouraged.  In either case, kick_iocb() must be called once and only
- * once.  ki_retry must ensure forward progress, the AIO core will wait
- * indefinitely for kick_iocb() to be called.
+ * through generic helpers that queue kiocb->ki_wait on a wait queue, as
+ * wait_on_page_locked_async() does for the buffered reads of
+ * generic_file_aio_read(); its wake function kicks the kiocb.  It can
+ * also happen with custom tracking and manual calls to kick_iocb(),
+ * though that is discouraged.  In either case, kick_iocb() must be called
+ * once and only once.  ki_retry must ensure forward progress, the AIO
+ * core will wait indefinitely for kick_iocb() to be called.
  */
 struct kiocb {
 	struct list_head	ki_run_list;
@@ -123,6 +128,9 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	struct wait_bit_queue	ki_wait;	/* -EIOCBRETRY, see above */
+	wait_queue_head_t	*ki_poll_head;	/* ki_wait is queued on */
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -175,6 +183,26 @@ struct aio_ring_info {
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
+/* submission ring state, see io_ring_setup() */
+struct aio_sq_info {
+	unsigned long		mmap_base;
+	unsigned long		mmap_size;
+
+	unsigned		nr;
+	unsigned		head;		/* trusted copy */
+	unsigned		flags;		/* IORING_SETUP_ */
+	bool			compat;		/* iovecs are compat_iovecs */
+	struct mutex		lock;		/* serialises consumers */
+	unsigned		punted;		/* on aio_punt_wq, ctx_lock */
+
+	/* IORING_SETUP_SQPOLL */
+	struct task_struct	*thread;
+	wait_queue_head_t	wait;
+	unsigned long		idle;
+	struct files_struct	*files;
+	const struct cred	*creds;
+};
+
 struct kioctx {
 	atomic_t		users;
 	int			dead;
@@ -196,6 +224,7 @@ struct kioctx {
 	unsigned		max_reqs;
 
 	struct aio_ring_info	ring_info;
+	struct aio_sq_info	sq_info;
 
 	struct delayed_work	wq;
 
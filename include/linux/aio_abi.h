@@ -104,6 +104,48 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/*
+ * Submission ring, set up along with an aio_context by io_ring_setup().
+ * Userland fills iocbs[tail & (nr - 1)], then advances tail; the kernel
+ * takes iocbs from head, on io_ring_enter() or from its polling thread.
+ * head and tail are free running.  Completions go to the usual event
+ * ring, which is mapped at the aio_context_t address.
+ */
+#define IORING_SETUP_SQPOLL	(1 << 0)	/* a kernel thread polls the ring */
+#define IORING_SETUP_SQ_AFF	(1 << 1)	/* bound to sq_thread_cpu */
+
+/* aio_sq_ring flags */
+#define IORING_SQ_NEED_WAKEUP	(1 << 0)	/* the polling thread sleeps */
+
+/* io_ring_enter() flags */
+#define IORING_ENTER_GETEVENTS	(1 << 0)	/* wait for min_complete events */
+#define IORING_ENTER_SQ_WAKEUP	(1 << 1)	/* wake the polling thread up */
+
+struct io_ring_params {
+	__u32	sq_entries;	/* rounded up to a power of two */
+	__u32	flags;		/* IORING_SETUP_ */
+	__u32	sq_thread_cpu;
+	__u32	sq_thread_idle;	/* msecs before the polling thread sleeps */
+	__u64	ctx_id;		/* filled in: the aio_context_t */
+	__u64	sq_ring;	/* filled in: address of the aio_sq_ring */
+	__u64	resv[4];
+};
+
+#define AIO_SQ_RING_MAGIC	0xa10a5a10
+
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userland */
+	__u32	nr;		/* number of iocbs */
+	__u32	flags;		/* IORING_SQ_ */
+
+	__u32	magic;
+	__u32	header_length;	/* size of aio_sq_ring */
+	__u32	resv[10];
+
+	struct iocb	iocbs[0];
+}; /* 64 bytes + ring size */
+
 #undef IFBIG
 #undef IFLITTLE
 
@@ -0,0 +1,84 @@
+/*
+ * Dynamic queue limits (dql)
+ *
+ * A queue of objects, usually the bytes handed to the transmit ring of a
+ * NIC, is given a limit that adapts to how much the consumer drains per
+ * completion interval: large enough that the consumer never starves, and
+ * no larger, so that whatever sits above the queue (a qdisc) holds the
+ * backlog instead, where it can be scheduled.
+ *
+ * The producer side calls dql_queued() for each object added and checks
+ * dql_avail(): a negative value means the queue is over its limit and
+ * should be stopped. The consumer side calls dql_completed() with the
+ * amount completed each time it runs, which recomputes the limit:
+ *
+ *  - if the queue went empty while it had been over its limit, the
+ *    consumer starved and the limit grows by what it completed in the
+ *    interval;
+ *
+ *  - if the queue stayed busy for the whole interval, the smallest
+ *    excess ("slack") seen over slack_hold_time is taken off the limit.
+ *
+ * dql_queued() and dql_completed() may run on different cpus but must
+ * each be serialised against themselves; the two paths only share
+ * num_queued and adj_limit.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _LINUX_DQL_H
+#define _LINUX_DQL_H
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+
+struct dql {
+	/* written by the producer, dql_queued() */
+	unsigned int	num_queued;		/* objects ever queued */
+	unsigned int	adj_limit;		/* limit + num_completed */
+	unsigned int	last_obj_cnt;		/* size of the last object */
+
+	/* written by the consumer, dql_completed() */
+	unsigned int	limit ____cacheline_aligned_in_smp;
+	unsigned int	num_completed;		/* objects ever completed */
+	unsigned int	prev_ovlimit;		/* over limit last interval */
+	unsigned int	prev_num_queued;	/* num_queued last interval */
+	unsigned int	prev_last_obj_cnt;	/* last_obj_cnt last interval */
+	unsigned int	lowest_slack;		/* since slack_start_time */
+	unsigned long	slack_start_time;	/* jiffies */
+
+	/* configuration */
+	unsigned int	max_limit;
+	unsigned int	min_limit;
+	unsigned int	slack_hold_time;	/* jiffies */
+};
+
+/* Bounds keeping the unsigned arithmetic below clear of wrapping */
+#define DQL_MAX_OBJECT	(UINT_MAX / 16)
+#define DQL_MAX_LIMIT	((UINT_MAX / 2) - DQL_MAX_OBJECT)
+
+/* Record that count objects were added to the queue */
+static inline void dql_queued(struct dql *dql, unsigned int count)
+{
+	BUG_ON(count > DQL_MAX_OBJECT);
+
+	dql->num_queued += count;
+	dql->last_obj_cnt = count;
+}
+
+/* Room left under the limit, negative once the queue is over it */
+static inline int dql_avail(const struct dql *dql)
+{
+	return dql->adj_limit - dql->num_queued;
+}
+
+extern void dql_completed(struct dql *dql, unsigned int count);
+extern void dql_reset(struct dql *dql);
+extern void dql_init(struct dql *dql, unsigned int hold_time);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_DQL_H */
@@ -155,7 +155,14 @@ extern unsigned int sk_run_filter(const struct sk_buff *skb,
 				  const struct sock_filter *filter);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
+extern int sk_unattached_filter_create(struct sk_filter **pfp,
+				       struct sock_fprog *fprog);
+extern void sk_unattached_filter_destroy(struct sk_filter *fp);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+extern void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+						 int k, unsigned int size);
+extern int sk_filter_nlattr(const struct sk_buff *skb, u32 A, u32 X);
+extern int sk_filter_nlattr_nest(const struct sk_buff *skb, u32 A, u32 X);
 
 #ifdef CONFIG_BPF_JIT
 extern void bpf_jit_compile(struct sk_filter *fp);
@@ -0,0 +1,44 @@
+/*
+ * Helpers of the benchmark modules, CONFIG_KBENCH.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _LINUX_KBENCH_H
+#define _LINUX_KBENCH_H
+
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+/* nsecs since @start */
+static inline s64 kbench_ns(ktime_t start)
+{
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/* @ops done in @ns, per second */
+static inline u64 kbench_rate(u64 ops, s64 ns)
+{
+	return div64_u64(ops * NSEC_PER_SEC, max_t(s64, ns, 1));
+}
+
+/*
+ * What the init function of a benchmark module that got @err returns.
+ * Like tcrypt, -EAGAIN once the results are out, so that the module
+ * is not kept around.
+ */
+static inline int kbench_done(int err)
+{
+	return err ? err : -EAGAIN;
+}
+
+extern s64 kbench_threads(const char *name, unsigned int nthreads,
+			  unsigned int per_cpu,
+			  void (*fn)(void *data, unsigned int thread),
+			  void *data);
+extern int kbench_scale(int (*run)(void *data, unsigned int nthreads),
+			void *data);
+
+#endif /* _LINUX_KBENCH_H */
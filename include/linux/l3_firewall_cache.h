@@ -1,9 +1,17 @@
 /*
  * This is a module which is used for L3 Firewall acceleration
  *
- * This module adds a soft cache table whose data structure is based
- * on ring buffer. Each cache line includes all of the fields which
- * is needed by Firewall rule-set basic filtering features.
+ * This module adds a soft cache table whose data structure is a hash
+ * table keyed by the 5-tuple and the source MAC address. Lookups are
+ * lockless under RCU, insertions take a per-bucket lock and each
+ * bucket holds a bounded number of lines which are replaced by a
+ * clock (second chance) policy. Each cache line includes all of the
+ * fields which is needed by Firewall rule-set basic filtering features.
+ * IPv4 and IPv6 packets are cached on the FORWARD hook, where the
+ * verdict of the whole hook is recorded, and on the LOCAL_IN/LOCAL_OUT
+ * hooks, where only the verdict of the filter table is recorded so
+ * that conntrack and NAT still see every packet, as long as the filter
+ * rules of every namespace are stateless.
  * When a new IP packet comes,it will go along the original filtering
  * path, then a message of the IP packet can be sent to the cache so
  * that the cache can remember the IP packet as an acquaintance, and
@@ -37,6 +45,8 @@
 #define	__H_L3_FIREWALL_CACHE_H__
 
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
 #include <linux/ip.h>
 #include <linux/in.h>
 #include <linux/module.h>
@@ -46,43 +56,210 @@
 #include <linux/udp.h>
 #include <linux/if_arp.h>
 #include <linux/if_ether.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/jhash.h>
 
 #ifdef CONFIG_L3_FIREWALL_CACHE
 
-#define TOTAL_LINES_OF_CACHE 0x400
+/* default number of hash buckets, can be overridden at boot time by
+ * l3_firewall_cache.buckets=N, rounded up to a power of two.
+ */
+#define L3_FIREWALL_CACHE_BUCKETS	0x400
+/* maximum number of cache lines chained on one bucket */
+#define L3_FIREWALL_CACHE_DEPTH		4
+/* default idle timeout of a cache line, in seconds */
+#define L3_FIREWALL_CACHE_TIMEOUT	30
 #define NF_NOTFOUND	-1
 
 /* cache line members come from the the requirement of
  * Firewall rule-set basic filtering features. please refer
  * to http://en.wikipedia.org/wiki/Comparison_of_firewalls
  */
-struct firewall_cache_lines {
+/* The lookup key, filled from a packet or kept in a cache line and
+ * compared as a whole, so the padding must stay zeroed.
+ */
+struct firewall_cache_key {
+	union nf_inet_addr	Saddr;	/* Source IP address */
+	union nf_inet_addr	Daddr;	/* Destination IP address */
+	int	InIfindex;		/* where the packet comes from */
+	int	OutIfindex;		/* where the packet will go to */
 	unsigned char	h_source[ETH_ALEN];	/* Source MAC */
-	__u8	Protocol;		/* L3 protocol: TCP/UDP */
-	__be32	Saddr;			/* Source IP address */
-	__be32	Daddr;			/* Destination IP address */
-	__be16	SourcePort;		/* Source Port */
-	__be16	DestPort;		/* Destination Port */
+	__u8	Family;			/* NFPROTO_IPV4/NFPROTO_IPV6 */
+	__u8	Hook;			/* FORWARD/LOCAL_IN/LOCAL_OUT */
+	__u8	Protocol;		/* L4 protocol: TCP/UDP/SCTP/ICMP */
+	__u8	pad[3];
+	__be16	SourcePort;		/* Source Port, ICMP echo id */
+	__be16	DestPort;		/* Destination Port, ICMP type/code */
+};
+
+/* a cached verdict, found in its bucket by the key */
+struct firewall_cache_lines {
+	struct hlist_node	hnode;		/* bucket chain, RCU protected */
+	struct rcu_head		rcu;
+	struct firewall_cache_key key;
+	__u8	referenced;		/* clock bit, set on every hit */
 	unsigned int response;		/* Response from hook functions.*/
+	unsigned int generation;	/* rule generation of the hook */
+	unsigned long last_used;	/* jiffies of the last hit */
+};
+
+struct firewall_cache_bucket {
+	struct hlist_head	chain;
+	spinlock_t		lock;	/* serialises writers of this bucket */
+	unsigned int		count;	/* lines currently on the chain */
 };
 
 struct p_firewall_cache {
-	struct firewall_cache_lines cache_lines[TOTAL_LINES_OF_CACHE];
-	rwlock_t    lock;
-	int			current;/* avoid to search from the head */
-	int			total;
-	int			full;
+	struct firewall_cache_bucket	*buckets;
+	unsigned int		hash_size;	/* number of buckets, 2^n */
+	unsigned int		hash_rnd;
+	atomic_t		total;		/* lines in the whole cache */
+};
+
+/* per-cpu counters, summed up by the sysctl interface */
+struct l3_firewall_cache_stat {
+	unsigned long	hits;
+	unsigned long	misses;
+	unsigned long	inserts;
+	unsigned long	evictions;	/* lines replaced in a full bucket */
+	unsigned long	invalidations;	/* stale generation seen on lookup */
+	unsigned long	expired;	/* idle timeout seen on lookup */
 };
 
 extern struct p_firewall_cache *p_l3_firewall_cache;
 
-/* The L3 Firewall sysctrl variable,1: enable, 0: disable */
+/* Idle timeout of a cache line, in jiffies */
+extern int	l3_firewall_cache_timeout;
+
+/* The L3 Firewall sysctrl variables,1: enable, 0: disable */
 extern int	ipv4_l3_firewall_cache_enable;
+extern int	ipv6_l3_firewall_cache_enable;
 extern int	L3_Firewall_Cache_register_proc(void);
 extern int	L3_Firewall_Cache_unregister_proc(void);
 
 int init_l3_firewall_cache(void);
 
+/* On FORWARD the verdict of the whole hook is cached by nf_hook_slow()
+ * and the forwarding paths skip the hook on a hit; there is no
+ * conntrack or NAT work on that hook to be lost.
+ */
+static inline bool l3_firewall_cache_forward_hook(u_int8_t pf,
+						  unsigned int hook)
+{
+	return (pf == NFPROTO_IPV4 || pf == NFPROTO_IPV6) &&
+		hook == NF_INET_FORWARD;
+}
+
+/* On LOCAL_IN/LOCAL_OUT only the step of a table which opted in with
+ * l3_cache is cached by nf_iterate(), and only while its rules are
+ * stateless; the other hook functions always run.
+ */
+static inline bool l3_firewall_cache_local_hook(u_int8_t pf,
+						unsigned int hook)
+{
+	return (pf == NFPROTO_IPV4 || pf == NFPROTO_IPV6) &&
+		(hook == NF_INET_LOCAL_IN || hook == NF_INET_LOCAL_OUT);
+}
+
+static inline bool l3_firewall_cache_hook(u_int8_t pf, unsigned int hook)
+{
+	return l3_firewall_cache_forward_hook(pf, hook) ||
+		l3_firewall_cache_local_hook(pf, hook);
+}
+
+/* l3_firewall_cache_invalidate- drop the verdicts of some hooks
+ *
+ * @pf:			NFPROTO_IPV4
+ * @hook_mask:		bit mask of the hooks whose rules changed
+ *
+ * Bump the rule generation of each hook in @hook_mask, so that
+ * the lines recorded for those hooks are no longer returned by
+ * search_from_firewall_cache(), while verdicts of other hooks
+ * stay in the cache. May sleep.
+ */
+void l3_firewall_cache_invalidate(u_int8_t pf, unsigned int hook_mask);
+
+bool l3_firewall_cache_stateless_match(const struct xt_entry_match *m);
+bool l3_firewall_cache_stateless_target(const struct xt_entry_target *t);
+void l3_firewall_cache_stateful(u_int8_t pf, unsigned int hook_mask,
+				int delta);
+/* no table opted in on @hook has stateful rules */
+bool l3_firewall_cache_stateless(u_int8_t pf, unsigned int hook);
+
+/* l3_firewall_cache_account- count a ruleset of a table in or out
+ *
+ * @table:		the table the ruleset is attached to
+ * @info:		the ruleset, scanned by DEFINE_L3_FIREWALL_CACHE_SCAN
+ * @delta:		1 when it is attached, -1 when it is detached
+ *
+ * A stateful ruleset of a table which opted in keeps the local hooks
+ * of the table from being cached. Count it in before it can see a
+ * packet and out once it is replaced or unregistered.
+ */
+static inline void l3_firewall_cache_account(const struct xt_table *table,
+					     const struct xt_table_info *info,
+					     int delta)
+{
+	if (table->l3_cache && info->stateful)
+		l3_firewall_cache_stateful(table->af, table->valid_hooks,
+					   delta);
+}
+
+/* DEFINE_L3_FIREWALL_CACHE_SCAN- define the ruleset scans of a family
+ *
+ * @prefix:		ipt, ip6t
+ * @type:		struct ipt_entry, struct ip6t_entry
+ *
+ * prefix_rules_fingerprint() hashes the rules, less the counters, once
+ * translate_table() has checked their layout and marked their chains
+ * but before it looks their matches and targets up: names are still
+ * names, jumps are offsets and no checkentry has written its private
+ * state yet. Pushing an unchanged ruleset again, or changing only the
+ * counters, gives the same fingerprint and keeps the L3 firewall cache
+ * warm.
+ *
+ * prefix_rules_stateful() runs on the translated rules. A ruleset is
+ * stateful as soon as one rule uses a match or a target that the cache
+ * cannot stand for.
+ */
+#define DEFINE_L3_FIREWALL_CACHE_SCAN(prefix, type)			\
+static void prefix##_rules_fingerprint(struct xt_table_info *info,	\
+				       const void *entries)		\
+{									\
+	const type *iter;						\
+	u32 hash = jhash_2words(info->size, info->number, 0);		\
+									\
+	xt_entry_foreach(iter, entries, info->size) {			\
+		hash = jhash(iter, offsetof(type, counters), hash);	\
+		hash = jhash(iter->elems,				\
+			     iter->next_offset - sizeof(type), hash);	\
+	}								\
+	info->fingerprint = hash;					\
+}									\
+									\
+static void prefix##_rules_stateful(struct xt_table_info *info)	\
+{									\
+	const void *entries = info->entries[raw_smp_processor_id()];	\
+	type *iter;							\
+	const struct xt_entry_match *ematch;				\
+	const struct xt_entry_target *t;				\
+	bool stateful = false;						\
+									\
+	xt_entry_foreach(iter, entries, info->size) {			\
+		xt_ematch_foreach(ematch, iter)				\
+			if (!l3_firewall_cache_stateless_match(ematch))	\
+				stateful = true;			\
+		t = (void *)iter + iter->target_offset;			\
+		if (!l3_firewall_cache_stateless_target(t))		\
+			stateful = true;				\
+	}								\
+	info->stateful = stateful;					\
+}
+
+void l3_firewall_cache_stat_sum(struct l3_firewall_cache_stat *sum);
+unsigned int l3_firewall_cache_entries(void);
+
 /* update_l3_firewall_cache- update a message to the cache
  *
  * @pf:			NFPROTO_IPV4
@@ -117,6 +117,10 @@ struct nf_hook_ops {
 	unsigned int hooknum;
 	/* Hooks are ordered in ascending priority. */
 	int priority;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	/* The verdict may be cached, see l3_firewall_cache_local_hook() */
+	bool l3_cache;
+#endif
 };
 
 struct nf_sockopt_ops {
@@ -242,6 +246,26 @@ NF_HOOK(uint8_t pf, unsigned int hook, struct sk_buff *skb,
 	return NF_HOOK_THRESH(pf, hook, skb, in, out, okfn, INT_MIN);
 }
 
+/* With no hook registered, leave @list to the caller for the list
+   version of okfn. Otherwise take every packet through the hook and
+   okfn before the next one, as NF_HOOK() does: conntrack confirms a
+   new connection only at the end of okfn, so a second packet of it
+   hooked before that would not find it, and be dropped in a clash. */
+static inline void
+NF_HOOK_LIST(uint8_t pf, unsigned int hook, struct sk_buff_head *list,
+	     struct net_device *in, struct net_device *out,
+	     int (*okfn)(struct sk_buff *))
+{
+	struct sk_buff *skb;
+
+#ifndef CONFIG_NETFILTER_DEBUG
+	if (list_empty(&nf_hooks[pf][hook]))
+		return;
+#endif
+	while ((skb = __skb_dequeue(list)))
+		NF_HOOK(pf, hook, skb, in, out, okfn);
+}
+
 /* Call setsockopt() */
 int nf_setsockopt(struct sock *sk, u_int8_t pf, int optval, char __user *opt,
 		  unsigned int len);
@@ -348,6 +372,12 @@ extern struct proc_dir_entry *proc_net_netfilter;
 #else /* !CONFIG_NETFILTER */
 #define NF_HOOK(pf, hook, skb, indev, outdev, okfn) (okfn)(skb)
 #define NF_HOOK_COND(pf, hook, skb, indev, outdev, okfn, cond) (okfn)(skb)
+static inline void
+NF_HOOK_LIST(uint8_t pf, unsigned int hook, struct sk_buff_head *list,
+	     struct net_device *in, struct net_device *out,
+	     int (*okfn)(struct sk_buff *))
+{
+}
 static inline int nf_hook_thresh(u_int8_t pf, unsigned int hook,
 				 struct sk_buff *skb,
 				 struct net_device *indev,
@@ -377,6 +377,10 @@ struct xt_table {
 
 	u_int8_t af;		/* address/protocol family */
 	int priority;		/* hook order */
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	/* Stateless rules may have their verdict cached on local hooks */
+	bool l3_cache;
+#endif
 
 	/* A unique name... */
 	const char name[XT_TABLE_MAXNAMELEN];
@@ -404,6 +408,16 @@ struct xt_table_info {
 	unsigned int stacksize;
 	unsigned int __percpu *stackptr;
 	void ***jumpstack;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	/* Hash of the rules, to tell whether a replace changed them */
+	u32 fingerprint;
+	/* Rules the L3 firewall cache cannot stand for */
+	bool stateful;
+#endif
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	/* Header classifier of the base chains, vmalloc()ed */
+	void *classifier;
+#endif
 	/* ipt_entry tables: one per CPU */
 	/* Note : this field MUST be the last one, see XT_TABLE_INFO_SZ */
 	void *entries[1];
@@ -372,6 +372,9 @@ static inline int wait_on_page_locked_killable(struct page *page)
 	return 0;
 }
 
+extern int wait_on_page_locked_async(struct page *page,
+				     struct wait_bit_queue *wait);
+
 /* 
  * Wait for a page to be unlocked.
  *
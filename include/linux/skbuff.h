@@ -188,6 +188,26 @@ enum {
 
 	/* ensure the originating sk reference is available on driver level */
 	SKBTX_DRV_NEEDS_SK_REF = 1 << 3,
+
+	/* frags are user pages, destructor_arg is their struct ubuf_info */
+	SKBTX_DEV_ZEROCOPY = 1 << 4,
+};
+
+/*
+ * Tracks the user pages that MSG_ZEROCOPY sends attach to skbs. Every
+ * skb whose frags point into them holds a reference, and the callback
+ * runs once the last one is freed, when userspace may reuse the pages.
+ * It reports the range of sends [id, id + len) as done; zerocopy is
+ * cleared if the data had to be copied after all. The ubuf_info lives
+ * in the cb of the skb that carries the notification.
+ */
+struct ubuf_info {
+	void		(*callback)(struct ubuf_info *, bool zerocopy);
+	u32		id;
+	u16		len;
+	u16		zerocopy:1;
+	u32		bytelen;
+	atomic_t	refcnt;
 };
 
 /* This data is invariant across clones and lives at
@@ -250,6 +270,11 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* The segments are carried in a GRE or a UDP tunnel. */
+	SKB_GSO_GRE = 1 << 6,
+
+	SKB_GSO_UDP_TUNNEL = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -320,6 +345,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@ndisc_nodetype: router type (from link layer)
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@secmark: security marking
  *	@vlan_tci: vlan tag control information
  */
@@ -407,8 +433,11 @@ struct sk_buff {
 
 	/* 0/13 bit hole */
 
-#ifdef CONFIG_NET_DMA
-	dma_cookie_t		dma_cookie;
+#if defined CONFIG_NET_DMA || defined CONFIG_NET_RX_BUSY_POLL
+	union {
+		unsigned int	napi_id;
+		dma_cookie_t	dma_cookie;
+	};
 #endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
@@ -596,6 +625,58 @@ static inline struct skb_shared_hwtstamps *skb_hwtstamps(struct sk_buff *skb)
 	return &skb_shinfo(skb)->hwtstamps;
 }
 
+extern struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					       struct ubuf_info *uarg);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+/* the ubuf_info of the user pages in the frags of @skb, if any */
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	if (skb && skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)
+		return skb_shinfo(skb)->destructor_arg;
+	return NULL;
+}
+
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	if (uarg && !skb_zcopy(skb)) {
+		sock_zerocopy_get(uarg);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+	}
+}
+
+/* drop the reference of @skb, @zerocopy is false if the pages were copied */
+static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
+{
+	struct ubuf_info *uarg = skb_zcopy(skb);
+
+	if (uarg) {
+		uarg->zerocopy = uarg->zerocopy && zerocopy;
+		skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+		sock_zerocopy_put(uarg);
+	}
+}
+
+/*
+ * A packet that is received may be queued for as long as the reader
+ * pleases. Copy the user pages it points to before it is, so that
+ * the sender hears back in a bounded time.
+ */
+static inline int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_zcopy(skb)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1910,6 +1991,9 @@ extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
 extern int	       skb_shift(struct sk_buff *tgt, struct sk_buff *skb,
 				 int shiftlen);
+extern int	       skb_zerocopy_from_user(struct sk_buff *skb,
+					      const void __user *from, int len,
+					      struct ubuf_info *uarg);
 
 extern struct sk_buff *skb_segment(struct sk_buff *skb, u32 features);
 
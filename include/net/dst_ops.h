@@ -24,7 +24,8 @@ struct dst_ops {
 					  struct net_device *dev, int how);
 	struct dst_entry *	(*negative_advice)(struct dst_entry *);
 	void			(*link_failure)(struct sk_buff *);
-	void			(*update_pmtu)(struct dst_entry *dst, u32 mtu);
+	void			(*update_pmtu)(struct dst_entry *dst,
+					       struct sk_buff *skb, u32 mtu);
 	int			(*local_out)(struct sk_buff *skb);
 
 	struct kmem_cache	*kmem_cachep;
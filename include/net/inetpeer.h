@@ -54,6 +54,10 @@ struct inet_peer {
 			u32				pmtu_orig;
 			u32				pmtu_learned;
 			struct inetpeer_addr_base	redirect_learned;
+			/* TCP Fast Open: MSS and cookie the peer gave us */
+			__u16				tcp_fastopen_mss;
+			__u8				tcp_fastopen_cookie_len;
+			__u8				tcp_fastopen_cookie[16];
 		};
 		struct rcu_head         rcu;
 	};
@@ -44,6 +44,10 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
+
+/* Input routes a nexthop shares, by ingress device and route flags */
+#define FIB_NH_INPUT_SLOTS	8
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -62,6 +66,7 @@ struct fib_nh {
 	__be32			nh_gw;
 	__be32			nh_saddr;
 	int			nh_saddr_genid;
+	struct rtable __rcu	*nh_rth_input[FIB_NH_INPUT_SLOTS];
 };
 
 /*
@@ -244,6 +249,7 @@ extern void fib_select_multipath(struct fib_result *res);
 /* Exported by fib_trie.c */
 extern void fib_trie_init(void);
 extern struct fib_table *fib_trie_table(u32 id);
+extern int fib_trie_compact(struct fib_table *tb, bool on);
 
 static inline void fib_combine_itag(u32 *itag, const struct fib_result *res)
 {
@@ -21,6 +21,7 @@
 #include <linux/skbuff.h>
 #include <linux/rcupdate.h>
 #include <linux/seq_file.h>
+#include <linux/spinlock.h>
 
 #include <linux/err.h>
 #include <linux/sysctl.h>
@@ -86,6 +87,10 @@ struct neigh_statistics {
 	unsigned long forced_gc_runs;	/* number of forced GC runs */
 
 	unsigned long unres_discards;	/* number of unresolved drops */
+
+	unsigned long hash_moves;	/* entries moved by hash resizes */
+	unsigned long gc_buckets;	/* hash buckets visited by GC */
+	unsigned long lock_contended;	/* hash bucket locks found taken */
 };
 
 #define NEIGH_CACHE_STAT_INC(tbl, field) this_cpu_inc((tbl)->stats->field)
@@ -142,11 +147,20 @@ struct pneigh_entry {
 
 struct neigh_hash_table {
 	struct neighbour __rcu	**hash_buckets;
+	unsigned int		hash_shift;
 	unsigned int		hash_mask;
 	__u32			hash_rnd;
 	struct rcu_head		rcu;
 };
 
+/*
+ * Hash buckets are indexed by the top bits of the hash and locked in
+ * stripes by the top NEIGH_HASH_LOCK_SHIFT bits: a bucket and the two
+ * it splits into when the table doubles share their lock.
+ */
+#define NEIGH_HASH_LOCK_SHIFT	6
+#define NEIGH_HASH_LOCKS	(1 << NEIGH_HASH_LOCK_SHIFT)
+
 
 struct neigh_table {
 	struct neigh_table	*next;
@@ -172,11 +186,20 @@ struct neigh_table {
 	struct timer_list 	proxy_timer;
 	struct sk_buff_head	proxy_queue;
 	atomic_t		entries;
+	/* protects parms and the proxy hash */
 	rwlock_t		lock;
 	unsigned long		last_rand;
 	struct kmem_cache	*kmem_cachep;
 	struct neigh_statistics	__percpu *stats;
 	struct neigh_hash_table __rcu *nht;
+	/* table a resize moves the entries to */
+	struct neigh_hash_table __rcu *nht_next;
+	/* held while entries move; walks that must see them all take it */
+	spinlock_t		resize_lock;
+	struct work_struct	resize_work;
+	unsigned int		gc_pos;
+	unsigned int		forced_gc_pos;
+	spinlock_t		hash_locks[NEIGH_HASH_LOCKS];
 	struct pneigh_entry	**phash_buckets;
 };
 
@@ -247,6 +270,7 @@ struct neigh_seq_state {
 	struct seq_net_private p;
 	struct neigh_table *tbl;
 	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht_next;
 	void *(*neigh_sub_iter)(struct neigh_seq_state *state,
 				struct neighbour *n, loff_t *pos);
 	unsigned int bucket;
@@ -0,0 +1,74 @@
+#ifndef _IPT_CLASSIFIER_H
+#define _IPT_CLASSIFIER_H
+
+/*
+ * Header classifier for the base chains of an iptables table.
+ *
+ * Each field the classifier knows about (source and destination
+ * address, protocol, and the tcp/udp port ranges) is cut into
+ * elementary intervals, and every interval carries a bit vector of
+ * the rules that may match a packet whose field falls into it. ANDing
+ * the vectors of a packet gives the rules worth looking at; all the
+ * others are known not to match, so ipt_do_table() steps over them.
+ * A candidate is still checked by ip_packet_match() and its matches.
+ */
+
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+
+enum ipt_cls_dims {
+	IPT_CLS_SRC,
+	IPT_CLS_DST,
+	IPT_CLS_PROTO,
+	IPT_CLS_SPORT,
+	IPT_CLS_DPORT,
+	IPT_CLS_DIMS
+};
+
+struct ipt_cls_dim {
+	unsigned int		nr;	/* intervals, 0 if not classified */
+	const u32		*start;	/* lower bounds, ascending */
+	const unsigned long	*bits;	/* nr vectors of chain->words */
+};
+
+struct ipt_cls_chain {
+	unsigned int		nrules;
+	unsigned int		words;	/* longs per bit vector */
+	const unsigned int	*offset; /* rule offsets from the table */
+	struct ipt_cls_dim	dim[IPT_CLS_DIMS];
+};
+
+/* One vmalloc()ed block, freed along with its xt_table_info */
+struct ipt_classifier {
+	const struct ipt_cls_chain *chain[NF_INET_NUMHOOKS];
+};
+
+/* Per packet state, on the stack of ipt_do_table() */
+struct ipt_cls_state {
+	const struct ipt_cls_chain *chain;
+	unsigned int		ndims;
+	unsigned int		pos;	/* index of the last candidate */
+	const unsigned long	*vec[IPT_CLS_DIMS];
+};
+
+extern struct ipt_classifier *
+ipt_classifier_build(const struct xt_table_info *info, const void *entry0,
+		     unsigned int valid_hooks);
+
+extern bool ipt_classifier_prepare(const struct ipt_classifier *cls,
+				   unsigned int hook,
+				   const struct sk_buff *skb,
+				   const struct iphdr *ip,
+				   unsigned int fragoff, unsigned int thoff,
+				   struct ipt_cls_state *st);
+
+extern struct ipt_entry *ipt_classifier_first(struct ipt_cls_state *st,
+					      const void *table_base);
+
+extern struct ipt_entry *ipt_classifier_next(struct ipt_cls_state *st,
+					     const void *table_base,
+					     const struct ipt_entry *e);
+
+#endif /* _IPT_CLASSIFIER_H */
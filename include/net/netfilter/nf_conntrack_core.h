@@ -76,4 +76,15 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 
 extern spinlock_t nf_conntrack_lock ;
 
+/* Hash buckets are locked in stripes; a resize takes them all for
+ * each batch of buckets it moves */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
+/* Walkers that must visit every conntrack in the hash hold this, so
+ * that no resize moves any between the buckets behind their back */
+extern struct mutex nf_conntrack_resize_mutex;
+
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -3,20 +3,43 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+};
+
+/* Kept by the gc worker only, for /proc/net/stat/nf_conntrack_gc */
+struct nf_ct_gc_stat {
+	unsigned long		passes;
+	unsigned long		scanned;
+	unsigned long		expired;
+	unsigned int		last_us;	/* length of the last pass */
+	unsigned int		max_us;		/* and of the longest one */
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
 	unsigned int		htable_size;
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
+	/* table a resize is moving the conntracks to, and its size */
+	struct hlist_nulls_head	*hash_next;
+	unsigned int		htable_size_next;
+	/* buckets of hash it has moved over so far */
+	unsigned int		hash_moved;
+	seqcount_t		generation;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
-	struct hlist_nulls_head	dying;
+	struct ct_pcpu __percpu	*pcpu_lists;
 	struct ip_conntrack_stat __percpu *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
@@ -24,6 +47,11 @@ struct netns_ct {
 	int			sysctl_tstamp;
 	int			sysctl_checksum;
 	unsigned int		sysctl_log_invalid; /* Log invalid packets */
+	unsigned int		sysctl_gc_budget;   /* entries per gc pass */
+	unsigned int		sysctl_gc_interval; /* jiffies between passes */
+	struct delayed_work	gc_work;
+	unsigned int		gc_bucket;	/* where the next pass starts */
+	struct nf_ct_gc_stat	gc_stat;
 #ifdef CONFIG_SYSCTL
 	struct ctl_table_header	*sysctl_header;
 	struct ctl_table_header	*acct_sysctl_header;
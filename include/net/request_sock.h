@@ -105,12 +105,26 @@ struct listen_sock {
 	struct request_sock	*syn_table[0];
 };
 
+/** struct fastopen_queue - TCP Fast Open state of a listener
+ *
+ * @lock - serializes the request_sock <-> child association, see
+ *	   reqsk_fastopen_remove()
+ * @qlen - # of children created by a SYN still in the handshake
+ * @max_qlen - cap on @qlen set by TCP_FASTOPEN, 0 disables Fast Open
+ */
+struct fastopen_queue {
+	spinlock_t		lock;
+	int			qlen;
+	int			max_qlen;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
+ * @fastopenq - TCP Fast Open children
  *
  * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
  * lock sock while browsing the listening hash (otherwise it's deadlock prone).
@@ -128,11 +142,14 @@ struct request_sock_queue {
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	struct fastopen_queue	fastopenq;
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
 			     unsigned int nr_table_entries);
 
+extern void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req);
+
 extern void __reqsk_queue_destroy(struct request_sock_queue *queue);
 extern void reqsk_queue_destroy(struct request_sock_queue *queue);
 
@@ -115,6 +115,7 @@ extern void		ip_rt_redirect(__be32 old_gw, __be32 dst, __be32 new_gw,
 				       __be32 src, struct net_device *dev);
 extern void		rt_cache_flush(struct net *net, int how);
 extern void		rt_cache_flush_batch(struct net *net);
+extern void		rt_flush_nh(struct fib_nh *nh);
 extern struct rtable *__ip_route_output_key(struct net *, struct flowi4 *flp);
 extern struct rtable *ip_route_output_flow(struct net *, struct flowi4 *flp,
 					   struct sock *sk);
@@ -315,7 +316,7 @@ typedef int route_add_hook(int iif, struct net_device *dev, uint32_t daddr,
 			   uint32_t saddr, int tos, void *ctx);
 typedef void route_flush_hook(void);
 
-extern route_add_hook *route_add_fn;
+extern route_add_hook __rcu *route_add_fn;
 
 void route_hook_fn_register(route_add_hook *add,
 			    route_flush_hook *flush);
@@ -113,6 +113,7 @@ struct net;
  *	@skc_family: network address family
  *	@skc_state: Connection state
  *	@skc_reuse: %SO_REUSEADDR setting
+ *	@skc_reuseport: %SO_REUSEPORT setting
  *	@skc_bound_dev_if: bound device index if != 0
  *	@skc_bind_node: bind hash linkage for various protocol lookup tables
  *	@skc_portaddr_node: second hash linkage for UDP/UDP-Lite protocol
@@ -139,7 +140,8 @@ struct sock_common {
 	};
 	unsigned short		skc_family;
 	volatile unsigned char	skc_state;
-	unsigned char		skc_reuse;
+	unsigned char		skc_reuse:4;
+	unsigned char		skc_reuseport:4;
 	int			skc_bound_dev_if;
 	union {
 		struct hlist_node	skc_bind_node;
@@ -184,6 +186,7 @@ struct sock_common {
   *	@sk_async_wait_queue: DMA copied packets
   *	@sk_ack_queue: TCP ack packets
   *	@sk_omem_alloc: "o" is "option" or "other"
+  *	@sk_zckey: id of the next %MSG_ZEROCOPY send, for its notification
   *	@sk_wmem_queued: persistent queue size
   *	@sk_forward_alloc: space allocated forward
   *	@sk_allocation: allocation mode
@@ -217,6 +220,8 @@ struct sock_common {
   *	@sk_rcvtimeo: %SO_RCVTIMEO setting
   *	@sk_sndtimeo: %SO_SNDTIMEO setting
   *	@sk_rxhash: flow hash received from netif layer
+  *	@sk_napi_id: id of the last napi context to receive data for sk
+  *	@sk_ll_usec: usecs to busypoll when there is no data
   *	@sk_filter: socket filtering instructions
   *	@sk_protinfo: private area, net family specific, when not using slab
   *	@sk_timer: sock cleanup timer
@@ -254,6 +259,7 @@ struct sock {
 #define sk_family		__sk_common.skc_family
 #define sk_state		__sk_common.skc_state
 #define sk_reuse		__sk_common.skc_reuse
+#define sk_reuseport		__sk_common.skc_reuseport
 #define sk_bound_dev_if		__sk_common.skc_bound_dev_if
 #define sk_bind_node		__sk_common.skc_bind_node
 #define sk_prot			__sk_common.skc_prot
@@ -278,6 +284,10 @@ struct sock {
 	int			sk_forward_alloc;
 #ifdef CONFIG_RPS
 	__u32			sk_rxhash;
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		sk_napi_id;
+	unsigned int		sk_ll_usec;
 #endif
 	atomic_t		sk_drops;
 	int			sk_rcvbuf;
@@ -304,6 +314,7 @@ struct sock {
 	spinlock_t		sk_dst_lock;
 	atomic_t		sk_wmem_alloc;
 	atomic_t		sk_omem_alloc;
+	atomic_t		sk_zckey;
 	int			sk_sndbuf;
 	struct sk_buff_head	sk_write_queue;
 	kmemcheck_bitfield_begin(flags);
@@ -572,6 +583,7 @@ enum sock_flags {
 	SOCK_TIMESTAMPING_SYS_HARDWARE, /* %SOF_TIMESTAMPING_SYS_HARDWARE */
 	SOCK_FASYNC, /* fasync() active */
 	SOCK_RXQ_OVFL,
+	SOCK_ZEROCOPY, /* buffers from userspace, %SO_ZEROCOPY setting */
 };
 
 static inline void sock_copy_flags(struct sock *nsk, struct sock *osk)
@@ -780,6 +792,8 @@ struct proto {
 	int			(*backlog_rcv) (struct sock *sk, 
 						struct sk_buff *skb);
 
+	void			(*release_cb)(struct sock *sk);
+
 	/* Keeping track of sk's, looking them up, and port selection methods. */
 	void			(*hash)(struct sock *sk);
 	void			(*unhash)(struct sock *sk);
@@ -912,6 +926,7 @@ struct sock_iocb {
 	struct scm_cookie	*scm;
 	struct msghdr		*msg, async_msg;
 	struct kiocb		*kiocb;
+	struct sock_batch	*batch;
 };
 
 static inline struct sock_iocb *kiocb_to_siocb(struct kiocb *iocb)
@@ -924,6 +939,45 @@ static inline struct kiocb *siocb_to_kiocb(struct sock_iocb *si)
 	return si->kiocb;
 }
 
+/*
+ * What sendmmsg() and recvmmsg() carry from one datagram of a call to
+ * the next. On the way out, the route of the last datagram sent, which
+ * the next one may reuse if its flow is the same. On the way in, the
+ * datagrams that were taken off the receive queue along with the one
+ * asked for, and those read, whose memory goes back to the socket at
+ * the end of the call.
+ */
+struct sock_batch {
+	unsigned int		budget;		/* datagrams still wanted */
+	struct dst_entry	*dst;
+	struct flowi		key;		/* flow dst was looked up for */
+	struct flowi		fl;		/* and what the lookup made of it */
+	struct sk_buff_head	rxq;
+	struct sk_buff_head	done;
+};
+
+static inline void sock_batch_init(struct sock_batch *batch)
+{
+	batch->budget = 0;
+	batch->dst = NULL;
+	__skb_queue_head_init(&batch->rxq);
+	__skb_queue_head_init(&batch->done);
+}
+
+extern struct sk_buff *skb_recv_datagram_batch(struct sock *sk,
+					       struct sock_batch *batch,
+					       unsigned flags, int *peeked,
+					       int *err);
+extern void skb_free_datagram_batch(struct sock *sk, struct sock_batch *batch,
+				    struct sk_buff *skb);
+extern void sock_batch_end(struct sock *sk, struct sock_batch *batch);
+
+/* the batch of the sendmmsg() or recvmmsg() call @iocb is part of, if any */
+static inline struct sock_batch *sock_iocb_batch(struct kiocb *iocb)
+{
+	return iocb && iocb->private ? kiocb_to_siocb(iocb)->batch : NULL;
+}
+
 struct socket_alloc {
 	struct socket socket;
 	struct inode vfs_inode;
@@ -1097,6 +1151,9 @@ extern struct sk_buff		*sock_wmalloc(struct sock *sk,
 extern struct sk_buff		*sock_rmalloc(struct sock *sk,
 					      unsigned long size, int force,
 					      gfp_t priority);
+extern struct sk_buff		*sock_omalloc(struct sock *sk,
+					      unsigned long size,
+					      gfp_t priority);
 extern void			sock_wfree(struct sk_buff *skb);
 extern void			sock_rfree(struct sk_buff *skb);
 
@@ -257,4 +257,35 @@ extern void udp_init(void);
 
 extern int udp4_ufo_send_check(struct sk_buff *skb);
 extern struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features);
+
+/*
+ * GRO and GSO for a tunnel carried over UDP to a well known port.
+ * gro_receive is called with the GRO offset past the UDP header and
+ * gro_complete with @nhoff, the offset of the tunnel header from
+ * skb->data; both normally end up in gro_receive_inner() and
+ * gro_complete_inner(). gso_segment gets packets with data past the
+ * UDP header and normally calls skb_tunnel_gso_segment(); the UDP
+ * headers of the segments are fixed up afterwards. Aggregates carry
+ * SKB_GSO_UDP_TUNNEL and no outer checksum.
+ */
+struct udp_offload_callbacks {
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+						 struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
+	struct sk_buff		*(*gso_segment)(struct sk_buff *skb,
+						u32 features);
+};
+
+struct udp_offload {
+	__be16				port;
+	struct udp_offload_callbacks	callbacks;
+	struct list_head		list;
+};
+
+extern void udp_add_offload(struct udp_offload *uo);
+extern void udp_del_offload(struct udp_offload *uo);
+extern struct sk_buff **udp4_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int udp4_gro_complete(struct sk_buff *skb);
 #endif	/* _UDP_H */
@@ -145,6 +145,8 @@ cond_syscall(sys_io_destroy);
 cond_syscall(sys_io_submit);
 cond_syscall(sys_io_cancel);
 cond_syscall(sys_io_getevents);
+cond_syscall(sys_io_ring_setup);
+cond_syscall(sys_io_ring_enter);
 cond_syscall(sys_syslog);
 
 /* arch-specific weak syscall entries */
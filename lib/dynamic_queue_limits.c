@@ -0,0 +1,133 @@
+/*
+ * Dynamic queue limits (dql), see <linux/dynamic_queue_limits.h>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/dynamic_queue_limits.h>
+
+/* A - B if A is after B, else 0; all counters may wrap */
+#define POSDIFF(A, B)	((int)((A) - (B)) > 0 ? (A) - (B) : 0)
+#define AFTER_EQ(A, B)	((int)((A) - (B)) >= 0)
+
+/**
+ *	dql_completed - account for completed objects and adapt the limit
+ *	@dql: queue
+ *	@count: objects completed since the last call
+ *
+ *	An interval is the time between two calls. Must not be called
+ *	concurrently for the same queue.
+ */
+void dql_completed(struct dql *dql, unsigned int count)
+{
+	unsigned int inprogress, prev_inprogress, limit;
+	unsigned int ovlimit, completed, num_queued;
+	bool all_prev_completed;
+
+	num_queued = ACCESS_ONCE(dql->num_queued);
+
+	/* cannot complete more than was queued */
+	BUG_ON(count > num_queued - dql->num_completed);
+
+	completed = dql->num_completed + count;
+	limit = dql->limit;
+	ovlimit = POSDIFF(num_queued - dql->num_completed, limit);
+	inprogress = num_queued - completed;
+	prev_inprogress = dql->prev_num_queued - dql->num_completed;
+	all_prev_completed = AFTER_EQ(completed, dql->prev_num_queued);
+
+	if ((ovlimit && !inprogress) ||
+	    (dql->prev_ovlimit && all_prev_completed)) {
+		/*
+		 * Starved: the queue was over its limit and has run dry,
+		 * now or possibly before the producer got to run again.
+		 * Grow the limit by what was queued and completed in the
+		 * interval, plus the previous overshoot.
+		 */
+		limit += POSDIFF(completed, dql->prev_num_queued) +
+			 dql->prev_ovlimit;
+		dql->slack_start_time = jiffies;
+		dql->lowest_slack = UINT_MAX;
+	} else if (inprogress && prev_inprogress && !all_prev_completed) {
+		/*
+		 * Busy for the whole interval: whatever is queued beyond
+		 * what keeps the consumer going is slack. That is the
+		 * larger of the limit (plus overshoot) minus twice what
+		 * completed, and the part of the last object that did not
+		 * fit under the limit. Only the lowest slack seen over
+		 * slack_hold_time is given back, to damp oscillation.
+		 */
+		unsigned int slack, slack_last_objs;
+
+		slack = POSDIFF(limit + dql->prev_ovlimit,
+				2 * (completed - dql->num_completed));
+		slack_last_objs = dql->prev_ovlimit ?
+			POSDIFF(dql->prev_last_obj_cnt, dql->prev_ovlimit) : 0;
+
+		slack = max(slack, slack_last_objs);
+		if (slack < dql->lowest_slack)
+			dql->lowest_slack = slack;
+
+		if (time_after(jiffies,
+			       dql->slack_start_time + dql->slack_hold_time)) {
+			limit = POSDIFF(limit, dql->lowest_slack);
+			dql->slack_start_time = jiffies;
+			dql->lowest_slack = UINT_MAX;
+		}
+	}
+
+	limit = clamp(limit, dql->min_limit, dql->max_limit);
+	if (limit != dql->limit) {
+		dql->limit = limit;
+		ovlimit = 0;
+	}
+
+	dql->adj_limit = limit + completed;
+	dql->prev_ovlimit = ovlimit;
+	dql->prev_last_obj_cnt = dql->last_obj_cnt;
+	dql->num_completed = completed;
+	dql->prev_num_queued = num_queued;
+}
+EXPORT_SYMBOL(dql_completed);
+
+/**
+ *	dql_reset - forget the queue state
+ *	@dql: queue
+ *
+ *	For when the queue was emptied other than through dql_completed(),
+ *	e.g. a ring reset. The configured bounds are kept.
+ */
+void dql_reset(struct dql *dql)
+{
+	dql->limit = dql->min_limit;
+	dql->num_queued = 0;
+	dql->num_completed = 0;
+	dql->adj_limit = dql->limit;
+	dql->last_obj_cnt = 0;
+	dql->prev_num_queued = 0;
+	dql->prev_last_obj_cnt = 0;
+	dql->prev_ovlimit = 0;
+	dql->lowest_slack = UINT_MAX;
+	dql->slack_start_time = jiffies;
+}
+EXPORT_SYMBOL(dql_reset);
+
+/**
+ *	dql_init - set up a queue
+ *	@dql: queue
+ *	@hold_time: jiffies over which slack is measured before the limit
+ *		is lowered
+ */
+void dql_init(struct dql *dql, unsigned int hold_time)
+{
+	dql->max_limit = DQL_MAX_LIMIT;
+	dql->min_limit = 0;
+	dql->slack_hold_time = hold_time;
+	dql_reset(dql);
+}
+EXPORT_SYMBOL(dql_init);
@@ -0,0 +1,137 @@
+/*
+ * Helpers of the benchmark modules.
+ *
+ * The benchmark modules are quick & dirty, in the spirit of tcrypt:
+ * loading one runs the benchmark, prints the results to the kernel log
+ * and fails with kbench_done(), so that nothing stays loaded. Those
+ * that measure scaling run one kernel thread per cpu, for 1, 2, 4, ...
+ * of the online cpus, with kbench_scale() and kbench_threads(), and
+ * report each step.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/kbench.h>
+
+struct kbench_run {
+	void			(*fn)(void *data, unsigned int thread);
+	void			*data;
+	atomic_t		running;
+	struct completion	done;
+};
+
+struct kbench_thread {
+	struct kbench_run	*run;
+	struct task_struct	*task;
+	unsigned int		id;
+};
+
+static int kbench_thread(void *arg)
+{
+	struct kbench_thread *t = arg;
+	struct kbench_run *run = t->run;
+
+	run->fn(run->data, t->id);
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+/**
+ * kbench_threads - time threads running at once on several cpus
+ * @name: the threads are called @name/cpu
+ * @nthreads: threads to run
+ * @per_cpu: threads bound to each cpu, from the first online one on
+ * @fn: body of each thread, given @data and the thread number
+ * @data: passed to @fn
+ *
+ * Returns the nsecs from waking the first thread to the last one
+ * returning from @fn, or a negative errno if the threads could not be
+ * created, in which case @fn did not run. The caller keeps the cpus
+ * from going away, see kbench_scale().
+ */
+s64 kbench_threads(const char *name, unsigned int nthreads,
+		   unsigned int per_cpu,
+		   void (*fn)(void *data, unsigned int thread), void *data)
+{
+	struct kbench_run run = { .fn = fn, .data = data };
+	struct kbench_thread *threads;
+	unsigned int i;
+	int cpu = -1;
+	ktime_t start;
+	s64 ns;
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	atomic_set(&run.running, nthreads);
+	init_completion(&run.done);
+
+	for (i = 0; i < nthreads; i++) {
+		struct task_struct *task;
+
+		if (!(i % per_cpu))
+			cpu = cpumask_next(cpu, cpu_online_mask);
+		threads[i].run = &run;
+		threads[i].id = i;
+		task = kthread_create(kbench_thread, &threads[i], "%s/%d",
+				      name, cpu);
+		if (IS_ERR(task)) {
+			/* never woken up, so they never ran */
+			while (i--)
+				kthread_stop(threads[i].task);
+			ns = PTR_ERR(task);
+			goto out;
+		}
+		kthread_bind(task, cpu);
+		threads[i].task = task;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < nthreads; i++)
+		wake_up_process(threads[i].task);
+	wait_for_completion(&run.done);
+	ns = kbench_ns(start);
+out:
+	kfree(threads);
+	return ns;
+}
+EXPORT_SYMBOL_GPL(kbench_threads);
+
+/**
+ * kbench_scale - run a benchmark on more and more cpus
+ * @run: one run on @nthreads cpus, returns 0 or an errno
+ * @data: passed to @run
+ *
+ * Calls @run for 1, 2, 4, ... and finally all the online cpus, with
+ * cpu hotplug held off, until it fails. Returns what the last run
+ * returned. Per cpu state is best sized for nr_cpu_ids.
+ */
+int kbench_scale(int (*run)(void *data, unsigned int nthreads), void *data)
+{
+	unsigned int n, ncpus;
+	int err = 0;
+
+	get_online_cpus();
+	ncpus = num_online_cpus();
+	for (n = 1; !err; n *= 2) {
+		err = run(data, min(n, ncpus));
+		if (n >= ncpus)
+			break;
+	}
+	put_online_cpus();
+	return err;
+}
+EXPORT_SYMBOL_GPL(kbench_scale);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("helpers of the benchmark modules");
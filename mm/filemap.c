@@ -573,6 +573,40 @@ int wait_on_page_bit_killable(struct page *page, int bit_nr)
 			     sleep_on_page_killable, TASK_KILLABLE);
 }
 
+/**
+ * wait_on_page_locked_async - queue a callback for the unlock of a page
+ * @page: the page
+ * @wait: the waiter, whose wake function is called once @page is unlocked
+ *
+ * For AIO, which must not sleep on the page.  Returns -EIOCBRETRY if
+ * @page is locked and @wait was queued, its wake function has to take
+ * it off the queue.  Returns 0 if the page is unlocked already, @wait is
+ * not queued then.
+ */
+int wait_on_page_locked_async(struct page *page, struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	unsigned long flags;
+	int ret = 0;
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	spin_lock_irqsave(&q->lock, flags);
+	if (list_empty(&wait->wait.task_list))
+		__add_wait_queue(q, &wait->wait);
+	/* see the barrier in unlock_page() */
+	smp_mb();
+	if (PageLocked(page))
+		ret = -EIOCBRETRY;
+	else
+		list_del_init(&wait->wait.task_list);
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(wait_on_page_locked_async);
+
 /**
  * add_page_wait_queue - Add an arbitrary waiter to a page's wait queue
  * @page: Page defining the wait queue of interest
@@ -1062,15 +1096,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @wait:	for AIO, the waiter to queue instead of sleeping on a page
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With @wait it never sleeps for a page: it starts the reads it needs
+ * and queues @wait for the page, returning -EIOCBRETRY in desc->error,
+ * or it stops short if it has copied something already.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct wait_bit_queue *wait)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1189,6 +1229,24 @@ page_ok:
 		goto out;
 
 page_not_up_to_date:
+		if (wait) {
+			if (!trylock_page(page))
+				goto page_wait_async;
+			/*
+			 * The read we waited for failed: sync readers get
+			 * another go, AIO would come back here forever.
+			 */
+			if (PageError(page) && page->mapping &&
+			    wait->key.flags == &page->flags &&
+			    !PageUptodate(page)) {
+				unlock_page(page);
+				shrink_readahead_size_eio(filp, ra);
+				error = -EIO;
+				goto readpage_error;
+			}
+			goto page_not_up_to_date_locked;
+		}
+
 		/* Get exclusive access to the page ... */
 		error = lock_page_killable(page);
 		if (unlikely(error))
@@ -1227,6 +1285,8 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
+			if (wait)
+				goto page_wait_async;
 			error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
@@ -1255,6 +1315,24 @@ readpage_error:
 		page_cache_release(page);
 		goto out;
 
+page_wait_async:
+		/*
+		 * The page is locked for a read.  Rather than sleep, the
+		 * kiocb of @wait gets kicked when it is unlocked, and is
+		 * retried from here.  If something was copied already,
+		 * return that now, the caller comes back for the rest.
+		 */
+		if (desc->written) {
+			page_cache_release(page);
+			goto out;
+		}
+		error = wait_on_page_locked_async(page, wait);
+		page_cache_release(page);
+		if (!error)
+			goto find_page;		/* unlocked meanwhile */
+		desc->error = error;
+		goto out;
+
 no_cached_page:
 		/*
 		 * Ok, it wasn't cached, so we need to create a new
@@ -1378,11 +1456,16 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		unsigned long nr_segs, loff_t pos)
 {
 	struct file *filp = iocb->ki_filp;
+	struct wait_bit_queue *wait = NULL;
 	ssize_t retval;
 	unsigned long seg = 0;
 	size_t count;
 	loff_t *ppos = &iocb->ki_pos;
 
+	/* AIO does not sleep on the page cache, see do_generic_file_read() */
+	if (!is_sync_kiocb(iocb))
+		wait = &iocb->ki_wait;
+
 	count = 0;
 	retval = generic_segment_checks(iov, &nr_segs, &count, VERIFY_WRITE);
 	if (retval)
@@ -1448,13 +1531,20 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 			count = 0;
 		}
 
+		/*
+		 * AIO returns what it has at the end of each segment, so
+		 * that it never queues a retry with bytes copied already.
+		 */
+		if (wait && retval > 0)
+			break;
+
 		desc.written = 0;
 		desc.arg.buf = iov[seg].iov_base + offset;
 		desc.count = iov[seg].iov_len - offset;
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor, wait);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -0,0 +1,474 @@
+/*
+ * BPF JIT self test and benchmark.
+ *
+ * A set of filters that covers every classic BPF instruction, the
+ * ancillary loads included, runs over a few packets: linear and not,
+ * with and without a device, and a list of netlink attributes. Each
+ * filter runs both in sk_run_filter() and in the code bpf_jit_compile()
+ * made of it, the two have to return the same, and the time per packet
+ * of both goes to the kernel log. Filters are only compiled with
+ * net.core.bpf_jit_enable set, and the JIT may leave some to the
+ * interpreter; those are reported as not JITed:
+ *
+ *	sysctl -w net.core.bpf_jit_enable=1
+ *	modprobe bpf_jit_bench [runs=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kbench.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <net/net_namespace.h>
+#include <net/netlink.h>
+#include <net/sock.h>
+
+static unsigned int runs = 10000;
+module_param(runs, uint, 0444);
+MODULE_PARM_DESC(runs, "runs of each filter over each packet");
+
+/* M[0] = M[0] * 31 + the ancillary value */
+#define BENCH_ANC(code)							\
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_##code),	\
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),				\
+	BPF_STMT(BPF_LD | BPF_MEM, 0),					\
+	BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 31),			\
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),				\
+	BPF_STMT(BPF_ST, 0)
+
+/* M[1] |= bit if M[0] passes the test, the jump taken on true or false */
+#define BENCH_JMP(op, k, bit)						\
+	BPF_STMT(BPF_LD | BPF_MEM, 0),					\
+	BPF_JUMP(BPF_JMP | (op), k, 0, 3),				\
+	BPF_STMT(BPF_LD | BPF_MEM, 1),					\
+	BPF_STMT(BPF_ALU | BPF_OR | BPF_K, bit),			\
+	BPF_STMT(BPF_ST, 1)
+#define BENCH_JMP_NOT(op, k, bit)					\
+	BPF_STMT(BPF_LD | BPF_MEM, 0),					\
+	BPF_JUMP(BPF_JMP | (op), k, 3, 0),				\
+	BPF_STMT(BPF_LD | BPF_MEM, 1),					\
+	BPF_STMT(BPF_ALU | BPF_OR | BPF_K, bit),			\
+	BPF_STMT(BPF_ST, 1)
+
+/* tcpdump -dd ip and udp dst port 53 */
+static struct sock_filter bench_udp53[] = {
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 53, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static struct sock_filter bench_alu[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 26),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0x12345),
+	BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 77),
+	BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 3),
+	BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x10001),
+	BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 7),
+	BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff0fff),
+	BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0x80000010),
+	BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 3),
+	BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+	BPF_STMT(BPF_ALU | BPF_NEG, 0),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+	BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+	BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+	BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+	BPF_STMT(BPF_STX, 1),
+	BPF_STMT(BPF_LDX | BPF_IMM, 5),
+	BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+	BPF_STMT(BPF_ALU | BPF_RSH | BPF_X, 0),
+	BPF_STMT(BPF_LDX | BPF_MEM, 0),
+	BPF_STMT(BPF_ALU | BPF_AND | BPF_X, 0),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_MEM, 1),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_LD | BPF_IMM, 0x87654321),
+	BPF_STMT(BPF_MISC | BPF_TXA, 0),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+};
+
+static struct sock_filter bench_jmp[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LD | BPF_IMM, 0),
+	BPF_STMT(BPF_ST, 1),
+	BPF_STMT(BPF_LDX | BPF_IMM, 60),
+	BENCH_JMP(BPF_JEQ | BPF_K, 98, 0x1),
+	BENCH_JMP_NOT(BPF_JEQ | BPF_K, 97, 0x2),
+	BENCH_JMP(BPF_JGT | BPF_K, 60, 0x4),
+	BENCH_JMP_NOT(BPF_JGT | BPF_K, 98, 0x8),
+	BENCH_JMP(BPF_JGE | BPF_K, 98, 0x10),
+	BENCH_JMP(BPF_JSET | BPF_K, 0x2, 0x20),
+	BENCH_JMP_NOT(BPF_JSET | BPF_K, 0x10000, 0x40),
+	BENCH_JMP(BPF_JSET | BPF_K, 0x80000001, 0x80),
+	BENCH_JMP(BPF_JGT | BPF_K, 0x12345678, 0x100),
+	BENCH_JMP(BPF_JEQ | BPF_X, 0, 0x200),
+	BENCH_JMP(BPF_JGT | BPF_X, 0, 0x400),
+	BENCH_JMP_NOT(BPF_JGE | BPF_X, 0, 0x800),
+	BENCH_JMP(BPF_JSET | BPF_X, 0, 0x1000),
+	/* same target both ways, and always */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 5, 1, 1),
+	BPF_STMT(BPF_RET | BPF_K, 1),
+	BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+	BPF_STMT(BPF_RET | BPF_K, 2),
+	BPF_STMT(BPF_LD | BPF_MEM, 1),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+};
+
+static struct sock_filter bench_anc[] = {
+	BPF_STMT(BPF_LD | BPF_IMM, 0),
+	BPF_STMT(BPF_ST, 0),
+	BENCH_ANC(PROTOCOL),
+	BENCH_ANC(PKTTYPE),
+	BENCH_ANC(MARK),
+	BENCH_ANC(QUEUE),
+	BENCH_ANC(RXHASH),
+	BENCH_ANC(CPU),
+	/* these return 0 without a device */
+	BENCH_ANC(IFINDEX),
+	BENCH_ANC(HATYPE),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+};
+
+static struct sock_filter bench_nlattr[] = {
+	BPF_STMT(BPF_LDX | BPF_IMM, 2),
+	BPF_STMT(BPF_LD | BPF_IMM, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_NLATTR),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 6, 0),
+	BPF_STMT(BPF_LDX | BPF_IMM, 6),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_NLATTR_NEST),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_IND, 4),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static struct sock_filter bench_negative[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_LL_OFF + 12),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_LDX | BPF_MEM, 0),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+	BPF_STMT(BPF_LDX | BPF_MEM, 0),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+};
+
+/* the loads that fail end the filter, returning 0 */
+static struct sock_filter bench_bounds[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 97),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 94),
+	BPF_STMT(BPF_LDX | BPF_MEM, 0),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	BPF_STMT(BPF_ST, 0),
+	BPF_STMT(BPF_LDX | BPF_IMM, 90),
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, 6),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 96),
+	BPF_STMT(BPF_RET | BPF_K, 1),
+};
+
+static struct sock_filter bench_div0[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	BPF_STMT(BPF_LDX | BPF_IMM, 0),
+	BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+	BPF_STMT(BPF_RET | BPF_K, 1),
+};
+
+#define BENCH_FILTER(f) { #f, f, ARRAY_SIZE(f) }
+
+static struct bench_filter {
+	const char		*name;
+	struct sock_filter	*insns;
+	unsigned int		len;
+} bench_filters[] = {
+	BENCH_FILTER(bench_udp53),
+	BENCH_FILTER(bench_alu),
+	BENCH_FILTER(bench_jmp),
+	BENCH_FILTER(bench_anc),
+	BENCH_FILTER(bench_nlattr),
+	BENCH_FILTER(bench_negative),
+	BENCH_FILTER(bench_bounds),
+	BENCH_FILTER(bench_div0),
+	/* BPF_MAXINSNS long, filled in at load time */
+	{ "bench_long", NULL, BPF_MAXINSNS },
+};
+
+/*
+ * A load from the UDP header, then arithmetic on A up to the end, all
+ * of which the JA skips for short packets: the branches to the end and
+ * to the epilogue are as far as they get.
+ */
+static struct sock_filter *bench_long_filter(void)
+{
+	struct sock_filter *f;
+	unsigned int i, body = BPF_MAXINSNS - 4;
+
+	f = kcalloc(BPF_MAXINSNS, sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return NULL;
+
+	f[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+	f[1] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+					    64, 1, 0);
+	f[2] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, body, 0, 0);
+	f[3] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 34);
+	for (i = 4; i < BPF_MAXINSNS - 1; i++) {
+		switch (i % 3) {
+		case 0:
+			f[i] = (struct sock_filter)
+				BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0x12345);
+			break;
+		case 1:
+			f[i] = (struct sock_filter)
+				BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x87654321);
+			break;
+		default:
+			f[i] = (struct sock_filter)
+				BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 3);
+			break;
+		}
+	}
+	f[i] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	return f;
+}
+
+#define BENCH_FRAME_LEN	98
+/* how much of the frame the nonlinear packet has in the head */
+#define BENCH_HEADLEN	30
+
+/* Ethernet, IPv4 and UDP to port 53, zeroes for payload */
+static const u8 bench_frame[BENCH_FRAME_LEN] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+	0x45, 0x00, 0x00, 0x54, 0x12, 0x34, 0x40, 0x00,
+	0x40, 0x11, 0x00, 0x00, 0x7f, 0x00, 0x00, 0x01,
+	0x7f, 0x00, 0x00, 0x01,
+	0xab, 0xcd, 0x00, 0x35, 0x00, 0x40, 0x00, 0x00,
+};
+
+enum {
+	BENCH_SKB_LINEAR,
+	BENCH_SKB_FRAGS,
+	BENCH_SKB_NODEV,
+	BENCH_SKB_NLATTR,
+	BENCH_SKB_MAX,
+};
+
+static const char *const bench_skb_names[BENCH_SKB_MAX] = {
+	[BENCH_SKB_LINEAR]	= "linear",
+	[BENCH_SKB_FRAGS]	= "frags",
+	[BENCH_SKB_NODEV]	= "no dev",
+	[BENCH_SKB_NLATTR]	= "nlattr",
+};
+
+static int bench_put_nlattr(struct sk_buff *skb)
+{
+	struct nlattr *nest;
+
+	NLA_PUT_U32(skb, 1, 0x01020304);
+	nest = nla_nest_start(skb, 2);
+	if (!nest)
+		goto nla_put_failure;
+	NLA_PUT_U32(skb, 5, 0x05050505);
+	NLA_PUT_U32(skb, 6, 0x06060606);
+	nla_nest_end(skb, nest);
+	NLA_PUT_U16(skb, 3, 0x0303);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static struct sk_buff *bench_alloc_skb(int kind)
+{
+	struct sk_buff *skb;
+	struct page *page;
+
+	skb = alloc_skb(NET_IP_ALIGN + 256, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, NET_IP_ALIGN + 64);
+	skb->dev = init_net.loopback_dev;
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = PACKET_HOST;
+	skb->mark = 0x12345678;
+	skb->rxhash = 0xdeadbeef;
+	skb_set_queue_mapping(skb, 5);
+
+	switch (kind) {
+	case BENCH_SKB_NLATTR:
+		skb->protocol = htons(ETH_P_ALL);
+		if (bench_put_nlattr(skb))
+			goto err;
+		skb_reset_mac_header(skb);
+		skb_reset_network_header(skb);
+		return skb;
+	case BENCH_SKB_NODEV:
+		skb->dev = NULL;
+		break;
+	}
+
+	if (kind == BENCH_SKB_FRAGS) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			goto err;
+		memcpy(skb_put(skb, BENCH_HEADLEN), bench_frame,
+		       BENCH_HEADLEN);
+		memcpy(page_address(page), bench_frame + BENCH_HEADLEN,
+		       BENCH_FRAME_LEN - BENCH_HEADLEN);
+		skb_fill_page_desc(skb, 0, page, 0,
+				   BENCH_FRAME_LEN - BENCH_HEADLEN);
+		skb->len += BENCH_FRAME_LEN - BENCH_HEADLEN;
+		skb->data_len = BENCH_FRAME_LEN - BENCH_HEADLEN;
+		skb->truesize += PAGE_SIZE;
+	} else {
+		memcpy(skb_put(skb, BENCH_FRAME_LEN), bench_frame,
+		       BENCH_FRAME_LEN);
+	}
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	return skb;
+
+err:
+	kfree_skb(skb);
+	return NULL;
+}
+
+/*
+ * Both runs on the same cpu, for SKF_AD_CPU. Returns false if the
+ * results differ.
+ */
+static bool bench_run(struct sk_filter *fp, struct sk_buff *skb,
+		      u64 *interp_ns, u64 *jit_ns, unsigned int *interp_res,
+		      unsigned int *jit_res)
+{
+	unsigned int i;
+	ktime_t start;
+
+	get_cpu();
+	start = ktime_get();
+	for (i = 0; i < runs; i++)
+		*interp_res = sk_run_filter(skb, fp->insns);
+	*interp_ns += kbench_ns(start);
+
+	start = ktime_get();
+	for (i = 0; i < runs; i++)
+		*jit_res = SK_RUN_FILTER(fp, skb);
+	*jit_ns += kbench_ns(start);
+	put_cpu();
+
+	return *interp_res == *jit_res;
+}
+
+static int bench_filter(const struct bench_filter *bf,
+			struct sk_buff **skbs)
+{
+	struct sock_fprog fprog = {
+		.len	= bf->len,
+		.filter	= bf->insns,
+	};
+	unsigned int interp_res = 0, jit_res = 0;
+	u64 interp_ns = 0, jit_ns = 0;
+	struct sk_filter *fp;
+	int i, err, ret = 0;
+
+	err = sk_unattached_filter_create(&fp, &fprog);
+	if (err) {
+		pr_err("%s: rejected by sk_chk_filter(): %d\n", bf->name, err);
+		return err;
+	}
+
+	for (i = 0; i < BENCH_SKB_MAX; i++) {
+		if (!bench_run(fp, skbs[i], &interp_ns, &jit_ns,
+			       &interp_res, &jit_res)) {
+			pr_err("%s, %s packet: interpreter %u, JIT %u\n",
+			       bf->name, bench_skb_names[i], interp_res,
+			       jit_res);
+			ret = -EINVAL;
+		}
+		cond_resched();
+	}
+
+	pr_info("%-16s %4u insns: interpreter %6llu ns, JIT %6llu ns%s\n",
+		bf->name, bf->len,
+		div_u64(interp_ns, runs * BENCH_SKB_MAX),
+		div_u64(jit_ns, runs * BENCH_SKB_MAX),
+		fp->bpf_func == sk_run_filter ? " (not JITed)" : "");
+
+	sk_unattached_filter_destroy(fp);
+	return ret;
+}
+
+static int __init bpf_jit_bench_init(void)
+{
+	struct sk_buff *skbs[BENCH_SKB_MAX] = { NULL };
+	struct sock_filter *long_insns;
+	int i, err, ret = 0;
+
+	if (!runs)
+		return -EINVAL;
+
+	long_insns = bench_long_filter();
+	if (!long_insns)
+		return -ENOMEM;
+	bench_filters[ARRAY_SIZE(bench_filters) - 1].insns = long_insns;
+
+	for (i = 0; i < BENCH_SKB_MAX; i++) {
+		skbs[i] = bench_alloc_skb(i);
+		if (!skbs[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	pr_info("%u runs per packet, time per packet over %d packets\n",
+		runs, BENCH_SKB_MAX);
+	for (i = 0; i < ARRAY_SIZE(bench_filters); i++) {
+		err = bench_filter(&bench_filters[i], skbs);
+		if (err && !ret)
+			ret = err;
+	}
+
+out:
+	for (i = 0; i < BENCH_SKB_MAX; i++)
+		kfree_skb(skbs[i]);
+	kfree(long_insns);
+	return kbench_done(ret);
+}
+
+static void __exit bpf_jit_bench_exit(void)
+{
+}
+
+module_init(bpf_jit_bench_init);
+module_exit(bpf_jit_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BPF JIT self test and benchmark");
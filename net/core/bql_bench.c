@@ -0,0 +1,254 @@
+/*
+ * Byte queue limits latency under load benchmark.
+ *
+ * A load thread keeps the transmit path of dev saturated with frames of
+ * size bytes, sent to the device's own address with the local
+ * experimental ethertype, so that a switch drops them. Meanwhile probe
+ * frames are sent every interval usecs, each once the previous one is
+ * done, and timed from dev_queue_xmit() to their release by the driver.
+ * The probes get priority prio, by default TC_PRIO_INTERACTIVE, which
+ * pfifo_fast puts ahead of the load: they wait for what is on the
+ * transmit ring, not for the qdisc backlog.
+ *
+ * This is done first with limit_min at DQL_MAX_LIMIT on every tx queue,
+ * which takes the limit out of play, then with the adaptive limit. The
+ * minimum, average and maximum probe latencies go to the kernel log
+ * together with the load rate and the final limit of tx queue 0. The
+ * device needs a driver that reports to BQL (e1000, gianfar, virtio_net)
+ * and nobody else sending much on it; the qdisc is whatever it has, so
+ * replace it with fq_codel and prio=0 to see the probes share it with
+ * the load:
+ *
+ *	modprobe bql_bench dev=NAME [probes=N] [interval=USECS] [size=N]
+ *		[prio=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/kbench.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/pkt_sched.h>
+#include <linux/skbuff.h>
+
+static char *dev = "eth0";
+module_param(dev, charp, 0444);
+MODULE_PARM_DESC(dev, "ethernet device to load and probe");
+
+static unsigned int probes = 1000;
+module_param(probes, uint, 0444);
+MODULE_PARM_DESC(probes, "probe frames timed in each run");
+
+static unsigned int interval = 1000;
+module_param(interval, uint, 0444);
+MODULE_PARM_DESC(interval, "usecs between probe frames");
+
+static unsigned int size = ETH_FRAME_LEN;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "bytes in each load frame, ethernet header included");
+
+static unsigned int prio = TC_PRIO_INTERACTIVE;
+module_param(prio, uint, 0444);
+MODULE_PARM_DESC(prio, "skb priority of the probe frames");
+
+/* IEEE 802 local experimental ethertype */
+#define BQL_BENCH_ETH_P		0x88B5
+
+/* the one probe frame on its way, see bql_bench_probe_destructor() */
+static struct {
+	ktime_t			start;
+	s64			ns;
+	struct completion	done;
+} bql_bench_probe;
+
+struct bql_bench_load {
+	struct net_device	*dev;
+	unsigned long		sent;
+	unsigned long		dropped;
+};
+
+static struct sk_buff *bql_bench_frame(struct net_device *dev,
+				       unsigned int len)
+{
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+
+	skb = alloc_skb(LL_RESERVED_SPACE(dev) + len, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reserve(skb, LL_RESERVED_SPACE(dev));
+	skb_reset_mac_header(skb);
+	memset(skb_put(skb, len), 0, len);
+
+	eth = eth_hdr(skb);
+	memcpy(eth->h_dest, dev->dev_addr, ETH_ALEN);
+	memcpy(eth->h_source, dev->dev_addr, ETH_ALEN);
+	eth->h_proto = htons(BQL_BENCH_ETH_P);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = eth->h_proto;
+	skb->dev = dev;
+	return skb;
+}
+
+static int bql_bench_load_thread(void *data)
+{
+	struct bql_bench_load *l = data;
+	struct sk_buff *skb;
+
+	while (!kthread_should_stop()) {
+		skb = bql_bench_frame(l->dev, size);
+		if (!skb) {
+			msleep(1);
+			continue;
+		}
+		/* the qdisc drops what it has no room for */
+		if (dev_queue_xmit(skb) == NET_XMIT_SUCCESS)
+			l->sent++;
+		else
+			l->dropped++;
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Runs when the driver releases the probe, possibly in irq context */
+static void bql_bench_probe_destructor(struct sk_buff *skb)
+{
+	bql_bench_probe.ns = kbench_ns(bql_bench_probe.start);
+	complete(&bql_bench_probe.done);
+}
+
+/*
+ * Sends a probe and waits for it to be released, even when it is
+ * dropped: the destructor must not outlive the module.
+ */
+static int bql_bench_send_probe(struct net_device *dev, s64 *ns)
+{
+	struct sk_buff *skb;
+	int ret;
+
+	skb = bql_bench_frame(dev, ETH_ZLEN);
+	if (!skb)
+		return -ENOMEM;
+	skb->priority = prio;
+	skb->destructor = bql_bench_probe_destructor;
+
+	INIT_COMPLETION(bql_bench_probe.done);
+	bql_bench_probe.start = ktime_get();
+	ret = dev_queue_xmit(skb);
+	wait_for_completion(&bql_bench_probe.done);
+	*ns = bql_bench_probe.ns;
+	return ret == NET_XMIT_SUCCESS ? 0 : -ENOBUFS;
+}
+
+static int bql_bench_run(struct net_device *dev, bool limited)
+{
+	struct bql_bench_load l = { .dev = dev };
+	u64 min = ~0ULL, max = 0, sum = 0;
+	unsigned int *min_limit, i, done = 0, lost = 0;
+	struct task_struct *task;
+	ktime_t start;
+	s64 ns, load_ns;
+	int err = 0;
+
+	min_limit = kcalloc(dev->num_tx_queues, sizeof(*min_limit),
+			    GFP_KERNEL);
+	if (!min_limit)
+		return -ENOMEM;
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct dql *dql = &netdev_get_tx_queue(dev, i)->dql;
+
+		min_limit[i] = dql->min_limit;
+		if (!limited)
+			dql->min_limit = DQL_MAX_LIMIT;
+	}
+
+	task = kthread_run(bql_bench_load_thread, &l, "bql_bench");
+	if (IS_ERR(task)) {
+		err = PTR_ERR(task);
+		goto out;
+	}
+	start = ktime_get();
+	/* let the ring and the limit settle under the load */
+	msleep(200);
+
+	for (i = 0; i < probes && !err; i++) {
+		err = bql_bench_send_probe(dev, &ns);
+		if (err == -ENOBUFS) {
+			lost++;
+			err = 0;
+		} else if (!err) {
+			min = min_t(u64, min, ns);
+			max = max_t(u64, max, ns);
+			sum += ns;
+			done++;
+		}
+		usleep_range(interval, interval + interval / 4 + 1);
+	}
+
+	kthread_stop(task);
+	load_ns = kbench_ns(start);
+	if (err)
+		goto out;
+
+	pr_info("%s: probe latency min %llu avg %llu max %llu ns, %u lost\n",
+		limited ? "adaptive limit" : "limit_min max",
+		done ? min : 0, done ? div64_u64(sum, done) : 0, max, lost);
+	pr_info("%s: load %llu frames/s, %lu dropped by the qdisc, tx-0 limit %u\n",
+		limited ? "adaptive limit" : "limit_min max",
+		kbench_rate(l.sent, load_ns), l.dropped,
+		netdev_get_tx_queue(dev, 0)->dql.limit);
+out:
+	for (i = 0; i < dev->num_tx_queues; i++)
+		netdev_get_tx_queue(dev, i)->dql.min_limit = min_limit[i];
+	kfree(min_limit);
+	return err;
+}
+
+static int __init bql_bench_init(void)
+{
+	struct net_device *netdev;
+	int ret;
+
+	if (!probes || size < ETH_ZLEN || size > ETH_FRAME_LEN)
+		return -EINVAL;
+
+	netdev = dev_get_by_name(&init_net, dev);
+	if (!netdev)
+		return -ENODEV;
+	ret = -EINVAL;
+	if (netdev->type != ARPHRD_ETHER)
+		goto out;
+	ret = -ENETDOWN;
+	if (!netif_running(netdev))
+		goto out;
+
+	init_completion(&bql_bench_probe.done);
+	pr_info("%s: %u probes every %u usecs under %u byte frames\n",
+		netdev->name, probes, interval, size);
+	ret = bql_bench_run(netdev, false);
+	if (!ret)
+		ret = bql_bench_run(netdev, true);
+out:
+	dev_put(netdev);
+	return kbench_done(ret);
+}
+
+static void __exit bql_bench_exit(void)
+{
+}
+
+module_init(bql_bench_init);
+module_exit(bql_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("byte queue limits latency under load benchmark");
@@ -56,6 +56,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -159,14 +160,60 @@ out_noerr:
  */
 struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 				    int *peeked, int *err)
+{
+	return skb_recv_datagram_batch(sk, NULL, flags, peeked, err);
+}
+EXPORT_SYMBOL(__skb_recv_datagram);
+
+/* Move what @batch may still want of the receive queue to its rxq */
+static void skb_dequeue_batch(struct sk_buff_head *queue,
+			      struct sock_batch *batch)
+{
+	unsigned int n = batch->budget > 1 ? batch->budget - 1 : 0;
+
+	if (n >= skb_queue_len(queue))
+		skb_queue_splice_tail_init(queue, &batch->rxq);
+	else
+		while (n--)
+			__skb_queue_tail(&batch->rxq, __skb_dequeue(queue));
+}
+
+/**
+ *	skb_recv_datagram_batch - Receive a datagram skbuff for recvmmsg()
+ *	@sk: socket
+ *	@batch: state of the recvmmsg() call, or %NULL
+ *	@flags: MSG_ flags
+ *	@peeked: returns non-zero if this packet has been seen before
+ *	@err: error code returned
+ *
+ *	Like __skb_recv_datagram(), but when the queue lock is taken for a
+ *	datagram, up to @batch->budget - 1 more are taken off the queue too
+ *	and handed out by the following calls without locking. Whatever
+ *	is left over goes back with sock_batch_end().
+ */
+struct sk_buff *skb_recv_datagram_batch(struct sock *sk,
+					struct sock_batch *batch,
+					unsigned flags, int *peeked, int *err)
 {
 	struct sk_buff *skb;
 	long timeo;
 	/*
 	 * Caller is allowed not to check sk->sk_err before skb_recv_datagram()
 	 */
-	int error = sock_error(sk);
+	int error;
+
+	if (batch && !skb_queue_empty(&batch->rxq)) {
+		skb = skb_peek(&batch->rxq);
+		*peeked = skb->peeked;
+		if (flags & MSG_PEEK) {
+			skb->peeked = 1;
+			atomic_inc(&skb->users);
+		} else
+			__skb_unlink(skb, &batch->rxq);
+		return skb;
+	}
 
+	error = sock_error(sk);
 	if (error)
 		goto no_packet;
 
@@ -188,14 +235,22 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 			if (flags & MSG_PEEK) {
 				skb->peeked = 1;
 				atomic_inc(&skb->users);
-			} else
+			} else {
 				__skb_unlink(skb, &sk->sk_receive_queue);
+				if (batch)
+					skb_dequeue_batch(&sk->sk_receive_queue,
+							  batch);
+			}
 		}
 		spin_unlock_irqrestore(&sk->sk_receive_queue.lock, cpu_flags);
 
 		if (skb)
 			return skb;
 
+		if (sk_can_busy_loop(sk) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
+
 		/* User doesn't want to wait */
 		error = -EAGAIN;
 		if (!timeo)
@@ -209,7 +264,7 @@ no_packet:
 	*err = error;
 	return NULL;
 }
-EXPORT_SYMBOL(__skb_recv_datagram);
+EXPORT_SYMBOL(skb_recv_datagram_batch);
 
 struct sk_buff *skb_recv_datagram(struct sock *sk, unsigned flags,
 				  int noblock, int *err)
@@ -248,6 +303,75 @@ void skb_free_datagram_locked(struct sock *sk, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(skb_free_datagram_locked);
 
+/**
+ *	skb_free_datagram_batch - Free a datagram skbuff read by recvmmsg()
+ *	@sk: socket
+ *	@batch: state of the recvmmsg() call, or %NULL
+ *	@skb: datagram
+ *
+ *	Like skb_free_datagram_locked(), but in a batch the memory of the
+ *	datagram goes back to the socket, under a single socket lock with
+ *	the others, in sock_batch_end().
+ */
+void skb_free_datagram_batch(struct sock *sk, struct sock_batch *batch,
+			     struct sk_buff *skb)
+{
+	if (!batch) {
+		skb_free_datagram_locked(sk, skb);
+		return;
+	}
+
+	if (likely(atomic_read(&skb->users) == 1))
+		smp_rmb();
+	else if (likely(!atomic_dec_and_test(&skb->users)))
+		return;
+
+	__skb_queue_tail(&batch->done, skb);
+}
+EXPORT_SYMBOL(skb_free_datagram_batch);
+
+/**
+ *	sock_batch_end - Finish a sendmmsg() or recvmmsg() call
+ *	@sk: socket
+ *	@batch: state of the call
+ *
+ *	Drops the route kept for the call, puts the datagrams it did not
+ *	get to back at the head of the receive queue and frees those it
+ *	read.
+ */
+void sock_batch_end(struct sock *sk, struct sock_batch *batch)
+{
+	unsigned long cpu_flags;
+	struct sk_buff *skb;
+	bool slow;
+
+	dst_release(batch->dst);
+	batch->dst = NULL;
+
+	if (!skb_queue_empty(&batch->rxq)) {
+		spin_lock_irqsave(&sk->sk_receive_queue.lock, cpu_flags);
+		skb_queue_splice_init(&batch->rxq, &sk->sk_receive_queue);
+		spin_unlock_irqrestore(&sk->sk_receive_queue.lock, cpu_flags);
+		/* someone may have gone to sleep on the queue meanwhile */
+		sk->sk_data_ready(sk, 0);
+	}
+
+	if (skb_queue_empty(&batch->done))
+		return;
+
+	slow = lock_sock_fast(sk);
+	skb_queue_walk(&batch->done, skb)
+		skb_orphan(skb);
+	sk_mem_reclaim_partial(sk);
+	unlock_sock_fast(sk, slow);
+
+	while ((skb = __skb_dequeue(&batch->done)) != NULL) {
+		trace_kfree_skb(skb, sock_batch_end);
+		__kfree_skb(skb);
+	}
+}
+EXPORT_SYMBOL(sock_batch_end);
+
 /**
  *	skb_kill_datagram - Free a datagram skbuff forcibly
  *	@sk: socket
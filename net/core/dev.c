@@ -123,6 +123,7 @@
 #include <linux/if_vlan.h>
 #include <linux/ip.h>
 #include <net/ip.h>
+#include <net/tcp.h>
 #include <linux/ipv6.h>
 #include <linux/in.h>
 #include <linux/jhash.h>
@@ -133,6 +134,7 @@
 #include <linux/pci.h>
 #include <linux/inetdevice.h>
 #include <linux/cpu_rmap.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -1586,6 +1588,12 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			if (!skb2)
 				break;
 
+			/* a tap may keep it as long as a receiver would */
+			if (skb_orphan_frags_rx(skb2, GFP_ATOMIC)) {
+				kfree_skb(skb2);
+				break;
+			}
+
 			net_timestamp_set(skb2);
 
 			/* skb->nh should be correctly
@@ -1914,6 +1922,65 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb, u32 features)
 }
 EXPORT_SYMBOL(skb_gso_segment);
 
+/**
+ *	skb_tunnel_gso_segment - Perform segmentation inside a tunnel
+ *	@skb: buffer to segment, data at the tunnel header
+ *	@features: features for the output path (see dev->features)
+ *	@tnl_hlen: length of the tunnel headers in front of the inner packet
+ *	@type: ethertype of the inner network header
+ *
+ *	Called from the gso_segment callback of a tunnel protocol, for
+ *	packets that GRO aggregated inside the tunnel. The inner packet is
+ *	segmented by its own protocol and every segment gets a copy of the
+ *	outer headers. The offloads of the output device only apply to the
+ *	outer headers, so the inner checksums are computed in software.
+ *	The outer network and transport headers of the segments are left
+ *	for the caller and its callers to fix up.
+ */
+struct sk_buff *skb_tunnel_gso_segment(struct sk_buff *skb, u32 features,
+				       unsigned int tnl_hlen, __be16 type)
+{
+	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
+	struct packet_type *ptype;
+	unsigned int thoff = skb_transport_header(skb) - skb_mac_header(skb);
+	int mac_len = skb->mac_len;
+
+	if (unlikely(!pskb_may_pull(skb, tnl_hlen)))
+		return ERR_PTR(-EINVAL);
+
+	__skb_pull(skb, tnl_hlen);
+	skb_reset_network_header(skb);
+	skb->mac_len = skb->data - skb_mac_header(skb);
+
+	features &= ~(NETIF_F_SG | NETIF_F_ALL_CSUM | NETIF_F_GSO_MASK);
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype,
+			&ptype_base[ntohs(type) & PTYPE_HASH_MASK], list) {
+		if (ptype->type == type && !ptype->dev && ptype->gso_segment) {
+			segs = ptype->gso_segment(skb, features);
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	skb->mac_len = mac_len;
+	skb->network_header = skb->mac_header + mac_len;
+	skb->transport_header = skb->mac_header + thoff;
+
+	if (IS_ERR_OR_NULL(segs))
+		return segs;
+
+	for (skb = segs; skb; skb = skb->next) {
+		skb->mac_len = mac_len;
+		skb->network_header = skb->mac_header + mac_len;
+		skb->transport_header = skb->mac_header + thoff;
+	}
+
+	return segs;
+}
+EXPORT_SYMBOL(skb_tunnel_gso_segment);
+
 /* Take action when hardware reception checksum errors are detected. */
 #ifdef CONFIG_BUG
 void netdev_rx_csum_fault(struct net_device *dev)
@@ -2012,11 +2079,17 @@ static int dev_gso_segment(struct sk_buff *skb, int features)
  * Try to orphan skb early, right before transmission by the device.
  * We cannot orphan skb if tx timestamp is requested or the sk-reference
  * is needed on driver level for other reasons, e.g. see net/can/raw.c
+ * TCP small queues want their skbs charged to the socket until the
+ * device is done with them, see tcp_wfree().
  */
 static inline void skb_orphan_try(struct sk_buff *skb)
 {
 	struct sock *sk = skb->sk;
 
+#ifdef CONFIG_INET
+	if (skb->destructor == tcp_wfree)
+		return;
+#endif
 	if (sk && !skb_shinfo(skb)->tx_flags) {
 		/* skb_tx_hash() wont be able to get sk.
 		 * We copy sk_hash into skb->rxhash
@@ -2185,7 +2258,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -2427,7 +2500,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 	txq = dev_pick_tx(dev, skb);
 	if ((dev->features & NETIF_F_HW_QDISC) &&
-	    likely(!netif_tx_queue_stopped(txq))) {
+	    likely(!netif_xmit_stopped(txq))) {
 		rc = dev_hard_start_xmit(skb, dev, txq);
 		goto out;
 	}
@@ -2465,7 +2538,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
 				rc = dev_hard_start_xmit(skb, dev, txq);
 				__this_cpu_dec(xmit_recursion);
@@ -2508,6 +2581,7 @@ EXPORT_SYMBOL(dev_queue_xmit);
 int netdev_max_backlog __read_mostly = 1000;
 int netdev_tstamp_prequeue __read_mostly = 1;
 int netdev_budget __read_mostly = 300;
+int gro_normal_batch __read_mostly = 8;
 int weight_p __read_mostly = 64;            /* old backlog weight */
 
 /* Called with irq disabled */
@@ -3133,10 +3207,66 @@ void netdev_rx_handler_unregister(struct net_device *dev)
 }
 EXPORT_SYMBOL_GPL(netdev_rx_handler_unregister);
 
-static int __netif_receive_skb(struct sk_buff *skb)
+#ifdef CONFIG_AS_FASTPATH
+static rx_handler_func_t __rcu *netif_fastpath_hook __read_mostly;
+static DEFINE_SPINLOCK(netif_fastpath_lock);
+
+/**
+ *	netif_fastpath_register - register the receive fastpath
+ *	@hook: handler to call for the frames of every device
+ *
+ *	The fastpath sees what any device receives, after the taps and
+ *	before the rx_handler of the device. It may consume a frame by
+ *	returning RX_HANDLER_CONSUMED; the frame goes on otherwise. There
+ *	is a single fastpath, so -EBUSY is returned if it is taken.
+ */
+int netif_fastpath_register(rx_handler_func_t *hook)
 {
+	int err = 0;
+
+	spin_lock(&netif_fastpath_lock);
+	if (rcu_dereference_protected(netif_fastpath_hook,
+				      lockdep_is_held(&netif_fastpath_lock)))
+		err = -EBUSY;
+	else
+		rcu_assign_pointer(netif_fastpath_hook, hook);
+	spin_unlock(&netif_fastpath_lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(netif_fastpath_register);
+
+/**
+ *	netif_fastpath_unregister - unregister the receive fastpath
+ *
+ *	The hook may still run until an RCU grace period has elapsed,
+ *	synchronize_net() before it goes away.
+ */
+void netif_fastpath_unregister(void)
+{
+	spin_lock(&netif_fastpath_lock);
+	rcu_assign_pointer(netif_fastpath_hook, NULL);
+	spin_unlock(&netif_fastpath_lock);
+}
+EXPORT_SYMBOL_GPL(netif_fastpath_unregister);
+#endif
+
+static int __netif_receive_skb(struct sk_buff *skb);
+
+/*
+ * Everything __netif_receive_skb() does but the final delivery: the
+ * packet_type that is to get the buffer is left in *ppt_prev, NULL if
+ * the buffer was consumed or dropped on the way. Called under
+ * rcu_read_lock(), which must be held until the delivery is made.
+ */
+static int __netif_receive_skb_core(struct sk_buff **pskb,
+				    struct packet_type **ppt_prev)
+{
+	struct sk_buff *skb = *pskb;
 	struct packet_type *ptype, *pt_prev;
 	rx_handler_func_t *rx_handler;
+#ifdef CONFIG_AS_FASTPATH
+	rx_handler_func_t *fastpath;
+#endif
 	struct net_device *orig_dev;
 	struct net_device *null_or_dev;
 	bool deliver_exact = false;
@@ -3152,6 +3282,13 @@ static int __netif_receive_skb(struct sk_buff *skb)
 	if (netpoll_receive_skb(skb))
 		return NET_RX_DROP;
 
+	/* looped back MSG_ZEROCOPY data: the reader may take its time */
+	if (skb_orphan_frags_rx(skb, GFP_ATOMIC)) {
+		atomic_long_inc(&skb->dev->rx_dropped);
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
 	if (!skb->skb_iif)
 		skb->skb_iif = skb->dev->ifindex;
 	orig_dev = skb->dev;
@@ -3162,8 +3299,6 @@ static int __netif_receive_skb(struct sk_buff *skb)
 
 	pt_prev = NULL;
 
-	rcu_read_lock();
-
 another_round:
 
 	__this_cpu_inc(softnet_data.processed);
@@ -3196,6 +3331,20 @@ another_round:
 ncls:
 #endif
 
+#ifdef CONFIG_AS_FASTPATH
+	fastpath = rcu_dereference(netif_fastpath_hook);
+	if (fastpath) {
+		if (pt_prev) {
+			ret = deliver_skb(skb, pt_prev, orig_dev);
+			pt_prev = NULL;
+		}
+		if (fastpath(&skb) == RX_HANDLER_CONSUMED) {
+			ret = NET_RX_SUCCESS;
+			goto out;
+		}
+	}
+#endif
+
 	rx_handler = rcu_dereference(skb->dev->rx_handler);
 	if (rx_handler) {
 		if (pt_prev) {
@@ -3244,21 +3393,86 @@ ncls:
 	}
 
 	if (pt_prev) {
-		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
-	} else {
-		atomic_long_inc(&skb->dev->rx_dropped);
-		kfree_skb(skb);
-		/* Jamal, now you will not able to escape explaining
-		 * me how you were going to use this. :-)
-		 */
-		ret = NET_RX_DROP;
+		*ppt_prev = pt_prev;
+		*pskb = skb;
+		return ret;
 	}
 
+	atomic_long_inc(&skb->dev->rx_dropped);
+	kfree_skb(skb);
+	/* Jamal, now you will not able to escape explaining
+	 * me how you were going to use this. :-)
+	 */
+	ret = NET_RX_DROP;
+
 out:
+	return ret;
+}
+
+static int __netif_receive_skb(struct sk_buff *skb)
+{
+	struct net_device *orig_dev = skb->dev;
+	struct packet_type *pt_prev = NULL;
+	int ret;
+
+	rcu_read_lock();
+	ret = __netif_receive_skb_core(&skb, &pt_prev);
+	if (pt_prev)
+		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	rcu_read_unlock();
 	return ret;
 }
 
+static void __netif_receive_skb_list_ptype(struct sk_buff_head *list,
+					   struct packet_type *pt_prev,
+					   struct net_device *orig_dev)
+{
+	struct sk_buff *skb;
+
+	if (!pt_prev || skb_queue_empty(list))
+		return;
+
+	if (pt_prev->list_func) {
+		pt_prev->list_func(list, pt_prev, orig_dev);
+		return;
+	}
+
+	while ((skb = __skb_dequeue(list)))
+		pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+}
+
+/*
+ * Runs each buffer through __netif_receive_skb_core() and hands runs of
+ * buffers that came in on the same device and go to the same packet_type
+ * over to that packet_type in one go. Called under rcu_read_lock().
+ */
+static void __netif_receive_skb_list_core(struct sk_buff_head *list)
+{
+	struct packet_type *pt_curr = NULL;
+	struct net_device *od_curr = NULL;
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(list))) {
+		struct net_device *orig_dev = skb->dev;
+		struct packet_type *pt_prev = NULL;
+
+		__netif_receive_skb_core(&skb, &pt_prev);
+		if (!pt_prev)
+			continue;
+		if (pt_curr != pt_prev || od_curr != orig_dev) {
+			/* dispatch the old sublist, start a new one */
+			__netif_receive_skb_list_ptype(&sublist, pt_curr,
+						       od_curr);
+			pt_curr = pt_prev;
+			od_curr = orig_dev;
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	__netif_receive_skb_list_ptype(&sublist, pt_curr, od_curr);
+}
+
 /**
  *	netif_receive_skb - process receive buffer from network
  *	@skb: buffer to process
@@ -3303,6 +3517,54 @@ int netif_receive_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_receive_skb);
 
+/**
+ *	netif_receive_skb_list - process many receive buffers from network
+ *	@list: list of skbs to process, left empty
+ *
+ *	Like netif_receive_skb() for every buffer on @list, but the buffers
+ *	that take the same way through the stack take it together: a
+ *	protocol that has a list_func, like IPv4, validates, filters and
+ *	routes the whole batch before it delivers the first packet. The
+ *	order of the buffers is kept.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ */
+void netif_receive_skb_list(struct sk_buff_head *list)
+{
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(list))) {
+		if (netdev_tstamp_prequeue)
+			net_timestamp_check(skb);
+		if (!skb_defer_rx_timestamp(skb))
+			__skb_queue_tail(&sublist, skb);
+	}
+	skb_queue_splice_init(&sublist, list);
+
+	rcu_read_lock();
+#ifdef CONFIG_RPS
+	if (static_branch(&rps_needed)) {
+		struct sk_buff *next;
+
+		skb_queue_walk_safe(list, skb, next) {
+			struct rps_dev_flow voidflow, *rflow = &voidflow;
+			int cpu = get_rps_cpu(skb->dev, skb, &rflow);
+
+			if (cpu >= 0) {
+				__skb_unlink(skb, list);
+				enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
+			}
+		}
+	}
+#endif
+	__netif_receive_skb_list_core(list);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(netif_receive_skb_list);
+
 /* Network device is going away, flush any packets still pending
  * Called with irqs disabled.
  */
@@ -3334,7 +3596,24 @@ static void flush_backlog(void *arg)
 		raise_softirq_irqoff(NET_RX_SOFTIRQ);
 }
 
-static int napi_gro_complete(struct sk_buff *skb)
+/* Pass the buffers GRO had nothing to do with up the stack as a list */
+static void gro_normal_list(struct napi_struct *napi)
+{
+	if (!skb_queue_empty(&napi->rx_list))
+		netif_receive_skb_list(&napi->rx_list);
+}
+
+/* Queue a buffer for gro_normal_list(), which runs once gro_normal_batch
+ * of them are waiting, when GRO is flushed and when the poll is over.
+ */
+static void gro_normal_one(struct napi_struct *napi, struct sk_buff *skb)
+{
+	__skb_queue_tail(&napi->rx_list, skb);
+	if (skb_queue_len(&napi->rx_list) >= gro_normal_batch)
+		gro_normal_list(napi);
+}
+
+static int napi_gro_complete(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct packet_type *ptype;
 	__be16 type = skb->protocol;
@@ -3363,7 +3642,8 @@ static int napi_gro_complete(struct sk_buff *skb)
 	}
 
 out:
-	return netif_receive_skb(skb);
+	gro_normal_one(napi, skb);
+	return NET_RX_SUCCESS;
 }
 
 inline void napi_gro_flush(struct napi_struct *napi)
@@ -3373,14 +3653,91 @@ inline void napi_gro_flush(struct napi_struct *napi)
 	for (skb = napi->gro_list; skb; skb = next) {
 		next = skb->next;
 		skb->next = NULL;
-		napi_gro_complete(skb);
+		napi_gro_complete(napi, skb);
 	}
 
 	napi->gro_count = 0;
 	napi->gro_list = NULL;
+	gro_normal_list(napi);
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
+/**
+ *	gro_receive_inner - pass a tunnelled packet on to its inner protocol
+ *	@head: list of packets held by GRO
+ *	@skb: packet, with its GRO offset at the inner network header
+ *	@type: ethertype of the inner network header
+ *
+ *	Called from the gro_receive callback of a tunnel protocol once the
+ *	tunnel header of @skb has been compared with those in @head. While
+ *	the inner protocol runs, the network header of @skb is the inner
+ *	one. Tunnels within tunnels are not aggregated.
+ */
+struct sk_buff **gro_receive_inner(struct sk_buff **head, struct sk_buff *skb,
+				   __be16 type)
+{
+	struct list_head *list = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	int nhoff;
+
+	if (NAPI_GRO_CB(skb)->encapsulation)
+		goto flush;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, list, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+
+		nhoff = skb_network_offset(skb);
+		skb_set_network_header(skb, skb_gro_offset(skb));
+		NAPI_GRO_CB(skb)->encapsulation = 1;
+
+		pp = ptype->gro_receive(head, skb);
+
+		skb_set_network_header(skb, nhoff);
+		rcu_read_unlock();
+		return pp;
+	}
+	rcu_read_unlock();
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+EXPORT_SYMBOL(gro_receive_inner);
+
+/**
+ *	gro_complete_inner - finish the inner packet of a tunnelled aggregate
+ *	@skb: aggregate built by gro_receive_inner()
+ *	@type: ethertype of the inner network header
+ *	@nhoff: offset of the inner network header from skb->data
+ *
+ *	Called from the gro_complete callback of a tunnel protocol.
+ */
+int gro_complete_inner(struct sk_buff *skb, __be16 type, int nhoff)
+{
+	struct list_head *list = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+	int outer = skb_network_offset(skb);
+	int err = -ENOENT;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, list, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+
+		skb_set_network_header(skb, nhoff);
+		err = ptype->gro_complete(skb);
+		skb_set_network_header(skb, outer);
+		break;
+	}
+	rcu_read_unlock();
+
+	return err;
+}
+EXPORT_SYMBOL(gro_complete_inner);
+
 enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct sk_buff **pp = NULL;
@@ -3408,6 +3765,7 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encapsulation = 0;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -3425,7 +3783,7 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 
 		*pp = nskb->next;
 		nskb->next = NULL;
-		napi_gro_complete(nskb);
+		napi_gro_complete(napi, nskb);
 		napi->gro_count--;
 	}
 
@@ -3479,6 +3837,8 @@ __napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	struct sk_buff *p;
 	unsigned int maclen = skb->dev->hard_header_len;
 
+	skb_mark_napi_id(skb, napi);
+
 	for (p = napi->gro_list; p; p = p->next) {
 		unsigned long diffs;
 
@@ -3538,9 +3898,16 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	gro_result_t ret;
+
 	skb_gro_reset_offset(skb);
 
-	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
+	ret = __napi_gro_receive(napi, skb);
+	if (ret == GRO_NORMAL) {
+		gro_normal_one(napi, skb);
+		return ret;
+	}
+	return napi_skb_finish(ret, skb);
 }
 EXPORT_SYMBOL(napi_gro_receive);
 
@@ -3579,8 +3946,8 @@ gro_result_t napi_frags_finish(struct napi_struct *napi, struct sk_buff *skb,
 
 		if (ret == GRO_HELD)
 			skb_gro_pull(skb, -ETH_HLEN);
-		else if (netif_receive_skb(skb))
-			ret = GRO_DROP;
+		else
+			gro_normal_one(napi, skb);
 		break;
 
 	case GRO_DROP:
@@ -3750,7 +4117,6 @@ EXPORT_SYMBOL(__napi_schedule);
 void __napi_complete(struct napi_struct *n)
 {
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
-	BUG_ON(n->gro_list);
 
 	list_del(&n->poll_list);
 	smp_mb__before_clear_bit();
@@ -3758,9 +4124,9 @@ void __napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(__napi_complete);
 
-void napi_complete(struct napi_struct *n)
+void napi_complete_done(struct napi_struct *n, int work_done)
 {
-	unsigned long flags;
+	unsigned long flags, timeout = 0;
 
 	/*
 	 * don't let napi dequeue from the cpu poll list
@@ -3769,19 +4135,115 @@ void napi_complete(struct napi_struct *n)
 	if (unlikely(test_bit(NAPI_STATE_NPSVC, &n->state)))
 		return;
 
-	napi_gro_flush(n);
+	if (n->gro_list) {
+		if (work_done)
+			timeout = n->dev->gro_flush_timeout;
+
+		/* leave a pending timer alone: nothing is held back for
+		 * longer than the timeout, however often we get here
+		 */
+		if (!timeout)
+			napi_gro_flush(n);
+		else if (!hrtimer_is_queued(&n->timer))
+			hrtimer_start(&n->timer, ns_to_ktime(timeout),
+				      HRTIMER_MODE_REL_PINNED);
+	}
+	gro_normal_list(n);
+
 	local_irq_save(flags);
 	__napi_complete(n);
 	local_irq_restore(flags);
 }
-EXPORT_SYMBOL(napi_complete);
+EXPORT_SYMBOL(napi_complete_done);
+
+/*
+ * The GRO flush was deferred by napi_complete_done(). Poll once more:
+ * the driver finds no work and the packets held are flushed.
+ */
+static enum hrtimer_restart napi_watchdog(struct hrtimer *timer)
+{
+	struct napi_struct *napi;
+
+	napi = container_of(timer, struct napi_struct, timer);
+	if (napi->gro_list)
+		napi_schedule(napi);
+
+	return HRTIMER_NORESTART;
+}
+
+#define NAPI_HASH_BITS	8
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+static struct hlist_head *napi_hash_bucket(unsigned int napi_id)
+{
+	return &napi_hash[hash_32(napi_id, NAPI_HASH_BITS)];
+}
+
+/* must be called under rcu_read_lock(), as we dont take a reference */
+struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct hlist_node *node;
+	struct napi_struct *napi;
+
+	hlist_for_each_entry_rcu(napi, node, napi_hash_bucket(napi_id),
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(napi_by_id);
+
+void napi_hash_add(struct napi_struct *napi)
+{
+	if (test_and_set_bit(NAPI_STATE_HASHED, &napi->state))
+		return;
+
+	spin_lock(&napi_hash_lock);
+
+	/* 0 is not a valid id, we also skip an id that is taken
+	 * we expect both events to be extremely rare
+	 */
+	napi->napi_id = 0;
+	while (!napi->napi_id) {
+		napi->napi_id = ++napi_gen_id;
+		if (napi_by_id(napi->napi_id))
+			napi->napi_id = 0;
+	}
+
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   napi_hash_bucket(napi->napi_id));
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+/* Warning : caller is responsible to make sure rcu grace period
+ * is respected before freeing memory containing @napi
+ */
+bool napi_hash_del(struct napi_struct *napi)
+{
+	if (!test_and_clear_bit(NAPI_STATE_HASHED, &napi->state))
+		return false;
+
+	spin_lock(&napi_hash_lock);
+	hlist_del_rcu(&napi->napi_hash_node);
+	spin_unlock(&napi_hash_lock);
+	return true;
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
 
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
 	INIT_LIST_HEAD(&napi->poll_list);
+	hrtimer_init(&napi->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+	napi->timer.function = napi_watchdog;
 	napi->gro_count = 0;
 	napi->gro_list = NULL;
+	__skb_queue_head_init(&napi->rx_list);
 	napi->skb = NULL;
 	napi->poll = poll;
 	napi->weight = weight;
@@ -3799,7 +4261,12 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	/* a busy poller may still be looking at @napi */
+	if (napi_hash_del(napi))
+		synchronize_net();
+
 	list_del_init(&napi->dev_list);
+	hrtimer_cancel(&napi->timer);
 	napi_free_frags(napi);
 
 	for (skb = napi->gro_list; skb; skb = next) {
@@ -3810,6 +4277,7 @@ void netif_napi_del(struct napi_struct *napi)
 
 	napi->gro_list = NULL;
 	napi->gro_count = 0;
+	__skb_queue_purge(&napi->rx_list);
 }
 EXPORT_SYMBOL(netif_napi_del);
 
@@ -3867,6 +4335,12 @@ static void net_rx_action(struct softirq_action *h)
 
 		WARN_ON_ONCE(work > weight);
 
+		/* the poll is over but the instance is still ours: what it
+		 * queued for the stack goes up now rather than next time
+		 */
+		if (work == weight)
+			gro_normal_list(n);
+
 		budget -= work;
 
 		local_irq_disable();
@@ -5446,6 +5920,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 	queue->xmit_lock_owner = -1;
 	netdev_queue_numa_node_write(queue, NUMA_NO_NODE);
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static int netif_alloc_netdev_queues(struct net_device *dev)
@@ -6547,6 +7024,7 @@ static int __init net_dev_init(void)
 		sd->backlog.weight = weight_p;
 		sd->backlog.gro_list = NULL;
 		sd->backlog.gro_count = 0;
+		__skb_queue_head_init(&sd->backlog.rx_list);
 	}
 
 	dev_boot_phase = 0;
@@ -40,8 +40,9 @@
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
 
-/* No hurry in this branch */
-static void *__load_pointer(const struct sk_buff *skb, int k, unsigned int size)
+/* No hurry in this branch, also used by the JITs for negative offsets */
+void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb, int k,
+					   unsigned int size)
 {
 	u8 *ptr = NULL;
 
@@ -60,7 +61,42 @@ static inline void *load_pointer(const struct sk_buff *skb, int k,
 {
 	if (k >= 0)
 		return skb_header_pointer(skb, k, size, buffer);
-	return __load_pointer(skb, k, size);
+	return bpf_internal_load_pointer_neg_helper(skb, k, size);
+}
+
+/*
+ * BPF_S_ANC_NLATTR and BPF_S_ANC_NLATTR_NEST, for the JITs as well:
+ * the offset in the packet of attribute X of the list, or of the nest,
+ * at offset A, 0 if there is none, or -1 if the filter has to return 0.
+ */
+int sk_filter_nlattr(const struct sk_buff *skb, u32 A, u32 X)
+{
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return -1;
+	if (A > skb->len - sizeof(struct nlattr))
+		return -1;
+
+	nla = nla_find((struct nlattr *)&skb->data[A], skb->len - A, X);
+	return nla ? (void *)nla - (void *)skb->data : 0;
+}
+
+int sk_filter_nlattr_nest(const struct sk_buff *skb, u32 A, u32 X)
+{
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return -1;
+	if (A > skb->len - sizeof(struct nlattr))
+		return -1;
+
+	nla = (struct nlattr *)&skb->data[A];
+	if (nla->nla_len > A - skb->len)
+		return -1;
+
+	nla = nla_find_nested(nla, X);
+	return nla ? (void *)nla - (void *)skb->data : 0;
 }
 
 /**
@@ -315,41 +351,18 @@ load_b:
 		case BPF_S_ANC_CPU:
 			A = raw_smp_processor_id();
 			continue;
-		case BPF_S_ANC_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
+		case BPF_S_ANC_NLATTR:
+			k = sk_filter_nlattr(skb, A, X);
+			if (k < 0)
 				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
+			A = k;
 			continue;
-		}
-		case BPF_S_ANC_NLATTR_NEST: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
+		case BPF_S_ANC_NLATTR_NEST:
+			k = sk_filter_nlattr_nest(skb, A, X);
+			if (k < 0)
 				return 0;
-
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
-				return 0;
-
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
+			A = k;
 			continue;
-		}
 		default:
 			WARN_RATELIMIT(1, "Unknown code:%u jt:%u tf:%u k:%u\n",
 				       fentry->code, fentry->jt,
@@ -637,6 +650,52 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(sk_attach_filter);
 
+/**
+ *	sk_unattached_filter_create - create a filter not bound to a socket
+ *	@pfp: the new filter is returned here
+ *	@fprog: the filter program, in kernel memory
+ *
+ * Like sk_attach_filter(), for users in the kernel that run the filter
+ * themselves with SK_RUN_FILTER(). Release it with
+ * sk_unattached_filter_destroy().
+ */
+int sk_unattached_filter_create(struct sk_filter **pfp,
+				struct sock_fprog *fprog)
+{
+	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
+	struct sk_filter *fp;
+	int err;
+
+	if (fprog->filter == NULL)
+		return -EINVAL;
+
+	fp = kmalloc(fsize + sizeof(*fp), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, fprog->filter, fsize);
+
+	atomic_set(&fp->refcnt, 1);
+	fp->len = fprog->len;
+	fp->bpf_func = sk_run_filter;
+
+	err = sk_chk_filter(fp->insns, fp->len);
+	if (err) {
+		kfree(fp);
+		return err;
+	}
+
+	bpf_jit_compile(fp);
+	*pfp = fp;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sk_unattached_filter_create);
+
+void sk_unattached_filter_destroy(struct sk_filter *fp)
+{
+	sk_filter_release(fp);
+}
+EXPORT_SYMBOL_GPL(sk_unattached_filter_destroy);
+
 int sk_detach_filter(struct sock *sk)
 {
 	int ret = -ENOENT;
@@ -0,0 +1,175 @@
+/*
+ * Neighbour table churn benchmark.
+ *
+ * Creates neighbour entries for distinct addresses in a private table,
+ * looks each up again and drops its reference, as an ARP storm on a
+ * large L2 segment does. The table is capped at gc_thresh3 = entries,
+ * so past that point forced GC has to make room for every new entry.
+ * The rate, in new entries per second, and the bucket lock contention
+ * go to the kernel log, see lib/kbench.c:
+ *
+ *	modprobe neigh_bench [creates=N] [entries=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kbench.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <net/net_namespace.h>
+#include <net/neighbour.h>
+
+static unsigned int creates = 200000;
+module_param(creates, uint, 0444);
+MODULE_PARM_DESC(creates, "entries created by each thread");
+
+static unsigned int entries = 65536;
+module_param(entries, uint, 0444);
+MODULE_PARM_DESC(entries, "most entries in the table");
+
+static u32 neigh_bench_hash(const void *pkey, const struct net_device *dev,
+			    __u32 hash_rnd)
+{
+	return jhash_2words(*(u32 *)pkey, dev->ifindex, hash_rnd);
+}
+
+/* only for the netlink notifications of discarded entries */
+static const struct neigh_ops neigh_bench_ops = {
+	.family =		AF_UNSPEC,
+};
+
+static int neigh_bench_constructor(struct neighbour *n)
+{
+	n->ops = &neigh_bench_ops;
+	n->nud_state = NUD_NOARP;
+	return 0;
+}
+
+static struct neigh_table neigh_bench_tbl = {
+	.family =	AF_UNSPEC,
+	.entry_size =	sizeof(struct neighbour) + 4,
+	.key_len =	4,
+	.hash =		neigh_bench_hash,
+	.constructor =	neigh_bench_constructor,
+	.id =		"neigh_bench_cache",
+	.parms = {
+		.tbl =			&neigh_bench_tbl,
+		.base_reachable_time =	30 * HZ,
+		.retrans_time =		1 * HZ,
+		.gc_staletime =		60 * HZ,
+		.reachable_time =	30 * HZ,
+		.delay_probe_time =	5 * HZ,
+		.queue_len =		3,
+	},
+	.gc_interval =	30 * HZ,
+	.gc_thresh1 =	128,
+};
+
+struct neigh_bench_worker {
+	unsigned int		failed;
+};
+
+static void neigh_bench_thread(void *data, unsigned int id)
+{
+	struct neigh_bench_worker *w = (struct neigh_bench_worker *)data + id;
+	struct net_device *dev = init_net.loopback_dev;
+	struct neighbour *n;
+	unsigned int i;
+	u32 key;
+
+	for (i = 0; i < creates; i++) {
+		key = (id << 24) | (i & 0xffffff);
+		n = neigh_create(&neigh_bench_tbl, &key, dev);
+		if (IS_ERR(n)) {
+			w->failed++;
+		} else {
+			neigh_release(n);
+			n = neigh_lookup(&neigh_bench_tbl, &key, dev);
+			if (n)
+				neigh_release(n);
+			else
+				w->failed++;
+		}
+		if (!(i & 255))
+			cond_resched();
+	}
+}
+
+static unsigned long neigh_bench_contended(void)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu_ptr(neigh_bench_tbl.stats, cpu)->lock_contended;
+	return sum;
+}
+
+static int neigh_bench_run(void *data, unsigned int nthreads)
+{
+	struct neigh_bench_worker *workers = data;
+	unsigned int i, failed = 0;
+	unsigned long contended;
+	s64 ns;
+
+	memset(workers, 0, nthreads * sizeof(*workers));
+	contended = neigh_bench_contended();
+	ns = kbench_threads("neigh_bench", nthreads, 1, neigh_bench_thread,
+			    workers);
+	if (ns < 0)
+		return ns;
+
+	for (i = 0; i < nthreads; i++)
+		failed += workers[i].failed;
+
+	pr_info("%3u threads: %llu creates/s, %u failed, %lu contended\n",
+		nthreads, kbench_rate((u64)nthreads * creates, ns),
+		failed, neigh_bench_contended() - contended);
+
+	/* start the next run from an empty table */
+	neigh_ifdown(&neigh_bench_tbl, NULL);
+	return 0;
+}
+
+static int __init neigh_bench_init(void)
+{
+	struct neigh_bench_worker *workers;
+	int ret = 0;
+
+	if (!creates || entries < 256)
+		return -EINVAL;
+
+	neigh_bench_tbl.gc_thresh2 = entries / 2;
+	neigh_bench_tbl.gc_thresh3 = entries;
+	neigh_table_init_no_netlink(&neigh_bench_tbl);
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	pr_info("%u creates per thread, at most %u entries\n", creates,
+		entries);
+	ret = kbench_scale(neigh_bench_run, workers);
+	kfree(workers);
+out:
+	neigh_table_clear(&neigh_bench_tbl);
+	return kbench_done(ret);
+}
+
+static void __exit neigh_bench_exit(void)
+{
+}
+
+module_init(neigh_bench_init);
+module_exit(neigh_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("neighbour table churn benchmark");
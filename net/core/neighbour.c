@@ -66,15 +66,20 @@ static const struct file_operations neigh_stat_seq_fops;
 #endif
 
 /*
-   Neighbour hash table buckets are protected with rwlock tbl->lock.
+   Neighbour hash table buckets are protected with the bucket locks
+   tbl->hash_locks, lookups only need rcu_read_lock_bh().
 
-   - All the scans/updates to hash buckets MUST be made under this lock.
-   - NOTHING clever should be made under this lock: no callbacks
+   - All the updates to a hash bucket MUST be made under its lock.
+     Scans which must see every entry also hold tbl->resize_lock,
+     so that no entry moves to a new table under them.
+   - NOTHING clever should be made under these locks: no callbacks
      to protocol backends, no attempts to send something to network.
      It will result in deadlocks, if backend/driver wants to use neighbour
      cache.
    - If the entry requires some non-trivial actions, increase
-     its reference count and release table lock.
+     its reference count and release the bucket lock.
+
+   tbl->lock protects the neigh_parms list and the proxy hash.
 
    Neighbour entries are protected:
    - with reference count.
@@ -126,48 +131,152 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
 
-static int neigh_forced_gc(struct neigh_table *tbl)
+static inline unsigned int neigh_bucket(const struct neigh_hash_table *nht,
+					u32 hash)
+{
+	return hash >> (32 - nht->hash_shift);
+}
+
+static inline struct neighbour __rcu **
+neigh_chain(const struct neigh_hash_table *nht, u32 hash)
+{
+	return &nht->hash_buckets[neigh_bucket(nht, hash)];
+}
+
+/* Bucket i of nht, as a hash value for neigh_bucket_lock() */
+static inline u32 neigh_bucket_hash(const struct neigh_hash_table *nht,
+				    unsigned int i)
 {
+	return i << (32 - nht->hash_shift);
+}
+
+static spinlock_t *neigh_bucket_lock(struct neigh_table *tbl, u32 hash)
+{
+	spinlock_t *lock;
+
+	lock = &tbl->hash_locks[hash >> (32 - NEIGH_HASH_LOCK_SHIFT)];
+	if (!spin_trylock_bh(lock)) {
+		NEIGH_CACHE_STAT_INC(tbl, lock_contended);
+		spin_lock_bh(lock);
+	}
+	return lock;
+}
+
+/*
+ * The tables to search: tbl->nht and, while a resize runs, the one the
+ * entries move to. nht_next is read first, see neigh_hash_resize().
+ */
+static inline struct neigh_hash_table *
+neigh_tables_bh(struct neigh_table *tbl, struct neigh_hash_table **next)
+{
+	*next = rcu_dereference_bh(tbl->nht_next);
+	smp_rmb();
+	return rcu_dereference_bh(tbl->nht);
+}
+
+/* Iterates over nht, then nht_next if it is another table */
+#define for_each_neigh_table(nht, next) \
+	for (; nht; nht = (nht == next) ? NULL : next)
+
+/*
+ * Releases the entries of a chain that GC may discard. Forced GC takes
+ * any entry nobody refers to that is not permanent; periodic GC spares
+ * those in a timer and those used within gc_staletime.
+ */
+static int neigh_gc_chain(struct neigh_table *tbl, struct neighbour __rcu **np,
+			  bool forced)
+{
+	struct neighbour *n;
 	int shrunk = 0;
-	int i;
-	struct neigh_hash_table *nht;
 
-	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
+	while ((n = rcu_dereference_protected(*np, 1)) != NULL) {
+		unsigned int state;
+		bool release;
+
+		write_lock(&n->lock);
+		state = n->nud_state;
+		if (forced) {
+			release = atomic_read(&n->refcnt) == 1 &&
+				  !(state & NUD_PERMANENT);
+		} else if (state & (NUD_PERMANENT | NUD_IN_TIMER)) {
+			release = false;
+		} else {
+			if (time_before(n->used, n->confirmed))
+				n->used = n->confirmed;
+			release = atomic_read(&n->refcnt) == 1 &&
+				  (state == NUD_FAILED ||
+				   time_after(jiffies,
+					      n->used + n->parms->gc_staletime));
+		}
 
-	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-	for (i = 0; i <= nht->hash_mask; i++) {
-		struct neighbour *n;
-		struct neighbour __rcu **np;
-
-		np = &nht->hash_buckets[i];
-		while ((n = rcu_dereference_protected(*np,
-					lockdep_is_held(&tbl->lock))) != NULL) {
-			/* Neighbour record may be discarded if:
-			 * - nobody refers to it.
-			 * - it is not permanent
-			 */
-			write_lock(&n->lock);
-			if (atomic_read(&n->refcnt) == 1 &&
-			    !(n->nud_state & NUD_PERMANENT)) {
-				rcu_assign_pointer(*np,
-					rcu_dereference_protected(n->next,
-						  lockdep_is_held(&tbl->lock)));
-				n->dead = 1;
-				shrunk	= 1;
-				write_unlock(&n->lock);
-				neigh_cleanup_and_release(n);
-				continue;
-			}
+		if (release) {
+			rcu_assign_pointer(*np,
+				rcu_dereference_protected(n->next, 1));
+			n->dead = 1;
+			shrunk++;
 			write_unlock(&n->lock);
-			np = &n->next;
+			neigh_cleanup_and_release(n);
+			continue;
 		}
+		write_unlock(&n->lock);
+		np = &n->next;
 	}
+	return shrunk;
+}
 
-	tbl->last_flush = jiffies;
+/*
+ * GC of bucket i of nht and, while a resize runs, of the two buckets
+ * of next it splits into, under their common lock.
+ * called with rcu_read_lock_bh()
+ */
+static int neigh_gc_bucket(struct neigh_table *tbl,
+			   struct neigh_hash_table *nht,
+			   struct neigh_hash_table *next,
+			   unsigned int i, bool forced)
+{
+	spinlock_t *lock = neigh_bucket_lock(tbl, neigh_bucket_hash(nht, i));
+	int shrunk;
 
-	write_unlock_bh(&tbl->lock);
+	shrunk = neigh_gc_chain(tbl, &nht->hash_buckets[i], forced);
+	if (next && next != nht) {
+		shrunk += neigh_gc_chain(tbl, &next->hash_buckets[2 * i],
+					 forced);
+		shrunk += neigh_gc_chain(tbl, &next->hash_buckets[2 * i + 1],
+					 forced);
+	}
+	spin_unlock_bh(lock);
+
+	NEIGH_CACHE_STAT_INC(tbl, gc_buckets);
+	return shrunk;
+}
+
+/*
+ * Called when allocating beyond gc_thresh2. Works through the buckets
+ * from where the last run stopped, until enough entries are gone to
+ * get back under gc_thresh2 or the whole table was visited.
+ */
+static int neigh_forced_gc(struct neigh_table *tbl)
+{
+	struct neigh_hash_table *nht, *next;
+	int goal = atomic_read(&tbl->entries) - tbl->gc_thresh2;
+	unsigned int i, visited;
+	int shrunk = 0;
+
+	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
+
+	rcu_read_lock_bh();
+	nht = neigh_tables_bh(tbl, &next);
+	i = ACCESS_ONCE(tbl->forced_gc_pos);
+	for (visited = 0; visited <= nht->hash_mask; visited++) {
+		i &= nht->hash_mask;
+		shrunk += neigh_gc_bucket(tbl, nht, next, i++, true);
+		if (shrunk >= max(goal, 1))
+			break;
+	}
+	tbl->forced_gc_pos = i;
+	rcu_read_unlock_bh();
+
+	tbl->last_flush = jiffies;
 
 	return shrunk;
 }
@@ -202,67 +311,84 @@ static void pneigh_queue_purge(struct sk_buff_head *list)
 	}
 }
 
-static void neigh_flush_dev(struct neigh_table *tbl, struct net_device *dev)
+/*
+ * Calls fn on every hash chain, with the bucket lock held. Entries do
+ * not move meanwhile, so fn sees each of them once.
+ */
+static void neigh_walk_chains(struct neigh_table *tbl,
+			      void (*fn)(struct neighbour __rcu **np,
+					 void *arg),
+			      void *arg)
 {
-	int i;
-	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht, *next;
+	unsigned int i;
 
+	spin_lock_bh(&tbl->resize_lock);
+	next = rcu_dereference_protected(tbl->nht_next,
+					 lockdep_is_held(&tbl->resize_lock));
 	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-
-	for (i = 0; i <= nht->hash_mask; i++) {
-		struct neighbour *n;
-		struct neighbour __rcu **np = &nht->hash_buckets[i];
+					lockdep_is_held(&tbl->resize_lock));
+	for_each_neigh_table(nht, next) {
+		for (i = 0; i <= nht->hash_mask; i++) {
+			spinlock_t *lock;
+
+			lock = neigh_bucket_lock(tbl, neigh_bucket_hash(nht, i));
+			fn(&nht->hash_buckets[i], arg);
+			spin_unlock_bh(lock);
+		}
+	}
+	spin_unlock_bh(&tbl->resize_lock);
+}
 
-		while ((n = rcu_dereference_protected(*np,
-					lockdep_is_held(&tbl->lock))) != NULL) {
-			if (dev && n->dev != dev) {
-				np = &n->next;
-				continue;
-			}
-			rcu_assign_pointer(*np,
-				   rcu_dereference_protected(n->next,
-						lockdep_is_held(&tbl->lock)));
-			write_lock(&n->lock);
-			neigh_del_timer(n);
-			n->dead = 1;
+static void neigh_flush_chain(struct neighbour __rcu **np, void *arg)
+{
+	struct net_device *dev = arg;
+	struct neighbour *n;
 
-			if (atomic_read(&n->refcnt) != 1) {
-				/* The most unpleasant situation.
-				   We must destroy neighbour entry,
-				   but someone still uses it.
-
-				   The destroy will be delayed until
-				   the last user releases us, but
-				   we must kill timers etc. and move
-				   it to safe state.
-				 */
-				skb_queue_purge(&n->arp_queue);
-				n->output = neigh_blackhole;
-				if (n->nud_state & NUD_VALID)
-					n->nud_state = NUD_NOARP;
-				else
-					n->nud_state = NUD_NONE;
-				NEIGH_PRINTK2("neigh %p is stray.\n", n);
-			}
-			write_unlock(&n->lock);
-			neigh_cleanup_and_release(n);
+	while ((n = rcu_dereference_protected(*np, 1)) != NULL) {
+		if (dev && n->dev != dev) {
+			np = &n->next;
+			continue;
 		}
+		rcu_assign_pointer(*np, rcu_dereference_protected(n->next, 1));
+		write_lock(&n->lock);
+		neigh_del_timer(n);
+		n->dead = 1;
+
+		if (atomic_read(&n->refcnt) != 1) {
+			/* The most unpleasant situation.
+			   We must destroy neighbour entry,
+			   but someone still uses it.
+
+			   The destroy will be delayed until
+			   the last user releases us, but
+			   we must kill timers etc. and move
+			   it to safe state.
+			 */
+			skb_queue_purge(&n->arp_queue);
+			n->output = neigh_blackhole;
+			if (n->nud_state & NUD_VALID)
+				n->nud_state = NUD_NOARP;
+			else
+				n->nud_state = NUD_NONE;
+			NEIGH_PRINTK2("neigh %p is stray.\n", n);
+		}
+		write_unlock(&n->lock);
+		neigh_cleanup_and_release(n);
 	}
 }
 
 void neigh_changeaddr(struct neigh_table *tbl, struct net_device *dev)
 {
-	write_lock_bh(&tbl->lock);
-	neigh_flush_dev(tbl, dev);
-	write_unlock_bh(&tbl->lock);
+	neigh_walk_chains(tbl, neigh_flush_chain, dev);
 }
 EXPORT_SYMBOL(neigh_changeaddr);
 
 int neigh_ifdown(struct neigh_table *tbl, struct net_device *dev)
 {
+	neigh_walk_chains(tbl, neigh_flush_chain, dev);
+
 	write_lock_bh(&tbl->lock);
-	neigh_flush_dev(tbl, dev);
 	pneigh_ifdown(tbl, dev);
 	write_unlock_bh(&tbl->lock);
 
@@ -312,27 +438,28 @@ out_entries:
 	goto out;
 }
 
-static struct neigh_hash_table *neigh_hash_alloc(unsigned int entries)
+static struct neigh_hash_table *neigh_hash_alloc(unsigned int shift)
 {
-	size_t size = entries * sizeof(struct neighbour *);
+	size_t size = (1 << shift) * sizeof(struct neighbour *);
 	struct neigh_hash_table *ret;
 	struct neighbour __rcu **buckets;
 
-	ret = kmalloc(sizeof(*ret), GFP_ATOMIC);
+	ret = kmalloc(sizeof(*ret), GFP_KERNEL);
 	if (!ret)
 		return NULL;
 	if (size <= PAGE_SIZE)
-		buckets = kzalloc(size, GFP_ATOMIC);
+		buckets = kzalloc(size, GFP_KERNEL);
 	else
 		buckets = (struct neighbour __rcu **)
-			  __get_free_pages(GFP_ATOMIC | __GFP_ZERO,
+			  __get_free_pages(GFP_KERNEL | __GFP_ZERO,
 					   get_order(size));
 	if (!buckets) {
 		kfree(ret);
 		return NULL;
 	}
 	ret->hash_buckets = buckets;
-	ret->hash_mask = entries - 1;
+	ret->hash_shift = shift;
+	ret->hash_mask = (1 << shift) - 1;
 	get_random_bytes(&ret->hash_rnd, sizeof(ret->hash_rnd));
 	return ret;
 }
@@ -352,73 +479,113 @@ static void neigh_hash_free_rcu(struct rcu_head *head)
 	kfree(nht);
 }
 
-static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
-						unsigned long new_entries)
+/* Moves the entries of bucket i of old to the two buckets of new */
+static void neigh_hash_move(struct neigh_table *tbl,
+			    struct neigh_hash_table *old,
+			    struct neigh_hash_table *new, unsigned int i)
 {
-	unsigned int i, hash;
-	struct neigh_hash_table *new_nht, *old_nht;
+	spinlock_t *lock = neigh_bucket_lock(tbl, neigh_bucket_hash(old, i));
+	struct neighbour *n, *next;
 
-	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
+	for (n = rcu_dereference_protected(old->hash_buckets[i], 1);
+	     n != NULL;
+	     n = next) {
+		unsigned int hash = neigh_bucket(new,
+				tbl->hash(n->primary_key, n->dev,
+					  new->hash_rnd));
+
+		next = rcu_dereference_protected(n->next, 1);
+		rcu_assign_pointer(n->next,
+			rcu_dereference_protected(new->hash_buckets[hash], 1));
+		rcu_assign_pointer(new->hash_buckets[hash], n);
+		NEIGH_CACHE_STAT_INC(tbl, hash_moves);
+	}
+	RCU_INIT_POINTER(old->hash_buckets[i], NULL);
+	spin_unlock_bh(lock);
+}
 
-	BUG_ON(!is_power_of_2(new_entries));
-	old_nht = rcu_dereference_protected(tbl->nht,
-					    lockdep_is_held(&tbl->lock));
-	new_nht = neigh_hash_alloc(new_entries);
-	if (!new_nht)
-		return old_nht;
+#define NEIGH_RESIZE_BUCKETS	64
 
-	for (i = 0; i <= old_nht->hash_mask; i++) {
-		struct neighbour *n, *next;
+/*
+ * Doubles the hash table once it holds more entries than buckets.
+ * Entries move a bucket at a time, NEIGH_RESIZE_BUCKETS between breaks,
+ * under the bucket lock they share in both tables. Meanwhile lookups
+ * search both tables and new entries go to the new one; a lookup
+ * racing with the move of its entry may miss it, as it could when the
+ * whole table was relinked at once.
+ */
+static void neigh_hash_resize(struct work_struct *work)
+{
+	struct neigh_table *tbl = container_of(work, struct neigh_table,
+					       resize_work);
+	struct neigh_hash_table *old, *new;
+	unsigned int i;
 
-		for (n = rcu_dereference_protected(old_nht->hash_buckets[i],
-						   lockdep_is_held(&tbl->lock));
-		     n != NULL;
-		     n = next) {
-			hash = tbl->hash(n->primary_key, n->dev,
-					 new_nht->hash_rnd);
-
-			hash &= new_nht->hash_mask;
-			next = rcu_dereference_protected(n->next,
-						lockdep_is_held(&tbl->lock));
-
-			rcu_assign_pointer(n->next,
-					   rcu_dereference_protected(
-						new_nht->hash_buckets[hash],
-						lockdep_is_held(&tbl->lock)));
-			rcu_assign_pointer(new_nht->hash_buckets[hash], n);
+	/* only this work replaces tbl->nht */
+	old = rcu_dereference_protected(tbl->nht, 1);
+	if (atomic_read(&tbl->entries) <= old->hash_mask + 1)
+		return;
+
+	new = neigh_hash_alloc(old->hash_shift + 1);
+	if (!new)
+		return;
+	new->hash_rnd = old->hash_rnd;
+	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
+
+	spin_lock_bh(&tbl->resize_lock);
+	rcu_assign_pointer(tbl->nht_next, new);
+	spin_unlock_bh(&tbl->resize_lock);
+
+	for (i = 0; i <= old->hash_mask; i++) {
+		if (!(i % NEIGH_RESIZE_BUCKETS)) {
+			if (i)
+				spin_unlock_bh(&tbl->resize_lock);
+			cond_resched();
+			spin_lock_bh(&tbl->resize_lock);
 		}
+		neigh_hash_move(tbl, old, new, i);
 	}
 
-	rcu_assign_pointer(tbl->nht, new_nht);
-	call_rcu(&old_nht->rcu, neigh_hash_free_rcu);
-	return new_nht;
+	rcu_assign_pointer(tbl->nht, new);
+	/* whoever sees nht_next cleared must see the new table */
+	smp_wmb();
+	RCU_INIT_POINTER(tbl->nht_next, NULL);
+	spin_unlock_bh(&tbl->resize_lock);
+
+	call_rcu(&old->rcu, neigh_hash_free_rcu);
+
+	if (atomic_read(&tbl->entries) > new->hash_mask + 1)
+		schedule_work(&tbl->resize_work);
 }
 
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
-	struct neighbour *n;
+	struct neighbour *n = NULL;
 	int key_len = tbl->key_len;
 	u32 hash_val;
-	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht, *next;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
 	rcu_read_lock_bh();
-	nht = rcu_dereference_bh(tbl->nht);
-	hash_val = tbl->hash(pkey, dev, nht->hash_rnd) & nht->hash_mask;
+	nht = neigh_tables_bh(tbl, &next);
+	hash_val = tbl->hash(pkey, dev, nht->hash_rnd);
 
-	for (n = rcu_dereference_bh(nht->hash_buckets[hash_val]);
-	     n != NULL;
-	     n = rcu_dereference_bh(n->next)) {
-		if (dev == n->dev && !memcmp(n->primary_key, pkey, key_len)) {
-			if (!atomic_inc_not_zero(&n->refcnt))
-				n = NULL;
-			NEIGH_CACHE_STAT_INC(tbl, hits);
-			break;
+	for_each_neigh_table(nht, next) {
+		for (n = rcu_dereference_bh(*neigh_chain(nht, hash_val));
+		     n != NULL;
+		     n = rcu_dereference_bh(n->next)) {
+			if (dev == n->dev &&
+			    !memcmp(n->primary_key, pkey, key_len)) {
+				if (!atomic_inc_not_zero(&n->refcnt))
+					n = NULL;
+				NEIGH_CACHE_STAT_INC(tbl, hits);
+				goto out;
+			}
 		}
 	}
-
+out:
 	rcu_read_unlock_bh();
 	return n;
 }
@@ -427,29 +594,31 @@ EXPORT_SYMBOL(neigh_lookup);
 struct neighbour *neigh_lookup_nodev(struct neigh_table *tbl, struct net *net,
 				     const void *pkey)
 {
-	struct neighbour *n;
+	struct neighbour *n = NULL;
 	int key_len = tbl->key_len;
 	u32 hash_val;
-	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht, *next;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
 	rcu_read_lock_bh();
-	nht = rcu_dereference_bh(tbl->nht);
-	hash_val = tbl->hash(pkey, NULL, nht->hash_rnd) & nht->hash_mask;
+	nht = neigh_tables_bh(tbl, &next);
+	hash_val = tbl->hash(pkey, NULL, nht->hash_rnd);
 
-	for (n = rcu_dereference_bh(nht->hash_buckets[hash_val]);
-	     n != NULL;
-	     n = rcu_dereference_bh(n->next)) {
-		if (!memcmp(n->primary_key, pkey, key_len) &&
-		    net_eq(dev_net(n->dev), net)) {
-			if (!atomic_inc_not_zero(&n->refcnt))
-				n = NULL;
-			NEIGH_CACHE_STAT_INC(tbl, hits);
-			break;
+	for_each_neigh_table(nht, next) {
+		for (n = rcu_dereference_bh(*neigh_chain(nht, hash_val));
+		     n != NULL;
+		     n = rcu_dereference_bh(n->next)) {
+			if (!memcmp(n->primary_key, pkey, key_len) &&
+			    net_eq(dev_net(n->dev), net)) {
+				if (!atomic_inc_not_zero(&n->refcnt))
+					n = NULL;
+				NEIGH_CACHE_STAT_INC(tbl, hits);
+				goto out;
+			}
 		}
 	}
-
+out:
 	rcu_read_unlock_bh();
 	return n;
 }
@@ -461,8 +630,11 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 	u32 hash_val;
 	int key_len = tbl->key_len;
 	int error;
+	unsigned int size;
 	struct neighbour *n1, *rc, *n = neigh_alloc(tbl);
-	struct neigh_hash_table *nht;
+	struct neighbour __rcu **np;
+	struct neigh_hash_table *nht, *next, *ins;
+	spinlock_t *lock;
 
 	if (!n) {
 		rc = ERR_PTR(-ENOBUFS);
@@ -488,45 +660,68 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	n->confirmed = jiffies - (n->parms->base_reachable_time << 1);
 
-	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-
-	if (atomic_read(&tbl->entries) > (nht->hash_mask + 1))
-		nht = neigh_hash_grow(tbl, (nht->hash_mask + 1) << 1);
-
-	hash_val = tbl->hash(pkey, dev, nht->hash_rnd) & nht->hash_mask;
-
+	/*
+	 * neigh_parms_release() marks the parms dead under tbl->lock and
+	 * the device flushes its entries afterwards: hold it until the
+	 * entry is linked, so that it is either refused or flushed.
+	 */
+	read_lock_bh(&tbl->lock);
 	if (n->parms->dead) {
+		read_unlock_bh(&tbl->lock);
 		rc = ERR_PTR(-EINVAL);
-		goto out_tbl_unlock;
-	}
-
-	for (n1 = rcu_dereference_protected(nht->hash_buckets[hash_val],
-					    lockdep_is_held(&tbl->lock));
-	     n1 != NULL;
-	     n1 = rcu_dereference_protected(n1->next,
-			lockdep_is_held(&tbl->lock))) {
-		if (dev == n1->dev && !memcmp(n1->primary_key, pkey, key_len)) {
-			neigh_hold(n1);
-			rc = n1;
-			goto out_tbl_unlock;
+		goto out_neigh_release;
+	}
+
+	rcu_read_lock_bh();
+	/* resizes keep hash_rnd */
+	nht = rcu_dereference_bh(tbl->nht);
+	hash_val = tbl->hash(pkey, dev, nht->hash_rnd);
+
+	/*
+	 * The tables are read under the bucket lock: a resize moving
+	 * the bucket meanwhile has published the new one already.
+	 */
+	lock = neigh_bucket_lock(tbl, hash_val);
+	nht = neigh_tables_bh(tbl, &next);
+	/* during a resize, new entries go to the new table */
+	ins = next ? next : nht;
+
+	for_each_neigh_table(nht, next) {
+		for (n1 = rcu_dereference_protected(*neigh_chain(nht, hash_val),
+						    1);
+		     n1 != NULL;
+		     n1 = rcu_dereference_protected(n1->next, 1)) {
+			if (dev == n1->dev &&
+			    !memcmp(n1->primary_key, pkey, key_len)) {
+				neigh_hold(n1);
+				rc = n1;
+				goto out_tbl_unlock;
+			}
 		}
 	}
 
+	np = neigh_chain(ins, hash_val);
+	size = ins->hash_mask + 1;
+
 	n->dead = 0;
 	neigh_hold(n);
-	rcu_assign_pointer(n->next,
-			   rcu_dereference_protected(nht->hash_buckets[hash_val],
-						     lockdep_is_held(&tbl->lock)));
-	rcu_assign_pointer(nht->hash_buckets[hash_val], n);
-	write_unlock_bh(&tbl->lock);
+	rcu_assign_pointer(n->next, rcu_dereference_protected(*np, 1));
+	rcu_assign_pointer(*np, n);
+	spin_unlock_bh(lock);
+	rcu_read_unlock_bh();
+	read_unlock_bh(&tbl->lock);
+
+	if (atomic_read(&tbl->entries) > size)
+		schedule_work(&tbl->resize_work);
+
 	NEIGH_PRINTK2("neigh %p is created.\n", n);
 	rc = n;
 out:
 	return rc;
 out_tbl_unlock:
-	write_unlock_bh(&tbl->lock);
+	spin_unlock_bh(lock);
+	rcu_read_unlock_bh();
+	read_unlock_bh(&tbl->lock);
 out_neigh_release:
 	neigh_release(n);
 	goto out;
@@ -758,24 +953,26 @@ static void neigh_connect(struct neighbour *neigh)
 		hh->hh_output = neigh->ops->hh_output;
 }
 
+#define NEIGH_GC_BUCKETS	256
+
+/*
+ * Periodic GC visits NEIGH_GC_BUCKETS buckets per run, each under its
+ * own lock, and goes round the table every base_reachable_time/2.
+ */
 static void neigh_periodic_work(struct work_struct *work)
 {
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
-	struct neighbour *n;
-	struct neighbour __rcu **np;
-	unsigned int i;
-	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht, *next;
+	unsigned int i, n, slice;
+	unsigned long delay;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
-	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-
 	/*
 	 *	periodically recompute ReachableTime from random function
 	 */
 
+	write_lock_bh(&tbl->lock);
 	if (time_after(jiffies, tbl->last_rand + 300 * HZ)) {
 		struct neigh_parms *p;
 		tbl->last_rand = jiffies;
@@ -783,56 +980,26 @@ static void neigh_periodic_work(struct work_struct *work)
 			p->reachable_time =
 				neigh_rand_reach_time(p->base_reachable_time);
 	}
+	write_unlock_bh(&tbl->lock);
 
-	for (i = 0 ; i <= nht->hash_mask; i++) {
-		np = &nht->hash_buckets[i];
-
-		while ((n = rcu_dereference_protected(*np,
-				lockdep_is_held(&tbl->lock))) != NULL) {
-			unsigned int state;
-
-			write_lock(&n->lock);
-
-			state = n->nud_state;
-			if (state & (NUD_PERMANENT | NUD_IN_TIMER)) {
-				write_unlock(&n->lock);
-				goto next_elt;
-			}
-
-			if (time_before(n->used, n->confirmed))
-				n->used = n->confirmed;
-
-			if (atomic_read(&n->refcnt) == 1 &&
-			    (state == NUD_FAILED ||
-			     time_after(jiffies, n->used + n->parms->gc_staletime))) {
-				*np = n->next;
-				n->dead = 1;
-				write_unlock(&n->lock);
-				neigh_cleanup_and_release(n);
-				continue;
-			}
-			write_unlock(&n->lock);
+	rcu_read_lock_bh();
+	nht = neigh_tables_bh(tbl, &next);
+	slice = min_t(unsigned int, nht->hash_mask + 1, NEIGH_GC_BUCKETS);
+	i = tbl->gc_pos;
+	for (n = 0; n < slice; n++) {
+		i &= nht->hash_mask;
+		neigh_gc_bucket(tbl, nht, next, i++, false);
+	}
+	tbl->gc_pos = i;
+	delay = (tbl->parms.base_reachable_time >> 1) /
+		((nht->hash_mask + 1) / slice);
+	rcu_read_unlock_bh();
 
-next_elt:
-			np = &n->next;
-		}
-		/*
-		 * It's fine to release lock here, even if hash table
-		 * grows while we are preempted.
-		 */
-		write_unlock_bh(&tbl->lock);
-		cond_resched();
-		write_lock_bh(&tbl->lock);
-		nht = rcu_dereference_protected(tbl->nht,
-						lockdep_is_held(&tbl->lock));
-	}
 	/* Cycle through all hash buckets every base_reachable_time/2 ticks.
 	 * ARP entry timeouts range from 1/2 base_reachable_time to 3/2
 	 * base_reachable_time.
 	 */
-	schedule_delayed_work(&tbl->gc_work,
-			      tbl->parms.base_reachable_time >> 1);
-	write_unlock_bh(&tbl->lock);
+	schedule_delayed_work(&tbl->gc_work, max(delay, 1UL));
 }
 
 static __inline__ int neigh_max_probes(struct neighbour *n)
@@ -1530,6 +1697,7 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 {
 	unsigned long now = jiffies;
 	unsigned long phsize;
+	int i;
 
 	write_pnet(&tbl->parms.net, &init_net);
 	atomic_set(&tbl->parms.refcnt, 1);
@@ -1551,7 +1719,7 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 		panic("cannot create neighbour proc dir entry");
 #endif
 
-	RCU_INIT_POINTER(tbl->nht, neigh_hash_alloc(8));
+	RCU_INIT_POINTER(tbl->nht, neigh_hash_alloc(NEIGH_HASH_LOCK_SHIFT));
 
 	phsize = (PNEIGH_HASHMASK + 1) * sizeof(struct pneigh_entry *);
 	tbl->phash_buckets = kzalloc(phsize, GFP_KERNEL);
@@ -1560,6 +1728,10 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 		panic("cannot allocate neighbour cache hashes");
 
 	rwlock_init(&tbl->lock);
+	spin_lock_init(&tbl->resize_lock);
+	for (i = 0; i < NEIGH_HASH_LOCKS; i++)
+		spin_lock_init(&tbl->hash_locks[i]);
+	INIT_WORK(&tbl->resize_work, neigh_hash_resize);
 	INIT_DELAYED_WORK_DEFERRABLE(&tbl->gc_work, neigh_periodic_work);
 	schedule_delayed_work(&tbl->gc_work, tbl->parms.reachable_time);
 	setup_timer(&tbl->proxy_timer, neigh_proxy_process, (unsigned long)tbl);
@@ -1599,6 +1771,7 @@ int neigh_table_clear(struct neigh_table *tbl)
 
 	/* It is not clean... Fix it to unload IPv6 module safely */
 	cancel_delayed_work_sync(&tbl->gc_work);
+	cancel_work_sync(&tbl->resize_work);
 	del_timer_sync(&tbl->proxy_timer);
 	pneigh_queue_purge(&tbl->proxy_queue);
 	neigh_ifdown(tbl, NULL);
@@ -1625,6 +1798,8 @@ int neigh_table_clear(struct neigh_table *tbl)
 	free_percpu(tbl->stats);
 	tbl->stats = NULL;
 
+	/* wait for neigh_destroy_rcu() */
+	rcu_barrier();
 	kmem_cache_destroy(tbl->kmem_cachep);
 	tbl->kmem_cachep = NULL;
 
@@ -2199,6 +2374,23 @@ static void neigh_update_notify(struct neighbour *neigh)
 	__neigh_notify(neigh, RTM_NEWNEIGH, 0);
 }
 
+/*
+ * Dumps and /proc go through the buckets of nht, then those of next
+ * while a resize runs: an entry moving meanwhile may show up twice or
+ * not at all.
+ */
+static struct neighbour __rcu **neigh_walk_bucket(struct neigh_hash_table *nht,
+						  struct neigh_hash_table *next,
+						  unsigned int bucket)
+{
+	if (bucket <= nht->hash_mask)
+		return &nht->hash_buckets[bucket];
+	bucket -= nht->hash_mask + 1;
+	if (next && next != nht && bucket <= next->hash_mask)
+		return &next->hash_buckets[bucket];
+	return NULL;
+}
+
 static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb,
 			    struct netlink_callback *cb)
 {
@@ -2206,17 +2398,16 @@ static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb,
 	struct neighbour *n;
 	int rc, h, s_h = cb->args[1];
 	int idx, s_idx = idx = cb->args[2];
-	struct neigh_hash_table *nht;
+	struct neigh_hash_table *nht, *next;
+	struct neighbour __rcu **np;
 
 	rcu_read_lock_bh();
-	nht = rcu_dereference_bh(tbl->nht);
+	nht = neigh_tables_bh(tbl, &next);
 
-	for (h = 0; h <= nht->hash_mask; h++) {
-		if (h < s_h)
-			continue;
+	for (h = s_h; (np = neigh_walk_bucket(nht, next, h)) != NULL; h++) {
 		if (h > s_h)
 			s_idx = 0;
-		for (n = rcu_dereference_bh(nht->hash_buckets[h]), idx = 0;
+		for (n = rcu_dereference_bh(*np), idx = 0;
 		     n != NULL;
 		     n = rcu_dereference_bh(n->next)) {
 			if (!net_eq(dev_net(n->dev), net))
@@ -2266,60 +2457,61 @@ static int neigh_dump_info(struct sk_buff *skb, struct netlink_callback *cb)
 	return skb->len;
 }
 
+struct neigh_walk_arg {
+	union {
+		void	(*cb)(struct neighbour *, void *);
+		int	(*release_cb)(struct neighbour *);
+	};
+	void	*cookie;
+};
+
+static void neigh_for_each_chain(struct neighbour __rcu **np, void *arg)
+{
+	struct neigh_walk_arg *w = arg;
+	struct neighbour *n;
+
+	for (n = rcu_dereference_protected(*np, 1); n != NULL;
+	     n = rcu_dereference_protected(n->next, 1))
+		w->cb(n, w->cookie);
+}
+
 void neigh_for_each(struct neigh_table *tbl, void (*cb)(struct neighbour *, void *), void *cookie)
 {
-	int chain;
-	struct neigh_hash_table *nht;
+	struct neigh_walk_arg w = { .cb = cb, .cookie = cookie };
 
-	rcu_read_lock_bh();
-	nht = rcu_dereference_bh(tbl->nht);
+	neigh_walk_chains(tbl, neigh_for_each_chain, &w);
+}
+EXPORT_SYMBOL(neigh_for_each);
 
-	read_lock(&tbl->lock); /* avoid resizes */
-	for (chain = 0; chain <= nht->hash_mask; chain++) {
-		struct neighbour *n;
+static void neigh_release_chain(struct neighbour __rcu **np, void *arg)
+{
+	struct neigh_walk_arg *w = arg;
+	struct neighbour *n;
 
-		for (n = rcu_dereference_bh(nht->hash_buckets[chain]);
-		     n != NULL;
-		     n = rcu_dereference_bh(n->next))
-			cb(n, cookie);
+	while ((n = rcu_dereference_protected(*np, 1)) != NULL) {
+		int release;
+
+		write_lock(&n->lock);
+		release = w->release_cb(n);
+		if (release) {
+			rcu_assign_pointer(*np,
+				rcu_dereference_protected(n->next, 1));
+			n->dead = 1;
+		} else
+			np = &n->next;
+		write_unlock(&n->lock);
+		if (release)
+			neigh_cleanup_and_release(n);
 	}
-	read_unlock(&tbl->lock);
-	rcu_read_unlock_bh();
 }
-EXPORT_SYMBOL(neigh_for_each);
 
-/* The tbl->lock must be held as a writer and BH disabled. */
+/* Takes the bucket locks itself, cb runs with BH disabled */
 void __neigh_for_each_release(struct neigh_table *tbl,
 			      int (*cb)(struct neighbour *))
 {
-	int chain;
-	struct neigh_hash_table *nht;
+	struct neigh_walk_arg w = { .release_cb = cb };
 
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-	for (chain = 0; chain <= nht->hash_mask; chain++) {
-		struct neighbour *n;
-		struct neighbour __rcu **np;
-
-		np = &nht->hash_buckets[chain];
-		while ((n = rcu_dereference_protected(*np,
-					lockdep_is_held(&tbl->lock))) != NULL) {
-			int release;
-
-			write_lock(&n->lock);
-			release = cb(n);
-			if (release) {
-				rcu_assign_pointer(*np,
-					rcu_dereference_protected(n->next,
-						lockdep_is_held(&tbl->lock)));
-				n->dead = 1;
-			} else
-				np = &n->next;
-			write_unlock(&n->lock);
-			if (release)
-				neigh_cleanup_and_release(n);
-		}
-	}
+	neigh_walk_chains(tbl, neigh_release_chain, &w);
 }
 EXPORT_SYMBOL(__neigh_for_each_release);
 
@@ -2329,13 +2521,15 @@ static struct neighbour *neigh_get_first(struct seq_file *seq)
 {
 	struct neigh_seq_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
-	struct neigh_hash_table *nht = state->nht;
+	struct neighbour __rcu **np;
 	struct neighbour *n = NULL;
 	int bucket = state->bucket;
 
 	state->flags &= ~NEIGH_SEQ_IS_PNEIGH;
-	for (bucket = 0; bucket <= nht->hash_mask; bucket++) {
-		n = rcu_dereference_bh(nht->hash_buckets[bucket]);
+	for (bucket = 0;
+	     (np = neigh_walk_bucket(state->nht, state->nht_next, bucket));
+	     bucket++) {
+		n = rcu_dereference_bh(*np);
 
 		while (n) {
 			if (!net_eq(dev_net(n->dev), net))
@@ -2370,7 +2564,7 @@ static struct neighbour *neigh_get_next(struct seq_file *seq,
 {
 	struct neigh_seq_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
-	struct neigh_hash_table *nht = state->nht;
+	struct neighbour __rcu **np;
 
 	if (state->neigh_sub_iter) {
 		void *v = state->neigh_sub_iter(state, n, pos);
@@ -2401,10 +2595,12 @@ next:
 		if (n)
 			break;
 
-		if (++state->bucket > nht->hash_mask)
+		np = neigh_walk_bucket(state->nht, state->nht_next,
+				       ++state->bucket);
+		if (!np)
 			break;
 
-		n = rcu_dereference_bh(nht->hash_buckets[state->bucket]);
+		n = rcu_dereference_bh(*np);
 	}
 
 	if (n && pos)
@@ -2511,7 +2707,7 @@ void *neigh_seq_start(struct seq_file *seq, loff_t *pos, struct neigh_table *tbl
 	state->flags = (neigh_seq_flags & ~NEIGH_SEQ_IS_PNEIGH);
 
 	rcu_read_lock_bh();
-	state->nht = rcu_dereference_bh(tbl->nht);
+	state->nht = neigh_tables_bh(tbl, &state->nht_next);
 
 	return *pos ? neigh_get_idx_any(seq, pos) : SEQ_START_TOKEN;
 }
@@ -2595,12 +2791,12 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 	struct neigh_statistics *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards\n");
+		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards  hash_moves gc_buckets lock_contended\n");
 		return 0;
 	}
 
 	seq_printf(seq, "%08x  %08lx %08lx %08lx  %08lx %08lx  %08lx  "
-			"%08lx %08lx  %08lx %08lx %08lx\n",
+			"%08lx %08lx  %08lx %08lx %08lx  %08lx %08lx %08lx\n",
 		   atomic_read(&tbl->entries),
 
 		   st->allocs,
@@ -2617,7 +2813,11 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 
 		   st->periodic_gc_runs,
 		   st->forced_gc_runs,
-		   st->unres_discards
+		   st->unres_discards,
+
+		   st->hash_moves,
+		   st->gc_buckets,
+		   st->lock_contended
 		   );
 
 	return 0;
@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/tcp.h>
 
 #include <net/request_sock.h>
 
@@ -58,6 +59,7 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
 	rwlock_init(&queue->syn_wait_lock);
+	spin_lock_init(&queue->fastopenq.lock);
 	queue->rskq_accept_head = NULL;
 	lopt->nr_table_entries = nr_table_entries;
 
@@ -129,3 +131,30 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 		kfree(lopt);
 }
 
+/*
+ * A TCP Fast Open child, created when its SYN arrived, is done with the
+ * handshake: either the final ACK came in or the child is being closed.
+ * Drop it from the listener's fastopenq. The request_sock is freed here
+ * if the child was accept()ed already; otherwise it is still on the
+ * accept queue and goes away with it, see inet_csk_accept() and
+ * inet_csk_listen_stop().
+ */
+void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req)
+{
+	struct sock *lsk = tcp_rsk(req)->listener;
+	struct fastopen_queue *fastopenq =
+		&inet_csk(lsk)->icsk_accept_queue.fastopenq;
+	bool accepted;
+
+	spin_lock_bh(&fastopenq->lock);
+	tcp_sk(sk)->fastopen_rsk = NULL;
+	tcp_rsk(req)->listener = NULL;
+	fastopenq->qlen--;
+	accepted = req->sk == NULL;
+	spin_unlock_bh(&fastopenq->lock);
+
+	sock_put(lsk);
+	if (accepted)
+		reqsk_free(req);
+}
+EXPORT_SYMBOL(reqsk_fastopen_remove);
@@ -333,6 +333,7 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
+		skb_zcopy_clear(skb, true);
 		kfree(skb->head);
 	}
 }
@@ -570,6 +571,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->vlan_tci		= old->vlan_tci;
 
 	skb_copy_secmark(new, old);
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id	= old->napi_id;
+#endif
 }
 
 /*
@@ -762,6 +767,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zcopy_set(n, skb_zcopy(skb));
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -851,6 +857,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		if (skb_has_frag_list(skb))
 			skb_clone_fraglist(skb);
 
+		/* the new copy of skb_shinfo() points to it too */
+		if (skb_zcopy(skb))
+			sock_zerocopy_get(skb_zcopy(skb));
+
 		skb_release_data(skb);
 	}
 	off = (data + nhead) - skb->head;
@@ -884,6 +894,199 @@ nodata:
 }
 EXPORT_SYMBOL(pskb_expand_head);
 
+/**
+ *	skb_copy_ubufs - copy the user pages of a MSG_ZEROCOPY skb
+ *	@skb: buffer to modify
+ *	@gfp_mask: allocation priority
+ *
+ *	Replaces the frags of @skb with copies in kernel pages and drops
+ *	its reference to the ubuf_info of the user pages, which learns
+ *	that the data was copied. A clone gets private data first.
+ *	Returns zero, or a negative errno with @skb left as it was.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	int num_frags = skb_shinfo(skb)->nr_frags;
+	struct page *pages[MAX_SKB_FRAGS];
+	int i;
+
+	if (skb_shared(skb))
+		return -EINVAL;
+	if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask))
+		return -ENOMEM;
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+		u8 *vaddr;
+
+		pages[i] = alloc_page(gfp_mask);
+		if (!pages[i]) {
+			while (--i >= 0)
+				put_page(pages[i]);
+			return -ENOMEM;
+		}
+		vaddr = kmap_skb_frag(f);
+		memcpy(page_address(pages[i]), vaddr + f->page_offset, f->size);
+		kunmap_skb_frag(vaddr);
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+		put_page(f->page);
+		f->page = pages[i];
+		f->page_offset = 0;
+	}
+
+	skb_zcopy_clear(skb, false);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
+#define skb_from_uarg(uarg) container_of((void *)(uarg), struct sk_buff, cb)
+
+/* Merge the notification of sends [lo, lo + len) into the one queued
+ * last, if that one ends right before them.
+ */
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo = serr->ee.ee_info, old_hi = serr->ee.ee_data;
+
+	if (lo != old_hi + 1 || (u64)old_hi - old_lo + 1 + len >= (1ULL << 32))
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+static void sock_zerocopy_callback(struct ubuf_info *uarg, bool zerocopy)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+
+	/* nothing to report if the only send gave up, or to nobody */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_data = hi;
+	if (!zerocopy)
+		serr->ee.ee_code |= SO_EE_CODE_ZEROCOPY_COPIED;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    !skb_zerocopy_notify_extend(tail, lo, len)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+static struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	skb = sock_omalloc(sk, 0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+	uarg = (void *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = ((u32)atomic_inc_return(&sk->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->bytelen = size;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+
+/**
+ *	sock_zerocopy_realloc - get the ubuf_info of a MSG_ZEROCOPY send
+ *	@sk: socket sent on, locked by the caller
+ *	@size: bytes in the send
+ *	@uarg: ubuf_info of the last skb on the write queue, or %NULL
+ *
+ *	Sends that follow each other share the ubuf_info, and so their
+ *	notification, of the skb they append to for as long as their ids
+ *	follow each other and the range stays small. Returns the ubuf_info
+ *	with a reference for the caller, or %NULL if out of memory.
+ */
+struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					struct ubuf_info *uarg)
+{
+	if (uarg) {
+		const u32 byte_limit = 1 << 19;	/* a few TSO packets */
+		u32 bytelen, next;
+
+		/* uarg->len and sk_zckey are serialized by the socket lock */
+		if (WARN_ON_ONCE(!sock_owned_by_user(sk)))
+			return NULL;
+
+		bytelen = uarg->bytelen + size;
+		if (uarg->len == USHRT_MAX - 1 || bytelen > byte_limit)
+			goto new_alloc;
+
+		next = (u32)atomic_read(&sk->sk_zckey);
+		if ((u32)(uarg->id + uarg->len) == next) {
+			uarg->len++;
+			uarg->bytelen = bytelen;
+			atomic_set(&sk->sk_zckey, ++next);
+			sock_zerocopy_get(uarg);
+			return uarg;
+		}
+	}
+
+new_alloc:
+	return sock_zerocopy_alloc(sk, size);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_realloc);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg, uarg->zerocopy);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Undo sock_zerocopy_realloc() for a send that did not queue anything */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk->sk_zckey);
+		uarg->len--;
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
 /* Make private copy of skb with writable head and some headroom */
 
 struct sk_buff *skb_realloc_headroom(struct sk_buff *skb, unsigned int headroom)
@@ -2107,6 +2310,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zcopy_set(skb1, skb_zcopy(skb));
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2114,6 +2318,55 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 }
 EXPORT_SYMBOL(skb_split);
 
+/**
+ * skb_zerocopy_from_user - attach user pages to an skb
+ * @skb: the buffer to add frags to
+ * @from: user address of the data
+ * @len: bytes wanted
+ * @uarg: MSG_ZEROCOPY state of the send
+ *
+ * Pins the pages that hold @from, as many as there are free frag slots
+ * and up to @len bytes, and appends them to the frags of @skb, which
+ * then refers to @uarg. Memory accounting is left to the caller.
+ * Returns the number of bytes attached, -EMSGSIZE if no slot is free,
+ * -EEXIST if @skb holds the pages of another send, or -EFAULT.
+ */
+int skb_zerocopy_from_user(struct sk_buff *skb, const void __user *from,
+			   int len, struct ubuf_info *uarg)
+{
+	unsigned long addr = (unsigned long)from;
+	int frag = skb_shinfo(skb)->nr_frags;
+	struct page *pages[MAX_SKB_FRAGS];
+	int off = offset_in_page(addr);
+	int i, n, copied = 0;
+
+	if (skb_zcopy(skb) && skb_zcopy(skb) != uarg)
+		return -EEXIST;
+
+	n = min_t(int, MAX_SKB_FRAGS - frag, DIV_ROUND_UP(off + len, PAGE_SIZE));
+	if (n <= 0)
+		return -EMSGSIZE;
+
+	n = get_user_pages_fast(addr & PAGE_MASK, n, 0, pages);
+	if (n <= 0)
+		return -EFAULT;
+
+	for (i = 0; i < n; i++) {
+		int size = min_t(int, len - copied, PAGE_SIZE - off);
+
+		skb_fill_page_desc(skb, frag++, pages[i], off, size);
+		copied += size;
+		off = 0;
+	}
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	skb_zcopy_set(skb, uarg);
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_from_user);
+
 /* Shifting from/to a cloned skb is a no-go.
  *
  * Caller cannot keep skb_shinfo related pointers past calling here!
@@ -2149,6 +2402,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* an skb points to the user pages of one send at most */
+	if (skb_zcopy(tgt) || skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2619,6 +2876,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, u32 features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zcopy_set(nskb, skb_zcopy(skb));
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -169,7 +169,7 @@ static inline void dccp_do_pmtu_discovery(struct sock *sk,
 	if ((dst = __sk_dst_check(sk, 0)) == NULL)
 		return;
 
-	dst->ops->update_pmtu(dst, mtu);
+	dst->ops->update_pmtu(dst, NULL, mtu);
 
 	/* Something is about to be wrong... Remember soft error
 	 * for the case, if this connection will not able to recover.
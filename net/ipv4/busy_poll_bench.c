@@ -0,0 +1,257 @@
+/*
+ * UDP busy poll latency benchmark.
+ *
+ * One kernel socket sends requests of size bytes to addr:port and waits
+ * for each answer before sending the next one, first with SO_BUSY_POLL
+ * off and then with it set to busy microseconds. The minimum, average
+ * and maximum round trip times go to the kernel log, followed by a
+ * histogram in power of two nanosecond buckets.
+ *
+ * Unless echo=0, the module answers its own requests from an echo
+ * thread bound to port. Over loopback, the default, no NAPI context
+ * is involved and both runs measure the same path; aim addr at a UDP
+ * echo service, with echo=0, behind a device that has ndo_busy_poll to
+ * see what busy polling saves:
+ *
+ *	modprobe busy_poll_bench [addr=A.B.C.D] [port=N] [echo=0|1]
+ *		[requests=N] [size=N] [busy=USECS]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/kbench.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/socket.h>
+#include <net/sock.h>
+
+static char *addr = "127.0.0.1";
+module_param(addr, charp, 0444);
+MODULE_PARM_DESC(addr, "IPv4 address to send the requests to");
+
+static unsigned short port = 16400;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "udp port of the echo service");
+
+static bool echo = true;
+module_param(echo, bool, 0444);
+MODULE_PARM_DESC(echo, "answer the requests from an in-module echo thread");
+
+static unsigned int requests = 10000;
+module_param(requests, uint, 0444);
+MODULE_PARM_DESC(requests, "round trips timed in each run");
+
+static unsigned int size = 64;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "bytes in each request and response");
+
+static unsigned int busy = 50;
+module_param(busy, uint, 0444);
+MODULE_PARM_DESC(busy, "SO_BUSY_POLL value of the second run, in usecs");
+
+#define BUSY_BENCH_BUCKETS	32
+
+struct busy_bench_echo {
+	struct socket	*sock;
+	char		*buf;
+};
+
+static int busy_bench_socket(struct socket **sockp)
+{
+	struct timeval tv = { .tv_usec = 100 * USEC_PER_MSEC };
+	int err;
+
+	err = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, sockp);
+	if (err)
+		return err;
+
+	/* lets the echo thread notice kthread_stop() and the client a
+	 * lost answer
+	 */
+	err = kernel_setsockopt(*sockp, SOL_SOCKET, SO_RCVTIMEO,
+				(char *)&tv, sizeof(tv));
+	if (err) {
+		sock_release(*sockp);
+		*sockp = NULL;
+	}
+	return err;
+}
+
+static int busy_bench_echo_thread(void *data)
+{
+	struct busy_bench_echo *e = data;
+	struct sockaddr_in sin;
+	struct msghdr msg;
+	struct kvec iov;
+	int len;
+
+	while (!kthread_should_stop()) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &sin;
+		msg.msg_namelen = sizeof(sin);
+		iov.iov_base = e->buf;
+		iov.iov_len = size;
+		len = kernel_recvmsg(e->sock, &msg, &iov, 1, size, 0);
+		if (len < 0)
+			continue;
+
+		msg.msg_flags = 0;
+		iov.iov_len = len;
+		kernel_sendmsg(e->sock, &msg, &iov, 1, len);
+	}
+	return 0;
+}
+
+static int busy_bench_roundtrip(struct socket *sock, struct sockaddr_in *sin,
+				char *buf)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = sin;
+	msg.msg_namelen = sizeof(*sin);
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	ret = kernel_sendmsg(sock, &msg, &iov, 1, size);
+	if (ret < 0)
+		return ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	ret = kernel_recvmsg(sock, &msg, &iov, 1, size, 0);
+	return ret < 0 ? ret : 0;
+}
+
+static int busy_bench_run(struct socket *sock, struct sockaddr_in *sin,
+			  char *buf, unsigned int usecs)
+{
+	unsigned int hist[BUSY_BENCH_BUCKETS] = { 0 };
+	u64 ns, min = ~0ULL, max = 0, sum = 0;
+	unsigned int i, val = usecs;
+	ktime_t start;
+	int err;
+
+	err = kernel_setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL,
+				(char *)&val, sizeof(val));
+	if (err)
+		return err;
+
+	for (i = 0; i < requests; i++) {
+		start = ktime_get();
+		err = busy_bench_roundtrip(sock, sin, buf);
+		if (err)
+			break;
+		ns = kbench_ns(start);
+
+		min = min(min, ns);
+		max = max(max, ns);
+		sum += ns;
+		hist[min_t(int, fls64(ns), BUSY_BENCH_BUCKETS - 1)]++;
+		if (!(i & 255))
+			cond_resched();
+	}
+	if (err) {
+		pr_info("busy %u: no answer to request %u, error %d\n",
+			usecs, i, err);
+		return err;
+	}
+
+	pr_info("busy %u: rtt min %llu avg %llu max %llu ns\n", usecs,
+		min, div64_u64(sum, requests), max);
+	for (i = 0; i < BUSY_BENCH_BUCKETS; i++)
+		if (hist[i])
+			pr_info("  %10llu ns and up: %u\n",
+				i ? 1ULL << (i - 1) : 0ULL, hist[i]);
+	return 0;
+}
+
+static int __init busy_bench_init(void)
+{
+	struct busy_bench_echo e = { NULL, NULL };
+	struct task_struct *echo_task = NULL;
+	struct socket *sock = NULL;
+	struct sockaddr_in sin;
+	char *buf;
+	int ret;
+
+	if (!requests || !size || !port)
+		return -EINVAL;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = in_aton(addr);
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (echo) {
+		struct sockaddr_in any = {
+			.sin_family	= AF_INET,
+			.sin_port	= htons(port),
+			.sin_addr	= { htonl(INADDR_ANY) },
+		};
+
+		ret = -ENOMEM;
+		e.buf = kzalloc(size, GFP_KERNEL);
+		if (!e.buf)
+			goto out;
+		ret = busy_bench_socket(&e.sock);
+		if (ret)
+			goto out;
+		ret = kernel_bind(e.sock, (struct sockaddr *)&any, sizeof(any));
+		if (ret)
+			goto out;
+		echo_task = kthread_run(busy_bench_echo_thread, &e,
+					"busy_poll_bench");
+		if (IS_ERR(echo_task)) {
+			ret = PTR_ERR(echo_task);
+			echo_task = NULL;
+			goto out;
+		}
+	}
+
+	ret = busy_bench_socket(&sock);
+	if (ret)
+		goto out;
+
+	pr_info("%u requests of %u bytes to %pI4:%u\n",
+		requests, size, &sin.sin_addr.s_addr, port);
+	ret = busy_bench_run(sock, &sin, buf, 0);
+	if (!ret && busy)
+		ret = busy_bench_run(sock, &sin, buf, busy);
+
+out:
+	if (sock)
+		sock_release(sock);
+	if (echo_task)
+		kthread_stop(echo_task);
+	if (e.sock)
+		sock_release(e.sock);
+	kfree(e.buf);
+	kfree(buf);
+	return kbench_done(ret);
+}
+
+static void __exit busy_bench_exit(void)
+{
+}
+
+module_init(busy_bench_init);
+module_exit(busy_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("UDP busy poll round trip latency benchmark");
@@ -67,7 +67,9 @@ static int __net_init fib4_rules_init(struct net *net)
 	return 0;
 
 fail:
-	kfree(local_table);
+	rtnl_lock();
+	fib_free_table(local_table);
+	rtnl_unlock();
 	return -ENOMEM;
 }
 #else
@@ -73,6 +73,8 @@
 #include <linux/list.h>
 #include <linux/slab.h>
 #include <linux/prefetch.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -138,6 +140,8 @@ struct trie_use_stats {
 	unsigned int semantic_match_miss;
 	unsigned int null_node_hit;
 	unsigned int resize_node_skipped;
+	unsigned int dir_hit;
+	unsigned int dir_fallback;
 };
 #endif
 
@@ -151,10 +155,16 @@ struct trie_stat {
 	unsigned int nodesizes[MAX_STAT_DEPTH];
 };
 
+struct fib_dir;
+
 struct trie {
 	struct rt_trie_node __rcu *trie;
+	struct fib_dir __rcu *dir;	/* compact lookup arrays */
+	unsigned int prefixes;
+	unsigned long dir_retry;
+	bool dir_off;			/* forced off by fib_trie_compact() */
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	struct trie_use_stats stats;
+	struct trie_use_stats __percpu *stats;
 #endif
 };
 
@@ -164,6 +174,8 @@ static void tnode_put_child_reorg(struct tnode *tn, int i, struct rt_trie_node *
 static struct rt_trie_node *resize(struct trie *t, struct tnode *tn);
 static struct tnode *inflate(struct trie *t, struct tnode *tn);
 static struct tnode *halve(struct trie *t, struct tnode *tn);
+static struct leaf *trie_firstleaf(struct trie *t);
+static struct leaf *trie_nextleaf(struct leaf *l);
 /* tnodes to free after resize(); protected by RTNL */
 static struct tnode *tnode_free_head;
 static size_t tnode_free_size;
@@ -640,7 +652,7 @@ static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -667,7 +679,7 @@ static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -1028,6 +1040,329 @@ static void trie_rebalance(struct trie *t, struct tnode *tn)
 	tnode_free_flush();
 }
 
+/*
+ * Compact lookup arrays.
+ *
+ * A walk down the trie touches a tnode per level, then the leaf and its
+ * leaf_info list, each in a cache line of its own. Large tables also get
+ * a multibit array: the top 16 bits of the key index a flat array, the
+ * next bits, 4 at a time, chunks of 16 entries. An entry holds the
+ * leaf_info of the longest prefix covering its range, or a chunk (tagged
+ * with FIB_DIR_CHUNK) when longer prefixes split that range. At most
+ * five loads find the longest prefix for a key, and only its aliases
+ * are checked; the trie is walked as before when none of them fits the
+ * flow (tos, scope, oif or dead nexthops) and shorter prefixes have to
+ * be tried.
+ *
+ * The arrays are updated along with the trie under RTNL, before the
+ * leaf_info going away is freed.
+ */
+#define FIB_DIR_ROOT_BITS	16
+#define FIB_DIR_BITS		4
+#define FIB_DIR_CHUNK		0x1UL
+
+/* Smaller tables are left to the trie */
+#define FIB_DIR_MIN_PREFIXES	1024
+
+struct fib_dir_chunk {
+	unsigned long ent[1 << FIB_DIR_BITS];
+	struct rcu_head rcu;
+};
+
+struct fib_dir {
+	union {
+		struct rcu_head rcu;
+		struct work_struct work;
+	};
+	unsigned int chunks;
+	unsigned long ent[1 << FIB_DIR_ROOT_BITS];
+};
+
+static struct kmem_cache *fib_dir_kmem __read_mostly;
+
+static inline bool fib_dir_is_chunk(unsigned long e)
+{
+	return e & FIB_DIR_CHUNK;
+}
+
+static inline struct fib_dir_chunk *fib_dir_chunk(unsigned long e)
+{
+	return (struct fib_dir_chunk *)(e & ~FIB_DIR_CHUNK);
+}
+
+static inline int fib_dir_plen(unsigned long e)
+{
+	return e ? ((struct leaf_info *)e)->plen : -1;
+}
+
+/* rcu_read_lock needs to be hold by caller */
+static struct leaf_info *fib_dir_lookup(const struct fib_dir *dir, t_key key)
+{
+	unsigned int shift = KEYLENGTH - FIB_DIR_ROOT_BITS;
+	unsigned long e;
+
+	e = ACCESS_ONCE(dir->ent[key >> shift]);
+	while (fib_dir_is_chunk(e)) {
+		smp_read_barrier_depends();
+		shift -= FIB_DIR_BITS;
+		e = ACCESS_ONCE(fib_dir_chunk(e)->ent[(key >> shift) &
+					((1 << FIB_DIR_BITS) - 1)]);
+	}
+	smp_read_barrier_depends();
+	return (struct leaf_info *)e;
+}
+
+static void fib_dir_chunk_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(fib_dir_kmem,
+			container_of(head, struct fib_dir_chunk, rcu));
+}
+
+/* Fold a chunk whose entries all became the same into its parent */
+static void fib_dir_collapse(struct fib_dir *dir, unsigned long *p)
+{
+	struct fib_dir_chunk *c = fib_dir_chunk(*p);
+	unsigned long e = c->ent[0];
+	unsigned int i;
+
+	if (fib_dir_is_chunk(e))
+		return;
+	for (i = 1; i < 1 << FIB_DIR_BITS; i++)
+		if (c->ent[i] != e)
+			return;
+
+	ACCESS_ONCE(*p) = e;
+	dir->chunks--;
+	call_rcu(&c->rcu, fib_dir_chunk_free_rcu);
+}
+
+/*
+ * Point an entry, or all of a chunk, at @to: where it holds @from when
+ * that prefix goes away, where it holds a shorter prefix than @to when
+ * @to is added (@from is NULL then).
+ */
+static void fib_dir_fill(struct fib_dir *dir, unsigned long *p,
+			 const struct leaf_info *from, struct leaf_info *to)
+{
+	unsigned long e = *p;
+	unsigned int i;
+
+	if (fib_dir_is_chunk(e)) {
+		struct fib_dir_chunk *c = fib_dir_chunk(e);
+
+		for (i = 0; i < 1 << FIB_DIR_BITS; i++)
+			fib_dir_fill(dir, &c->ent[i], from, to);
+		fib_dir_collapse(dir, p);
+		return;
+	}
+
+	if (from ? e == (unsigned long)from : fib_dir_plen(e) < to->plen)
+		ACCESS_ONCE(*p) = (unsigned long)to;
+}
+
+/*
+ * Update the range of prefix @key/@plen in the array @ent, indexed by
+ * @bits of the key above @shift, splitting entries into chunks as far
+ * down as the prefix goes.
+ */
+static int fib_dir_update(struct fib_dir *dir, unsigned long *ent,
+			  unsigned int shift, unsigned int bits,
+			  t_key key, int plen,
+			  const struct leaf_info *from, struct leaf_info *to)
+{
+	unsigned int depth = KEYLENGTH - shift;
+	unsigned int idx = (key >> shift) & ((1U << bits) - 1);
+	struct fib_dir_chunk *c;
+	unsigned int i;
+	int err;
+
+	if (plen <= depth) {
+		for (i = 0; i < 1U << (depth - plen); i++)
+			fib_dir_fill(dir, &ent[idx + i], from, to);
+		return 0;
+	}
+
+	if (!fib_dir_is_chunk(ent[idx])) {
+		/* nothing longer than the entry lives below it */
+		if (from) {
+			fib_dir_fill(dir, &ent[idx], from, to);
+			return 0;
+		}
+
+		c = kmem_cache_alloc(fib_dir_kmem, GFP_KERNEL);
+		if (!c)
+			return -ENOMEM;
+		for (i = 0; i < 1 << FIB_DIR_BITS; i++)
+			c->ent[i] = ent[idx];
+		dir->chunks++;
+
+		/* readers see the chunk filled in */
+		smp_wmb();
+		ACCESS_ONCE(ent[idx]) = (unsigned long)c | FIB_DIR_CHUNK;
+	}
+
+	c = fib_dir_chunk(ent[idx]);
+	err = fib_dir_update(dir, c->ent, shift - FIB_DIR_BITS, FIB_DIR_BITS,
+			     key, plen, from, to);
+	fib_dir_collapse(dir, &ent[idx]);
+	return err;
+}
+
+static int fib_dir_update_root(struct fib_dir *dir, t_key key, int plen,
+			       const struct leaf_info *from,
+			       struct leaf_info *to)
+{
+	return fib_dir_update(dir, dir->ent, KEYLENGTH - FIB_DIR_ROOT_BITS,
+			      FIB_DIR_ROOT_BITS, key, plen, from, to);
+}
+
+static void fib_dir_free_chunks(unsigned long e)
+{
+	struct fib_dir_chunk *c;
+	unsigned int i;
+
+	if (!fib_dir_is_chunk(e))
+		return;
+	c = fib_dir_chunk(e);
+	for (i = 0; i < 1 << FIB_DIR_BITS; i++)
+		fib_dir_free_chunks(c->ent[i]);
+	kmem_cache_free(fib_dir_kmem, c);
+}
+
+static void __fib_dir_free_work(struct work_struct *arg)
+{
+	struct fib_dir *dir = container_of(arg, struct fib_dir, work);
+	unsigned int i;
+
+	for (i = 0; i < 1 << FIB_DIR_ROOT_BITS; i++)
+		fib_dir_free_chunks(dir->ent[i]);
+	vfree(dir);
+}
+
+static void __fib_dir_free_rcu(struct rcu_head *head)
+{
+	struct fib_dir *dir = container_of(head, struct fib_dir, rcu);
+
+	/* vfree() may sleep */
+	INIT_WORK(&dir->work, __fib_dir_free_work);
+	schedule_work(&dir->work);
+}
+
+static void fib_dir_drop(struct trie *t)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	if (dir) {
+		rcu_assign_pointer(t->dir, NULL);
+		call_rcu(&dir->rcu, __fib_dir_free_rcu);
+	}
+}
+
+/* Out of memory half way through an update: fall back to the trie */
+static void fib_dir_fail(struct trie *t)
+{
+	pr_warning("fib_trie: no memory for the lookup arrays, using the trie\n");
+	fib_dir_drop(t);
+	t->dir_retry = jiffies + 10 * HZ;
+}
+
+static int fib_dir_build(struct trie *t)
+{
+	struct fib_dir *dir;
+	struct leaf_info *li;
+	struct hlist_node *node;
+	struct leaf *l;
+	int err = 0;
+
+	dir = vzalloc(sizeof(*dir));
+	if (!dir) {
+		t->dir_retry = jiffies + 10 * HZ;
+		return -ENOMEM;
+	}
+
+	for (l = trie_firstleaf(t); l && !err; l = trie_nextleaf(l)) {
+		hlist_for_each_entry(li, node, &l->list, hlist) {
+			err = fib_dir_update_root(dir, l->key, li->plen,
+						  NULL, li);
+			if (err)
+				break;
+		}
+	}
+	if (err) {
+		call_rcu(&dir->rcu, __fib_dir_free_rcu);
+		t->dir_retry = jiffies + 10 * HZ;
+		return err;
+	}
+
+	rcu_assign_pointer(t->dir, dir);
+	return 0;
+}
+
+/* A prefix was added, and its first alias linked in */
+static void fib_dir_insert(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	t->prefixes++;
+	if (!dir) {
+		if (t->prefixes >= FIB_DIR_MIN_PREFIXES && !t->dir_off &&
+		    time_after_eq(jiffies, t->dir_retry))
+			fib_dir_build(t);
+		return;
+	}
+
+	if (fib_dir_update_root(dir, key, li->plen, NULL, li))
+		fib_dir_fail(t);
+}
+
+/* A prefix is unlinked from its leaf, and about to be freed */
+static void fib_dir_remove(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+	struct leaf_info *repl = NULL;
+	struct leaf *l;
+	int plen;
+
+	t->prefixes--;
+	if (!dir)
+		return;
+
+	/* the ranges it covered go to the next shorter prefix */
+	for (plen = li->plen - 1; plen >= 0 && !repl; plen--) {
+		l = fib_find_node(t, mask_pfx(key, plen));
+		if (l)
+			repl = find_leaf_info(l, plen);
+	}
+
+	if (fib_dir_update_root(dir, key, li->plen, li, repl))
+		fib_dir_fail(t);
+}
+
+/**
+ * fib_trie_compact - build or drop the compact lookup arrays of a table
+ * @tb: the table
+ * @on: whether it should have them
+ *
+ * Tables get the arrays by themselves once they hold enough prefixes;
+ * this forces them on or off, for tests and benchmarks. Off lasts
+ * until the arrays are forced on again, later inserts do not bring
+ * them back. Caller must hold RTNL.
+ */
+int fib_trie_compact(struct fib_table *tb, bool on)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+
+	t->dir_off = !on;
+	if (!on) {
+		fib_dir_drop(t);
+		return 0;
+	}
+	if (rtnl_dereference(t->dir))
+		return 0;
+	return fib_dir_build(t);
+}
+EXPORT_SYMBOL_GPL(fib_trie_compact);
+
 /* only used from updater-side */
 
 static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
@@ -1192,6 +1527,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	u32 key, mask;
 	int err;
 	struct leaf *l;
+	bool new_prefix = false;
 
 	if (plen > 32)
 		return -EINVAL;
@@ -1326,6 +1662,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 			err = -ENOMEM;
 			goto out_free_new_fa;
 		}
+		new_prefix = true;
 	}
 
 	if (!plen)
@@ -1333,6 +1670,9 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 
 	list_add_tail_rcu(&new_fa->fa_list,
 			  (fa ? &fa->fa_list : fa_head));
+	if (new_prefix)
+		fib_dir_insert(t, key,
+			       container_of(fa_head, struct leaf_info, falh));
 
 	rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
 	rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen, tb->tb_id,
@@ -1347,71 +1687,83 @@ out:
 err:
 	return err;
 }
+EXPORT_SYMBOL_GPL(fib_table_insert);
 
 /* should be called with rcu_read_lock */
-static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
-		      t_key key,  const struct flowi4 *flp,
-		      struct fib_result *res, int fib_flags)
+static int check_leaf_info(struct fib_table *tb, struct trie *t,
+			   struct leaf_info *li, const struct flowi4 *flp,
+			   struct fib_result *res, int fib_flags)
 {
-	struct leaf_info *li;
-	struct hlist_head *hhead = &l->list;
-	struct hlist_node *node;
+	struct fib_alias *fa;
 
-	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
-		struct fib_alias *fa;
-		int plen = li->plen;
-		__be32 mask = inet_make_mask(plen);
+	list_for_each_entry_rcu(fa, &li->falh, fa_list) {
+		struct fib_info *fi = fa->fa_info;
+		int nhsel, err;
 
-		if (l->key != (key & ntohl(mask)))
+		if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
 			continue;
-
-		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-			struct fib_info *fi = fa->fa_info;
-			int nhsel, err;
-
-			if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
-				continue;
-			if (fi->fib_dead)
-				continue;
-			if (fa->fa_info->fib_scope < flp->flowi4_scope)
-				continue;
-			fib_alias_accessed(fa);
-			err = fib_props[fa->fa_type].error;
-			if (err) {
+		if (fi->fib_dead)
+			continue;
+		if (fa->fa_info->fib_scope < flp->flowi4_scope)
+			continue;
+		fib_alias_accessed(fa);
+		err = fib_props[fa->fa_type].error;
+		if (err) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			this_cpu_inc(t->stats->semantic_match_passed);
 #endif
-				return err;
-			}
-			if (fi->fib_flags & RTNH_F_DEAD)
-				continue;
-			for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
-				const struct fib_nh *nh = &fi->fib_nh[nhsel];
+			return err;
+		}
+		if (fi->fib_flags & RTNH_F_DEAD)
+			continue;
+		for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+			const struct fib_nh *nh = &fi->fib_nh[nhsel];
 
-				if (nh->nh_flags & RTNH_F_DEAD)
-					continue;
-				if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
-					continue;
+			if (nh->nh_flags & RTNH_F_DEAD)
+				continue;
+			if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
+				continue;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			this_cpu_inc(t->stats->semantic_match_passed);
 #endif
-				res->prefixlen = plen;
-				res->nh_sel = nhsel;
-				res->type = fa->fa_type;
-				res->scope = fa->fa_info->fib_scope;
-				res->fi = fi;
-				res->table = tb;
-				res->fa_head = &li->falh;
-				if (!(fib_flags & FIB_LOOKUP_NOREF))
-					atomic_inc(&res->fi->fib_clntref);
-				return 0;
-			}
+			res->prefixlen = li->plen;
+			res->nh_sel = nhsel;
+			res->type = fa->fa_type;
+			res->scope = fa->fa_info->fib_scope;
+			res->fi = fi;
+			res->table = tb;
+			res->fa_head = &li->falh;
+			if (!(fib_flags & FIB_LOOKUP_NOREF))
+				atomic_inc(&res->fi->fib_clntref);
+			return 0;
 		}
+	}
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-		t->stats.semantic_match_miss++;
+	this_cpu_inc(t->stats->semantic_match_miss);
 #endif
+	return 1;
+}
+
+/* should be called with rcu_read_lock */
+static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
+		      t_key key,  const struct flowi4 *flp,
+		      struct fib_result *res, int fib_flags)
+{
+	struct leaf_info *li;
+	struct hlist_head *hhead = &l->list;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
+		int ret;
+
+		if (l->key != mask_pfx(key, li->plen))
+			continue;
+
+		ret = check_leaf_info(tb, t, li, flp, res, fib_flags);
+		if (ret <= 0)
+			return ret;
 	}
 
 	return 1;
@@ -1431,16 +1783,34 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	unsigned int current_prefix_length = KEYLENGTH;
 	struct tnode *cn;
 	t_key pref_mismatch;
+	struct fib_dir *dir;
 
 	rcu_read_lock();
 
-	n = rcu_dereference(t->trie);
-	if (!n)
-		goto failed;
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	this_cpu_inc(t->stats->gets);
+#endif
+
+	dir = rcu_dereference(t->dir);
+	if (dir) {
+		struct leaf_info *li = fib_dir_lookup(dir, key);
 
+		/* without a covering prefix, there is no route at all */
+		ret = li ? check_leaf_info(tb, t, li, flp, res, fib_flags) : 1;
+		if (!li || ret <= 0) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+			this_cpu_inc(t->stats->dir_hit);
+#endif
+			goto found;
+		}
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	t->stats.gets++;
+		this_cpu_inc(t->stats->dir_fallback);
 #endif
+	}
+
+	n = rcu_dereference(t->trie);
+	if (!n)
+		goto failed;
 
 	/* Just a leaf? */
 	if (IS_LEAF(n)) {
@@ -1463,7 +1833,7 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 
 		if (n == NULL) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.null_node_hit++;
+			this_cpu_inc(t->stats->null_node_hit);
 #endif
 			goto backtrace;
 		}
@@ -1597,7 +1967,7 @@ backtrace:
 			chopped_off = 0;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.backtrack++;
+			this_cpu_inc(t->stats->backtrack);
 #endif
 			goto backtrace;
 		}
@@ -1608,6 +1978,7 @@ found:
 	rcu_read_unlock();
 	return ret;
 }
+EXPORT_SYMBOL_GPL(fib_table_lookup);
 
 /*
  * Remove the leaf and return parent.
@@ -1703,6 +2074,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (list_empty(fa_head)) {
 		hlist_del_rcu(&li->hlist);
+		fib_dir_remove(t, key, li);
 		free_leaf_info(li);
 	}
 
@@ -1716,6 +2088,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 	alias_free_mem_rcu(fa);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(fib_table_delete);
 
 static int trie_flush_list(struct list_head *head)
 {
@@ -1735,7 +2108,7 @@ static int trie_flush_list(struct list_head *head)
 	return found;
 }
 
-static int trie_flush_leaf(struct leaf *l)
+static int trie_flush_leaf(struct trie *t, struct leaf *l)
 {
 	int found = 0;
 	struct hlist_head *lih = &l->list;
@@ -1747,6 +2120,7 @@ static int trie_flush_leaf(struct leaf *l)
 
 		if (list_empty(&li->falh)) {
 			hlist_del_rcu(&li->hlist);
+			fib_dir_remove(t, l->key, li);
 			free_leaf_info(li);
 		}
 	}
@@ -1834,7 +2208,7 @@ int fib_table_flush(struct fib_table *tb)
 	int found = 0;
 
 	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
-		found += trie_flush_leaf(l);
+		found += trie_flush_leaf(t, l);
 
 		if (ll && hlist_empty(&ll->list))
 			trie_leaf_remove(t, ll);
@@ -1850,8 +2224,15 @@ int fib_table_flush(struct fib_table *tb)
 
 void fib_free_table(struct fib_table *tb)
 {
+	struct trie *t = (struct trie *) tb->tb_data;
+
+	fib_dir_drop(t);
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	free_percpu(t->stats);
+#endif
 	kfree(tb);
 }
+EXPORT_SYMBOL_GPL(fib_free_table);
 
 static int fn_trie_dump_fa(t_key key, int plen, struct list_head *fah,
 			   struct fib_table *tb,
@@ -1976,6 +2357,10 @@ void __init fib_trie_init(void)
 					   max(sizeof(struct leaf),
 					       sizeof(struct leaf_info)),
 					   0, SLAB_PANIC, NULL);
+
+	fib_dir_kmem = kmem_cache_create("ip_fib_dir",
+					 sizeof(struct fib_dir_chunk),
+					 0, SLAB_PANIC, NULL);
 }
 
 
@@ -1995,9 +2380,18 @@ struct fib_table *fib_trie_table(u32 id)
 
 	t = (struct trie *) tb->tb_data;
 	memset(t, 0, sizeof(*t));
+	t->dir_retry = jiffies;
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	t->stats = alloc_percpu(struct trie_use_stats);
+	if (!t->stats) {
+		kfree(tb);
+		return NULL;
+	}
+#endif
 
 	return tb;
 }
+EXPORT_SYMBOL_GPL(fib_trie_table);
 
 #ifdef CONFIG_PROC_FS
 /* Depth first Trie walk iterator */
@@ -2159,20 +2553,53 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 	seq_printf(seq, "Total size: %u  kB\n", (bytes + 1023) / 1024);
 }
 
+static void trie_show_dir(struct seq_file *seq, struct trie *t)
+{
+	const struct fib_dir *dir;
+	size_t bytes;
+
+	rcu_read_lock();
+	dir = rcu_dereference(t->dir);
+	if (dir) {
+		bytes = sizeof(*dir) +
+			sizeof(struct fib_dir_chunk) * dir->chunks;
+		seq_printf(seq, "Lookup arrays: %u chunks, %zu kB\n",
+			   dir->chunks, (bytes + 1023) / 1024);
+	}
+	rcu_read_unlock();
+}
+
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 static void trie_show_usage(struct seq_file *seq,
-			    const struct trie_use_stats *stats)
-{
+			    const struct trie_use_stats __percpu *stats)
+{
+	struct trie_use_stats s = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct trie_use_stats *pcpu = per_cpu_ptr(stats, cpu);
+
+		s.gets += pcpu->gets;
+		s.backtrack += pcpu->backtrack;
+		s.semantic_match_passed += pcpu->semantic_match_passed;
+		s.semantic_match_miss += pcpu->semantic_match_miss;
+		s.null_node_hit += pcpu->null_node_hit;
+		s.resize_node_skipped += pcpu->resize_node_skipped;
+		s.dir_hit += pcpu->dir_hit;
+		s.dir_fallback += pcpu->dir_fallback;
+	}
+
 	seq_printf(seq, "\nCounters:\n---------\n");
-	seq_printf(seq, "gets = %u\n", stats->gets);
-	seq_printf(seq, "backtracks = %u\n", stats->backtrack);
+	seq_printf(seq, "gets = %u\n", s.gets);
+	seq_printf(seq, "backtracks = %u\n", s.backtrack);
 	seq_printf(seq, "semantic match passed = %u\n",
-		   stats->semantic_match_passed);
+		   s.semantic_match_passed);
 	seq_printf(seq, "semantic match miss = %u\n",
-		   stats->semantic_match_miss);
-	seq_printf(seq, "null node hit= %u\n", stats->null_node_hit);
-	seq_printf(seq, "skipped node resize = %u\n\n",
-		   stats->resize_node_skipped);
+		   s.semantic_match_miss);
+	seq_printf(seq, "null node hit= %u\n", s.null_node_hit);
+	seq_printf(seq, "skipped node resize = %u\n", s.resize_node_skipped);
+	seq_printf(seq, "array hit = %u\n", s.dir_hit);
+	seq_printf(seq, "array fallback = %u\n\n", s.dir_fallback);
 }
 #endif /*  CONFIG_IP_FIB_TRIE_STATS */
 
@@ -2213,8 +2640,9 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
+			trie_show_dir(seq, t);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			trie_show_usage(seq, &t->stats);
+			trie_show_usage(seq, t->stats);
 #endif
 		}
 	}
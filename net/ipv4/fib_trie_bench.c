@@ -0,0 +1,250 @@
+/*
+ * Benchmark of IPv4 FIB lookups.
+ *
+ * Fills a private table with random prefixes, their lengths spread
+ * roughly as in a full Internet table, then times fib_table_lookup()
+ * for a batch of addresses, half of them inside some prefix: through
+ * the compact lookup arrays, updated prefix by prefix as the table
+ * grew, and walking the trie. Both must give the same prefix for every
+ * address, also once half of the prefixes are deleted again. The
+ * results go to the kernel log, see lib/kbench.c. This takes a few
+ * seconds and, with the default of 400000 prefixes, a few hundred
+ * megabytes:
+ *
+ *	modprobe fib_trie_bench [prefixes=N] [lookups=N]
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version
+ *   2 of the License, or (at your option) any later version.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/kbench.h>
+#include <linux/sched.h>
+#include <linux/netdevice.h>
+#include <linux/inetdevice.h>
+#include <linux/rtnetlink.h>
+#include <net/net_namespace.h>
+#include <net/ip_fib.h>
+
+static unsigned int prefixes = 400000;
+module_param(prefixes, uint, 0444);
+MODULE_PARM_DESC(prefixes, "prefixes in the table");
+
+static unsigned int lookups = 1 << 20;
+module_param(lookups, uint, 0444);
+MODULE_PARM_DESC(lookups, "addresses looked up per pass");
+
+/* Percentage of the prefixes of each length, /8 to /24 */
+static const unsigned char bench_plen_mix[] = {
+	[8] = 1, [12] = 1, [14] = 1, [15] = 1, [16] = 3, [17] = 1,
+	[18] = 2, [19] = 4, [20] = 5, [21] = 5, [22] = 10, [23] = 10,
+	[24] = 56,
+};
+
+struct bench_prefix {
+	__be32	dst;
+	u8	plen;
+};
+
+static int bench_plen(void)
+{
+	unsigned int r = random32() % 100, plen;
+
+	for (plen = 0; plen < ARRAY_SIZE(bench_plen_mix); plen++) {
+		if (r < bench_plen_mix[plen])
+			return plen;
+		r -= bench_plen_mix[plen];
+	}
+	return 24;
+}
+
+static void bench_cfg(struct fib_config *cfg, struct fib_table *tb,
+		      const struct bench_prefix *p)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->fc_dst = p->dst;
+	cfg->fc_dst_len = p->plen;
+	cfg->fc_table = tb->tb_id;
+	cfg->fc_protocol = RTPROT_STATIC;
+	/* host scope spares the nexthop checks, lo need not be up */
+	cfg->fc_scope = RT_SCOPE_HOST;
+	cfg->fc_type = RTN_UNICAST;
+	cfg->fc_oif = init_net.loopback_dev->ifindex;
+	cfg->fc_nlflags = NLM_F_CREATE | NLM_F_EXCL;
+	cfg->fc_nlinfo.nl_net = &init_net;
+}
+
+/* Returns the number of prefixes inserted, duplicates are skipped */
+static unsigned int bench_fill(struct fib_table *tb, struct bench_prefix *p)
+{
+	struct fib_config cfg;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < prefixes; i++) {
+		p[n].plen = bench_plen();
+		p[n].dst = inet_make_mask(p[n].plen) &
+			   (__force __be32)random32();
+
+		bench_cfg(&cfg, tb, &p[n]);
+		rtnl_lock();
+		if (fib_table_insert(tb, &cfg) == 0)
+			n++;
+		rtnl_unlock();
+		cond_resched();
+	}
+	return n;
+}
+
+static void bench_flush(struct fib_table *tb, const struct bench_prefix *p,
+			unsigned int n, unsigned int step)
+{
+	struct fib_config cfg;
+	unsigned int i;
+
+	for (i = 0; i < n; i += step) {
+		bench_cfg(&cfg, tb, &p[i]);
+		rtnl_lock();
+		fib_table_delete(tb, &cfg);
+		rtnl_unlock();
+		cond_resched();
+	}
+}
+
+static s64 bench_pass(struct fib_table *tb, const __be32 *addr, int *plen)
+{
+	struct fib_result res;
+	struct flowi4 fl4;
+	unsigned int i;
+	ktime_t start;
+
+	memset(&fl4, 0, sizeof(fl4));
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		fl4.daddr = addr[i];
+		if (fib_table_lookup(tb, &fl4, &res, FIB_LOOKUP_NOREF))
+			plen[i] = -1;
+		else
+			plen[i] = res.prefixlen;
+		if (!(i & 4095))
+			cond_resched();
+	}
+	return kbench_ns(start);
+}
+
+/*
+ * Time lookups through the arrays as the updates left them, then
+ * through the trie, and check that both agree.
+ */
+static int bench_compare(struct fib_table *tb, const __be32 *addr,
+			 int *trie_plen, int *dir_plen)
+{
+	unsigned int i, bad = 0;
+	s64 trie_ns, dir_ns;
+
+	dir_ns = bench_pass(tb, addr, dir_plen);
+
+	rtnl_lock();
+	fib_trie_compact(tb, false);
+	rtnl_unlock();
+	trie_ns = bench_pass(tb, addr, trie_plen);
+
+	for (i = 0; i < lookups; i++)
+		if (trie_plen[i] != dir_plen[i])
+			bad++;
+
+	pr_info("trie %lld ns/lookup, arrays %lld ns/lookup, %u mismatches\n",
+		div_s64(trie_ns, lookups), div_s64(dir_ns, lookups), bad);
+	return bad ? -EINVAL : 0;
+}
+
+static int __init fib_trie_bench_init(void)
+{
+	struct bench_prefix *p = NULL;
+	int *trie_plen = NULL, *dir_plen = NULL;
+	__be32 *addr = NULL;
+	struct fib_table *tb;
+	unsigned int i, n;
+	ktime_t start;
+	int err;
+
+	if (!prefixes || !lookups)
+		return -EINVAL;
+
+	tb = fib_trie_table(RT_TABLE_MAX);
+	if (!tb)
+		return -ENOMEM;
+	p = vmalloc(prefixes * sizeof(*p));
+	addr = vmalloc(lookups * sizeof(*addr));
+	trie_plen = vmalloc(lookups * sizeof(*trie_plen));
+	dir_plen = vmalloc(lookups * sizeof(*dir_plen));
+	err = -ENOMEM;
+	if (!p || !addr || !trie_plen || !dir_plen)
+		goto out;
+
+	start = ktime_get();
+	n = bench_fill(tb, p);
+	pr_info("%u prefixes inserted in %lld ms\n", n,
+		div_s64(kbench_ns(start), NSEC_PER_MSEC));
+	err = 0;
+	if (!n)
+		goto out;
+
+	for (i = 0; i < lookups; i++) {
+		if (i & 1) {
+			addr[i] = (__force __be32)random32();
+		} else {
+			const struct bench_prefix *pp = &p[random32() % n];
+
+			addr[i] = pp->dst | (~inet_make_mask(pp->plen) &
+					     (__force __be32)random32());
+		}
+	}
+
+	/* big tables have had their arrays updated as they grew */
+	rtnl_lock();
+	start = ktime_get();
+	err = fib_trie_compact(tb, true);
+	rtnl_unlock();
+	if (err)
+		goto out_nomem;
+	pr_info("lookup arrays ready in %lld ms\n",
+		div_s64(kbench_ns(start), NSEC_PER_MSEC));
+	err = bench_compare(tb, addr, trie_plen, dir_plen);
+	if (err)
+		goto out_flush;
+
+	/* and as prefixes go away */
+	rtnl_lock();
+	err = fib_trie_compact(tb, true);
+	rtnl_unlock();
+	if (err)
+		goto out_nomem;
+	bench_flush(tb, p, n, 2);
+	pr_info("%u prefixes deleted\n", (n + 1) / 2);
+	err = bench_compare(tb, addr, trie_plen, dir_plen);
+	goto out_flush;
+
+out_nomem:
+	pr_info("no memory for the lookup arrays\n");
+out_flush:
+	bench_flush(tb, p, n, 1);
+out:
+	vfree(dir_plen);
+	vfree(trie_plen);
+	vfree(addr);
+	vfree(p);
+	rtnl_lock();
+	fib_free_table(tb);
+	rtnl_unlock();
+	return kbench_done(err);
+}
+module_init(fib_trie_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IPv4 FIB lookup benchmark");
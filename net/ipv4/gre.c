@@ -17,6 +17,7 @@
 #include <linux/in.h>
 #include <linux/ip.h>
 #include <linux/netdevice.h>
+#include <linux/if_tunnel.h>
 #include <linux/version.h>
 #include <linux/spinlock.h>
 #include <net/protocol.h>
@@ -111,9 +112,110 @@ static void gre_err(struct sk_buff *skb, u32 info)
 	rcu_read_unlock();
 }
 
+/*
+ * Only version 0 GRE with at most a key is aggregated: checksums and
+ * sequence numbers differ from packet to packet, and version 1 is
+ * PPTP. The header is the flags, the protocol and the optional key.
+ */
+static int gre_gro_hlen(__be16 flags)
+{
+	if (flags & ~GRE_KEY)
+		return 0;
+	return flags & GRE_KEY ? 8 : 4;
+}
+
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	const __be16 *greh;
+	unsigned int hlen;
+	unsigned int off;
+	int grehlen;
+	int flush = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	grehlen = gre_gro_hlen(greh[0]);
+	if (!grehlen)
+		goto out;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+	pp = gro_receive_inner(head, skb, greh[1]);
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb) + ip_hdr(skb)->ihl * 4;
+	const __be16 *greh = (const __be16 *)(skb->data + nhoff);
+	int err;
+
+	err = gro_complete_inner(skb, greh[1], nhoff + gre_gro_hlen(greh[0]));
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
+static int gre_gso_send_check(struct sk_buff *skb)
+{
+	/* the inner checksums are done while segmenting */
+	return 0;
+}
+
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb, u32 features)
+{
+	const __be16 *greh;
+	int grehlen;
+
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE) ||
+		     !pskb_may_pull(skb, 4)))
+		return ERR_PTR(-EINVAL);
+
+	greh = (const __be16 *)skb->data;
+	grehlen = gre_gro_hlen(greh[0]);
+	if (unlikely(!grehlen))
+		return ERR_PTR(-EINVAL);
+
+	return skb_tunnel_gso_segment(skb, features, grehlen, greh[1]);
+}
+
 static const struct net_protocol net_gre_protocol = {
 	.handler     = gre_rcv,
 	.err_handler = gre_err,
+	.gso_send_check = gre_gso_send_check,
+	.gso_segment = gre_gso_segment,
+	.gro_receive = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
 	.netns_ok    = 1,
 };
 
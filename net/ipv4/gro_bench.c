@@ -0,0 +1,276 @@
+/*
+ * GRO per byte cost benchmark.
+ *
+ * A private ethernet device feeds frames of one TCP flow to the GRO
+ * engine from its NAPI poll, batch frames per poll, the way a lightly
+ * loaded link does. The flow is sent plain and then inside GRE (the
+ * gre module is loaded for it), each time with GRO off, with GRO
+ * flushing at the end of every poll and with the flush deferred by
+ * timeout nsecs through gro_flush_timeout. What comes out of GRO is
+ * counted and freed by an rx_handler, so the cost reported, in nsecs
+ * per KB of payload, is that of building the frames, the GRO engine
+ * and one netif_receive_skb() per delivered packet; the segments per
+ * delivered packet show how much the stack above would save:
+ *
+ *	modprobe gro_bench [frames=N] [size=N] [batch=N] [timeout=NSECS]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kmod.h>
+#include <linux/kbench.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <net/ip.h>
+
+static unsigned int frames = 200000;
+module_param(frames, uint, 0444);
+MODULE_PARM_DESC(frames, "frames fed to GRO in each run");
+
+static unsigned int size = 1448;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "tcp payload bytes in each frame");
+
+static unsigned int batch = 1;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "frames found by each poll");
+
+static unsigned long timeout = 20000;
+module_param(timeout, ulong, 0444);
+MODULE_PARM_DESC(timeout, "gro_flush_timeout of the deferred runs, in nsecs");
+
+#define GRO_BENCH_WEIGHT	64
+
+struct gro_bench {
+	struct net_device	*dev;
+	struct napi_struct	napi;
+	bool			gre;
+	unsigned int		left;
+	unsigned int		delivered;
+	unsigned int		segs;
+	u32			seq;
+	u16			id;
+};
+
+static netdev_tx_t gro_bench_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	dev_kfree_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops gro_bench_ops = {
+	.ndo_start_xmit	= gro_bench_xmit,
+};
+
+static rx_handler_result_t gro_bench_rx(struct sk_buff **pskb)
+{
+	struct sk_buff *skb = *pskb;
+	struct gro_bench *b = netdev_priv(skb->dev);
+
+	b->delivered++;
+	b->segs += skb_shinfo(skb)->gso_segs ?: 1;
+	consume_skb(skb);
+	return RX_HANDLER_CONSUMED;
+}
+
+/* RFC 2544 benchmarking addresses, 198.18.0.0/15 */
+static void gro_bench_iphdr(struct gro_bench *b, struct iphdr *iph, u8 proto,
+			    unsigned int len, u8 net)
+{
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = 0;
+	iph->tot_len = htons(len);
+	iph->id = htons(b->id);
+	iph->frag_off = htons(IP_DF);
+	iph->ttl = 64;
+	iph->protocol = proto;
+	iph->saddr = htonl(0xc6120001 | net << 16);
+	iph->daddr = htonl(0xc6120002 | net << 16);
+	ip_send_check(iph);
+}
+
+static struct sk_buff *gro_bench_frame(struct gro_bench *b)
+{
+	unsigned int len = sizeof(struct iphdr) + sizeof(struct tcphdr) + size;
+	unsigned int hlen = b->gre ? sizeof(struct iphdr) + 4 : 0;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct tcphdr *th;
+	__be16 *greh;
+
+	skb = netdev_alloc_skb_ip_align(b->dev, ETH_HLEN + hlen + len);
+	if (!skb)
+		return NULL;
+
+	/* the payload is never looked at */
+	eth = (struct ethhdr *)skb_put(skb, ETH_HLEN + hlen + len);
+	memcpy(eth->h_dest, b->dev->dev_addr, ETH_ALEN);
+	memcpy(eth->h_source, b->dev->dev_addr, ETH_ALEN);
+	eth->h_source[ETH_ALEN - 1] ^= 1;
+	eth->h_proto = htons(ETH_P_IP);
+
+	if (b->gre) {
+		gro_bench_iphdr(b, (struct iphdr *)(eth + 1), IPPROTO_GRE,
+				hlen + len, 0);
+		greh = (__be16 *)((struct iphdr *)(eth + 1) + 1);
+		greh[0] = 0;
+		greh[1] = htons(ETH_P_IP);
+	}
+	gro_bench_iphdr(b, (struct iphdr *)((u8 *)(eth + 1) + hlen),
+			IPPROTO_TCP, len, 1);
+
+	th = (struct tcphdr *)((u8 *)(eth + 1) + hlen + sizeof(struct iphdr));
+	memset(th, 0, sizeof(*th));
+	th->source = htons(9);
+	th->dest = htons(9);
+	th->seq = htonl(b->seq);
+	th->ack_seq = htonl(1);
+	th->doff = sizeof(*th) / 4;
+	th->ack = 1;
+	th->window = htons(65535);
+
+	b->seq += size;
+	b->id++;
+
+	skb->protocol = eth_type_trans(skb, b->dev);
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	return skb;
+}
+
+static int gro_bench_poll(struct napi_struct *napi, int budget)
+{
+	struct gro_bench *b = container_of(napi, struct gro_bench, napi);
+	struct sk_buff *skb;
+	int work = 0;
+
+	while (work < min_t(int, budget, batch) && b->left) {
+		skb = gro_bench_frame(b);
+		if (!skb)
+			break;
+		napi_gro_receive(napi, skb);
+		b->left--;
+		work++;
+	}
+
+	if (work < budget)
+		napi_complete_done(napi, work);
+	return work;
+}
+
+static void gro_bench_run(struct gro_bench *b, bool gre, bool gro,
+			  unsigned long flush_timeout)
+{
+	unsigned int i;
+	ktime_t start;
+	u64 ns;
+
+	b->gre = gre;
+	b->left = frames;
+	b->delivered = 0;
+	b->segs = 0;
+	if (gro)
+		b->dev->features |= NETIF_F_GRO;
+	else
+		b->dev->features &= ~NETIF_F_GRO;
+	b->dev->gro_flush_timeout = flush_timeout;
+
+	napi_enable(&b->napi);
+	start = ktime_get();
+	for (i = 0; b->left; i++) {
+		local_bh_disable();
+		napi_schedule(&b->napi);
+		local_bh_enable();
+		if (!(i & 255))
+			cond_resched();
+	}
+
+	/* without waiting for the timer */
+	napi_disable(&b->napi);
+	local_bh_disable();
+	napi_gro_flush(&b->napi);
+	local_bh_enable();
+	ns = kbench_ns(start);
+
+	pr_info("%s %-13s: %6llu ns/KB, %3u.%02u segs per packet%s\n",
+		gre ? "gre  " : "plain", !gro ? "gro off" :
+		flush_timeout ? "gro deferred" : "gro flush",
+		div64_u64(ns * 1024, (u64)frames * size),
+		b->segs / max(b->delivered, 1U),
+		b->segs % max(b->delivered, 1U) * 100 / max(b->delivered, 1U),
+		b->segs != frames ? ", frames lost" : "");
+}
+
+static void gro_bench_setup(struct net_device *dev)
+{
+	ether_setup(dev);
+	dev->netdev_ops = &gro_bench_ops;
+}
+
+static int __init gro_bench_init(void)
+{
+	struct net_device *dev;
+	struct gro_bench *b;
+	int ret;
+
+	if (!frames || !size || !batch || size > ETH_DATA_LEN -
+	    2 * sizeof(struct iphdr) - 4 - sizeof(struct tcphdr))
+		return -EINVAL;
+
+	request_module("gre");
+
+	dev = alloc_netdev(sizeof(*b), "grobench%d", gro_bench_setup);
+	if (!dev)
+		return -ENOMEM;
+	random_ether_addr(dev->dev_addr);
+	b = netdev_priv(dev);
+	b->dev = dev;
+	netif_napi_add(dev, &b->napi, gro_bench_poll, GRO_BENCH_WEIGHT);
+
+	ret = register_netdev(dev);
+	if (ret)
+		goto out_free;
+
+	rtnl_lock();
+	ret = netdev_rx_handler_register(dev, gro_bench_rx, NULL);
+	rtnl_unlock();
+	if (ret)
+		goto out_unregister;
+
+	pr_info("%u frames of %u bytes, %u per poll, deferred flush %lu ns\n",
+		frames, size, batch, timeout);
+	gro_bench_run(b, false, false, 0);
+	gro_bench_run(b, false, true, 0);
+	gro_bench_run(b, false, true, timeout);
+	gro_bench_run(b, true, false, 0);
+	gro_bench_run(b, true, true, 0);
+	gro_bench_run(b, true, true, timeout);
+
+	rtnl_lock();
+	netdev_rx_handler_unregister(dev);
+	rtnl_unlock();
+out_unregister:
+	unregister_netdev(dev);
+out_free:
+	netif_napi_del(&b->napi);
+	free_netdev(dev);
+	return kbench_done(ret);
+}
+
+static void __exit gro_bench_exit(void)
+{
+}
+
+module_init(gro_bench_init);
+module_exit(gro_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("GRO per byte cost benchmark, plain and GRE");
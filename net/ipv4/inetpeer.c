@@ -526,6 +526,8 @@ found:		/* The existing node has been found.
 		p->pmtu_expires = 0;
 		p->pmtu_orig = 0;
 		memset(&p->redirect_learned, 0, sizeof(p->redirect_learned));
+		p->tcp_fastopen_mss = 0;
+		p->tcp_fastopen_cookie_len = 0;
 		INIT_LIST_HEAD(&p->unused);
 
 
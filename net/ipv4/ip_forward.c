@@ -109,11 +109,15 @@ int ip_forward(struct sk_buff *skb)
 	iph = ip_hdr(skb);
 
 #ifdef CONFIG_AS_FASTPATH
-	if (route_add_fn &&
-	    rt && rt->rt_src)	/* To avoid ARP packet */
-		/* ToS in route table is not actually that is in packet */
-		route_add_fn(rt->rt_iif, rt->dst.dev, rt->rt_dst, rt->rt_src,
-			     iph->tos, NULL);
+	{
+		route_add_hook *add = rcu_dereference(route_add_fn);
+
+		if (add && rt && iph->saddr)	/* To avoid ARP packet */
+			/* The route may be shared by all the flows of its
+			 * nexthop */
+			add(rt->rt_iif, rt->dst.dev, iph->daddr, iph->saddr,
+			    iph->tos, NULL);
+	}
 #endif
 
 	/* Decrease ttl after skb cow done */
@@ -320,7 +320,11 @@ drop:
 EXPORT_SYMBOL(ip_rcv_options);
 #endif
 
-static int ip_rcv_finish(struct sk_buff *skb)
+/*
+ *	Route the packet and process its options. On failure the packet
+ *	is freed and NET_RX_DROP returned.
+ */
+static int ip_rcv_finish_core(struct sk_buff *skb)
 {
 	const struct iphdr *iph = ip_hdr(skb);
 	struct rtable *rt;
@@ -368,17 +372,27 @@ static int ip_rcv_finish(struct sk_buff *skb)
 		IP_UPD_PO_STATS_BH(dev_net(rt->dst.dev), IPSTATS_MIB_INBCAST,
 				skb->len);
 
-	return dst_input(skb);
+	return 0;
 
 drop:
 	kfree_skb(skb);
 	return NET_RX_DROP;
 }
 
+static int ip_rcv_finish(struct sk_buff *skb)
+{
+	int ret = ip_rcv_finish_core(skb);
+
+	if (ret)
+		return ret;
+	return dst_input(skb);
+}
+
 /*
- * 	Main IP Receive routine.
+ *	Sanity checks of ip_rcv(), done before the PRE_ROUTING hook.
+ *	Returns the packet, or NULL if it was dropped.
  */
-int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+static struct sk_buff *ip_rcv_core(struct sk_buff *skb, struct net_device *dev)
 {
 	const struct iphdr *iph;
 	u32 len;
@@ -446,13 +460,83 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 	/* Must drop socket now because of tproxy. */
 	skb_orphan(skb);
 
-	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
-		       ip_rcv_finish);
+	return skb;
 
 inhdr_error:
 	IP_INC_STATS_BH(dev_net(dev), IPSTATS_MIB_INHDRERRORS);
 drop:
 	kfree_skb(skb);
 out:
-	return NET_RX_DROP;
+	return NULL;
+}
+
+/*
+ * 	Main IP Receive routine.
+ */
+int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+{
+	skb = ip_rcv_core(skb, dev);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
+		       ip_rcv_finish);
+}
+
+/*
+ *	Route every packet of the list before the first one is delivered,
+ *	so that the lookups and the delivery each run hot in the cache.
+ */
+static void ip_list_rcv_finish(struct sk_buff_head *list)
+{
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(list)) != NULL)
+		if (!ip_rcv_finish_core(skb))
+			__skb_queue_tail(&sublist, skb);
+
+	while ((skb = __skb_dequeue(&sublist)) != NULL)
+		dst_input(skb);
+}
+
+static void ip_sublist_rcv(struct sk_buff_head *list, struct net_device *dev)
+{
+	if (skb_queue_empty(list))
+		return;
+
+	NF_HOOK_LIST(NFPROTO_IPV4, NF_INET_PRE_ROUTING, list, dev, NULL,
+		     ip_rcv_finish);
+	ip_list_rcv_finish(list);
+}
+
+/*
+ *	List version of ip_rcv(), called by netif_receive_skb_list() for
+ *	packets that share orig_dev: they are checked, then routed a device
+ *	at a time. With PRE_ROUTING hooks, NF_HOOK_LIST() takes them through
+ *	the hooks and ip_rcv_finish() one by one instead.
+ */
+void ip_list_rcv(struct sk_buff_head *list, struct packet_type *pt,
+		 struct net_device *orig_dev)
+{
+	struct net_device *curr_dev = NULL;
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		struct net_device *dev = skb->dev;
+
+		skb = ip_rcv_core(skb, dev);
+		if (skb == NULL)
+			continue;
+
+		if (curr_dev != dev) {
+			ip_sublist_rcv(&sublist, curr_dev);
+			curr_dev = dev;
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	ip_sublist_rcv(&sublist, curr_dev);
 }
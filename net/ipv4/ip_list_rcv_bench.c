@@ -0,0 +1,209 @@
+/*
+ * IPv4 list receive benchmark.
+ *
+ * UDP frames from saddr to daddr:port are built in batches of batch
+ * frames and received on dev as if its driver had found them, first
+ * with one netif_receive_skb() call per frame and then with a single
+ * netif_receive_skb_list() call per batch, which takes the batch
+ * through ip_rcv and the route lookups together. The rate, in Mpps,
+ * goes to the kernel log. Frames are built between the timed receives.
+ * With a PRE_ROUTING hook registered, the list still goes through the
+ * hook and ip_rcv_finish() a frame at a time, for conntrack.
+ *
+ * By default the frames go over loopback to a socket that the module
+ * binds to port and never reads, so the path measured ends in the UDP
+ * receive queue. To get a forwarding rate, the way pktgen would, enable
+ * ip_forward and route daddr out of a device that discards what it is
+ * given, dummy for instance:
+ *
+ *	modprobe ip_list_rcv_bench [dev=NAME] [saddr=A.B.C.D]
+ *		[daddr=A.B.C.D] [port=N] [frames=N] [size=N] [batch=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kbench.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/inet.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/net.h>
+#include <net/ip.h>
+#include <net/sock.h>
+
+static char *dev = "lo";
+module_param(dev, charp, 0444);
+MODULE_PARM_DESC(dev, "device the frames are received on");
+
+static char *saddr = "127.0.0.1";
+module_param(saddr, charp, 0444);
+MODULE_PARM_DESC(saddr, "IPv4 source address of the frames");
+
+static char *daddr = "127.0.0.1";
+module_param(daddr, charp, 0444);
+MODULE_PARM_DESC(daddr, "IPv4 destination address of the frames");
+
+static unsigned short port = 16500;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "udp destination port, the sink socket is bound to it");
+
+static unsigned int frames = 1000000;
+module_param(frames, uint, 0444);
+MODULE_PARM_DESC(frames, "frames received in each run");
+
+static unsigned int size = 18;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "udp payload bytes in each frame");
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "frames received together");
+
+static struct sk_buff *list_bench_frame(struct net_device *ndev, __be32 src,
+					__be32 dst)
+{
+	unsigned int len = sizeof(struct iphdr) + sizeof(struct udphdr) + size;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct udphdr *uh;
+
+	skb = netdev_alloc_skb_ip_align(ndev, ETH_HLEN + len);
+	if (!skb)
+		return NULL;
+
+	/* the payload is never looked at */
+	eth = (struct ethhdr *)skb_put(skb, ETH_HLEN + len);
+	memcpy(eth->h_dest, ndev->dev_addr, ETH_ALEN);
+	memset(eth->h_source, 0, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph = (struct iphdr *)(eth + 1);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = 0;
+	iph->tot_len = htons(len);
+	iph->id = 0;
+	iph->frag_off = htons(IP_DF);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->saddr = src;
+	iph->daddr = dst;
+	ip_send_check(iph);
+
+	uh = (struct udphdr *)(iph + 1);
+	uh->source = htons(port);
+	uh->dest = htons(port);
+	uh->len = htons(sizeof(*uh) + size);
+	uh->check = 0;
+
+	skb->protocol = eth_type_trans(skb, ndev);
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	return skb;
+}
+
+static int list_bench_run(struct net_device *ndev, __be32 src, __be32 dst,
+			  bool list)
+{
+	struct sk_buff_head queue;
+	unsigned int i, n;
+	struct sk_buff *skb;
+	ktime_t start;
+	u64 ns = 0;
+
+	/* only the receive is timed, not the building of each batch */
+	__skb_queue_head_init(&queue);
+	for (i = 0; i < frames; i += n) {
+		for (n = 0; n < batch && i + n < frames; n++) {
+			skb = list_bench_frame(ndev, src, dst);
+			if (!skb) {
+				__skb_queue_purge(&queue);
+				return -ENOMEM;
+			}
+			__skb_queue_tail(&queue, skb);
+		}
+
+		start = ktime_get();
+		local_bh_disable();
+		if (list)
+			netif_receive_skb_list(&queue);
+		else
+			while ((skb = __skb_dequeue(&queue)))
+				netif_receive_skb(skb);
+		local_bh_enable();
+		ns += kbench_ns(start);
+		cond_resched();
+	}
+
+	/* Mpps with two decimals */
+	n = div64_u64((u64)frames * 100000, max_t(u64, ns, 1));
+	pr_info("%s: %u.%02u Mpps, %llu ns per frame\n",
+		list ? "netif_receive_skb_list" : "netif_receive_skb     ",
+		n / 100, n % 100, div64_u64(ns, frames));
+	return 0;
+}
+
+static int __init list_bench_init(void)
+{
+	struct sockaddr_in sin = {
+		.sin_family	= AF_INET,
+		.sin_addr	= { htonl(INADDR_ANY) },
+	};
+	struct socket *sock = NULL;
+	struct net_device *ndev;
+	__be32 src, dst;
+	int ret;
+
+	if (!frames || !batch || !port ||
+	    size > ETH_DATA_LEN - sizeof(struct iphdr) - sizeof(struct udphdr))
+		return -EINVAL;
+
+	src = in_aton(saddr);
+	dst = in_aton(daddr);
+	sin.sin_port = htons(port);
+
+	ndev = dev_get_by_name(&init_net, dev);
+	if (!ndev)
+		return -ENODEV;
+	if (!(ndev->flags & IFF_UP)) {
+		ret = -ENETDOWN;
+		goto out;
+	}
+
+	/* a closed port would have every frame answered by an ICMP error */
+	ret = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, &sock);
+	if (ret)
+		goto out;
+	ret = kernel_bind(sock, (struct sockaddr *)&sin, sizeof(sin));
+	if (ret)
+		goto out;
+
+	pr_info("%u frames of %u bytes on %s, %pI4 to %pI4:%u, %u per batch\n",
+		frames, size, ndev->name, &src, &dst, port, batch);
+	ret = list_bench_run(ndev, src, dst, false);
+	if (!ret)
+		ret = list_bench_run(ndev, src, dst, true);
+
+out:
+	if (sock)
+		sock_release(sock);
+	dev_put(ndev);
+	return kbench_done(ret);
+}
+
+static void __exit list_bench_exit(void)
+{
+}
+
+module_init(list_bench_init);
+module_exit(list_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IPv4 single versus list receive rate benchmark");
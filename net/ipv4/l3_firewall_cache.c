@@ -1,9 +1,16 @@
 /*
  * This is a module which is used for L3 Firewall acceleration
  *
- * This module adds a soft cache table whose data structure is based
- * on ring buffer. Each cache line includes all of the fields which
- * is needed by Firewall rule-set basic filtering features.
+ * This module adds a soft cache table whose data structure is a hash
+ * table keyed by the 5-tuple and the source MAC address. Lookups are
+ * lockless under RCU, insertions take a per-bucket lock and each
+ * bucket holds a bounded number of lines which are replaced by a
+ * clock (second chance) policy. Each cache line includes all of the
+ * fields which is needed by Firewall rule-set basic filtering features.
+ * IPv4 and IPv6 packets are cached on the FORWARD hook, where the
+ * verdict of the whole hook is recorded, and on the LOCAL_IN/LOCAL_OUT
+ * hooks, where only the verdict of the filter table is recorded so
+ * that conntrack and NAT still see every packet.
  * When a new IP packet comes,it will go along the original filtering
  * path, then a message of the IP packet can be sent to the cache so
  * that the cache can remember the IP packet as an acquaintance, and
@@ -34,6 +41,11 @@
  *
  */
 #include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
 #include <linux/mm.h>
 #include <linux/skbuff.h>
 #include <linux/ip.h>
@@ -50,9 +62,12 @@
 #include <linux/route.h>
 #include <net/route.h>
 #include <net/xfrm.h>
+#include <net/ipv6.h>
+#include <linux/icmpv6.h>
 
 #include <linux/l3_firewall_cache.h>
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <linux/etherdevice.h>
 
 MODULE_LICENSE("GPL");
@@ -64,23 +79,337 @@ MODULE_DESCRIPTION("L3 Firewall accelorator");
 struct p_firewall_cache *p_l3_firewall_cache;
 EXPORT_SYMBOL_GPL(p_l3_firewall_cache);
 
+static unsigned int buckets = L3_FIREWALL_CACHE_BUCKETS;
+module_param(buckets, uint, 0400);
+MODULE_PARM_DESC(buckets, "number of hash buckets (rounded up to 2^n)");
+
+static unsigned int depth = L3_FIREWALL_CACHE_DEPTH;
+module_param(depth, uint, 0400);
+MODULE_PARM_DESC(depth, "maximum cache lines per hash bucket");
+
+static struct kmem_cache *l3_firewall_cache_cachep __read_mostly;
+
+/* Rule generation of every hook, bumped whenever the rules attached
+ * to the hook change. A line recorded under an older generation is
+ * stale and is never returned by a lookup.
+ */
+static unsigned int l3_firewall_cache_gen[NFPROTO_NUMPROTO][NF_INET_NUMHOOKS];
+
+/* Tables opted in to the local hook cache whose rules keep state or
+ * look past the cache key, per hook. The filter step of a local hook
+ * is only cached while no such table sits on it, in any namespace.
+ */
+static atomic_t l3_firewall_cache_stateful_tables[NFPROTO_NUMPROTO][NF_INET_NUMHOOKS];
+
+static DEFINE_PER_CPU(struct l3_firewall_cache_stat, l3_firewall_cache_stat);
+#define L3_FIREWALL_CACHE_STAT_INC(field) \
+	this_cpu_inc(l3_firewall_cache_stat.field)
+
+static inline bool l3_firewall_cache_enabled(u_int8_t pf)
+{
+	if (pf == NFPROTO_IPV4)
+		return ipv4_l3_firewall_cache_enable;
+	return ipv6_l3_firewall_cache_enable;
+}
+
+/* Fill the lookup key of a packet, which is laid out the same way as
+ * the key of a cache line. Returns false when the packet can not be
+ * cached: fragments, and protocols other than TCP/UDP/SCTP and ICMP
+ * echo, go the slow path.
+ */
+static bool l3_firewall_cache_get_key(u_int8_t pf,
+				      unsigned int hook,
+				      const struct sk_buff *skb,
+				      const struct net_device *indev,
+				      const struct net_device *outdev,
+				      struct firewall_cache_key *key)
+{
+	unsigned int thoff;
+	u8 protocol;
+
+	memset(key, 0, sizeof(*key));
+	if (pf == NFPROTO_IPV4) {
+		const struct iphdr *iph = ip_hdr(skb);
+
+		if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+			return false;
+		key->Saddr.ip	= iph->saddr;
+		key->Daddr.ip	= iph->daddr;
+		protocol	= iph->protocol;
+		thoff		= skb_network_offset(skb) + ip_hdrlen(skb);
+	} else {
+		const struct ipv6hdr *ip6h = ipv6_hdr(skb);
+		int off;
+
+		protocol = ip6h->nexthdr;
+		off = ipv6_skip_exthdr(skb, skb_network_offset(skb) +
+				       sizeof(*ip6h), &protocol);
+		if (off < 0 || protocol == NEXTHDR_FRAGMENT)
+			return false;
+		ipv6_addr_copy(&key->Saddr.in6, &ip6h->saddr);
+		ipv6_addr_copy(&key->Daddr.in6, &ip6h->daddr);
+		thoff		= off;
+	}
+
+	switch (protocol) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP: {
+		__be16 _ports[2];
+		const __be16 *ports;
+
+		ports = skb_header_pointer(skb, thoff, sizeof(_ports), _ports);
+		if (!ports)
+			return false;
+		key->SourcePort	= ports[0];
+		key->DestPort	= ports[1];
+		break;
+	}
+	case IPPROTO_ICMP: {
+		struct icmphdr _ih;
+		const struct icmphdr *ih;
+
+		if (pf != NFPROTO_IPV4)
+			return false;
+		ih = skb_header_pointer(skb, thoff, sizeof(_ih), &_ih);
+		if (!ih || (ih->type != ICMP_ECHO &&
+			    ih->type != ICMP_ECHOREPLY))
+			return false;
+		key->SourcePort	= ih->un.echo.id;
+		key->DestPort	= htons(ih->type << 8 | ih->code);
+		break;
+	}
+	case IPPROTO_ICMPV6: {
+		struct icmp6hdr _ih;
+		const struct icmp6hdr *ih;
+
+		if (pf != NFPROTO_IPV6)
+			return false;
+		ih = skb_header_pointer(skb, thoff, sizeof(_ih), &_ih);
+		if (!ih || (ih->icmp6_type != ICMPV6_ECHO_REQUEST &&
+			    ih->icmp6_type != ICMPV6_ECHO_REPLY))
+			return false;
+		key->SourcePort	= ih->icmp6_identifier;
+		key->DestPort	= htons(ih->icmp6_type << 8 | ih->icmp6_code);
+		break;
+	}
+	default:
+		return false;
+	}
+
+	/* locally generated packets have no link layer header yet */
+	if (hook != NF_INET_LOCAL_OUT && indev &&
+	    indev->type == ARPHRD_ETHER && skb_mac_header_was_set(skb))
+		memcpy(key->h_source, eth_hdr(skb)->h_source, ETH_ALEN);
+	key->InIfindex	= indev ? indev->ifindex : 0;
+	key->OutIfindex	= outdev ? outdev->ifindex : 0;
+	key->Family	= pf;
+	key->Hook	= hook;
+	key->Protocol	= protocol;
+	return true;
+}
+
+static inline struct firewall_cache_bucket *
+l3_firewall_cache_bucket(const struct p_firewall_cache *cache,
+			 const struct firewall_cache_key *key)
+{
+	u32 hash;
+
+	hash = jhash2((const u32 *)key, sizeof(*key) / sizeof(u32),
+		      cache->hash_rnd);
+	return &cache->buckets[hash & (cache->hash_size - 1)];
+}
+
+static inline bool l3_firewall_cache_line_match(
+			const struct firewall_cache_lines *p,
+			const struct firewall_cache_key *key)
+{
+	return !memcmp(&p->key, key, sizeof(*key));
+}
+
+static inline unsigned int l3_firewall_cache_generation(u_int8_t pf,
+							unsigned int hook)
+{
+	return ACCESS_ONCE(l3_firewall_cache_gen[pf][hook]);
+}
+
+static inline bool l3_firewall_cache_line_expired(
+			const struct firewall_cache_lines *p)
+{
+	return time_after(jiffies, p->last_used + l3_firewall_cache_timeout);
+}
+
+/* a line which can never hit again, whatever its clock bit says */
+static inline bool l3_firewall_cache_line_dead(
+			const struct firewall_cache_lines *p)
+{
+	return p->generation != l3_firewall_cache_generation(p->key.Family,
+							p->key.Hook) ||
+		l3_firewall_cache_line_expired(p);
+}
+
+static void l3_firewall_cache_line_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(l3_firewall_cache_cachep,
+			container_of(head, struct firewall_cache_lines, rcu));
+}
+
+/* called with the bucket lock held */
+static void l3_firewall_cache_line_del(struct p_firewall_cache *cache,
+				       struct firewall_cache_bucket *b,
+				       struct firewall_cache_lines *p)
+{
+	hlist_del_rcu(&p->hnode);
+	b->count--;
+	atomic_dec(&cache->total);
+	call_rcu(&p->rcu, l3_firewall_cache_line_free_rcu);
+}
+
+/* Pick the line to be replaced in a full bucket. Stale or idle lines
+ * go first. Otherwise, lines are inserted at the head of the chain so
+ * the tail is the oldest one; each line that was hit since the hand
+ * last passed gets a second chance.
+ * Called with the bucket lock held.
+ */
+static struct firewall_cache_lines *
+l3_firewall_cache_victim(struct firewall_cache_bucket *b)
+{
+	struct firewall_cache_lines *p, *victim = NULL, *last = NULL;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(p, n, &b->chain, hnode) {
+		if (l3_firewall_cache_line_dead(p))
+			return p;
+		last = p;
+		if (p->referenced)
+			p->referenced = 0;
+		else
+			victim = p;
+	}
+	return victim ? victim : last;
+}
+
 int init_l3_firewall_cache()
 {
-	memset(p_l3_firewall_cache->cache_lines,
-		0, sizeof(struct firewall_cache_lines) * TOTAL_LINES_OF_CACHE);
-	p_l3_firewall_cache->current = -1; /* empty */
-	p_l3_firewall_cache->total = 0;
-	p_l3_firewall_cache->full = 0; /* full flag is faulse */
+	struct p_firewall_cache *cache = p_l3_firewall_cache;
+	struct firewall_cache_lines *p;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < cache->hash_size; i++) {
+		struct firewall_cache_bucket *b = &cache->buckets[i];
+
+		spin_lock_bh(&b->lock);
+		hlist_for_each_entry_safe(p, n, tmp, &b->chain, hnode)
+			l3_firewall_cache_line_del(cache, b, p);
+		spin_unlock_bh(&b->lock);
+	}
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(init_l3_firewall_cache);
 
+void l3_firewall_cache_invalidate(u_int8_t pf, unsigned int hook_mask)
+{
+	unsigned int hook;
+
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++)
+		if (hook_mask & (1 << hook))
+			l3_firewall_cache_gen[pf][hook]++;
+	/* A verdict computed by the old rules may still be on its way
+	 * into the cache from nf_hook_slow(), stamped with the new
+	 * generation. Wait for those hooks to finish and bump again.
+	 */
+	synchronize_rcu();
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++)
+		if (hook_mask & (1 << hook))
+			l3_firewall_cache_gen[pf][hook]++;
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_invalidate);
+
+/* Matches whose verdict only depends on what the cache line is keyed
+ * on. tcp is only so when it does not look at the flags or options.
+ */
+bool l3_firewall_cache_stateless_match(const struct xt_entry_match *m)
+{
+	static const char * const stateless[] = {
+		"udp", "udplite", "icmp", "icmp6", "multiport", "iprange",
+		"mac",
+	};
+	const char *name = m->u.kernel.match->name;
+	unsigned int i;
+
+	if (!strcmp(name, "tcp")) {
+		const struct xt_tcp *tcpinfo = (const void *)m->data;
+
+		return !tcpinfo->option && !tcpinfo->flg_mask;
+	}
+	for (i = 0; i < ARRAY_SIZE(stateless); i++)
+		if (!strcmp(name, stateless[i]))
+			return true;
+	return false;
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_stateless_match);
+
+/* Only the verdicts and jumps of the standard target, and the ERROR
+ * target heading the user chains, which is never reached.
+ */
+bool l3_firewall_cache_stateless_target(const struct xt_entry_target *t)
+{
+	const char *name = t->u.kernel.target->name;
+
+	return !strcmp(name, XT_STANDARD_TARGET) ||
+		!strcmp(name, XT_ERROR_TARGET);
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_stateless_target);
+
+void l3_firewall_cache_stateful(u_int8_t pf, unsigned int hook_mask,
+				int delta)
+{
+	unsigned int hook;
+
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++)
+		if (hook_mask & (1 << hook))
+			atomic_add(delta,
+				&l3_firewall_cache_stateful_tables[pf][hook]);
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_stateful);
+
+bool l3_firewall_cache_stateless(u_int8_t pf, unsigned int hook)
+{
+	return !atomic_read(&l3_firewall_cache_stateful_tables[pf][hook]);
+}
+
+void l3_firewall_cache_stat_sum(struct l3_firewall_cache_stat *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		const struct l3_firewall_cache_stat *st =
+			&per_cpu(l3_firewall_cache_stat, cpu);
+
+		sum->hits		+= st->hits;
+		sum->misses		+= st->misses;
+		sum->inserts		+= st->inserts;
+		sum->evictions		+= st->evictions;
+		sum->invalidations	+= st->invalidations;
+		sum->expired		+= st->expired;
+	}
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_stat_sum);
+
+unsigned int l3_firewall_cache_entries(void)
+{
+	return atomic_read(&p_l3_firewall_cache->total);
+}
+EXPORT_SYMBOL_GPL(l3_firewall_cache_entries);
+
 
 /* update_l3_firewall_cache- update a message to the cache
  *
- * @pf:			NFPROTO_IPV4
- * @hook:		NF_INET_FORWARD
+ * @pf:			NFPROTO_IPV4/NFPROTO_IPV6
+ * @hook:		NF_INET_FORWARD/NF_INET_LOCAL_IN/NF_INET_LOCAL_OUT
  * @skb:		the current packet
  * @indev:		where the packet comes from
  * @outdev:		where the packet will go to
@@ -88,8 +417,10 @@ EXPORT_SYMBOL_GPL(init_l3_firewall_cache);
  * @response:	the last action of Netfilter
  *
  * Record a new ip packet and the netfilter's response then insert
- * them to the top cache line, including, the net device which the
- * packet comes from and go to.
+ * them at the head of its hash bucket, including, the net device
+ * which the packet comes from and go to. A line already present
+ * for the same packet is replaced, and when the bucket is full one
+ * line is evicted by the clock policy.
  *
  * The function returns 0 forever.
  */
@@ -101,59 +432,59 @@ int update_l3_firewall_cache(u_int8_t pf,
 			struct p_firewall_cache *p_l3_firewall_cache,
 			unsigned int response)
 {
-	unsigned long current_pos = 0;
-	struct firewall_cache_lines *p = (struct firewall_cache_lines *)
-		&(p_l3_firewall_cache->cache_lines[0]);
-	/* don't need to update cache while disable the function */
-	if (ipv4_l3_firewall_cache_enable == 0)
-		return 0;
-	/* we only cache IPV4 and Forwarding */
-	if (NFPROTO_IPV4 != pf)
+	struct firewall_cache_key key;
+	struct firewall_cache_bucket *b;
+	struct firewall_cache_lines *p, *new;
+	struct hlist_node *n;
+
+	/* we only cache IPV4/IPV6 on Forwarding and local in/out */
+	if (!l3_firewall_cache_hook(pf, hook))
 		return 0;
-	if (NF_INET_FORWARD != hook)
+	/* don't need to update cache while disable the function */
+	if (!l3_firewall_cache_enabled(pf))
 		return 0;
-	/* we only cache TCP/UDP protocol, others go the slow path */
-	if ((IPPROTO_TCP != ip_hdr(skb)->protocol) &&
-		(IPPROTO_UDP != ip_hdr(skb)->protocol))
-			return 0;
 	/* we only cache NF_STOP/NF_DROP/NF_ACCEPT actions */
 	if ((NF_DROP != response) && (NF_STOP != response) &&
 		(NF_ACCEPT != response))
 			return 0;
-	write_lock_bh(&(p_l3_firewall_cache->lock));
-	/* calculate current pointer and juge ring buff full flag */
-	p_l3_firewall_cache->total++;
-	if (p_l3_firewall_cache->total >= TOTAL_LINES_OF_CACHE)
-		p_l3_firewall_cache->full = 1;
-	/* process overflow */
-	if (p_l3_firewall_cache->total < 0)
-		p_l3_firewall_cache->total = 0;
-	p_l3_firewall_cache->current =
-		(p_l3_firewall_cache->current + 1) & (TOTAL_LINES_OF_CACHE - 1);
-
-	current_pos = p_l3_firewall_cache->current;
-	memcpy(p[current_pos].h_source, eth_hdr(skb)->h_source, ETH_ALEN);
-	p[current_pos].Saddr	= ip_hdr(skb)->saddr;
-	p[current_pos].Daddr	= ip_hdr(skb)->daddr;
-	p[current_pos].Protocol	= ip_hdr(skb)->protocol;
-	p[current_pos].response	= response;
-
-	if (IPPROTO_TCP == ip_hdr(skb)->protocol) {
-		p[current_pos].SourcePort	= tcp_hdr(skb)->source;
-		p[current_pos].DestPort		= tcp_hdr(skb)->dest;
-	} else if (IPPROTO_UDP == ip_hdr(skb)->protocol) {
-		p[current_pos].SourcePort	= udp_hdr(skb)->source;
-		p[current_pos].DestPort		= udp_hdr(skb)->dest;
+	if (!l3_firewall_cache_get_key(pf, hook, skb, indev, outdev, &key))
+		return 0;
+
+	new = kmem_cache_alloc(l3_firewall_cache_cachep, GFP_ATOMIC);
+	if (!new)
+		return 0;
+	new->key	= key;
+	new->response	= response;
+	new->referenced	= 0;
+	new->generation	= l3_firewall_cache_generation(pf, hook);
+	new->last_used	= jiffies;
+
+	b = l3_firewall_cache_bucket(p_l3_firewall_cache, &key);
+	spin_lock_bh(&b->lock);
+	hlist_for_each_entry(p, n, &b->chain, hnode) {
+		if (l3_firewall_cache_line_match(p, &key)) {
+			l3_firewall_cache_line_del(p_l3_firewall_cache, b, p);
+			break;
+		}
+	}
+	if (b->count >= depth) {
+		l3_firewall_cache_line_del(p_l3_firewall_cache, b,
+					   l3_firewall_cache_victim(b));
+		L3_FIREWALL_CACHE_STAT_INC(evictions);
 	}
-	write_unlock_bh(&(p_l3_firewall_cache->lock));
+	hlist_add_head_rcu(&new->hnode, &b->chain);
+	b->count++;
+	atomic_inc(&p_l3_firewall_cache->total);
+	spin_unlock_bh(&b->lock);
+	L3_FIREWALL_CACHE_STAT_INC(inserts);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(update_l3_firewall_cache);
 
 /* search_from_firewall_cache- search a skb from the cache
  *
- * @pf:			NFPROTO_IPV4
- * @hook:		NF_INET_FORWARD
+ * @pf:			NFPROTO_IPV4/NFPROTO_IPV6
+ * @hook:		NF_INET_FORWARD/NF_INET_LOCAL_IN/NF_INET_LOCAL_OUT
  * @skb:		the current packet
  * @indev:		where the packet comes from
  * @outdev:		where the packet will go to
@@ -161,7 +492,10 @@ EXPORT_SYMBOL_GPL(update_l3_firewall_cache);
  *
  * Search a new ip packet from the cache, if it is found,
  * the function returns the response in the same cache line,
- * else it returns NF_NOTFOUND.
+ * else it returns NF_NOTFOUND. Only the bucket the packet
+ * hashes to is walked, without taking any lock. A line left
+ * over from older rules or idle for longer than the timeout
+ * is treated as not found.
  */
 int search_from_firewall_cache(u_int8_t pf,
 			unsigned int hook,
@@ -170,137 +504,141 @@ int search_from_firewall_cache(u_int8_t pf,
 			struct net_device *outdev,
 			struct p_firewall_cache *p_l3_firewall_cache)
 {
-	bool found = false;
-	int i;
-
 	/* NF_DROP=0, NF_ACCEPT=1, NF_STOP=5 */
-	unsigned int response = NF_NOTFOUND;
-	struct ethhdr *mh = eth_hdr(skb);
-
-	unsigned char   ms[ETH_ALEN]; /* Source MAC */
-	__u8    lpro;	/* protocol */
-	__be32  lsa;	/* source address */
-	__be32  lda;	/* destination address */
-	__be16  lsp;	/* source port */
-	__be16  ldp;	/* destination port */
-
-	struct firewall_cache_lines *p = (struct firewall_cache_lines *)
-		&(p_l3_firewall_cache->cache_lines[0]);
-	/* don't use the cache while disable the function */
-	if (ipv4_l3_firewall_cache_enable == 0)
+	int response = NF_NOTFOUND;
+	struct firewall_cache_key key;
+	struct firewall_cache_bucket *b;
+	struct firewall_cache_lines *p;
+	struct hlist_node *n;
+
+	/* we only cache IPV4/IPV6 on Forwarding and local in/out */
+	if (!l3_firewall_cache_hook(pf, hook))
 		return NF_NOTFOUND;
-	/* we only cache IPV4 and Forwarding */
-	if (NFPROTO_IPV4 != pf)
+	/* don't use the cache while disable the function */
+	if (!l3_firewall_cache_enabled(pf))
 		return NF_NOTFOUND;
-	if (NF_INET_FORWARD != hook)
+	if (!l3_firewall_cache_get_key(pf, hook, skb, indev, outdev, &key))
 		return NF_NOTFOUND;
-	/* we only search TCP/UDP protocol, others go the slow path */
-	if ((IPPROTO_TCP != ip_hdr(skb)->protocol) &&
-		(IPPROTO_UDP != ip_hdr(skb)->protocol))
+	if (0 == atomic_read(&p_l3_firewall_cache->total)) {
+		/* empty table, need not to search */
+		L3_FIREWALL_CACHE_STAT_INC(misses);
 		return NF_NOTFOUND;
-	if (0 == p_l3_firewall_cache->total)
-		return NF_NOTFOUND; /* empty table, need not to search */
-
-	/* store the ip pkg's chractors */
-	memcpy(ms, mh->h_source, ETH_ALEN);
-	lpro	= ip_hdr(skb)->protocol;
-	lsa		= ip_hdr(skb)->saddr;
-	lda		= ip_hdr(skb)->daddr;
-	if (IPPROTO_TCP == ip_hdr(skb)->protocol) {
-		lsp		= tcp_hdr(skb)->source;
-		ldp		= tcp_hdr(skb)->dest;
-	} else{
-		lsp		= udp_hdr(skb)->source;
-		ldp		= udp_hdr(skb)->dest;
 	}
 
-	/* if tables is not full,loop from current till head.
-	 * if find, return with the response of current pointer.
-	 * else if not find, return NF_NOTFOUND */
-	if (!(p_l3_firewall_cache->full)) {
-		read_lock_bh(&(p_l3_firewall_cache->lock));
-		for (i = p_l3_firewall_cache->current; i >= 0; i--) {
-			if ((!compare_ether_addr(p[i].h_source, ms)) &&
-				(p[i].Saddr == lsa) &&
-				(p[i].Daddr == lda) &&
-				(p[i].Protocol == lpro) &&
-				(p[i].SourcePort == lsp) &&
-				(p[i].DestPort == ldp)) {
-
-				response = p[i].response;
-				read_unlock_bh(&(p_l3_firewall_cache->lock));
-				found = true;
-				goto out;
-			}
+	b = l3_firewall_cache_bucket(p_l3_firewall_cache, &key);
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(p, n, &b->chain, hnode) {
+		if (!l3_firewall_cache_line_match(p, &key))
+			continue;
+		if (p->generation != l3_firewall_cache_generation(pf, hook)) {
+			L3_FIREWALL_CACHE_STAT_INC(invalidations);
+			break;
 		}
-		read_unlock_bh(&(p_l3_firewall_cache->lock));
-	} else {
-	/* if table is full, loop from current to head,
-	 * then loop from tail to current pointer again.
-	 * if find, return with the response of current pointer.
-	 * else if not find, return NF_NOTFOUND */
-		read_lock_bh(&(p_l3_firewall_cache->lock));
-		i = p_l3_firewall_cache->current;
-		for (;;) {
-			/* find from current pointer */
-			if ((!compare_ether_addr(p[i].h_source, ms)) &&
-				(p[i].Saddr == lsa) &&
-				(p[i].Daddr == lda) &&
-				(p[i].Protocol == lpro) &&
-				(p[i].SourcePort == lsp) &&
-				(p[i].DestPort == ldp)) {
-
-				response = p[i].response;
-				read_unlock_bh(&(p_l3_firewall_cache->lock));
-				found = true;
-				goto out;
-				} else {
-					/* adjust the pointer and make sure
-					 * to travel all the cache lines.
-					 */
-					i = (TOTAL_LINES_OF_CACHE + i - 1) &
-						(TOTAL_LINES_OF_CACHE - 1);
-					if (p_l3_firewall_cache->current == i)
-						break;
-				}
+		if (l3_firewall_cache_line_expired(p)) {
+			L3_FIREWALL_CACHE_STAT_INC(expired);
+			break;
 		}
-		read_unlock_bh(&(p_l3_firewall_cache->lock));
+		response = p->response;
+		if (!p->referenced)
+			p->referenced = 1;
+		if (p->last_used != jiffies)
+			p->last_used = jiffies;
+		break;
 	}
+	rcu_read_unlock();
+
+	if (response == NF_NOTFOUND)
+		L3_FIREWALL_CACHE_STAT_INC(misses);
+	else
+		L3_FIREWALL_CACHE_STAT_INC(hits);
 
-out:
 	/* if not found, the response is NF_NOTFOUND */
-	return (int)response;
+	return response;
 }
 EXPORT_SYMBOL_GPL(search_from_firewall_cache);
 
+static void *l3_firewall_cache_alloc_buckets(unsigned int nr)
+{
+	size_t sz = nr * sizeof(struct firewall_cache_bucket);
+	void *hash;
+
+	hash = (void *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN | __GFP_ZERO,
+					get_order(sz));
+	if (!hash)
+		hash = vzalloc(sz);
+	return hash;
+}
+
+static void l3_firewall_cache_free_buckets(void *hash, unsigned int nr)
+{
+	if (is_vmalloc_addr(hash))
+		vfree(hash);
+	else
+		free_pages((unsigned long)hash,
+			   get_order(nr * sizeof(struct firewall_cache_bucket)));
+}
+
 static int __init l3_firewall_cache_init_early(void)
 {
+	unsigned int i;
+
 	/* set l3 firewall cahche disable as default */
 	ipv4_l3_firewall_cache_enable = 0;
+	ipv6_l3_firewall_cache_enable = 0;
+	BUILD_BUG_ON(sizeof(struct firewall_cache_key) % sizeof(u32));
+	if (!buckets)
+		buckets = L3_FIREWALL_CACHE_BUCKETS;
+	buckets = roundup_pow_of_two(buckets);
+	if (!depth)
+		depth = L3_FIREWALL_CACHE_DEPTH;
+
+	l3_firewall_cache_cachep = kmem_cache_create("l3_firewall_cache",
+				sizeof(struct firewall_cache_lines), 0,
+				SLAB_HWCACHE_ALIGN, NULL);
+	if (!l3_firewall_cache_cachep)
+		return -ENOMEM;
 	p_l3_firewall_cache = (struct p_firewall_cache *)
-		kmalloc(sizeof(struct p_firewall_cache), GFP_KERNEL);
+		kzalloc(sizeof(struct p_firewall_cache), GFP_KERNEL);
 	if (!p_l3_firewall_cache)
-		return -ENOMEM;
-	if (init_l3_firewall_cache()) {
-		kfree(p_l3_firewall_cache);
+		goto err_cachep;
+	p_l3_firewall_cache->buckets = l3_firewall_cache_alloc_buckets(buckets);
+	if (!p_l3_firewall_cache->buckets) {
 		printk(KERN_INFO "%s:not enough memory.\n", __func__);
-		return -ENOMEM;
+		goto err_cache;
+	}
+	p_l3_firewall_cache->hash_size = buckets;
+	get_random_bytes(&p_l3_firewall_cache->hash_rnd,
+			 sizeof(p_l3_firewall_cache->hash_rnd));
+	atomic_set(&p_l3_firewall_cache->total, 0);
+	for (i = 0; i < buckets; i++) {
+		INIT_HLIST_HEAD(&p_l3_firewall_cache->buckets[i].chain);
+		spin_lock_init(&p_l3_firewall_cache->buckets[i].lock);
 	}
-	rwlock_init(&(p_l3_firewall_cache->lock));
 	printk(KERN_INFO
-		"%s:init ok\nTOTAL_LINES_OF_CACHE:%d, struct size:%dB\n",
-		__func__, TOTAL_LINES_OF_CACHE,
+		"%s:init ok\nbuckets:%u, depth:%u, struct size:%zuB\n",
+		__func__, buckets, depth,
 		sizeof(struct firewall_cache_lines));
 
 	L3_Firewall_Cache_register_proc();
 	return 0;
+
+err_cache:
+	kfree(p_l3_firewall_cache);
+err_cachep:
+	kmem_cache_destroy(l3_firewall_cache_cachep);
+	return -ENOMEM;
 }
 
 static void __exit l3_firewall_cache_exit(void)
 {
+	L3_Firewall_Cache_unregister_proc();
+	init_l3_firewall_cache();
+	rcu_barrier();
+	l3_firewall_cache_free_buckets(p_l3_firewall_cache->buckets,
+				       p_l3_firewall_cache->hash_size);
 	kfree(p_l3_firewall_cache);
+	kmem_cache_destroy(l3_firewall_cache_cachep);
 	printk(KERN_INFO "%s exit ok\n.", __func__);
-	L3_Firewall_Cache_unregister_proc();
 }
 
 module_init(l3_firewall_cache_init_early);
@@ -19,7 +19,16 @@
  *	`-- sys/
  *		`-- net/
  *			`-- l3_firewall_cache_ctrl/
- *					`-- ipv4_l3_firewall_cache_enable
+ *					|-- ipv4_l3_firewall_cache_enable
+ *					|-- ipv6_l3_firewall_cache_enable
+ *					|-- ipv4_l3_firewall_cache_timeout
+ *					|-- stat_entries
+ *					|-- stat_hits
+ *					|-- stat_misses
+ *					|-- stat_inserts
+ *					|-- stat_evictions
+ *					|-- stat_invalidations
+ *					`-- stat_expired
  *
  * In order to enable or disable the acceleration function dynamically
  * by the following command:
@@ -33,6 +42,13 @@
  * or
  * echo 0 >/proc/sys/net/l3_firewall_cache_ctrl/ipv4_l3_firewall_cache_enable
  *
+ * ipv6_l3_firewall_cache_enable does the same for IPv6 packets.
+ *
+ * ipv4_l3_firewall_cache_timeout is the idle time, in seconds, after
+ * which a cache line is no longer used. The stat_* files are read
+ * only and show the number of lines in the cache and the counters
+ * of the lookups and updates, summed over all cpus.
+ *
  *
  * Copyright (C) 2012 Freescale Semiconductor, Inc. All rights reserved.
  *
@@ -64,10 +80,17 @@
 #include <linux/sysctl.h>
 #include <linux/version.h>
 #include <linux/proc_fs.h>
+#include <linux/l3_firewall_cache.h>
 
 int ipv4_l3_firewall_cache_enable;
 EXPORT_SYMBOL(ipv4_l3_firewall_cache_enable);
 
+int ipv6_l3_firewall_cache_enable;
+EXPORT_SYMBOL(ipv6_l3_firewall_cache_enable);
+
+int l3_firewall_cache_timeout = L3_FIREWALL_CACHE_TIMEOUT * HZ;
+EXPORT_SYMBOL(l3_firewall_cache_timeout);
+
 static struct ctl_table_header *L3_Firewall_Cache_Header;
 
 static int proc_ipv4_l3_firewall_cache_enable(ctl_table *ctl, int write,
@@ -90,6 +113,63 @@ static int proc_ipv4_l3_firewall_cache_enable(ctl_table *ctl, int write,
 	return ret;
 }
 
+static int proc_ipv6_l3_firewall_cache_enable(ctl_table *ctl, int write,
+				void __user *buffer,
+				size_t *lenp, loff_t *ppos)
+{
+	int old_state = ipv6_l3_firewall_cache_enable, ret;
+	ret = proc_dointvec(ctl, write, buffer, lenp, ppos);
+	if (ipv6_l3_firewall_cache_enable != 0)
+		ipv6_l3_firewall_cache_enable = 1;
+
+	if (ipv6_l3_firewall_cache_enable != old_state) {
+		if (ipv6_l3_firewall_cache_enable)
+			printk(KERN_INFO "IPv6 Firewall acceleration function"
+					" based on Cache enabled.\n");
+		else
+			printk(KERN_INFO "IPv6 Firewall acceleration function"
+					" based on Cache disabled.\n");
+	}
+	return ret;
+}
+
+/* extra1 holds the offset of the counter in l3_firewall_cache_stat */
+static int proc_l3_firewall_cache_stat(ctl_table *ctl, int write,
+				void __user *buffer,
+				size_t *lenp, loff_t *ppos)
+{
+	struct l3_firewall_cache_stat sum;
+	unsigned long val;
+	ctl_table tmp = *ctl;
+
+	l3_firewall_cache_stat_sum(&sum);
+	val = *(unsigned long *)((char *)&sum + (unsigned long)ctl->extra1);
+	tmp.data = &val;
+	tmp.extra1 = NULL;
+	return proc_doulongvec_minmax(&tmp, write, buffer, lenp, ppos);
+}
+
+static int proc_l3_firewall_cache_entries(ctl_table *ctl, int write,
+				void __user *buffer,
+				size_t *lenp, loff_t *ppos)
+{
+	unsigned long val = l3_firewall_cache_entries();
+	ctl_table tmp = *ctl;
+
+	tmp.data = &val;
+	return proc_doulongvec_minmax(&tmp, write, buffer, lenp, ppos);
+}
+
+#define L3_FIREWALL_CACHE_STAT(name)					\
+	{								\
+		.procname       = "stat_" #name,			\
+		.maxlen         = sizeof(unsigned long),		\
+		.mode           = 0444,					\
+		.proc_handler   = proc_l3_firewall_cache_stat,		\
+		.extra1         = (void *)offsetof(			\
+				struct l3_firewall_cache_stat, name),	\
+	}
+
 static struct ctl_table L3_Firewall_Cache_Items[] = {
 	{
 		.procname       = "ipv4_l3_firewall_cache_enable",
@@ -98,6 +178,32 @@ static struct ctl_table L3_Firewall_Cache_Items[] = {
 		.mode           = 0644,
 		.proc_handler   = proc_ipv4_l3_firewall_cache_enable,
 	},
+	{
+		.procname       = "ipv6_l3_firewall_cache_enable",
+		.data           = &ipv6_l3_firewall_cache_enable,
+		.maxlen         = sizeof(int),
+		.mode           = 0644,
+		.proc_handler   = proc_ipv6_l3_firewall_cache_enable,
+	},
+	{
+		.procname       = "ipv4_l3_firewall_cache_timeout",
+		.data           = &l3_firewall_cache_timeout,
+		.maxlen         = sizeof(int),
+		.mode           = 0644,
+		.proc_handler   = proc_dointvec_jiffies,
+	},
+	{
+		.procname       = "stat_entries",
+		.maxlen         = sizeof(unsigned long),
+		.mode           = 0444,
+		.proc_handler   = proc_l3_firewall_cache_entries,
+	},
+	L3_FIREWALL_CACHE_STAT(hits),
+	L3_FIREWALL_CACHE_STAT(misses),
+	L3_FIREWALL_CACHE_STAT(inserts),
+	L3_FIREWALL_CACHE_STAT(evictions),
+	L3_FIREWALL_CACHE_STAT(invalidations),
+	L3_FIREWALL_CACHE_STAT(expired),
 	{}
 };
 static struct ctl_table L3_Firewall_Cache_Directory[] = {
@@ -25,12 +25,14 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
 #include <linux/l3_firewall_cache.h>
+#include <net/netfilter/ipv4/ipt_classifier.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
@@ -305,6 +307,10 @@ ipt_do_table(struct sk_buff *skb,
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
 	unsigned int addend;
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	struct ipt_cls_state cls;
+	bool classified = false;
+#endif
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -335,6 +341,21 @@ ipt_do_table(struct sk_buff *skb,
 	origptr    = *stackptr;
 
 	e = get_entry(table_base, private->hook_entry[hook]);
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	/* Start at the first rule of the base chain whose header
+	 * may match, and step over the others on a miss.
+	 */
+	if (private->classifier &&
+	    ipt_classifier_prepare(private->classifier, hook, skb, ip,
+				   acpar.fragoff, acpar.thoff, &cls)) {
+		struct ipt_entry *first = ipt_classifier_first(&cls,
+							       table_base);
+		if (first != NULL) {
+			e = first;
+			classified = true;
+		}
+	}
+#endif
 
 	pr_debug("Entering %s(hook %u); sp at %u (UF %p)\n",
 		 table->name, hook, origptr,
@@ -348,6 +369,17 @@ ipt_do_table(struct sk_buff *skb,
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+			if (classified) {
+				struct ipt_entry *next;
+
+				next = ipt_classifier_next(&cls, table_base, e);
+				if (next != NULL) {
+					e = next;
+					continue;
+				}
+			}
+#endif
 			e = ipt_next_entry(e);
 			continue;
 		}
@@ -785,6 +817,10 @@ cleanup_entry(struct ipt_entry *e, struct net *net)
 	module_put(par.target->me);
 }
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+DEFINE_L3_FIREWALL_CACHE_SCAN(ipt, struct ipt_entry)
+#endif
+
 /* Checks and translates the user-supplied table segment (held in
    newinfo) */
 static int
@@ -846,6 +882,9 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 
 	if (!mark_source_chains(newinfo, repl->valid_hooks, entry0))
 		return -ELOOP;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ipt_rules_fingerprint(newinfo, entry0);
+#endif
 
 	/* Finally, each sanity check must pass */
 	i = 0;
@@ -1172,11 +1211,14 @@ get_entries(struct net *net, struct ipt_get_entries __user *uptr,
 }
 
 #ifdef CONFIG_AS_FASTPATH
-void (*pfnfirewall_asfctrl)(void);
+void (__rcu *pfnfirewall_asfctrl)(void);
 
+/* The callback runs under rcu_read_lock(): whoever clears it has to
+ * synchronize_net() before it goes away. */
 void hook_firewall_asfctrl_cb(const struct firewall_asfctrl *fwasfctrl)
 {
-	pfnfirewall_asfctrl = fwasfctrl->firewall_asfctrl_cb;
+	rcu_assign_pointer(pfnfirewall_asfctrl,
+			   fwasfctrl->firewall_asfctrl_cb);
 }
 EXPORT_SYMBOL(hook_firewall_asfctrl_cb);
 #endif
@@ -1192,6 +1234,9 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	struct xt_counters *counters;
 	void *loc_cpu_old_entry;
 	struct ipt_entry *iter;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	bool rules_changed;
+#endif
 
 	ret = 0;
 	counters = vzalloc(num_counters * sizeof(struct xt_counters));
@@ -1215,9 +1260,27 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 		goto put_module;
 	}
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ipt_rules_stateful(newinfo);
+	l3_firewall_cache_account(t, newinfo, 1);
+#endif
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	newinfo->classifier = ipt_classifier_build(newinfo,
+				newinfo->entries[raw_smp_processor_id()],
+				valid_hooks);
+#endif
 	oldinfo = xt_replace_table(t, num_counters, newinfo, &ret);
-	if (!oldinfo)
+	if (!oldinfo) {
+#ifdef CONFIG_L3_FIREWALL_CACHE
+		l3_firewall_cache_account(t, newinfo, -1);
+#endif
 		goto put_module;
+	}
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	rules_changed = oldinfo->fingerprint != newinfo->fingerprint ||
+			oldinfo->stateful != newinfo->stateful;
+	l3_firewall_cache_account(t, oldinfo, -1);
+#endif
 
 	/* Update module usage count based on number of rules */
 	duprintf("do_replace: oldnum=%u, initnum=%u, newnum=%u\n",
@@ -1244,10 +1307,23 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	vfree(counters);
 	xt_table_unlock(t);
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	/* Only the verdicts of the hooks this table sits on can change */
+	if (rules_changed)
+		l3_firewall_cache_invalidate(NFPROTO_IPV4, valid_hooks);
+#endif  /* endif CONFIG_L3_FIREWALL_CACHE */
+
 #ifdef CONFIG_AS_FASTPATH
 	/* Call the  ASF CTRL CB */
-	if (!ret && pfnfirewall_asfctrl)
-		pfnfirewall_asfctrl();
+	if (!ret) {
+		void (*asfctrl)(void);
+
+		rcu_read_lock();
+		asfctrl = rcu_dereference(pfnfirewall_asfctrl);
+		if (asfctrl)
+			asfctrl();
+		rcu_read_unlock();
+	}
 #endif
 
 	return ret;
@@ -1746,6 +1822,9 @@ translate_compat_table(struct net *net,
 	ret = -ELOOP;
 	if (!mark_source_chains(newinfo, valid_hooks, entry1))
 		goto free_newinfo;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ipt_rules_fingerprint(newinfo, entry1);
+#endif
 
 	i = 0;
 	xt_entry_foreach(iter1, entry1, newinfo->size) {
@@ -1872,9 +1951,6 @@ compat_do_ipt_set_ctl(struct sock *sk,	int cmd, void __user *user,
 	switch (cmd) {
 	case IPT_SO_SET_REPLACE:
 		ret = compat_do_replace(sock_net(sk), user, len);
-#ifdef CONFIG_L3_FIREWALL_CACHE
-		init_l3_firewall_cache();
-#endif  /* endif CONFIG_L3_FIREWALL_CACHE */
 		break;
 
 	case IPT_SO_SET_ADD_COUNTERS:
@@ -2012,10 +2088,6 @@ do_ipt_set_ctl(struct sock *sk, int cmd, void __user *user, unsigned int len)
 	switch (cmd) {
 	case IPT_SO_SET_REPLACE:
 		ret = do_replace(sock_net(sk), user, len);
-#ifdef CONFIG_L3_FIREWALL_CACHE
-		init_l3_firewall_cache();
-#endif  /* endif CONFIG_L3_FIREWALL_CACHE */
-
 		break;
 
 	case IPT_SO_SET_ADD_COUNTERS:
@@ -2105,12 +2177,18 @@ struct xt_table *ipt_register_table(struct net *net,
 	ret = translate_table(net, newinfo, loc_cpu_entry, repl);
 	if (ret != 0)
 		goto out_free;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ipt_rules_stateful(newinfo);
+#endif
 
 	new_table = xt_register_table(net, table, &bootstrap, newinfo);
 	if (IS_ERR(new_table)) {
 		ret = PTR_ERR(new_table);
 		goto out_free;
 	}
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	l3_firewall_cache_account(new_table, newinfo, 1);
+#endif
 
 	return new_table;
 
@@ -2127,6 +2205,9 @@ void ipt_unregister_table(struct net *net, struct xt_table *table)
 	struct module *table_owner = table->me;
 	struct ipt_entry *iter;
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	l3_firewall_cache_account(table, table->private, -1);
+#endif
 	private = xt_unregister_table(table);
 
 	/* Decrease module usage counts and free resources */
@@ -0,0 +1,533 @@
+/*
+ * Header classifier for iptables base chains.
+ *
+ * Built when a table is replaced, from the source/destination address
+ * and protocol of every rule of a base chain, and from the port ranges
+ * of its "tcp" and "udp" matches. A field a rule says nothing about,
+ * or that can not be expressed as a range (non prefix masks), makes
+ * the rule a candidate for every value of that field, so the set of
+ * candidates handed back to ipt_do_table() is always a superset of
+ * the rules that match.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/bitops.h>
+#include <linux/in.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <net/netfilter/ipv4/ipt_classifier.h>
+
+/* Chains shorter than this are walked faster than classified */
+static unsigned int min_rules __read_mostly = 32;
+module_param(min_rules, uint, 0644);
+MODULE_PARM_DESC(min_rules, "smallest base chain worth classifying");
+
+/* Upper bound on the bit vectors of a single field of a chain */
+static unsigned int max_dim_kb __read_mostly = 4096;
+module_param(max_dim_kb, uint, 0644);
+MODULE_PARM_DESC(max_dim_kb, "largest field classifier in KB, "
+		 "bigger ones are left out");
+
+/* Value of the port fields for packets that carry no ports */
+#define IPT_CLS_NOPORT	0x10000
+
+static const u32 ipt_cls_max[IPT_CLS_DIMS] = {
+	[IPT_CLS_SRC]	= 0xffffffff,
+	[IPT_CLS_DST]	= 0xffffffff,
+	[IPT_CLS_PROTO]	= 0xff,
+	[IPT_CLS_SPORT]	= IPT_CLS_NOPORT,
+	[IPT_CLS_DPORT]	= IPT_CLS_NOPORT,
+};
+
+struct ipt_cls_range {
+	u32 lo, hi;
+};
+
+/* What a rule asks of each field: any value when the bit is set in
+ * @wild, otherwise one of its @n (0, 1 or 2) ranges.
+ */
+struct ipt_cls_rule {
+	u8			wild;
+	u8			n[IPT_CLS_DIMS];
+	struct ipt_cls_range	r[IPT_CLS_DIMS][2];
+};
+
+/* Work area for one base chain while the classifier is built */
+struct ipt_cls_work {
+	unsigned int		nrules;
+	unsigned int		*offset;
+	struct ipt_cls_rule	*rules;
+	u32			*points[IPT_CLS_DIMS];
+	unsigned int		npoints[IPT_CLS_DIMS];
+};
+
+static void ipt_cls_set(struct ipt_cls_rule *r, unsigned int d,
+			u32 lo, u32 hi, u32 max, bool inv)
+{
+	r->wild &= ~(1 << d);
+	r->n[d] = 0;
+	if (!inv) {
+		r->r[d][r->n[d]++] = (struct ipt_cls_range){ lo, hi };
+		return;
+	}
+	/* The complement may be empty: then the rule never matches */
+	if (lo > 0)
+		r->r[d][r->n[d]++] = (struct ipt_cls_range){ 0, lo - 1 };
+	if (hi < max)
+		r->r[d][r->n[d]++] = (struct ipt_cls_range){ hi + 1, max };
+}
+
+static void ipt_cls_addr(struct ipt_cls_rule *r, unsigned int d,
+			 __be32 addr, __be32 mask, bool inv)
+{
+	u32 a = ntohl(addr), m = ntohl(mask);
+
+	/* non prefix masks and stray address bits are left to
+	 * ip_packet_match()
+	 */
+	if ((~m & (~m + 1)) != 0 || (a & ~m) != 0)
+		return;
+	if (m == 0 && !inv)
+		return;
+	ipt_cls_set(r, d, a, a | ~m, ipt_cls_max[d], inv);
+}
+
+static void ipt_cls_ports(struct ipt_cls_rule *r, const u16 *spts,
+			  const u16 *dpts, bool sinv, bool dinv)
+{
+	if (spts[0] != 0 || spts[1] != 0xffff || sinv)
+		ipt_cls_set(r, IPT_CLS_SPORT, spts[0], spts[1], 0xffff, sinv);
+	if (dpts[0] != 0 || dpts[1] != 0xffff || dinv)
+		ipt_cls_set(r, IPT_CLS_DPORT, dpts[0], dpts[1], 0xffff, dinv);
+}
+
+static void ipt_cls_rule_init(struct ipt_cls_rule *r,
+			      const struct ipt_entry *e)
+{
+	const struct ipt_ip *ip = &e->ip;
+	const struct xt_entry_match *ematch;
+
+	memset(r, 0, sizeof(*r));
+	r->wild = (1 << IPT_CLS_DIMS) - 1;
+
+	ipt_cls_addr(r, IPT_CLS_SRC, ip->src.s_addr, ip->smsk.s_addr,
+		     ip->invflags & IPT_INV_SRCIP);
+	ipt_cls_addr(r, IPT_CLS_DST, ip->dst.s_addr, ip->dmsk.s_addr,
+		     ip->invflags & IPT_INV_DSTIP);
+	if (ip->proto)
+		ipt_cls_set(r, IPT_CLS_PROTO, ip->proto, ip->proto,
+			    ipt_cls_max[IPT_CLS_PROTO],
+			    ip->invflags & IPT_INV_PROTO);
+
+	xt_ematch_foreach(ematch, e) {
+		const struct xt_match *m = ematch->u.kernel.match;
+
+		if (m->revision != 0)
+			continue;
+		if (strcmp(m->name, "tcp") == 0) {
+			const struct xt_tcp *info = (const void *)ematch->data;
+
+			ipt_cls_ports(r, info->spts, info->dpts,
+				      info->invflags & XT_TCP_INV_SRCPT,
+				      info->invflags & XT_TCP_INV_DSTPT);
+			break;
+		}
+		if (strcmp(m->name, "udp") == 0) {
+			const struct xt_udp *info = (const void *)ematch->data;
+
+			ipt_cls_ports(r, info->spts, info->dpts,
+				      info->invflags & XT_UDP_INV_SRCPT,
+				      info->invflags & XT_UDP_INV_DSTPT);
+			break;
+		}
+	}
+}
+
+static int ipt_cls_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* index of the interval holding @v: the last start <= @v */
+static unsigned int ipt_cls_interval(const u32 *start, unsigned int nr,
+				     u32 v)
+{
+	unsigned int lo = 0, hi = nr;
+
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (start[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Collect the interval bounds of field @d, sorted and unique */
+static int ipt_cls_points(struct ipt_cls_work *w, unsigned int d)
+{
+	unsigned int i, j, n = 0;
+	u32 *p;
+
+	p = vmalloc((1 + 4 * w->nrules) * sizeof(u32));
+	if (!p)
+		return -ENOMEM;
+	p[n++] = 0;
+	for (i = 0; i < w->nrules; i++) {
+		const struct ipt_cls_rule *r = &w->rules[i];
+
+		if (r->wild & (1 << d))
+			continue;
+		for (j = 0; j < r->n[d]; j++) {
+			p[n++] = r->r[d][j].lo;
+			if (r->r[d][j].hi < ipt_cls_max[d])
+				p[n++] = r->r[d][j].hi + 1;
+		}
+	}
+	sort(p, n, sizeof(u32), ipt_cls_cmp_u32, NULL);
+	for (i = 1, j = 1; i < n; i++)
+		if (p[i] != p[j - 1])
+			p[j++] = p[i];
+
+	w->points[d] = p;
+	w->npoints[d] = j;
+	return 0;
+}
+
+static void ipt_cls_work_free(struct ipt_cls_work *w)
+{
+	unsigned int d;
+
+	for (d = 0; d < IPT_CLS_DIMS; d++)
+		vfree(w->points[d]);
+	vfree(w->rules);
+	vfree(w->offset);
+	memset(w, 0, sizeof(*w));
+}
+
+/* Walk the base chain of @hook, from its entry to its policy rule */
+static int ipt_cls_work_init(struct ipt_cls_work *w,
+			     const struct xt_table_info *info,
+			     const void *entry0, unsigned int hook)
+{
+	unsigned int pos, i, d, end = info->underflow[hook];
+	const struct ipt_entry *e;
+	int ret;
+
+	memset(w, 0, sizeof(*w));
+	for (pos = info->hook_entry[hook]; pos < end; pos += e->next_offset) {
+		e = entry0 + pos;
+		w->nrules++;
+	}
+	if (pos != end)
+		return -EINVAL;
+	w->nrules++;
+	if (w->nrules < min_rules)
+		return -EINVAL;
+
+	w->offset = vmalloc(w->nrules * sizeof(unsigned int));
+	w->rules = vmalloc(w->nrules * sizeof(struct ipt_cls_rule));
+	if (!w->offset || !w->rules) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	for (i = 0, pos = info->hook_entry[hook]; i < w->nrules;
+	     i++, pos += e->next_offset) {
+		e = entry0 + pos;
+		w->offset[i] = pos;
+		ipt_cls_rule_init(&w->rules[i], e);
+	}
+
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		ret = ipt_cls_points(w, d);
+		if (ret < 0)
+			goto err;
+		/* a field nobody asks about does not narrow anything */
+		if (w->npoints[d] == 1)
+			w->npoints[d] = 0;
+	}
+	return 0;
+err:
+	ipt_cls_work_free(w);
+	return ret;
+}
+
+static size_t ipt_cls_dim_size(const struct ipt_cls_work *w, unsigned int d)
+{
+	unsigned int words = BITS_TO_LONGS(w->nrules);
+
+	return w->npoints[d] * (sizeof(u32) + words * sizeof(unsigned long));
+}
+
+static size_t ipt_cls_chain_size(struct ipt_cls_work *w)
+{
+	size_t size;
+	unsigned int d;
+
+	size = ALIGN(sizeof(struct ipt_cls_chain) +
+		     w->nrules * sizeof(unsigned int), sizeof(long));
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		if (ipt_cls_dim_size(w, d) > max_dim_kb * 1024)
+			w->npoints[d] = 0;
+		size += ALIGN(ipt_cls_dim_size(w, d), sizeof(long));
+	}
+	return size;
+}
+
+/* Lay out the chain at @p, returns the end of it */
+static void *ipt_cls_chain_fill(struct ipt_cls_chain *c,
+				const struct ipt_cls_work *w)
+{
+	unsigned int words = BITS_TO_LONGS(w->nrules);
+	unsigned int d, i, j, k;
+	unsigned int *offset;
+	void *p;
+
+	c->nrules = w->nrules;
+	c->words = words;
+	offset = (void *)(c + 1);
+	memcpy(offset, w->offset, w->nrules * sizeof(unsigned int));
+	c->offset = offset;
+	p = PTR_ALIGN((void *)(offset + w->nrules), sizeof(long));
+
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		struct ipt_cls_dim *dim = &c->dim[d];
+		unsigned int nr = w->npoints[d];
+		unsigned long *bits;
+		u32 *start;
+
+		dim->nr = nr;
+		if (!nr)
+			continue;
+		bits = p;
+		start = (void *)(bits + nr * words);
+		memcpy(start, w->points[d], nr * sizeof(u32));
+		dim->bits = bits;
+		dim->start = start;
+		p = PTR_ALIGN((void *)(start + nr), sizeof(long));
+
+		for (i = 0; i < w->nrules; i++) {
+			const struct ipt_cls_rule *r = &w->rules[i];
+
+			if (r->wild & (1 << d)) {
+				for (k = 0; k < nr; k++)
+					__set_bit(i, bits + k * words);
+				continue;
+			}
+			for (j = 0; j < r->n[d]; j++) {
+				unsigned int first, last;
+
+				first = ipt_cls_interval(start, nr,
+							 r->r[d][j].lo);
+				last = ipt_cls_interval(start, nr,
+							r->r[d][j].hi);
+				for (k = first; k <= last; k++)
+					__set_bit(i, bits + k * words);
+			}
+		}
+	}
+	return p;
+}
+
+/**
+ * ipt_classifier_build - classify the base chains of a new table
+ * @info: the translated table
+ * @entry0: the rules of @info on this cpu
+ * @valid_hooks: the hooks the table sits on
+ *
+ * Returns NULL when no base chain is worth classifying or memory
+ * is short; ipt_do_table() then walks the rules one by one.
+ */
+struct ipt_classifier *
+ipt_classifier_build(const struct xt_table_info *info, const void *entry0,
+		     unsigned int valid_hooks)
+{
+	struct ipt_cls_work w[NF_INET_NUMHOOKS];
+	struct ipt_classifier *cls = NULL;
+	size_t size = sizeof(*cls);
+	unsigned int hook, nr = 0;
+	void *p;
+
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++) {
+		memset(&w[hook], 0, sizeof(w[hook]));
+		if (!(valid_hooks & (1 << hook)))
+			continue;
+		if (ipt_cls_work_init(&w[hook], info, entry0, hook) < 0) {
+			w[hook].nrules = 0;
+			continue;
+		}
+		size += ipt_cls_chain_size(&w[hook]);
+		nr++;
+	}
+	if (!nr)
+		goto out;
+
+	cls = vzalloc(size);
+	if (!cls)
+		goto out;
+	p = PTR_ALIGN((void *)(cls + 1), sizeof(long));
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++) {
+		if (!w[hook].nrules)
+			continue;
+		cls->chain[hook] = p;
+		p = ipt_cls_chain_fill(p, &w[hook]);
+	}
+	pr_debug("classifier of %u chains, %zu bytes\n", nr, size);
+out:
+	for (hook = 0; hook < NF_INET_NUMHOOKS; hook++)
+		ipt_cls_work_free(&w[hook]);
+	return cls;
+}
+EXPORT_SYMBOL_GPL(ipt_classifier_build);
+
+/**
+ * ipt_classifier_prepare - look the fields of a packet up
+ *
+ * Returns false when the packet has to walk the chain rule by rule:
+ * no classifier for @hook, or a fragment or a truncated header, which
+ * the tcp and udp matches treat specially (they may hotdrop).
+ */
+bool ipt_classifier_prepare(const struct ipt_classifier *cls,
+			    unsigned int hook,
+			    const struct sk_buff *skb,
+			    const struct iphdr *ip,
+			    unsigned int fragoff, unsigned int thoff,
+			    struct ipt_cls_state *st)
+{
+	const struct ipt_cls_chain *c = cls->chain[hook];
+	u32 key[IPT_CLS_DIMS];
+	unsigned int d;
+
+	if (!c || fragoff)
+		return false;
+
+	key[IPT_CLS_SRC] = ntohl(ip->saddr);
+	key[IPT_CLS_DST] = ntohl(ip->daddr);
+	key[IPT_CLS_PROTO] = ip->protocol;
+	if (ip->protocol == IPPROTO_TCP) {
+		struct tcphdr _tcph;
+		const struct tcphdr *th;
+
+		/* the tcp match hotdrops shorter headers */
+		th = skb_header_pointer(skb, thoff, sizeof(_tcph), &_tcph);
+		if (!th)
+			return false;
+		key[IPT_CLS_SPORT] = ntohs(th->source);
+		key[IPT_CLS_DPORT] = ntohs(th->dest);
+	} else if (ip->protocol == IPPROTO_UDP) {
+		struct udphdr _udph;
+		const struct udphdr *uh;
+
+		/* as does the udp match */
+		uh = skb_header_pointer(skb, thoff, sizeof(_udph), &_udph);
+		if (!uh)
+			return false;
+		key[IPT_CLS_SPORT] = ntohs(uh->source);
+		key[IPT_CLS_DPORT] = ntohs(uh->dest);
+	} else {
+		key[IPT_CLS_SPORT] = IPT_CLS_NOPORT;
+		key[IPT_CLS_DPORT] = IPT_CLS_NOPORT;
+	}
+
+	st->chain = c;
+	st->ndims = 0;
+	st->pos = 0;
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		const struct ipt_cls_dim *dim = &c->dim[d];
+
+		if (!dim->nr)
+			continue;
+		st->vec[st->ndims++] = dim->bits + c->words *
+			ipt_cls_interval(dim->start, dim->nr, key[d]);
+	}
+	return true;
+}
+EXPORT_SYMBOL_GPL(ipt_classifier_prepare);
+
+/* first candidate rule at or after index @from */
+static unsigned int ipt_cls_find(const struct ipt_cls_state *st,
+				 unsigned int from)
+{
+	const struct ipt_cls_chain *c = st->chain;
+	unsigned int w = from / BITS_PER_LONG, d;
+	unsigned long v;
+
+	if (from >= c->nrules)
+		return c->nrules;
+	v = ~0UL << (from % BITS_PER_LONG);
+	for (; w < c->words; w++, v = ~0UL) {
+		for (d = 0; d < st->ndims && v; d++)
+			v &= st->vec[d][w];
+		if (v)
+			return min_t(unsigned int, w * BITS_PER_LONG + __ffs(v),
+				     c->nrules);
+	}
+	return c->nrules;
+}
+
+struct ipt_entry *ipt_classifier_first(struct ipt_cls_state *st,
+				       const void *table_base)
+{
+	unsigned int i = ipt_cls_find(st, 0);
+
+	if (i >= st->chain->nrules)
+		return NULL;
+	st->pos = i;
+	return (struct ipt_entry *)(table_base + st->chain->offset[i]);
+}
+EXPORT_SYMBOL_GPL(ipt_classifier_first);
+
+/**
+ * ipt_classifier_next - the candidate following a rule that missed
+ *
+ * Returns NULL when @e is not a rule of the classified base chain,
+ * e.g. in a user defined chain; the caller steps to the next rule.
+ */
+struct ipt_entry *ipt_classifier_next(struct ipt_cls_state *st,
+				      const void *table_base,
+				      const struct ipt_entry *e)
+{
+	const struct ipt_cls_chain *c = st->chain;
+	unsigned int off = (const void *)e - table_base;
+	unsigned int i = st->pos;
+
+	if (c->offset[i] != off) {
+		/* back from a user defined chain */
+		unsigned int lo = 0, hi = c->nrules;
+
+		while (lo < hi) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (c->offset[mid] < off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo >= c->nrules || c->offset[lo] != off)
+			return NULL;
+		i = lo;
+	}
+
+	i = ipt_cls_find(st, i + 1);
+	if (i >= c->nrules)
+		return NULL;
+	st->pos = i;
+	return (struct ipt_entry *)(table_base + c->offset[i]);
+}
+EXPORT_SYMBOL_GPL(ipt_classifier_next);
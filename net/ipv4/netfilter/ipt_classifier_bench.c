@@ -0,0 +1,302 @@
+/*
+ * Benchmark of the iptables header classifier.
+ *
+ * Builds synthetic FORWARD chains of growing length, and times how
+ * long a batch of random packets takes to find the first rule whose
+ * header matches: walking the rules one by one as ipt_do_table() does
+ * without a classifier, and going through the classifier. Both walks
+ * must agree on the rule. The results go to the kernel log:
+ *
+ *	modprobe ipt_classifier_bench [packets=N] [rounds=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/kbench.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <net/netfilter/ipv4/ipt_classifier.h>
+
+static unsigned int packets = 4096;
+module_param(packets, uint, 0444);
+MODULE_PARM_DESC(packets, "packets per round");
+
+static unsigned int rounds = 16;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "rounds per chain length");
+
+static const unsigned int bench_chain_len[] = {
+	64, 256, 1024, 2048, 4096
+};
+
+/* The classifier only looks at the name and revision of a match */
+static struct xt_match bench_tcp = { .name = "tcp" };
+static struct xt_match bench_udp = { .name = "udp" };
+
+#define BENCH_MATCH_SIZE (XT_ALIGN(sizeof(struct xt_entry_match)) + \
+			  XT_ALIGN(sizeof(struct xt_tcp)))
+#define BENCH_TARGET_SIZE XT_ALIGN(sizeof(struct xt_standard_target))
+#define BENCH_RULE_SIZE	(XT_ALIGN(sizeof(struct ipt_entry)) + \
+			 BENCH_MATCH_SIZE + BENCH_TARGET_SIZE)
+#define BENCH_POLICY_SIZE (XT_ALIGN(sizeof(struct ipt_entry)) + \
+			   BENCH_TARGET_SIZE)
+
+struct bench_pkt {
+	struct sk_buff	*skb;
+	u16		sport, dport;
+};
+
+static void bench_target(struct ipt_entry *e)
+{
+	struct xt_standard_target *t = (void *)e + e->target_offset;
+
+	t->target.u.target_size = BENCH_TARGET_SIZE;
+	t->verdict = -NF_ACCEPT - 1;
+}
+
+/* A mix of host and network addresses, protocols and port ranges */
+static void bench_rule(struct ipt_entry *e)
+{
+	struct xt_entry_match *m = (void *)e->elems;
+	struct xt_tcp *ports = (void *)m->data;
+	u32 r = random32();
+
+	memset(e, 0, BENCH_RULE_SIZE);
+	e->target_offset = XT_ALIGN(sizeof(struct ipt_entry)) +
+			   BENCH_MATCH_SIZE;
+	e->next_offset = BENCH_RULE_SIZE;
+
+	if (r & 1) {
+		e->ip.src.s_addr = htonl(0x0a000000 | (random32() & 0xffff00));
+		e->ip.smsk.s_addr = htonl(0xffffff00);
+	}
+	if (r & 2) {
+		e->ip.dst.s_addr = htonl(0xc0a80000 | (random32() & 0xffff));
+		e->ip.dmsk.s_addr = htonl(0xffffffff);
+	} else {
+		e->ip.dst.s_addr = htonl(0xac100000 | (random32() & 0xf0000));
+		e->ip.dmsk.s_addr = htonl(0xffff0000);
+	}
+	e->ip.proto = (r & 4) ? IPPROTO_TCP : IPPROTO_UDP;
+
+	m->u.match_size = BENCH_MATCH_SIZE;
+	m->u.kernel.match = e->ip.proto == IPPROTO_TCP ?
+			    &bench_tcp : &bench_udp;
+	/* xt_tcp and xt_udp share the layout of the port ranges */
+	ports->spts[0] = 0;
+	ports->spts[1] = 0xffff;
+	ports->dpts[0] = random32() % 60000;
+	ports->dpts[1] = ports->dpts[0] + ((r & 8) ? 0 : (r >> 8) % 1024);
+
+	bench_target(e);
+}
+
+/* The header part of ip_packet_match() and of the tcp/udp matches */
+static bool bench_match(const struct ipt_entry *e, const struct iphdr *iph,
+			u16 sport, u16 dport)
+{
+	const struct ipt_ip *ip = &e->ip;
+	const struct xt_entry_match *m;
+	const struct xt_tcp *ports;
+
+	if ((iph->saddr & ip->smsk.s_addr) != ip->src.s_addr ||
+	    (iph->daddr & ip->dmsk.s_addr) != ip->dst.s_addr)
+		return false;
+	if (ip->proto && iph->protocol != ip->proto)
+		return false;
+	if (e->target_offset == XT_ALIGN(sizeof(struct ipt_entry)))
+		return true;
+	m = (const void *)e->elems;
+	ports = (const void *)m->data;
+	return sport >= ports->spts[0] && sport <= ports->spts[1] &&
+	       dport >= ports->dpts[0] && dport <= ports->dpts[1];
+}
+
+/* Half of the packets are aimed at a rule, the others at random */
+static int bench_packet(struct bench_pkt *p, const void *entry0,
+			unsigned int nrules)
+{
+	const struct ipt_entry *e;
+	struct iphdr *iph;
+	__be16 *ports;
+	u32 r = random32();
+
+	p->skb = alloc_skb(sizeof(*iph) + 2 * sizeof(__be16), GFP_KERNEL);
+	if (!p->skb)
+		return -ENOMEM;
+	skb_reset_network_header(p->skb);
+	iph = (struct iphdr *)skb_put(p->skb, sizeof(*iph));
+	ports = (__be16 *)skb_put(p->skb, 2 * sizeof(__be16));
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	p->sport = random32();
+	p->dport = random32();
+	iph->saddr = htonl(0x0a000000 | (random32() & 0xffffff));
+	iph->daddr = htonl(random32());
+	iph->protocol = (r & 1) ? IPPROTO_TCP : IPPROTO_UDP;
+
+	if (r & 2) {
+		const struct xt_entry_match *m;
+		const struct xt_tcp *pr;
+
+		e = entry0 + (r >> 8) % (nrules - 1) * BENCH_RULE_SIZE;
+		m = (const void *)e->elems;
+		pr = (const void *)m->data;
+		iph->saddr = (iph->saddr & ~e->ip.smsk.s_addr) |
+			     e->ip.src.s_addr;
+		iph->daddr = (iph->daddr & ~e->ip.dmsk.s_addr) |
+			     e->ip.dst.s_addr;
+		iph->protocol = e->ip.proto;
+		p->dport = pr->dpts[0];
+	}
+	ports[0] = htons(p->sport);
+	ports[1] = htons(p->dport);
+	return 0;
+}
+
+static const struct ipt_entry *bench_linear(const void *entry0,
+					    const struct bench_pkt *p)
+{
+	const struct iphdr *iph = ip_hdr(p->skb);
+	const struct ipt_entry *e = entry0;
+
+	while (!bench_match(e, iph, p->sport, p->dport))
+		e = (const void *)e + e->next_offset;
+	return e;
+}
+
+static const struct ipt_entry *bench_classified(const struct ipt_classifier
+						*cls, const void *entry0,
+						const struct bench_pkt *p)
+{
+	const struct iphdr *iph = ip_hdr(p->skb);
+	struct ipt_cls_state st;
+	struct ipt_entry *e;
+
+	if (!ipt_classifier_prepare(cls, NF_INET_FORWARD, p->skb, iph,
+				    0, sizeof(*iph), &st))
+		return bench_linear(entry0, p);
+	e = ipt_classifier_first(&st, entry0);
+	while (e && !bench_match(e, iph, p->sport, p->dport))
+		e = ipt_classifier_next(&st, entry0, e);
+	return e;
+}
+
+static int bench_chain(unsigned int nrules, struct bench_pkt *pkts)
+{
+	struct xt_table_info *info;
+	struct ipt_classifier *cls;
+	unsigned int i, r, size, bad = 0;
+	s64 linear_ns, cls_ns;
+	ktime_t start;
+	struct ipt_entry *e;
+	void *entry0;
+	int ret = -ENOMEM;
+
+	size = (nrules - 1) * BENCH_RULE_SIZE + BENCH_POLICY_SIZE;
+	info = kzalloc(sizeof(*info), GFP_KERNEL);
+	entry0 = vmalloc(size);
+	if (!info || !entry0)
+		goto out;
+
+	for (i = 0; i < nrules - 1; i++)
+		bench_rule(entry0 + i * BENCH_RULE_SIZE);
+	e = entry0 + i * BENCH_RULE_SIZE;
+	memset(e, 0, BENCH_POLICY_SIZE);
+	e->target_offset = XT_ALIGN(sizeof(struct ipt_entry));
+	e->next_offset = BENCH_POLICY_SIZE;
+	bench_target(e);
+
+	info->size = size;
+	info->number = nrules;
+	info->hook_entry[NF_INET_FORWARD] = 0;
+	info->underflow[NF_INET_FORWARD] = i * BENCH_RULE_SIZE;
+
+	start = ktime_get();
+	cls = ipt_classifier_build(info, entry0, 1 << NF_INET_FORWARD);
+	if (!cls) {
+		pr_info("%5u rules: no classifier built\n", nrules);
+		ret = 0;
+		goto out;
+	}
+	pr_info("%5u rules: classifier built in %lld us\n", nrules,
+		ktime_to_us(ktime_sub(ktime_get(), start)));
+
+	for (i = 0; i < packets; i++) {
+		ret = bench_packet(&pkts[i], entry0, nrules);
+		if (ret < 0)
+			goto out_free;
+		if (bench_linear(entry0, &pkts[i]) !=
+		    bench_classified(cls, entry0, &pkts[i]))
+			bad++;
+	}
+
+	start = ktime_get();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < packets; i++)
+			bench_linear(entry0, &pkts[i]);
+	linear_ns = kbench_ns(start);
+
+	start = ktime_get();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < packets; i++)
+			bench_classified(cls, entry0, &pkts[i]);
+	cls_ns = kbench_ns(start);
+
+	pr_info("%5u rules: linear %lld ns/pkt, classified %lld ns/pkt, "
+		"%u mismatches\n", nrules,
+		div_s64(linear_ns, rounds * packets),
+		div_s64(cls_ns, rounds * packets), bad);
+	ret = bad ? -EINVAL : 0;
+out_free:
+	for (i = 0; i < packets; i++) {
+		kfree_skb(pkts[i].skb);
+		pkts[i].skb = NULL;
+	}
+	vfree(cls);
+out:
+	vfree(entry0);
+	kfree(info);
+	return ret;
+}
+
+static int __init ipt_classifier_bench_init(void)
+{
+	struct bench_pkt *pkts;
+	unsigned int i;
+	int ret = 0;
+
+	if (!packets || !rounds)
+		return -EINVAL;
+	pkts = vzalloc(packets * sizeof(*pkts));
+	if (!pkts)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(bench_chain_len) && !ret; i++)
+		ret = bench_chain(bench_chain_len[i], pkts);
+
+	vfree(pkts);
+	return kbench_done(ret);
+}
+
+static void __exit ipt_classifier_bench_exit(void)
+{
+}
+
+module_init(ipt_classifier_bench_init);
+module_exit(ipt_classifier_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("iptables header classifier benchmark");
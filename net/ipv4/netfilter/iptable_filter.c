@@ -30,6 +30,9 @@ static const struct xt_table packet_filter = {
 	.me		= THIS_MODULE,
 	.af		= NFPROTO_IPV4,
 	.priority	= NF_IP_PRI_FILTER,
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	.l3_cache	= true,
+#endif
 };
 
 static unsigned int
@@ -31,13 +31,13 @@ static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
 	struct hlist_nulls_node *n;
+	unsigned int size;
 
-	for (st->bucket = 0;
-	     st->bucket < net->ct.htable_size;
-	     st->bucket++) {
-		n = rcu_dereference(
-			hlist_nulls_first_rcu(&net->ct.hash[st->bucket]));
+	hash = nf_conntrack_get_ht(net, &size);
+	for (st->bucket = 0; st->bucket < size; st->bucket++) {
+		n = rcu_dereference(hlist_nulls_first_rcu(&hash[st->bucket]));
 		if (!is_a_nulls(n))
 			return n;
 	}
@@ -49,15 +49,20 @@ static struct hlist_nulls_node *ct_get_next(struct seq_file *seq,
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
+	unsigned int size;
 
 	head = rcu_dereference(hlist_nulls_next_rcu(head));
 	while (is_a_nulls(head)) {
+		hash = nf_conntrack_get_ht(net, &size);
 		if (likely(get_nulls_value(head) == st->bucket)) {
-			if (++st->bucket >= net->ct.htable_size)
+			if (++st->bucket >= size)
 				return NULL;
 		}
-		head = rcu_dereference(
-			hlist_nulls_first_rcu(&net->ct.hash[st->bucket]));
+		/* the table may have been resized under us */
+		if (st->bucket >= size)
+			return NULL;
+		head = rcu_dereference(hlist_nulls_first_rcu(&hash[st->bucket]));
 	}
 	return head;
 }
@@ -141,8 +146,7 @@ static int ct_seq_show(struct seq_file *s, void *v)
 	ret = -ENOSPC;
 	if (seq_printf(s, "%-8s %u %ld ",
 		      l4proto->name, nf_ct_protonum(ct),
-		      timer_pending(&ct->timeout)
-		      ? (long)(ct->timeout.expires - jiffies)/HZ : 0) != 0)
+		      (long)nf_ct_expires(ct) / HZ) != 0)
 		goto release;
 
 	if (l4proto->print_conntrack && l4proto->print_conntrack(s, ct))
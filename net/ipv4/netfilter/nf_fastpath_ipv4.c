@@ -0,0 +1,673 @@
+/*
+ * Software fastpath for established IPv4 flows.
+ *
+ * Once a forwarded tcp or udp connection is established and assured,
+ * the first packet of each direction that leaves through POST_ROUTING
+ * teaches us what happens to it on the way: the route, and with it the
+ * output device and the cached link layer header of the neighbour, and
+ * the addresses and ports NAT left it with. The next packets of that
+ * direction are taken from netif_receive_skb(), rewritten, their ttl
+ * and checksums updated, and handed to the neighbour without going
+ * through the IP stack or netfilter at all.
+ *
+ * Nothing is offloaded unless asked for: only packets whose mark,
+ * under the mark_mask parameter, equals the mark parameter teach us
+ * their flow, so the ruleset picks the connections, e.g. with
+ * -j MARK or CONNMARK. mark_mask is 0 by default.
+ *
+ * Packets that conntrack has to see still take the slow path: tcp
+ * SYN, FIN and RST, fragments, packets with IP options or too big for
+ * the route. Only NAT is replayed: what other targets did to the first
+ * packet, to its TOS or TTL for instance, is not. Counters are added
+ * to the conntrack accounting, and the conntrack timeout pushed
+ * forward, once a second. A flow goes away when its conntrack dies or
+ * leaves the established state, when it is idle for as long as the
+ * conntrack timeout, and on any route, device or iptables ruleset
+ * change.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/workqueue.h>
+#include <linux/netdevice.h>
+#include <linux/if_vlan.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <net/dst.h>
+#include <net/neighbour.h>
+#include <net/checksum.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+
+static unsigned int buckets = 4096;
+module_param(buckets, uint, 0444);
+MODULE_PARM_DESC(buckets, "size of the flow hash");
+
+static unsigned int max_flows = 65536;
+module_param(max_flows, uint, 0644);
+MODULE_PARM_DESC(max_flows, "flows offloaded at most, one per direction");
+
+static unsigned int mark;
+module_param(mark, uint, 0644);
+MODULE_PARM_DESC(mark, "mark of the packets whose flows are offloaded");
+
+static unsigned int mark_mask;
+module_param(mark_mask, uint, 0644);
+MODULE_PARM_DESC(mark_mask, "bits of the mark compared, none offloads nothing");
+
+struct nf_fp_flow {
+	struct hlist_node	hnode;
+	struct rcu_head		rcu;
+
+	/* what the packet looks like when it comes in, and where: the
+	 * device IP receives it on, not a bridge or bond port */
+	int			iif;
+	__be32			saddr, daddr;
+	__be16			sport, dport;
+	u8			protonum;
+	u8			dir;
+	bool			dead;
+	bool			liberal;	/* seen[!dir] had BE_LIBERAL */
+
+	/* and what it leaves with */
+	__be32			nat_saddr, nat_daddr;
+	__be16			nat_sport, nat_dport;
+	u32			mark;
+	u32			priority;
+	struct dst_entry	*dst;
+
+	struct nf_conn		*ct;
+	unsigned long		ct_timeout;	/* conntrack refreshes it by */
+	unsigned long		last_used;
+	unsigned long		synced;		/* last_used at the last sync */
+	atomic_long_t		packets;
+	atomic_long_t		bytes;
+};
+
+static struct hlist_head *nf_fp_hash __read_mostly;
+static unsigned int nf_fp_htable_size __read_mostly;
+static u32 nf_fp_hash_rnd __read_mostly;
+static struct kmem_cache *nf_fp_cachep __read_mostly;
+
+/* Serialises the writers; the fastpath looks flows up under RCU */
+static DEFINE_SPINLOCK(nf_fp_lock);
+static unsigned int nf_fp_count;
+
+static void nf_fp_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nf_fp_gc_work, nf_fp_gc);
+
+static u32 nf_fp_hashfn(int iif, __be32 saddr, __be32 daddr,
+			__be16 sport, __be16 dport, u8 protonum)
+{
+	return jhash_3words((__force u32)saddr, (__force u32)daddr,
+			    (__force u32)sport << 16 | (__force u32)dport,
+			    nf_fp_hash_rnd ^ iif ^ protonum) %
+	       nf_fp_htable_size;
+}
+
+static struct nf_fp_flow *nf_fp_find(int iif, __be32 saddr, __be32 daddr,
+				     __be16 sport, __be16 dport, u8 protonum)
+{
+	struct nf_fp_flow *fp;
+	struct hlist_node *n;
+	u32 hash;
+
+	hash = nf_fp_hashfn(iif, saddr, daddr, sport, dport, protonum);
+	hlist_for_each_entry_rcu(fp, n, &nf_fp_hash[hash], hnode) {
+		if (fp->saddr == saddr && fp->daddr == daddr &&
+		    fp->sport == sport && fp->dport == dport &&
+		    fp->protonum == protonum && fp->iif == iif)
+			return fp;
+	}
+	return NULL;
+}
+
+/*
+ * Conntrack does not see the packets of an offloaded tcp direction,
+ * while those of the other direction acknowledge them: window tracking
+ * lets the latter through meanwhile. Once the flow is gone, conntrack
+ * picks the window of the offloaded direction up again from its next
+ * packet, as for a connection met midstream.
+ */
+static void nf_fp_tcp_offload(struct nf_fp_flow *fp)
+{
+	struct ip_ct_tcp_state *other = &fp->ct->proto.tcp.seen[!fp->dir];
+
+	spin_lock_bh(&fp->ct->lock);
+	fp->liberal = other->flags & IP_CT_TCP_FLAG_BE_LIBERAL;
+	other->flags |= IP_CT_TCP_FLAG_BE_LIBERAL;
+	spin_unlock_bh(&fp->ct->lock);
+}
+
+static void nf_fp_tcp_resync(struct nf_fp_flow *fp)
+{
+	spin_lock_bh(&fp->ct->lock);
+	fp->ct->proto.tcp.seen[fp->dir].td_maxwin = 0;
+	spin_unlock_bh(&fp->ct->lock);
+}
+
+static void nf_fp_tcp_restore(struct nf_fp_flow *fp)
+{
+	struct ip_ct_tcp *tcp = &fp->ct->proto.tcp;
+
+	spin_lock_bh(&fp->ct->lock);
+	if (!fp->liberal)
+		tcp->seen[!fp->dir].flags &= ~IP_CT_TCP_FLAG_BE_LIBERAL;
+	tcp->seen[fp->dir].td_maxwin = 0;
+	spin_unlock_bh(&fp->ct->lock);
+}
+
+/* Push the counters and the last use of the flow to its conntrack */
+static void nf_fp_sync(struct nf_fp_flow *fp)
+{
+	struct nf_conn *ct = fp->ct;
+	struct nf_conn_counter *acct;
+	unsigned long packets, bytes, last, expires;
+
+	packets = atomic_long_xchg(&fp->packets, 0);
+	bytes = atomic_long_xchg(&fp->bytes, 0);
+	acct = nf_conn_acct_find(ct);
+	if (packets && acct) {
+		spin_lock_bh(&ct->lock);
+		acct[fp->dir].packets += packets;
+		acct[fp->dir].bytes += bytes;
+		spin_unlock_bh(&ct->lock);
+	}
+
+	last = ACCESS_ONCE(fp->last_used);
+	if (last != fp->synced) {
+		fp->synced = last;
+		expires = last + fp->ct_timeout;
+		if (time_after(expires, ACCESS_ONCE(ct->timeout)))
+			ct->timeout = expires;
+	}
+}
+
+static void nf_fp_free_rcu(struct rcu_head *head)
+{
+	struct nf_fp_flow *fp = container_of(head, struct nf_fp_flow, rcu);
+
+	dst_release(fp->dst);
+	nf_ct_put(fp->ct);
+	kmem_cache_free(nf_fp_cachep, fp);
+}
+
+/* Called with nf_fp_lock held */
+static void nf_fp_del(struct nf_fp_flow *fp)
+{
+	nf_fp_sync(fp);
+	if (fp->protonum == IPPROTO_TCP)
+		nf_fp_tcp_restore(fp);
+	hlist_del_rcu(&fp->hnode);
+	nf_fp_count--;
+	clear_bit(IPS_ASF_OFFLOADED_BIT, &fp->ct->status);
+	call_rcu(&fp->rcu, nf_fp_free_rcu);
+}
+
+static bool nf_fp_stale(const struct nf_fp_flow *fp)
+{
+	struct nf_conn *ct = fp->ct;
+
+	if (fp->dead || nf_ct_is_dying(ct) ||
+	    fp->dst->obsolete > 0 || !netif_running(fp->dst->dev))
+		return true;
+	if (nf_ct_protonum(ct) == IPPROTO_TCP &&
+	    ct->proto.tcp.state != TCP_CONNTRACK_ESTABLISHED)
+		return true;
+	/* idle: conntrack will time it out, as it would have anyway */
+	return time_after(jiffies, fp->last_used + fp->ct_timeout);
+}
+
+/* Drop the flows through a device, or all of them if dev is NULL */
+static void nf_fp_flush(const struct net_device *dev)
+{
+	struct nf_fp_flow *fp;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < nf_fp_htable_size; i++) {
+		spin_lock_bh(&nf_fp_lock);
+		hlist_for_each_entry_safe(fp, n, tmp, &nf_fp_hash[i], hnode) {
+			if (!dev || fp->iif == dev->ifindex ||
+			    fp->dst->dev == dev)
+				nf_fp_del(fp);
+		}
+		spin_unlock_bh(&nf_fp_lock);
+	}
+}
+
+static void nf_fp_gc(struct work_struct *work)
+{
+	struct nf_fp_flow *fp;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < nf_fp_htable_size; i++) {
+		spin_lock_bh(&nf_fp_lock);
+		hlist_for_each_entry_safe(fp, n, tmp, &nf_fp_hash[i], hnode) {
+			if (nf_fp_stale(fp))
+				nf_fp_del(fp);
+			else
+				nf_fp_sync(fp);
+		}
+		spin_unlock_bh(&nf_fp_lock);
+		if (i % 256 == 255)
+			cond_resched();
+	}
+	schedule_delayed_work(&nf_fp_gc_work, HZ);
+}
+
+static bool nf_fp_offloadable(struct nf_conn *ct,
+			      enum ip_conntrack_info ctinfo)
+{
+	if (ctinfo != IP_CT_ESTABLISHED && ctinfo != IP_CT_ESTABLISHED_REPLY)
+		return false;
+	if (!test_bit(IPS_ASSURED_BIT, &ct->status) ||
+	    test_bit(IPS_SEQ_ADJUST_BIT, &ct->status) ||
+	    !nf_ct_is_confirmed(ct) || nf_ct_is_dying(ct))
+		return false;
+	/* helpers have to see the payload */
+	if (nfct_help(ct))
+		return false;
+
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		return ct->proto.tcp.state == TCP_CONNTRACK_ESTABLISHED;
+	case IPPROTO_UDP:
+		return true;
+	}
+	return false;
+}
+
+static void nf_fp_add(struct nf_conn *ct, enum ip_conntrack_info ctinfo,
+		      struct sk_buff *skb)
+{
+	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
+	const struct nf_conntrack_tuple *tuple = &ct->tuplehash[dir].tuple;
+	struct dst_entry *dst = skb_dst(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	int iif = inet_iif(skb);
+	struct nf_fp_flow *fp;
+	__be16 _ports[2], *ports;
+	unsigned long timeout;
+	u32 hash;
+
+	if (iph->ihl != 5 || iph->frag_off & htons(IP_MF | IP_OFFSET))
+		return;
+	/* nothing to replay ipsec with, and a neighbour to send to */
+	if (dst->xfrm || (!dst->hh && !dst_get_neighbour(dst)))
+		return;
+	timeout = nf_ct_expires(ct);
+	if (!timeout)
+		return;
+
+	ports = skb_header_pointer(skb, sizeof(*iph), sizeof(_ports), _ports);
+	if (!ports)
+		return;
+
+	/* the other direction may be offloaded already, this one too */
+	if (nf_fp_find(iif, tuple->src.u3.ip, tuple->dst.u3.ip,
+		       tuple->src.u.all, tuple->dst.u.all, tuple->dst.protonum))
+		return;
+	hash = nf_fp_hashfn(iif, tuple->src.u3.ip, tuple->dst.u3.ip,
+			    tuple->src.u.all, tuple->dst.u.all,
+			    tuple->dst.protonum);
+
+	spin_lock_bh(&nf_fp_lock);
+	if (nf_fp_count >= max_flows ||
+	    nf_fp_find(iif, tuple->src.u3.ip, tuple->dst.u3.ip,
+		       tuple->src.u.all, tuple->dst.u.all,
+		       tuple->dst.protonum))
+		goto out;
+
+	fp = kmem_cache_zalloc(nf_fp_cachep, GFP_ATOMIC);
+	if (!fp)
+		goto out;
+
+	fp->iif = iif;
+	fp->saddr = tuple->src.u3.ip;
+	fp->daddr = tuple->dst.u3.ip;
+	fp->sport = tuple->src.u.all;
+	fp->dport = tuple->dst.u.all;
+	fp->protonum = tuple->dst.protonum;
+	fp->dir = dir;
+	fp->nat_saddr = iph->saddr;
+	fp->nat_daddr = iph->daddr;
+	fp->nat_sport = ports[0];
+	fp->nat_dport = ports[1];
+	fp->mark = skb->mark;
+	fp->priority = skb->priority;
+	fp->dst = dst_clone(dst);
+	nf_conntrack_get(&ct->ct_general);
+	fp->ct = ct;
+	fp->ct_timeout = timeout;
+	fp->last_used = fp->synced = jiffies;
+
+	if (fp->protonum == IPPROTO_TCP)
+		nf_fp_tcp_offload(fp);
+	set_bit(IPS_ASF_OFFLOADED_BIT, &ct->status);
+
+	hlist_add_head_rcu(&fp->hnode, &nf_fp_hash[hash]);
+	nf_fp_count++;
+out:
+	spin_unlock_bh(&nf_fp_lock);
+}
+
+static unsigned int nf_fp_learn(unsigned int hooknum, struct sk_buff *skb,
+				const struct net_device *in,
+				const struct net_device *out,
+				int (*okfn)(struct sk_buff *))
+{
+	enum ip_conntrack_info ctinfo;
+	unsigned int mask = ACCESS_ONCE(mark_mask);
+	struct nf_conn *ct;
+
+	if (!(IPCB(skb)->flags & IPSKB_FORWARDED))
+		return NF_ACCEPT;
+	/* the ruleset chooses what is offloaded */
+	if (!mask || (skb->mark & mask) != (ACCESS_ONCE(mark) & mask))
+		return NF_ACCEPT;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (ct && !nf_ct_is_untracked(ct) && nf_fp_offloadable(ct, ctinfo)) {
+		rcu_read_lock();
+		nf_fp_add(ct, ctinfo, skb);
+		rcu_read_unlock();
+	}
+	return NF_ACCEPT;
+}
+
+/* Last in POST_ROUTING, once NAT is done with the packet */
+static struct nf_hook_ops nf_fp_ops __read_mostly = {
+	.hook		= nf_fp_learn,
+	.owner		= THIS_MODULE,
+	.pf		= NFPROTO_IPV4,
+	.hooknum	= NF_INET_POST_ROUTING,
+	.priority	= NF_IP_PRI_CONNTRACK_CONFIRM - 1,
+};
+
+static void nf_fp_csum4(struct sk_buff *skb, struct iphdr *iph,
+			__sum16 *check, __be32 *addr, __be32 to)
+{
+	csum_replace4(&iph->check, *addr, to);
+	if (check)
+		inet_proto_csum_replace4(check, skb, *addr, to, 1);
+	*addr = to;
+}
+
+static void nf_fp_csum2(struct sk_buff *skb, __sum16 *check,
+			__be16 *port, __be16 to)
+{
+	if (check)
+		inet_proto_csum_replace2(check, skb, *port, to, 0);
+	*port = to;
+}
+
+static void nf_fp_mangle(const struct nf_fp_flow *fp, struct sk_buff *skb,
+			 struct iphdr *iph)
+{
+	__be16 *ports = (__be16 *)((void *)iph + sizeof(*iph));
+	__sum16 *check;
+
+	if (fp->protonum == IPPROTO_TCP) {
+		check = &((struct tcphdr *)ports)->check;
+	} else {
+		check = &((struct udphdr *)ports)->check;
+		if (!*check && skb->ip_summed != CHECKSUM_PARTIAL)
+			check = NULL;
+	}
+
+	if (iph->saddr != fp->nat_saddr)
+		nf_fp_csum4(skb, iph, check, &iph->saddr, fp->nat_saddr);
+	if (iph->daddr != fp->nat_daddr)
+		nf_fp_csum4(skb, iph, check, &iph->daddr, fp->nat_daddr);
+	if (ports[0] != fp->nat_sport)
+		nf_fp_csum2(skb, check, &ports[0], fp->nat_sport);
+	if (ports[1] != fp->nat_dport)
+		nf_fp_csum2(skb, check, &ports[1], fp->nat_dport);
+
+	if (check && fp->protonum == IPPROTO_UDP && !*check)
+		*check = CSUM_MANGLED_0;
+}
+
+/* What ip_finish_output2() does, the headroom is already there */
+static void nf_fp_xmit(struct sk_buff *skb, struct dst_entry *dst)
+{
+	struct neighbour *neigh;
+
+	if (dst->hh) {
+		neigh_hh_output(dst->hh, skb);
+		return;
+	}
+	neigh = dst_get_neighbour(dst);
+	if (neigh) {
+		neigh->output(skb);
+		return;
+	}
+	kfree_skb(skb);
+}
+
+/* Called from netif_receive_skb() under rcu_read_lock() */
+static rx_handler_result_t nf_fp_rx(struct sk_buff **pskb)
+{
+	struct sk_buff *skb = *pskb;
+	const struct iphdr *iph;
+	const __be16 *ports;
+	struct nf_fp_flow *fp;
+	struct dst_entry *dst;
+	unsigned int len, thlen;
+
+	/* flows are known by the device IP gets them on: the ports of a
+	 * bridge or bond hand their packets up to it first */
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb->pkt_type != PACKET_HOST || vlan_tx_tag_present(skb) ||
+	    rcu_access_pointer(skb->dev->rx_handler))
+		return RX_HANDLER_PASS;
+
+	/* as ip_rcv() would, before pulling anything in */
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (!skb)
+		return RX_HANDLER_CONSUMED;
+	*pskb = skb;
+
+	if (!pskb_may_pull(skb, sizeof(*iph)))
+		return RX_HANDLER_PASS;
+	iph = ip_hdr(skb);
+	if (iph->version != 4 || iph->ihl != 5 || iph->ttl <= 1 ||
+	    iph->frag_off & htons(IP_MF | IP_OFFSET))
+		return RX_HANDLER_PASS;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		thlen = sizeof(struct tcphdr);
+		break;
+	case IPPROTO_UDP:
+		thlen = sizeof(struct udphdr);
+		break;
+	default:
+		return RX_HANDLER_PASS;
+	}
+	if (!pskb_may_pull(skb, sizeof(*iph) + thlen))
+		return RX_HANDLER_PASS;
+	iph = ip_hdr(skb);
+	/* ip_rcv() counts the bad ones */
+	len = ntohs(iph->tot_len);
+	if (ip_fast_csum((u8 *)iph, iph->ihl) || skb->len < len ||
+	    len < sizeof(*iph) + thlen)
+		return RX_HANDLER_PASS;
+
+	ports = (const __be16 *)((const void *)iph + sizeof(*iph));
+	fp = nf_fp_find(skb->dev->ifindex, iph->saddr, iph->daddr,
+			ports[0], ports[1], iph->protocol);
+	if (!fp)
+		return RX_HANDLER_PASS;
+	if (iph->protocol == IPPROTO_TCP) {
+		const struct tcphdr *th = (const struct tcphdr *)ports;
+
+		/* conntrack has to follow the state changes, from a window
+		 * it picks up again */
+		if (th->syn || th->fin || th->rst) {
+			if (!fp->dead) {
+				fp->dead = true;
+				nf_fp_tcp_resync(fp);
+			}
+			return RX_HANDLER_PASS;
+		}
+	}
+	dst = fp->dst;
+	if (unlikely(fp->dead || dst->obsolete > 0 ||
+		     !netif_running(dst->dev))) {
+		fp->dead = true;
+		return RX_HANDLER_PASS;
+	}
+	if (len > dst_mtu(dst) && !skb_is_gso(skb))
+		return RX_HANDLER_PASS;
+
+	/* From here on the packet is ours */
+	if (pskb_trim_rcsum(skb, len) ||
+	    skb_cow(skb, LL_RESERVED_SPACE(dst->dev) + dst->header_len))
+		goto drop;
+
+	nf_fp_mangle(fp, skb, ip_hdr(skb));
+	ip_decrease_ttl(ip_hdr(skb));
+
+	atomic_long_inc(&fp->packets);
+	atomic_long_add(skb->len, &fp->bytes);
+	if (fp->last_used != jiffies)
+		fp->last_used = jiffies;
+
+	skb->dev = dst->dev;
+	skb->mark = fp->mark;
+	skb->priority = fp->priority;
+	skb_dst_drop(skb);
+	skb_dst_set(skb, dst_clone(dst));
+	nf_fp_xmit(skb, dst);
+	return RX_HANDLER_CONSUMED;
+
+drop:
+	kfree_skb(skb);
+	return RX_HANDLER_CONSUMED;
+}
+
+static void nf_fp_route_flush(void)
+{
+	nf_fp_flush(NULL);
+}
+
+#if defined(CONFIG_IP_NF_IPTABLES) || defined(CONFIG_IP_NF_IPTABLES_MODULE)
+/* The rules the flows skip may have changed */
+static const struct firewall_asfctrl nf_fp_asfctrl = {
+	.firewall_asfctrl_cb	= nf_fp_route_flush,
+};
+
+static const struct firewall_asfctrl nf_fp_asfctrl_none;
+#endif
+
+static int nf_fp_netdev_event(struct notifier_block *this,
+			      unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+
+	if (event == NETDEV_DOWN || event == NETDEV_UNREGISTER ||
+	    event == NETDEV_CHANGEMTU || event == NETDEV_CHANGEADDR)
+		nf_fp_flush(dev);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nf_fp_netdev_notifier = {
+	.notifier_call	= nf_fp_netdev_event,
+};
+
+static int __init nf_fp_init(void)
+{
+	int ret;
+
+	ret = nf_ct_l3proto_try_module_get(PF_INET);
+	if (ret < 0)
+		return ret;
+
+	ret = -ENOMEM;
+	nf_fp_cachep = KMEM_CACHE(nf_fp_flow, 0);
+	if (!nf_fp_cachep)
+		goto err_cache;
+	nf_fp_htable_size = buckets ? : 1;
+	nf_fp_hash = nf_ct_alloc_hashtable(&nf_fp_htable_size, 0);
+	if (!nf_fp_hash)
+		goto err_hash;
+	get_random_bytes(&nf_fp_hash_rnd, sizeof(nf_fp_hash_rnd));
+
+	ret = register_netdevice_notifier(&nf_fp_netdev_notifier);
+	if (ret < 0)
+		goto err_notifier;
+	ret = nf_register_hook(&nf_fp_ops);
+	if (ret < 0)
+		goto err_hook;
+	ret = netif_fastpath_register(nf_fp_rx);
+	if (ret < 0) {
+		pr_err("the receive fastpath is taken\n");
+		goto err_fastpath;
+	}
+	route_hook_fn_register(NULL, nf_fp_route_flush);
+#if defined(CONFIG_IP_NF_IPTABLES) || defined(CONFIG_IP_NF_IPTABLES_MODULE)
+	hook_firewall_asfctrl_cb(&nf_fp_asfctrl);
+#endif
+	schedule_delayed_work(&nf_fp_gc_work, HZ);
+	return 0;
+
+err_fastpath:
+	nf_unregister_hook(&nf_fp_ops);
+err_hook:
+	unregister_netdevice_notifier(&nf_fp_netdev_notifier);
+err_notifier:
+	nf_ct_free_hashtable(nf_fp_hash, nf_fp_htable_size);
+err_hash:
+	kmem_cache_destroy(nf_fp_cachep);
+err_cache:
+	nf_ct_l3proto_module_put(PF_INET);
+	return ret;
+}
+
+/* The callbacks run under RCU: synchronize_net() waits for them */
+static void __exit nf_fp_exit(void)
+{
+#if defined(CONFIG_IP_NF_IPTABLES) || defined(CONFIG_IP_NF_IPTABLES_MODULE)
+	hook_firewall_asfctrl_cb(&nf_fp_asfctrl_none);
+#endif
+	route_hook_fn_unregister();
+	netif_fastpath_unregister();
+	nf_unregister_hook(&nf_fp_ops);
+	unregister_netdevice_notifier(&nf_fp_netdev_notifier);
+	synchronize_net();
+
+	cancel_delayed_work_sync(&nf_fp_gc_work);
+	nf_fp_flush(NULL);
+	rcu_barrier();
+
+	nf_ct_free_hashtable(nf_fp_hash, nf_fp_htable_size);
+	kmem_cache_destroy(nf_fp_cachep);
+	nf_ct_l3proto_module_put(PF_INET);
+}
+
+module_init(nf_fp_init);
+module_exit(nf_fp_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("software fastpath for established IPv4 flows");
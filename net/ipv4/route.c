@@ -88,6 +88,7 @@
 #include <linux/netfilter_ipv4.h>
 #include <linux/random.h>
 #include <linux/jhash.h>
+#include <linux/hash.h>
 #include <linux/rcupdate.h>
 #include <linux/times.h>
 #include <linux/slab.h>
@@ -132,6 +133,7 @@ static int ip_rt_mtu_expires __read_mostly	= 10 * 60 * HZ;
 static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
 static int rt_chain_length_max __read_mostly	= 20;
+static int ip_rt_cache_bypass __read_mostly;
 
 static struct delayed_work expires_work;
 static unsigned long expires_ljiffies;
@@ -146,7 +148,8 @@ static unsigned int	 ipv4_default_mtu(const struct dst_entry *dst);
 static void		 ipv4_dst_destroy(struct dst_entry *dst);
 static struct dst_entry *ipv4_negative_advice(struct dst_entry *dst);
 static void		 ipv4_link_failure(struct sk_buff *skb);
-static void		 ip_rt_update_pmtu(struct dst_entry *dst, u32 mtu);
+static void		 ip_rt_update_pmtu(struct dst_entry *dst,
+					   struct sk_buff *skb, u32 mtu);
 static int rt_garbage_collect(struct dst_ops *ops);
 
 static void ipv4_dst_ifdown(struct dst_entry *dst, struct net_device *dev,
@@ -227,8 +230,8 @@ const __u8 ip_tos2prio[16] = {
 };
 
 #ifdef CONFIG_AS_FASTPATH
-route_add_hook *route_add_fn;
-static route_flush_hook *route_flush_fn;
+route_add_hook __rcu *route_add_fn;
+static route_flush_hook __rcu *route_flush_fn;
 #endif
 
 /*
@@ -753,6 +756,198 @@ static inline int rt_is_expired(struct rtable *rth)
 	return rth->rt_genid != rt_genid(dev_net(rth->dst.dev));
 }
 
+/*
+ * Cache bypass: with net.ipv4.route.cache_bypass set, the hash table
+ * is left alone. Input routes are resolved from the FIB for each
+ * packet; forwarded packets towards a gateway and packets for a local
+ * address share a route kept in the fib nexthop, others get a route
+ * of their own, freed with the packet. Output routes not cached by a
+ * socket go to a small direct mapped cache on each cpu. None of these
+ * grows with the number of flows.
+ *
+ * Slots hold no reference, like the hash chains: a route leaving a
+ * slot is freed with rt_free() once readers are done with it.
+ */
+#define RT_PCPU_CACHE_SIZE	256
+
+struct rt_pcpu_cache {
+	struct rtable __rcu	*slot[RT_PCPU_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct rt_pcpu_cache, rt_pcpu_cache);
+
+static inline struct rtable __rcu **rt_pcpu_slot(unsigned int hash)
+{
+	/* the cpu may change under us, slots are only ever swapped */
+	return &__this_cpu_ptr(&rt_pcpu_cache)->slot[hash &
+						     (RT_PCPU_CACHE_SIZE - 1)];
+}
+
+static void rt_slot_set(struct rtable __rcu **slot, struct rtable *rt)
+{
+	struct rtable *old;
+
+	old = xchg((__force struct rtable **)slot, rt);
+	if (old)
+		rt_free(old);
+
+	/* A flush may have looked at the slot before rt got there */
+	if (rt && rt_is_expired(rt) &&
+	    cmpxchg((__force struct rtable **)slot, rt, NULL) == rt)
+		rt_free(rt);
+}
+
+/* called with rcu_read_lock_bh() */
+static void rt_slot_flush(struct rtable __rcu **slot, struct net *net)
+{
+	struct rtable *rt = rcu_dereference_bh(*slot);
+
+	if (rt && (!net || net_eq(dev_net(rt->dst.dev), net)) &&
+	    cmpxchg((__force struct rtable **)slot, rt, NULL) == rt)
+		rt_free(rt);
+}
+
+static void rt_pcpu_flush(struct net *net)
+{
+	unsigned int i;
+	int cpu;
+
+	/* order against the genid update, see rt_slot_set() */
+	smp_mb();
+	for_each_possible_cpu(cpu) {
+		struct rt_pcpu_cache *pc = &per_cpu(rt_pcpu_cache, cpu);
+
+		rcu_read_lock_bh();
+		for (i = 0; i < RT_PCPU_CACHE_SIZE; i++)
+			rt_slot_flush(&pc->slot[i], net);
+		rcu_read_unlock_bh();
+	}
+}
+
+/* Called when the fib_info of nh goes away */
+void rt_flush_nh(struct fib_nh *nh)
+{
+	unsigned int i;
+
+	for (i = 0; i < FIB_NH_INPUT_SLOTS; i++)
+		rt_slot_set(&nh->nh_rth_input[i], NULL);
+}
+
+/* Packets from different devices, or whose source is not on link, get
+ * routes of their own: each keeps its slot while they interleave.
+ */
+static inline struct rtable __rcu **rt_nh_input_slot(struct fib_nh *nh,
+						     int iif,
+						     unsigned int flags)
+{
+	return &nh->nh_rth_input[jhash_2words(iif, flags, 0) &
+				 (FIB_NH_INPUT_SLOTS - 1)];
+}
+
+/*
+ * Whether a received packet may share the input route of its nexthop.
+ * IP options are answered from rt_spec_dst and friends, and classid
+ * tags can differ between the flows of a nexthop.
+ *
+ * The shared route carries the fib_info metrics only (DST_NOPEER).
+ * Forwarded packets towards a destination that has an inet_peer, with
+ * a learned PMTU, redirect or metrics, keep a route of their own.
+ */
+static bool rt_nh_input_ok(const struct sk_buff *skb,
+			   const struct fib_result *res, u32 itag)
+{
+	if (!ip_rt_cache_bypass || !res->fi)
+		return false;
+	if (skb->protocol != htons(ETH_P_IP) || ip_hdr(skb)->ihl > 5)
+		return false;
+#ifdef CONFIG_IP_ROUTE_CLASSID
+	if (itag)
+		return false;
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+	if (fib_rules_tclass(res))
+		return false;
+#endif
+#endif
+	return true;
+}
+
+/*
+ * Destinations that learned a PMTU or a redirect, hashed, so that the
+ * forwarding path looks for an inet_peer only when one may matter.
+ * Bits are never cleared: a stale one costs a lookup, no more.
+ */
+#define RT_PEER_LEARNED_BITS	4096
+
+static DECLARE_BITMAP(rt_peer_learned_map, RT_PEER_LEARNED_BITS);
+
+static inline unsigned int rt_peer_learned_bit(__be32 daddr)
+{
+	return hash_32((__force u32)daddr, ilog2(RT_PEER_LEARNED_BITS));
+}
+
+/* called with rcu_read_lock() */
+static bool rt_has_peer(__be32 daddr)
+{
+	struct inet_peer *peer;
+
+	if (!test_bit(rt_peer_learned_bit(daddr), rt_peer_learned_map))
+		return false;
+
+	peer = inet_getpeer_v4(daddr, 0);
+
+	if (!peer)
+		return false;
+	inet_putpeer(peer);
+	return true;
+}
+
+/*
+ * Attaches the shared route of nh to skb if it was made for packets
+ * arriving on iif with these flags. Local routes also carry the
+ * destination, the source address of replies.
+ * called with rcu_read_lock()
+ */
+static bool rt_nh_input_hit(struct sk_buff *skb, struct fib_nh *nh, int iif,
+			    __be32 daddr, unsigned int flags, bool noref)
+{
+	struct rtable *rth = rcu_dereference(*rt_nh_input_slot(nh, iif, flags));
+
+	if (!rth || rth->rt_iif != iif || rth->rt_flags != flags ||
+	    ((flags & RTCF_LOCAL) && rth->rt_dst != daddr) ||
+	    rt_is_expired(rth))
+		return false;
+
+	if (noref) {
+		dst_use_noref(&rth->dst, jiffies);
+		skb_dst_set_noref(skb, &rth->dst);
+	} else {
+		dst_use(&rth->dst, jiffies);
+		skb_dst_set(skb, &rth->dst);
+	}
+	RT_CACHE_STAT_INC(in_hit);
+	return true;
+}
+
+/* Makes rt, fresh from the FIB, the shared input route of nh */
+static int rt_nh_input_set(struct sk_buff *skb, struct fib_nh *nh,
+			   struct rtable *rt)
+{
+	if (rt->rt_type == RTN_UNICAST) {
+		int err = arp_bind_neighbour(&rt->dst);
+		if (err) {
+			rt_drop(rt);
+			return err;
+		}
+	}
+
+	rt_slot_set(rt_nh_input_slot(nh, rt->rt_iif, rt->rt_flags), rt);
+	/* fib_release_info() may have flushed nh already */
+	if (nh->nh_parent->fib_dead)
+		rt_flush_nh(nh);
+	skb_dst_set(skb, &rt->dst);
+	return 0;
+}
+
 /*
  * Perform a full scan of hash table and free all entries.
  * Can be called by a softirq or a process.
@@ -802,6 +997,8 @@ static void rt_do_flush(struct net *net, int process_context)
 			rt_free(list);
 		}
 	}
+
+	rt_pcpu_flush(net);
 }
 
 /*
@@ -948,8 +1145,15 @@ void rt_cache_flush(struct net *net, int delay)
 	rt_cache_invalidate(net);
 
 #ifdef CONFIG_AS_FASTPATH
-	if (route_flush_fn)
-		route_flush_fn();
+	{
+		route_flush_hook *flush;
+
+		rcu_read_lock();
+		flush = rcu_dereference(route_flush_fn);
+		if (flush)
+			flush();
+		rcu_read_unlock();
+	}
 #endif
 
 	if (delay >= 0)
@@ -1134,6 +1338,23 @@ restart:
 	candp = NULL;
 	now = jiffies;
 
+	if (ip_rt_cache_bypass) {
+		if (rt->rt_type == RTN_UNICAST || rt_is_output_route(rt)) {
+			int err = arp_bind_neighbour(&rt->dst);
+			if (err) {
+				rt_drop(rt);
+				return ERR_PTR(err);
+			}
+		}
+
+		/* Input routes worth sharing never get here */
+		if (rt_is_output_route(rt))
+			rt_slot_set(rt_pcpu_slot(hash), rt);
+		else
+			rt->dst.flags |= DST_NOCACHE;
+		goto skip_hashing;
+	}
+
 	if (!rt_caching(dev_net(rt->dst.dev))) {
 		/*
 		 * If we're not caching, just tell the caller we
@@ -1304,10 +1525,21 @@ static u32 rt_peer_genid(void)
 	return atomic_read(&__rt_peer_genid);
 }
 
+/* peer learned a PMTU or a redirect: routes have to look again */
+static void rt_peer_learned(struct inet_peer *peer)
+{
+	set_bit(rt_peer_learned_bit(peer->daddr.addr.a4), rt_peer_learned_map);
+	atomic_inc(&__rt_peer_genid);
+}
+
 void rt_bind_peer(struct rtable *rt, __be32 daddr, int create)
 {
 	struct inet_peer *peer;
 
+	/* Shared by many destinations, see rt_nh_input_ok() */
+	if (rt->dst.flags & DST_NOPEER)
+		return;
+
 	peer = inet_getpeer_v4(daddr, create);
 
 	if (peer && cmpxchg(&rt->peer, NULL, peer) != NULL)
@@ -1467,7 +1699,7 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 				if (peer) {
 					if (peer->redirect_learned.a4 != new_gw) {
 						peer->redirect_learned.a4 = new_gw;
-						atomic_inc(&__rt_peer_genid);
+						rt_peer_learned(peer);
 					}
 					check_peer_redir(&rt->dst, peer);
 				}
@@ -1704,9 +1936,8 @@ unsigned short ip_rt_frag_needed(struct net *net, const struct iphdr *iph,
 			peer->pmtu_expires = pmtu_expires;
 		}
 
+		rt_peer_learned(peer);
 		inet_putpeer(peer);
-
-		atomic_inc(&__rt_peer_genid);
 	}
 	return est_mtu ? : new_mtu;
 }
@@ -1728,33 +1959,56 @@ static void check_peer_pmtu(struct dst_entry *dst, struct inet_peer *peer)
 		dst_metric_set(dst, RTAX_MTU, peer->pmtu_orig);
 }
 
-static void ip_rt_update_pmtu(struct dst_entry *dst, u32 mtu)
+static bool rt_peer_learn_pmtu(struct inet_peer *peer, u32 mtu)
+{
+	unsigned long pmtu_expires = ACCESS_ONCE(peer->pmtu_expires);
+
+	if (mtu < ip_rt_min_pmtu)
+		mtu = ip_rt_min_pmtu;
+	if (pmtu_expires && mtu >= peer->pmtu_learned)
+		return false;
+
+	pmtu_expires = jiffies + ip_rt_mtu_expires;
+	if (!pmtu_expires)
+		pmtu_expires = 1UL;
+
+	peer->pmtu_learned = mtu;
+	peer->pmtu_expires = pmtu_expires;
+
+	rt_peer_learned(peer);
+	return true;
+}
+
+static void ip_rt_update_pmtu(struct dst_entry *dst,
+			      struct sk_buff *skb, u32 mtu)
 {
 	struct rtable *rt = (struct rtable *) dst;
 	struct inet_peer *peer;
 
 	dst_confirm(dst);
 
+	/*
+	 * A shared nexthop route learns for the destination of the packet
+	 * that did not fit, whose next packets then take a route of their
+	 * own. rt_dst is only that of the flow that set the route up.
+	 */
+	if (dst->flags & DST_NOPEER) {
+		if (!skb || skb->protocol != htons(ETH_P_IP))
+			return;
+		peer = inet_getpeer_v4(ip_hdr(skb)->daddr, 1);
+		if (peer) {
+			rt_peer_learn_pmtu(peer, mtu);
+			inet_putpeer(peer);
+		}
+		return;
+	}
+
 	if (!rt->peer)
 		rt_bind_peer(rt, rt->rt_dst, 1);
 	peer = rt->peer;
 	if (peer) {
-		unsigned long pmtu_expires = ACCESS_ONCE(peer->pmtu_expires);
-
-		if (mtu < ip_rt_min_pmtu)
-			mtu = ip_rt_min_pmtu;
-		if (!pmtu_expires || mtu < peer->pmtu_learned) {
-
-			pmtu_expires = jiffies + ip_rt_mtu_expires;
-			if (!pmtu_expires)
-				pmtu_expires = 1UL;
-
-			peer->pmtu_learned = mtu;
-			peer->pmtu_expires = pmtu_expires;
-
-			atomic_inc(&__rt_peer_genid);
+		if (rt_peer_learn_pmtu(peer, mtu))
 			rt->rt_peer_genid = rt_peer_genid();
-		}
 		check_peer_pmtu(dst, peer);
 	}
 }
@@ -1908,7 +2162,7 @@ static unsigned int ipv4_default_mtu(const struct dst_entry *dst)
 static void rt_init_metrics(struct rtable *rt, const struct flowi4 *fl4,
 			    struct fib_info *fi)
 {
-	struct inet_peer *peer;
+	struct inet_peer *peer = NULL;
 	int create = 0;
 
 	/* If a peer entry exists for this destination, we must hook
@@ -1917,7 +2171,9 @@ static void rt_init_metrics(struct rtable *rt, const struct flowi4 *fl4,
 	if (fl4 && (fl4->flowi4_flags & FLOWI_FLAG_PRECOW_METRICS))
 		create = 1;
 
-	rt->peer = peer = inet_getpeer_v4(rt->rt_dst, create);
+	if (!(rt->dst.flags & DST_NOPEER))
+		peer = inet_getpeer_v4(rt->rt_dst, create);
+	rt->peer = peer;
 	if (peer) {
 		rt->rt_peer_genid = rt_peer_genid();
 		if (inet_metrics_new(peer))
@@ -2094,9 +2350,10 @@ static int __mkroute_input(struct sk_buff *skb,
 			   const struct fib_result *res,
 			   struct in_device *in_dev,
 			   __be32 daddr, __be32 saddr, u32 tos,
-			   struct rtable **result)
+			   struct rtable **result, bool noref)
 {
 	struct rtable *rth;
+	struct fib_nh *nh = NULL;
 	int err;
 	struct in_device *out_dev;
 	unsigned int flags = 0;
@@ -2145,6 +2402,18 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	/* Routes to a gateway do not depend on the addresses */
+	if (!(flags & RTCF_DOREDIRECT) && FIB_RES_GW(*res) &&
+	    FIB_RES_NH(*res).nh_scope == RT_SCOPE_LINK &&
+	    rt_nh_input_ok(skb, res, itag) && !rt_has_peer(daddr)) {
+		nh = &FIB_RES_NH(*res);
+		if (rt_nh_input_hit(skb, nh, in_dev->dev->ifindex, daddr,
+				    flags, noref)) {
+			*result = NULL;
+			return 0;
+		}
+	}
+
 	rth = rt_dst_alloc(out_dev->dev,
 			   IN_DEV_CONF_GET(in_dev, NOPOLICY),
 			   IN_DEV_CONF_GET(out_dev, NOXFRM));
@@ -2173,9 +2442,16 @@ static int __mkroute_input(struct sk_buff *skb,
 
 	rth->dst.input = ip_forward;
 	rth->dst.output = ip_output;
+	if (nh)
+		rth->dst.flags |= DST_NOPEER;
 
 	rt_set_nexthop(rth, NULL, res, res->fi, res->type, itag);
 
+	if (nh) {
+		*result = NULL;
+		return rt_nh_input_set(skb, nh, rth);
+	}
+
 	*result = rth;
 	err = 0;
  cleanup:
@@ -2186,7 +2462,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
 			    struct fib_result *res,
 			    const struct flowi4 *fl4,
 			    struct in_device *in_dev,
-			    __be32 daddr, __be32 saddr, u32 tos)
+			    __be32 daddr, __be32 saddr, u32 tos, bool noref)
 {
 	struct rtable* rth = NULL;
 	int err;
@@ -2197,9 +2473,10 @@ static int ip_mkroute_input(struct sk_buff *skb,
 		fib_select_multipath(res);
 #endif
 
-	/* create a routing cache entry */
-	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
-	if (err)
+	/* create a routing cache entry, unless skb got a shared one */
+	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth,
+			      noref);
+	if (err || !rth)
 		return err;
 
 	/* put it into the cache */
@@ -2223,10 +2500,11 @@ static int ip_mkroute_input(struct sk_buff *skb,
  */
 
 static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
-			       u8 tos, struct net_device *dev)
+			       u8 tos, struct net_device *dev, bool noref)
 {
 	struct fib_result res;
 	struct in_device *in_dev = __in_dev_get_rcu(dev);
+	struct fib_nh	*nh = NULL;
 	struct flowi4	fl4;
 	unsigned	flags = 0;
 	u32		itag = 0;
@@ -2292,6 +2570,13 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 		if (err)
 			flags |= RTCF_DIRECTSRC;
 		spec_dst = daddr;
+		if (rt_nh_input_ok(skb, &res, itag)) {
+			nh = &FIB_RES_NH(res);
+			err = 0;
+			if (rt_nh_input_hit(skb, nh, dev->ifindex, daddr,
+					    flags | RTCF_LOCAL, noref))
+				goto out;
+		}
 		goto local_input;
 	}
 
@@ -2300,7 +2585,8 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	if (res.type != RTN_UNICAST)
 		goto martian_destination;
 
-	err = ip_mkroute_input(skb, &res, &fl4, in_dev, daddr, saddr, tos);
+	err = ip_mkroute_input(skb, &res, &fl4, in_dev, daddr, saddr, tos,
+			       noref);
 out:	return err;
 
 brd_input:
@@ -2358,6 +2644,10 @@ local_input:
 		rth->dst.error= -err;
 		rth->rt_flags 	&= ~RTCF_LOCAL;
 	}
+	if (nh) {
+		err = rt_nh_input_set(skb, nh, rth);
+		goto out;
+	}
 	hash = rt_hash(daddr, saddr, fl4.flowi4_iif, rt_genid(net));
 	rth = rt_intern_hash(hash, rth, skb, fl4.flowi4_iif);
 	err = 0;
@@ -2416,7 +2706,7 @@ int ip_route_input_common(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 
 	rcu_read_lock();
 
-	if (!rt_caching(net))
+	if (ip_rt_cache_bypass || !rt_caching(net))
 		goto skip_cache;
 
 	tos &= IPTOS_RT_MASK;
@@ -2479,7 +2769,7 @@ skip_cache:
 		rcu_read_unlock();
 		return -EINVAL;
 	}
-	res = ip_route_input_slow(skb, daddr, saddr, tos, dev);
+	res = ip_route_input_slow(skb, daddr, saddr, tos, dev, noref);
 	rcu_read_unlock();
 	return res;
 }
@@ -2784,59 +3074,76 @@ out:
 	return rth;
 }
 
+static inline bool rt_output_match(struct rtable *rth,
+				   const struct flowi4 *flp4, struct net *net)
+{
+	return rth->rt_key_dst == flp4->daddr &&
+	       rth->rt_key_src == flp4->saddr &&
+	       rt_is_output_route(rth) &&
+	       rth->rt_oif == flp4->flowi4_oif &&
+	       rth->rt_mark == flp4->flowi4_mark &&
+	       !((rth->rt_key_tos ^ flp4->flowi4_tos) &
+		 (IPTOS_RT_MASK | RTO_ONLINK)) &&
+	       net_eq(dev_net(rth->dst.dev), net) &&
+	       !rt_is_expired(rth);
+}
+
 struct rtable *__ip_route_output_key(struct net *net, struct flowi4 *flp4)
 {
 	struct rtable *rth;
 	unsigned int hash;
 
-	if (!rt_caching(net))
+	if (!ip_rt_cache_bypass && !rt_caching(net))
 		goto slow_output;
 
 	hash = rt_hash(flp4->daddr, flp4->saddr, flp4->flowi4_oif, rt_genid(net));
 
 	rcu_read_lock_bh();
+	if (ip_rt_cache_bypass) {
+		rth = rcu_dereference_bh(*rt_pcpu_slot(hash));
+		if (rth && rt_output_match(rth, flp4, net))
+			goto hit;
+		goto miss;
+	}
 	for (rth = rcu_dereference_bh(rt_hash_table[hash].chain); rth;
 		rth = rcu_dereference_bh(rth->dst.rt_next)) {
-		if (rth->rt_key_dst == flp4->daddr &&
-		    rth->rt_key_src == flp4->saddr &&
-		    rt_is_output_route(rth) &&
-		    rth->rt_oif == flp4->flowi4_oif &&
-		    rth->rt_mark == flp4->flowi4_mark &&
-		    !((rth->rt_key_tos ^ flp4->flowi4_tos) &
-			    (IPTOS_RT_MASK | RTO_ONLINK)) &&
-		    net_eq(dev_net(rth->dst.dev), net) &&
-		    !rt_is_expired(rth)) {
-			dst_use(&rth->dst, jiffies);
-			RT_CACHE_STAT_INC(out_hit);
-			rcu_read_unlock_bh();
-			if (!flp4->saddr)
-				flp4->saddr = rth->rt_src;
-			if (!flp4->daddr)
-				flp4->daddr = rth->rt_dst;
-			return rth;
-		}
+		if (rt_output_match(rth, flp4, net))
+			goto hit;
 		RT_CACHE_STAT_INC(out_hlist_search);
 	}
+miss:
 	rcu_read_unlock_bh();
 
 slow_output:
 	return ip_route_output_slow(net, flp4);
+
+hit:
+	dst_use(&rth->dst, jiffies);
+	RT_CACHE_STAT_INC(out_hit);
+	rcu_read_unlock_bh();
+	if (!flp4->saddr)
+		flp4->saddr = rth->rt_src;
+	if (!flp4->daddr)
+		flp4->daddr = rth->rt_dst;
+	return rth;
 }
 EXPORT_SYMBOL_GPL(__ip_route_output_key);
 
 #ifdef CONFIG_AS_FASTPATH
+/* The hooks run under rcu_read_lock(): after unregistering them, wait
+ * with synchronize_net() before they go away. */
 void route_hook_fn_register(route_add_hook *add,
 			    route_flush_hook *flush)
 {
-	route_add_fn = add;
-	route_flush_fn = flush;
+	rcu_assign_pointer(route_add_fn, add);
+	rcu_assign_pointer(route_flush_fn, flush);
 }
 EXPORT_SYMBOL(route_hook_fn_register);
 
 void route_hook_fn_unregister(void)
 {
-	route_add_fn = NULL;
-	route_flush_fn = NULL;
+	rcu_assign_pointer(route_add_fn, NULL);
+	rcu_assign_pointer(route_flush_fn, NULL);
 }
 EXPORT_SYMBOL(route_hook_fn_unregister);
 #endif
@@ -2851,7 +3158,8 @@ static unsigned int ipv4_blackhole_default_mtu(const struct dst_entry *dst)
 	return 0;
 }
 
-static void ipv4_rt_blackhole_update_pmtu(struct dst_entry *dst, u32 mtu)
+static void ipv4_rt_blackhole_update_pmtu(struct dst_entry *dst,
+					  struct sk_buff *skb, u32 mtu)
 {
 }
 
@@ -3204,6 +3512,9 @@ static int ipv4_sysctl_rtcache_flush(ctl_table *__ctl, int write,
 	return -EINVAL;
 }
 
+static int zero;
+static int one = 1;
+
 static ctl_table ipv4_route_table[] = {
 	{
 		.procname	= "gc_thresh",
@@ -3319,6 +3630,15 @@ static ctl_table ipv4_route_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "cache_bypass",
+		.data		= &ip_rt_cache_bypass,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 	{ }
 };
 
@@ -0,0 +1,109 @@
+/*
+ * TCP Fast Open: cookie generation on the server side and the per
+ * destination cookie cache on the client side.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/seqlock.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+static u32 tcp_fastopen_secret[16 - 1] __read_mostly;
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+static DEFINE_PER_CPU(__u32 [16 + SHA_DIGEST_WORDS + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+/*
+ * The cookie is a MAC of the client address under a boot time secret,
+ * the same construction the syncookies use, so a server can check it
+ * without keeping any state.
+ */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp;
+
+	tmp = get_cpu_var(tcp_fastopen_scratch);
+	tmp[0] = (__force u32)addr;
+	memcpy(tmp + 1, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	sha_init(tmp + 16);
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + SHA_DIGEST_WORDS);
+
+	BUILD_BUG_ON(TCP_FASTOPEN_COOKIE_SIZE > SHA_DIGEST_WORDS * 4);
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	put_cpu_var(tcp_fastopen_scratch);
+}
+
+/*
+ * The cookie and MSS a server handed out are kept in the inet_peer of
+ * the destination. Updates come from softirq context on SYN-ACK
+ * reception; the seqlock gives tcp_connect() a consistent copy.
+ */
+static DEFINE_SEQLOCK(tcp_fastopen_cache_lock);
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer;
+	bool release_it;
+	unsigned int seq;
+
+	BUILD_BUG_ON(sizeof(peer->tcp_fastopen_cookie) !=
+		     sizeof(cookie->val));
+
+	cookie->len = 0;
+	peer = inet_csk(sk)->icsk_af_ops->get_peer(sk, &release_it);
+	if (!peer)
+		return;
+
+	do {
+		seq = read_seqbegin(&tcp_fastopen_cache_lock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		cookie->len = peer->tcp_fastopen_cookie_len;
+		memcpy(cookie->val, peer->tcp_fastopen_cookie, cookie->len);
+	} while (read_seqretry(&tcp_fastopen_cache_lock, seq));
+
+	if (release_it)
+		inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer;
+	bool release_it;
+
+	peer = inet_csk(sk)->icsk_af_ops->get_peer(sk, &release_it);
+	if (!peer)
+		return;
+
+	write_seqlock_bh(&tcp_fastopen_cache_lock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0) {
+		peer->tcp_fastopen_cookie_len = cookie->len;
+		memcpy(peer->tcp_fastopen_cookie, cookie->val, cookie->len);
+	}
+	write_sequnlock_bh(&tcp_fastopen_cache_lock);
+
+	if (release_it)
+		inet_putpeer(peer);
+}
@@ -0,0 +1,319 @@
+/*
+ * TCP Fast Open loopback benchmark.
+ *
+ * Pairs of kernel threads, one pair per cpu for 1, 2, 4, ... of the
+ * online cpus, run short request/response transactions over loopback:
+ * each transaction is a new connection to 127.0.0.1:port+i that sends
+ * a request, reads the response and is reset. This is done first with
+ * connect() followed by send(), then with a single sendmsg(MSG_FASTOPEN)
+ * carrying the request in the SYN. The rate, in transactions per second,
+ * goes to the kernel log together with how many requests made it into a
+ * SYN. The fastopen runs need net.ipv4.tcp_fastopen=3. See also
+ * lib/kbench.c:
+ *
+ *	modprobe tcp_fastopen_bench [transactions=N] [size=N] [port=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kbench.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/socket.h>
+#include <linux/tcp.h>
+#include <net/sock.h>
+
+static unsigned int transactions = 20000;
+module_param(transactions, uint, 0444);
+MODULE_PARM_DESC(transactions, "connections made by each client thread");
+
+static unsigned int size = 256;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "bytes in each request and response");
+
+static unsigned short port = 16384;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "first loopback tcp port to listen on");
+
+/* Threads 2 * i and 2 * i + 1, the server and the client of pair i */
+struct fastopen_bench_worker {
+	struct socket		*listener;
+	unsigned short		port;
+	bool			fastopen;
+	unsigned int		done;
+	unsigned int		syn_data;
+	int			err;
+};
+
+/* cleared if MSG_FASTOPEN turns out to be disabled */
+static bool fastopen_bench_tfo = true;
+
+static void fastopen_bench_addr(struct sockaddr_in *sin, unsigned short port)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin->sin_port = htons(port);
+}
+
+/* Do not let a lost peer hang the benchmark. Clients reset rather than
+ * close once they have the response, so that no TIME-WAIT sockets pile
+ * up on either side.
+ */
+static int fastopen_bench_sockopts(struct socket *sock, bool reset)
+{
+	struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+	struct timeval tv = { .tv_sec = 1 };
+	int err;
+
+	err = kernel_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+				(char *)&tv, sizeof(tv));
+	if (!err && reset)
+		err = kernel_setsockopt(sock, SOL_SOCKET, SO_LINGER,
+					(char *)&lg, sizeof(lg));
+	return err;
+}
+
+static int fastopen_bench_recv(struct socket *sock, char *buf)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	ret = kernel_recvmsg(sock, &msg, &iov, 1, size, MSG_WAITALL);
+	if (ret >= 0 && ret != size)
+		ret = -EPIPE;
+	return ret < 0 ? ret : 0;
+}
+
+static int fastopen_bench_send(struct socket *sock, char *buf,
+			       struct sockaddr_in *sin)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	if (sin) {
+		msg.msg_name = sin;
+		msg.msg_namelen = sizeof(*sin);
+		msg.msg_flags = MSG_FASTOPEN;
+	}
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	ret = kernel_sendmsg(sock, &msg, &iov, 1, size);
+	if (ret >= 0 && ret != size)
+		ret = -EPIPE;
+	return ret < 0 ? ret : 0;
+}
+
+static int fastopen_bench_transaction(struct fastopen_bench_worker *w,
+				      char *buf)
+{
+	struct sockaddr_in sin;
+	struct socket *sock;
+	int err;
+
+	err = sock_create_kern(PF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+	if (err)
+		return err;
+	err = fastopen_bench_sockopts(sock, true);
+	if (err)
+		goto out;
+
+	fastopen_bench_addr(&sin, w->port);
+	if (w->fastopen) {
+		err = fastopen_bench_send(sock, buf, &sin);
+	} else {
+		err = kernel_connect(sock, (struct sockaddr *)&sin,
+				     sizeof(sin), 0);
+		if (!err)
+			err = fastopen_bench_send(sock, buf, NULL);
+	}
+	if (!err)
+		err = fastopen_bench_recv(sock, buf);
+	if (!err && tcp_sk(sock->sk)->syn_data)
+		w->syn_data++;
+out:
+	sock_release(sock);
+	return err;
+}
+
+static void fastopen_bench_client(struct fastopen_bench_worker *w)
+{
+	unsigned int i;
+	char *buf;
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (!buf)
+		w->err = -ENOMEM;
+	for (i = 0; i < transactions && !w->err; i++) {
+		w->err = fastopen_bench_transaction(w, buf);
+		if (!w->err)
+			w->done++;
+		if (!(i & 255))
+			cond_resched();
+	}
+	kfree(buf);
+}
+
+static void fastopen_bench_server(struct fastopen_bench_worker *w)
+{
+	struct socket *sock;
+	unsigned int i;
+	char *buf;
+	int err = 0;
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (!buf)
+		err = -ENOMEM;
+	for (i = 0; i < transactions && !err; i++) {
+		err = kernel_accept(w->listener, &sock, 0);
+		if (err)
+			break;
+		err = fastopen_bench_recv(sock, buf);
+		if (!err)
+			err = fastopen_bench_send(sock, buf, NULL);
+		sock_release(sock);
+	}
+	kfree(buf);
+	/* a failing client makes the server time out; report the cause */
+	if (err && !w->err)
+		w->err = err;
+}
+
+static void fastopen_bench_thread(void *data, unsigned int id)
+{
+	struct fastopen_bench_worker *w =
+		(struct fastopen_bench_worker *)data + id / 2;
+
+	if (id & 1)
+		fastopen_bench_client(w);
+	else
+		fastopen_bench_server(w);
+}
+
+static int fastopen_bench_listen(struct fastopen_bench_worker *w)
+{
+	struct sockaddr_in sin;
+	int one = 1, qlen = 128, err;
+
+	err = sock_create_kern(PF_INET, SOCK_STREAM, IPPROTO_TCP,
+			       &w->listener);
+	if (err)
+		return err;
+
+	fastopen_bench_addr(&sin, w->port);
+	err = kernel_setsockopt(w->listener, SOL_SOCKET, SO_REUSEADDR,
+				(char *)&one, sizeof(one));
+	if (!err)
+		err = fastopen_bench_sockopts(w->listener, false);
+	if (!err && w->fastopen)
+		err = kernel_setsockopt(w->listener, SOL_TCP, TCP_FASTOPEN,
+					(char *)&qlen, sizeof(qlen));
+	if (!err)
+		err = kernel_bind(w->listener, (struct sockaddr *)&sin,
+				  sizeof(sin));
+	if (!err)
+		err = kernel_listen(w->listener, qlen);
+	if (err) {
+		sock_release(w->listener);
+		w->listener = NULL;
+	}
+	return err;
+}
+
+static int fastopen_bench_run(unsigned int npairs,
+			      struct fastopen_bench_worker *workers,
+			      bool fastopen)
+{
+	unsigned int i, done = 0, syn_data = 0;
+	int err = 0;
+	s64 ns;
+
+	memset(workers, 0, npairs * sizeof(*workers));
+	for (i = 0; i < npairs && !err; i++) {
+		workers[i].port = port + i;
+		workers[i].fastopen = fastopen;
+		err = fastopen_bench_listen(&workers[i]);
+	}
+	if (err)
+		goto out;
+
+	ns = kbench_threads("fastopen_bench", 2 * npairs, 2,
+			    fastopen_bench_thread, workers);
+	if (ns < 0) {
+		err = ns;
+		goto out;
+	}
+
+	for (i = 0; i < npairs; i++) {
+		done += workers[i].done;
+		syn_data += workers[i].syn_data;
+		if (workers[i].err && !err)
+			err = workers[i].err;
+	}
+
+	pr_info("%3u pairs, %s: %llu trans/s, %u of %u done, %u with data in SYN\n",
+		npairs, fastopen ? "fastopen" : "connect ",
+		kbench_rate(done, ns), done, npairs * transactions, syn_data);
+out:
+	for (i = 0; i < npairs; i++)
+		if (workers[i].listener)
+			sock_release(workers[i].listener);
+	return err;
+}
+
+static int fastopen_bench_scale(void *data, unsigned int npairs)
+{
+	int err;
+
+	err = fastopen_bench_run(npairs, data, false);
+	if (!err && fastopen_bench_tfo) {
+		err = fastopen_bench_run(npairs, data, true);
+		if (err == -EOPNOTSUPP) {
+			pr_info("MSG_FASTOPEN disabled, see net.ipv4.tcp_fastopen\n");
+			fastopen_bench_tfo = false;
+			err = 0;
+		}
+	}
+	return err;
+}
+
+static int __init fastopen_bench_init(void)
+{
+	struct fastopen_bench_worker *workers;
+	int ret;
+
+	if (!transactions || !size || !port || port + nr_cpu_ids > 65536)
+		return -EINVAL;
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	pr_info("%u transactions of %u bytes per pair to 127.0.0.1:%u+\n",
+		transactions, size, port);
+	ret = kbench_scale(fastopen_bench_scale, workers);
+	kfree(workers);
+	return kbench_done(ret);
+}
+
+static void __exit fastopen_bench_exit(void)
+{
+}
+
+module_init(fastopen_bench_init);
+module_exit(fastopen_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP Fast Open loopback transaction benchmark");
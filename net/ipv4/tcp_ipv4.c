@@ -73,6 +73,7 @@
 #include <net/xfrm.h>
 #include <net/netdma.h>
 #include <net/secure_seq.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -305,7 +306,7 @@ static void do_pmtu_discovery(struct sock *sk, const struct iphdr *iph, u32 mtu)
 	if ((dst = __sk_dst_check(sk, 0)) == NULL)
 		return;
 
-	dst->ops->update_pmtu(dst, mtu);
+	dst->ops->update_pmtu(dst, NULL, mtu);
 
 	/* Something is about to be wrong... Remember soft error
 	 * for the case, if this connection will not able to recover.
@@ -1235,10 +1236,152 @@ static const struct tcp_request_sock_ops tcp_request_sock_ipv4_ops = {
 };
 #endif
 
+/* Decide whether the SYN in @skb may open a Fast Open connection. If it
+ * may not but the client asked for (or sent a stale) cookie, a valid
+ * one is put in @valid_foc for the SYN-ACK.
+ */
+static bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			       struct request_sock *req,
+			       struct tcp_fastopen_cookie *foc,
+			       struct tcp_fastopen_cookie *valid_foc)
+{
+	struct fastopen_queue *fastopenq =
+		&inet_csk(sk)->icsk_accept_queue.fastopenq;
+	bool data = TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1;
+
+	if (foc->len < 0 &&
+	    !((sysctl_tcp_fastopen & TFO_SERVER_COOKIE_NOT_REQD) && data))
+		return false;
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	/* Check the listener and its limit before burning cycles on the
+	 * cookie.
+	 */
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    fastopenq->max_qlen == 0)
+		return false;
+	if (fastopenq->qlen >= fastopenq->max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return false;
+	}
+
+	if (foc->len < 0) {
+		/* TFO_SERVER_COOKIE_NOT_REQD */
+		tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		return true;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, valid_foc);
+	if (foc->len == valid_foc->len &&
+	    !memcmp(foc->val, valid_foc->val, foc->len)) {
+		/* Acknowledge the data received from the peer */
+		tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		valid_foc->len = -1;
+		return true;
+	}
+
+	if (foc->len == 0)
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+	else
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return false;
+}
+
+/* Fast Open: create the child socket right away, queue the data in the
+ * SYN on it and put it on the accept queue. The request_sock stays with
+ * the child, for SYN-ACK retransmits, until the handshake completes.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct request_values *rvp)
+{
+	struct fastopen_queue *fastopenq =
+		&inet_csk(sk)->icsk_accept_queue.fastopenq;
+	const struct inet_request_sock *ireq = inet_rsk(req);
+	struct sk_buff *skb_synack;
+	struct dst_entry *dst;
+	struct tcp_sock *tp;
+	struct sock *child;
+	struct flowi4 fl4;
+
+	req->retrans = 0;
+	req->sk = NULL;
+
+	/* Build the SYN-ACK first: it settles the receive window and
+	 * window scale the child copies from the request_sock.
+	 */
+	dst = inet_csk_route_req(sk, &fl4, req);
+	if (dst == NULL)
+		return -1;
+	skb_synack = tcp_make_synack(sk, dst, req, rvp);
+	dst_release(dst);
+	if (skb_synack == NULL)
+		return -1;
+	__tcp_v4_send_check(skb_synack, ireq->loc_addr, ireq->rmt_addr);
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, NULL);
+	if (child == NULL) {
+		kfree_skb(skb_synack);
+		return -1;
+	}
+
+	/* A lost SYN-ACK is retransmitted from the child's timer */
+	ip_build_and_send_pkt(skb_synack, sk, ireq->loc_addr,
+			      ireq->rmt_addr, ireq->opt);
+
+	spin_lock(&fastopenq->lock);
+	fastopenq->qlen++;
+	spin_unlock(&fastopenq->lock);
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* The child may be accepted and outlive the listener: keep the
+	 * listener around for its fastopenq.
+	 */
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+	tp->max_window = tp->snd_wnd;
+
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, req, child);
+
+	/* Finish what tcp_rcv_state_process() would do on the final ACK */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data carried in the SYN. The caller frees @skb, take
+	 * a reference of our own.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	}
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	bool do_fastopen = false;
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1291,7 +1434,8 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0,
+			  want_cookie ? NULL : &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1328,6 +1472,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 		goto drop_and_release;
 	}
 	tmp_ext.cookie_in_always = tp->rx_opt.cookie_in_always;
+	tmp_ext.fastopen_cookie.len = -1;
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1398,6 +1543,18 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie)
+		do_fastopen = tcp_fastopen_check(sk, skb, req, &foc,
+						 &tmp_ext.fastopen_cookie);
+
+	if (do_fastopen) {
+		dst_release(dst);
+		if (tcp_v4_conn_req_fastopen(sk, skb, req,
+					     (struct request_values *)&tmp_ext))
+			goto drop_and_free;
+		return 0;
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1725,6 +1882,7 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
 	bh_lock_sock_nested(sk);
@@ -1788,6 +1946,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1884,6 +2043,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	skb_queue_head_init(&tp->out_of_order_queue);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_rto = TCP_TIMEOUT_INIT;
 	tp->mdev = TCP_TIMEOUT_INIT;
@@ -2584,7 +2744,9 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 
 	switch (skb->ip_summed) {
 	case CHECKSUM_COMPLETE:
-		if (!tcp_v4_check(skb_gro_len(skb), iph->saddr, iph->daddr,
+		/* in a tunnel, skb->csum covers the tunnel header too */
+		if (!NAPI_GRO_CB(skb)->encapsulation &&
+		    !tcp_v4_check(skb_gro_len(skb), iph->saddr, iph->daddr,
 				  skb->csum)) {
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
 			break;
@@ -2592,6 +2754,12 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 
 		/* fall through */
 	case CHECKSUM_NONE:
+		if (NAPI_GRO_CB(skb)->encapsulation &&
+		    !tcp_v4_check(skb_gro_len(skb), iph->saddr, iph->daddr,
+				  skb_gro_checksum(skb))) {
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+			break;
+		}
 		NAPI_GRO_CB(skb)->flush = 1;
 		return NULL;
 	}
@@ -2628,6 +2796,7 @@ struct proto tcp_prot = {
 	.sendmsg		= tcp_sendmsg,
 	.sendpage		= tcp_sendpage,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
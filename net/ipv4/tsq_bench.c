@@ -0,0 +1,308 @@
+/*
+ * TCP small queues benchmark.
+ *
+ * flows kernel threads each send a bulk TCP stream to addr:port for
+ * msecs milliseconds. Every 10 ms the smoothed RTT of each flow and
+ * the bytes it has below the TCP layer, sk_wmem_alloc, in the qdisc and
+ * the device ring, are sampled. Their averages and maxima go to the
+ * kernel log together with the throughput. Load it once with
+ * net.ipv4.tcp_limit_output_bytes at its default and once at 0, which
+ * turns TSQ off, to compare.
+ *
+ * Unless sink=0, the module reads the streams itself from threads bound
+ * to port. Over loopback, the default, nothing stays below TCP and both
+ * settings measure the same path; aim addr at a discard service behind
+ * a real device, with sink=0, to see what TSQ keeps out of the queues:
+ *
+ *	modprobe tsq_bench [addr=A.B.C.D] [port=N] [sink=0|1] [flows=N]
+ *		[msecs=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/kbench.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/socket.h>
+#include <linux/tcp.h>
+#include <net/sock.h>
+
+static char *addr = "127.0.0.1";
+module_param(addr, charp, 0444);
+MODULE_PARM_DESC(addr, "IPv4 address to send the streams to");
+
+static unsigned short port = 16416;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "tcp port of the discard service");
+
+static bool sink = true;
+module_param(sink, bool, 0444);
+MODULE_PARM_DESC(sink, "read the streams from in-module sink threads");
+
+static unsigned int flows = 4;
+module_param(flows, uint, 0444);
+MODULE_PARM_DESC(flows, "bulk streams sent at once");
+
+static unsigned int msecs = 2000;
+module_param(msecs, uint, 0444);
+MODULE_PARM_DESC(msecs, "length of the run in milliseconds");
+
+#define TSQ_BENCH_BUFLEN	65536
+#define TSQ_BENCH_SAMPLE_MS	10
+
+struct tsq_bench_flow {
+	struct socket		*sock;		/* sending end */
+	struct socket		*peer;		/* sink end, if sink */
+	struct task_struct	*send_task;
+	struct task_struct	*sink_task;
+	u64			bytes;
+	int			err;
+
+	/* samples */
+	u64			srtt_sum;
+	u32			srtt_max;
+	u64			queued_sum;
+	u32			queued_max;
+};
+
+/* lets the threads notice kthread_stop() */
+static int tsq_bench_socket(struct socket *sock)
+{
+	struct timeval tv = { .tv_usec = 100 * USEC_PER_MSEC };
+	int err;
+
+	err = kernel_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+				(char *)&tv, sizeof(tv));
+	if (!err)
+		err = kernel_setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO,
+					(char *)&tv, sizeof(tv));
+	return err;
+}
+
+static int tsq_bench_send_thread(void *data)
+{
+	struct tsq_bench_flow *f = data;
+	struct msghdr msg;
+	struct kvec iov;
+	char *buf;
+	int ret;
+
+	buf = kzalloc(TSQ_BENCH_BUFLEN, GFP_KERNEL);
+	if (!buf)
+		f->err = -ENOMEM;
+
+	while (!kthread_should_stop()) {
+		if (f->err) {
+			msleep(TSQ_BENCH_SAMPLE_MS);
+			continue;
+		}
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = TSQ_BENCH_BUFLEN;
+		ret = kernel_sendmsg(f->sock, &msg, &iov, 1, TSQ_BENCH_BUFLEN);
+		if (ret > 0)
+			f->bytes += ret;
+		else if (ret != -EAGAIN)
+			f->err = ret;
+	}
+	kfree(buf);
+	return 0;
+}
+
+static int tsq_bench_sink_thread(void *data)
+{
+	struct tsq_bench_flow *f = data;
+	struct msghdr msg;
+	struct kvec iov;
+	char *buf;
+
+	buf = kmalloc(TSQ_BENCH_BUFLEN, GFP_KERNEL);
+	while (!kthread_should_stop()) {
+		if (!buf) {
+			msleep(TSQ_BENCH_SAMPLE_MS);
+			continue;
+		}
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = TSQ_BENCH_BUFLEN;
+		kernel_recvmsg(f->peer, &msg, &iov, 1, TSQ_BENCH_BUFLEN, 0);
+	}
+	kfree(buf);
+	return 0;
+}
+
+static int tsq_bench_connect(struct tsq_bench_flow *f, struct socket *listener,
+			     struct sockaddr_in *sin)
+{
+	int err;
+
+	err = sock_create_kern(PF_INET, SOCK_STREAM, IPPROTO_TCP, &f->sock);
+	if (!err)
+		err = tsq_bench_socket(f->sock);
+	if (!err)
+		err = kernel_connect(f->sock, (struct sockaddr *)sin,
+				     sizeof(*sin), 0);
+	if (err || !listener)
+		return err;
+
+	err = kernel_accept(listener, &f->peer, 0);
+	if (!err)
+		err = tsq_bench_socket(f->peer);
+	if (err)
+		return err;
+	f->sink_task = kthread_run(tsq_bench_sink_thread, f, "tsq_bench_sink");
+	if (IS_ERR(f->sink_task)) {
+		err = PTR_ERR(f->sink_task);
+		f->sink_task = NULL;
+	}
+	return err;
+}
+
+static void tsq_bench_sample(struct tsq_bench_flow *f)
+{
+	struct sock *sk = f->sock->sk;
+	u32 srtt, queued;
+
+	srtt = jiffies_to_usecs(tcp_sk(sk)->srtt) >> 3;
+	/* one for the socket itself */
+	queued = max(atomic_read(&sk->sk_wmem_alloc) - 1, 0);
+
+	f->srtt_sum += srtt;
+	f->srtt_max = max(f->srtt_max, srtt);
+	f->queued_sum += queued;
+	f->queued_max = max(f->queued_max, queued);
+}
+
+static int tsq_bench_run(struct tsq_bench_flow *fl, struct socket *listener,
+			 struct sockaddr_in *sin)
+{
+	u64 bytes = 0, srtt_sum = 0, queued_sum = 0;
+	u32 srtt_max = 0, queued_max = 0;
+	unsigned int i, n, samples = 0;
+	ktime_t start;
+	s64 ns;
+	int err = 0;
+
+	for (i = 0; i < flows && !err; i++)
+		err = tsq_bench_connect(&fl[i], listener, sin);
+
+	start = ktime_get();
+	for (i = 0; i < flows && !err; i++) {
+		fl[i].send_task = kthread_run(tsq_bench_send_thread, &fl[i],
+					      "tsq_bench");
+		if (IS_ERR(fl[i].send_task)) {
+			err = PTR_ERR(fl[i].send_task);
+			fl[i].send_task = NULL;
+		}
+	}
+
+	for (n = 0; !err && n < msecs / TSQ_BENCH_SAMPLE_MS; n++) {
+		msleep(TSQ_BENCH_SAMPLE_MS);
+		for (i = 0; i < flows; i++)
+			tsq_bench_sample(&fl[i]);
+		samples++;
+	}
+
+	for (i = 0; i < flows; i++)
+		if (fl[i].send_task)
+			kthread_stop(fl[i].send_task);
+	ns = kbench_ns(start);
+	for (i = 0; i < flows; i++) {
+		if (fl[i].sink_task)
+			kthread_stop(fl[i].sink_task);
+		if (fl[i].sock)
+			sock_release(fl[i].sock);
+		if (fl[i].peer)
+			sock_release(fl[i].peer);
+		if (fl[i].err && !err)
+			err = fl[i].err;
+
+		bytes += fl[i].bytes;
+		srtt_sum += fl[i].srtt_sum;
+		srtt_max = max(srtt_max, fl[i].srtt_max);
+		queued_sum += fl[i].queued_sum;
+		queued_max = max(queued_max, fl[i].queued_max);
+	}
+	if (err)
+		return err;
+
+	samples = max(samples * flows, 1U);
+	pr_info("%llu Mbit/s, srtt avg %llu max %u us, below tcp avg %llu max %u bytes per flow\n",
+		div64_u64(bytes * 8000, max_t(s64, ns, 1)),
+		div64_u64(srtt_sum, samples), srtt_max,
+		div64_u64(queued_sum, samples), queued_max);
+	return 0;
+}
+
+static int __init tsq_bench_init(void)
+{
+	struct socket *listener = NULL;
+	struct tsq_bench_flow *fl;
+	struct sockaddr_in sin;
+	int ret;
+
+	if (!flows || !port || msecs < TSQ_BENCH_SAMPLE_MS)
+		return -EINVAL;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = in_aton(addr);
+
+	fl = kcalloc(flows, sizeof(*fl), GFP_KERNEL);
+	if (!fl)
+		return -ENOMEM;
+
+	if (sink) {
+		struct sockaddr_in any = {
+			.sin_family	= AF_INET,
+			.sin_port	= htons(port),
+			.sin_addr	= { htonl(INADDR_ANY) },
+		};
+		int one = 1;
+
+		ret = sock_create_kern(PF_INET, SOCK_STREAM, IPPROTO_TCP,
+				       &listener);
+		if (ret) {
+			listener = NULL;
+			goto out;
+		}
+		ret = kernel_setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+					(char *)&one, sizeof(one));
+		if (!ret)
+			ret = kernel_bind(listener, (struct sockaddr *)&any,
+					  sizeof(any));
+		if (!ret)
+			ret = kernel_listen(listener, flows);
+		if (ret)
+			goto out;
+	}
+
+	pr_info("%u flows to %pI4:%u for %u ms\n",
+		flows, &sin.sin_addr.s_addr, port, msecs);
+	ret = tsq_bench_run(fl, listener, &sin);
+out:
+	if (listener)
+		sock_release(listener);
+	kfree(fl);
+	return kbench_done(ret);
+}
+
+static void __exit tsq_bench_exit(void)
+{
+}
+
+module_init(tsq_bench_init);
+module_exit(tsq_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP small queues RTT and queueing benchmark");
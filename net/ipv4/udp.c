@@ -105,6 +105,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table __read_mostly;
@@ -135,12 +136,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
 		    sk2 != sk &&
 		    (bitmap || udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -165,6 +169,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 	int res = 0;
 
 	spin_lock(&hslot2->lock);
@@ -173,6 +178,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    sk2 != sk &&
 		    (udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -405,7 +412,8 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
@@ -416,8 +424,18 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -443,6 +461,10 @@ exact_match:
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
+ *
+ * Among equally good %SO_REUSEPORT sockets, the flow hash of the datagram
+ * picks one, so that a flow sticks to a socket while the group does not
+ * change.
  */
 static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 		__be16 sport, __be32 daddr, __be16 dport,
@@ -453,7 +475,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -489,6 +512,17 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -785,6 +819,48 @@ out:
 	return err;
 }
 
+/*
+ * The datagrams of a sendmmsg() call mostly go to one destination. The
+ * batch keeps the route of the last one for the next, as long as the
+ * flow, ports included for the sake of IPsec policies, stays the same.
+ */
+static struct rtable *udp_batch_route(struct sock_batch *batch,
+				      struct flowi4 *fl4)
+{
+	const struct flowi4 *key = &batch->key.u.ip4;
+	struct dst_entry *dst = batch->dst;
+
+	if (!dst ||
+	    key->daddr != fl4->daddr || key->saddr != fl4->saddr ||
+	    key->fl4_dport != fl4->fl4_dport ||
+	    key->fl4_sport != fl4->fl4_sport ||
+	    key->flowi4_oif != fl4->flowi4_oif ||
+	    key->flowi4_mark != fl4->flowi4_mark ||
+	    key->flowi4_tos != fl4->flowi4_tos ||
+	    key->flowi4_flags != fl4->flowi4_flags ||
+	    key->flowi4_secid != fl4->flowi4_secid)
+		return NULL;
+
+	if (dst->obsolete && dst->ops->check(dst, 0) == NULL) {
+		dst_release(dst);
+		batch->dst = NULL;
+		return NULL;
+	}
+
+	*fl4 = batch->fl.u.ip4;
+	return (struct rtable *)dst_clone(dst);
+}
+
+static void udp_batch_set_route(struct sock_batch *batch,
+				const struct flowi4 *key,
+				const struct flowi4 *fl4, struct rtable *rt)
+{
+	dst_release(batch->dst);
+	batch->dst = dst_clone(&rt->dst);
+	batch->key.u.ip4 = *key;
+	batch->fl.u.ip4 = *fl4;
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -921,7 +997,9 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		rt = (struct rtable *)sk_dst_check(sk, 0);
 
 	if (rt == NULL) {
+		struct sock_batch *batch = sock_iocb_batch(iocb);
 		struct net *net = sock_net(sk);
+		struct flowi4 key;
 
 		fl4 = &fl4_stack;
 		flowi4_init_output(fl4, ipc.oif, sk->sk_mark, tos,
@@ -930,13 +1008,21 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 				   faddr, saddr, dport, inet->inet_sport);
 
 		security_sk_classify_flow(sk, flowi4_to_flowi(fl4));
-		rt = ip_route_output_flow(net, fl4, sk);
-		if (IS_ERR(rt)) {
-			err = PTR_ERR(rt);
-			rt = NULL;
-			if (err == -ENETUNREACH)
-				IP_INC_STATS_BH(net, IPSTATS_MIB_OUTNOROUTES);
-			goto out;
+		if (batch && !connected)
+			rt = udp_batch_route(batch, fl4);
+		if (rt == NULL) {
+			key = *fl4;
+			rt = ip_route_output_flow(net, fl4, sk);
+			if (IS_ERR(rt)) {
+				err = PTR_ERR(rt);
+				rt = NULL;
+				if (err == -ENETUNREACH)
+					IP_INC_STATS_BH(net,
+						IPSTATS_MIB_OUTNOROUTES);
+				goto out;
+			}
+			if (batch && !connected)
+				udp_batch_set_route(batch, &key, fl4, rt);
 		}
 
 		err = -EACCES;
@@ -1162,6 +1248,7 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 {
 	struct inet_sock *inet = inet_sk(sk);
 	struct sockaddr_in *sin = (struct sockaddr_in *)msg->msg_name;
+	struct sock_batch *batch = sock_iocb_batch(iocb);
 	struct sk_buff *skb;
 	unsigned int ulen;
 	int peeked;
@@ -1179,8 +1266,9 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		return ip_recv_error(sk, msg, len);
 
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &err);
+	skb = skb_recv_datagram_batch(sk, batch,
+				      flags | (noblock ? MSG_DONTWAIT : 0),
+				      &peeked, &err);
 	if (!skb)
 		goto out;
 
@@ -1237,7 +1325,7 @@ try_again:
 		err = ulen;
 
 out_free:
-	skb_free_datagram_locked(sk, skb);
+	skb_free_datagram_batch(sk, batch, skb);
 out:
 	return err;
 
@@ -1355,6 +1443,7 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 
 	if (inet_sk(sk)->inet_daddr)
 		sock_rps_save_rxhash(sk, skb->rxhash);
+	sk_mark_napi_id(sk, skb);
 
 	rc = ip_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -2241,6 +2330,163 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+static LIST_HEAD(udp_offload_list);
+static DEFINE_SPINLOCK(udp_offload_lock);
+
+/* must be called under rcu_read_lock() */
+static struct udp_offload *udp_offload_lookup(__be16 port)
+{
+	struct udp_offload *uo;
+
+	list_for_each_entry_rcu(uo, &udp_offload_list, list)
+		if (uo->port == port)
+			return uo;
+
+	return NULL;
+}
+
+void udp_add_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_add_rcu(&uo->list, &udp_offload_list);
+	spin_unlock(&udp_offload_lock);
+}
+EXPORT_SYMBOL(udp_add_offload);
+
+/*
+ * Aggregates still held by GRO when this is called are dropped rather
+ * than completed.
+ */
+void udp_del_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_del_rcu(&uo->list);
+	spin_unlock(&udp_offload_lock);
+
+	synchronize_net();
+}
+EXPORT_SYMBOL(udp_del_offload);
+
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	struct udp_offload *uo;
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct udphdr *uh;
+	unsigned int hlen;
+	unsigned int off;
+	int flush = 1;
+
+	if (NAPI_GRO_CB(skb)->encapsulation)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (!uo || !uo->callbacks.gro_receive)
+		goto out_unlock;
+
+	if (ntohs(uh->len) != skb_gro_len(skb))
+		goto out_unlock;
+
+	/* the aggregate goes up without an outer checksum */
+	if (uh->check) {
+		if (skb->ip_summed == CHECKSUM_COMPLETE &&
+		    !csum_tcpudp_magic(iph->saddr, iph->daddr,
+				       skb_gro_len(skb), IPPROTO_UDP,
+				       skb->csum))
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+		if (skb->ip_summed != CHECKSUM_UNNECESSARY)
+			goto out_unlock;
+	}
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		struct udphdr *uh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source)
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, sizeof(*uh));
+	pp = uo->callbacks.gro_receive(head, skb);
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb) + ip_hdrlen(skb);
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
+	struct udp_offload *uo;
+	int err = -ENOSYS;
+
+	uh->len = htons(skb->len - nhoff);
+	uh->check = 0;
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (uo && uo->callbacks.gro_complete)
+		err = uo->callbacks.gro_complete(skb, nhoff + sizeof(*uh));
+	rcu_read_unlock();
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
+
+	return err;
+}
+
+static struct sk_buff *udp4_tunnel_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EPROTONOSUPPORT);
+	struct udp_offload *uo;
+	struct udphdr *uh;
+
+	if (!pskb_may_pull(skb, sizeof(*uh)))
+		return ERR_PTR(-EINVAL);
+
+	uh = udp_hdr(skb);
+
+	rcu_read_lock();
+	uo = udp_offload_lookup(uh->dest);
+	if (uo && uo->callbacks.gso_segment) {
+		__skb_pull(skb, sizeof(*uh));
+		segs = uo->callbacks.gso_segment(skb, features);
+	}
+	rcu_read_unlock();
+
+	if (IS_ERR_OR_NULL(segs))
+		return segs;
+
+	/* the outer checksum is optional over IPv4 and left out */
+	for (skb = segs; skb; skb = skb->next) {
+		uh = udp_hdr(skb);
+		uh->len = htons(skb->len - skb_transport_offset(skb));
+		uh->check = 0;
+	}
+
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -2248,6 +2494,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_TUNNEL)
+		return udp4_tunnel_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
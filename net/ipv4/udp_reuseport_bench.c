@@ -0,0 +1,210 @@
+/*
+ * UDP receive scaling benchmark for SO_REUSEPORT.
+ *
+ * Each thread sends datagrams over loopback to 127.0.0.1:port from a
+ * socket of its own, and drains a receiving socket: first all of them
+ * drain the one socket bound to the port, then each drains its own
+ * socket of a SO_REUSEPORT group bound to the port. The rate, in
+ * datagrams received per second, goes to the kernel log, see
+ * lib/kbench.c:
+ *
+ *	modprobe udp_reuseport_bench [packets=N] [port=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kbench.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/socket.h>
+#include <net/sock.h>
+
+static unsigned int packets = 200000;
+module_param(packets, uint, 0444);
+MODULE_PARM_DESC(packets, "datagrams sent by each thread");
+
+static unsigned short port = 16384;
+module_param(port, ushort, 0444);
+MODULE_PARM_DESC(port, "loopback udp port to bind");
+
+#define REUSEPORT_BENCH_LEN	64
+
+struct reuseport_bench_worker {
+	struct socket		*tx;
+	struct socket		*rx;
+	unsigned int		received;
+};
+
+static void reuseport_bench_addr(struct sockaddr_in *sin)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin->sin_port = htons(port);
+}
+
+static int reuseport_bench_drain(struct socket *sock, char *buf)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int n = 0;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = REUSEPORT_BENCH_LEN;
+		if (kernel_recvmsg(sock, &msg, &iov, 1, REUSEPORT_BENCH_LEN,
+				   MSG_DONTWAIT) < 0)
+			return n;
+		n++;
+	}
+}
+
+static void reuseport_bench_thread(void *data, unsigned int id)
+{
+	struct reuseport_bench_worker *w =
+		(struct reuseport_bench_worker *)data + id;
+	char buf[REUSEPORT_BENCH_LEN];
+	struct msghdr msg;
+	struct kvec iov;
+	unsigned int i;
+
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < packets; i++) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		kernel_sendmsg(w->tx, &msg, &iov, 1, sizeof(buf));
+		w->received += reuseport_bench_drain(w->rx, buf);
+		if (!(i & 255))
+			cond_resched();
+	}
+	w->received += reuseport_bench_drain(w->rx, buf);
+}
+
+/* A socket bound to the port, or connected to it when !bind */
+static int reuseport_bench_socket(struct socket **sockp, bool bind,
+				  bool reuseport)
+{
+	struct sockaddr_in sin;
+	int one = 1, err;
+
+	err = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, sockp);
+	if (err)
+		return err;
+
+	reuseport_bench_addr(&sin);
+	if (reuseport)
+		err = kernel_setsockopt(*sockp, SOL_SOCKET, SO_REUSEPORT,
+					(char *)&one, sizeof(one));
+	if (!err && bind)
+		err = kernel_bind(*sockp, (struct sockaddr *)&sin,
+				  sizeof(sin));
+	else if (!err)
+		err = kernel_connect(*sockp, (struct sockaddr *)&sin,
+				     sizeof(sin), 0);
+	if (err) {
+		sock_release(*sockp);
+		*sockp = NULL;
+	}
+	return err;
+}
+
+static void reuseport_bench_release(unsigned int nthreads,
+				    struct reuseport_bench_worker *workers)
+{
+	unsigned int i;
+
+	for (i = 0; i < nthreads; i++) {
+		if (workers[i].tx)
+			sock_release(workers[i].tx);
+		/* in the shared run, only the first one owns it */
+		if (workers[i].rx && (!i || workers[i].rx != workers[0].rx))
+			sock_release(workers[i].rx);
+		workers[i].tx = workers[i].rx = NULL;
+	}
+}
+
+static int reuseport_bench_run(unsigned int nthreads,
+			       struct reuseport_bench_worker *workers,
+			       bool reuseport)
+{
+	unsigned int i, received = 0;
+	int err = 0;
+	s64 ns;
+
+	memset(workers, 0, nthreads * sizeof(*workers));
+	for (i = 0; i < nthreads && !err; i++) {
+		err = reuseport_bench_socket(&workers[i].tx, false, false);
+		if (err)
+			break;
+		if (reuseport || !i)
+			err = reuseport_bench_socket(&workers[i].rx, true,
+						     reuseport);
+		else
+			workers[i].rx = workers[0].rx;
+	}
+	if (err)
+		goto out;
+
+	ns = kbench_threads("reuseport_bench", nthreads, 1,
+			    reuseport_bench_thread, workers);
+	if (ns < 0) {
+		err = ns;
+		goto out;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		received += workers[i].received;
+
+	pr_info("%3u threads, %s: %llu pkts/s, %u of %u received\n",
+		nthreads, reuseport ? "reuseport" : "shared   ",
+		kbench_rate(received, ns), received, nthreads * packets);
+out:
+	reuseport_bench_release(nthreads, workers);
+	return err;
+}
+
+static int reuseport_bench_scale(void *data, unsigned int nthreads)
+{
+	int err;
+
+	err = reuseport_bench_run(nthreads, data, false);
+	if (!err)
+		err = reuseport_bench_run(nthreads, data, true);
+	return err;
+}
+
+static int __init reuseport_bench_init(void)
+{
+	struct reuseport_bench_worker *workers;
+	int ret;
+
+	if (!packets || !port)
+		return -EINVAL;
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	pr_info("%u datagrams per thread to 127.0.0.1:%u\n", packets, port);
+	ret = kbench_scale(reuseport_bench_scale, workers);
+	kfree(workers);
+	return kbench_done(ret);
+}
+
+static void __exit reuseport_bench_exit(void)
+{
+}
+
+module_init(reuseport_bench_init);
+module_exit(reuseport_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SO_REUSEPORT udp receive scaling benchmark");
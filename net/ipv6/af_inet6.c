@@ -788,6 +788,8 @@ static struct sk_buff *ipv6_gso_segment(struct sk_buff *skb, u32 features)
 		       SKB_GSO_DODGY |
 		       SKB_GSO_TCP_ECN |
 		       SKB_GSO_TCPV6 |
+		       SKB_GSO_GRE |
+		       SKB_GSO_UDP_TUNNEL |
 		       0)))
 		goto out;
 
@@ -892,10 +894,11 @@ static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ipv6_hdr(p);
+		/* not ipv6_hdr(p): this may be the header inside a tunnel */
+		iph2 = (struct ipv6hdr *)(p->data + off);
 
 		/* All fields must match except length. */
-		if (nlen != skb_network_header_len(p) ||
+		if (nlen != skb_transport_header(p) - (u8 *)iph2 ||
 		    memcmp(iph, iph2, offsetof(struct ipv6hdr, payload_len)) ||
 		    memcmp(&iph->nexthdr, &iph2->nexthdr,
 			   nlen - offsetof(struct ipv6hdr, nexthdr))) {
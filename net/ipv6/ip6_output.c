@@ -55,6 +55,7 @@
 #include <net/xfrm.h>
 #include <net/checksum.h>
 #include <linux/mroute6.h>
+#include <linux/l3_firewall_cache.h>
 
 int ip6_fragment(struct sk_buff *skb, int (*output)(struct sk_buff *));
 
@@ -401,6 +402,9 @@ int ip6_forward(struct sk_buff *skb)
 	struct net *net = dev_net(dst->dev);
 	struct neighbour *n;
 	u32 mtu;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	int verdict;
+#endif
 
 	if (net->ipv6.devconf_all->forwarding == 0)
 		goto error;
@@ -540,6 +544,17 @@ int ip6_forward(struct sk_buff *skb)
 	hdr->hop_limit--;
 
 	IP6_INC_STATS_BH(net, ip6_dst_idev(dst), IPSTATS_MIB_OUTFORWDATAGRAMS);
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	verdict = search_from_firewall_cache(NFPROTO_IPV6, NF_INET_FORWARD,
+				skb, skb->dev, dst->dev, p_l3_firewall_cache);
+	if (verdict == NF_ACCEPT || verdict == NF_STOP) {
+		/* skip to the filtering patch */
+		return ip6_forward_finish(skb);
+	} else if (verdict != NF_NOTFOUND) {
+		/* We only recorded NF_ACCEPT, NF_STOP and NF_DROP */
+		goto drop;
+	}
+#endif  /* end CONFIG_L3_FIREWALL_CACHE */
 	return NF_HOOK(NFPROTO_IPV6, NF_INET_FORWARD, skb, skb->dev, dst->dev,
 		       ip6_forward_finish);
 
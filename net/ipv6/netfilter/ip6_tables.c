@@ -25,11 +25,13 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
 
 #include <linux/netfilter_ipv6/ip6_tables.h>
 #include <linux/netfilter/x_tables.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
+#include <linux/l3_firewall_cache.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
@@ -805,6 +807,10 @@ static void cleanup_entry(struct ip6t_entry *e, struct net *net)
 	module_put(par.target->me);
 }
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+DEFINE_L3_FIREWALL_CACHE_SCAN(ip6t, struct ip6t_entry)
+#endif
+
 /* Checks and translates the user-supplied table segment (held in
    newinfo) */
 static int
@@ -866,6 +872,9 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 
 	if (!mark_source_chains(newinfo, repl->valid_hooks, entry0))
 		return -ELOOP;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ip6t_rules_fingerprint(newinfo, entry0);
+#endif
 
 	/* Finally, each sanity check must pass */
 	i = 0;
@@ -1192,7 +1201,7 @@ get_entries(struct net *net, struct ip6t_get_entries __user *uptr,
 }
 
 #ifdef CONFIG_AS_FASTPATH
-extern void (*pfnfirewall_asfctrl)(void);
+extern void (__rcu *pfnfirewall_asfctrl)(void);
 #endif
 
 static int
@@ -1206,6 +1215,9 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	struct xt_counters *counters;
 	const void *loc_cpu_old_entry;
 	struct ip6t_entry *iter;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	bool rules_changed;
+#endif
 
 	ret = 0;
 	counters = vzalloc(num_counters * sizeof(struct xt_counters));
@@ -1229,9 +1241,22 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 		goto put_module;
 	}
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ip6t_rules_stateful(newinfo);
+	l3_firewall_cache_account(t, newinfo, 1);
+#endif
 	oldinfo = xt_replace_table(t, num_counters, newinfo, &ret);
-	if (!oldinfo)
+	if (!oldinfo) {
+#ifdef CONFIG_L3_FIREWALL_CACHE
+		l3_firewall_cache_account(t, newinfo, -1);
+#endif
 		goto put_module;
+	}
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	rules_changed = oldinfo->fingerprint != newinfo->fingerprint ||
+			oldinfo->stateful != newinfo->stateful;
+	l3_firewall_cache_account(t, oldinfo, -1);
+#endif
 
 	/* Update module usage count based on number of rules */
 	duprintf("do_replace: oldnum=%u, initnum=%u, newnum=%u\n",
@@ -1258,10 +1283,23 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	vfree(counters);
 	xt_table_unlock(t);
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	/* Only the verdicts of the hooks this table sits on can change */
+	if (rules_changed)
+		l3_firewall_cache_invalidate(NFPROTO_IPV6, valid_hooks);
+#endif  /* endif CONFIG_L3_FIREWALL_CACHE */
+
 #ifdef CONFIG_AS_FASTPATH
 	/* Call the  ASF CTRL CB */
-	if (!ret && pfnfirewall_asfctrl)
-		pfnfirewall_asfctrl();
+	if (!ret) {
+		void (*asfctrl)(void);
+
+		rcu_read_lock();
+		asfctrl = rcu_dereference(pfnfirewall_asfctrl);
+		if (asfctrl)
+			asfctrl();
+		rcu_read_unlock();
+	}
 #endif
 
 	return ret;
@@ -1760,6 +1798,9 @@ translate_compat_table(struct net *net,
 	ret = -ELOOP;
 	if (!mark_source_chains(newinfo, valid_hooks, entry1))
 		goto free_newinfo;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ip6t_rules_fingerprint(newinfo, entry1);
+#endif
 
 	i = 0;
 	xt_entry_foreach(iter1, entry1, newinfo->size) {
@@ -2112,12 +2153,18 @@ struct xt_table *ip6t_register_table(struct net *net,
 	ret = translate_table(net, newinfo, loc_cpu_entry, repl);
 	if (ret != 0)
 		goto out_free;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	ip6t_rules_stateful(newinfo);
+#endif
 
 	new_table = xt_register_table(net, table, &bootstrap, newinfo);
 	if (IS_ERR(new_table)) {
 		ret = PTR_ERR(new_table);
 		goto out_free;
 	}
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	l3_firewall_cache_account(new_table, newinfo, 1);
+#endif
 	return new_table;
 
 out_free:
@@ -2133,6 +2180,9 @@ void ip6t_unregister_table(struct net *net, struct xt_table *table)
 	struct module *table_owner = table->me;
 	struct ip6t_entry *iter;
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	l3_firewall_cache_account(table, table->private, -1);
+#endif
 	private = xt_unregister_table(table);
 
 	/* Decrease module usage counts and free resources */
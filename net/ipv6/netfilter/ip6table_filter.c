@@ -28,6 +28,9 @@ static const struct xt_table packet_filter = {
 	.me		= THIS_MODULE,
 	.af		= NFPROTO_IPV6,
 	.priority	= NF_IP6_PRI_FILTER,
+#ifdef CONFIG_L3_FIREWALL_CACHE
+	.l3_cache	= true,
+#endif
 };
 
 /* The work comes in here from netfilter.c. */
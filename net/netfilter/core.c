@@ -112,8 +112,39 @@ void nf_unregister_hooks(struct nf_hook_ops *reg, unsigned int n)
 }
 EXPORT_SYMBOL(nf_unregister_hooks);
 
+#ifdef CONFIG_L3_FIREWALL_CACHE
+/* Run a table of a local hook through the L3 firewall cache:
+ * a cached verdict replaces the table walk, otherwise the verdict of
+ * the table is recorded for the next packets of the flow.
+ */
+static unsigned int nf_hook_l3_firewall_cache(struct nf_hook_ops *elem,
+					      u_int8_t pf,
+					      unsigned int hook,
+					      struct sk_buff *skb,
+					      const struct net_device *indev,
+					      const struct net_device *outdev,
+					      int (*okfn)(struct sk_buff *))
+{
+	struct net_device *in = (struct net_device *)indev;
+	struct net_device *out = (struct net_device *)outdev;
+	unsigned int verdict;
+	int response;
+
+	response = search_from_firewall_cache(pf, hook, skb, in, out,
+					      p_l3_firewall_cache);
+	if (response != NF_NOTFOUND)
+		return response;
+
+	verdict = elem->hook(hook, skb, indev, outdev, okfn);
+	update_l3_firewall_cache(pf, hook, skb, in, out,
+				 p_l3_firewall_cache, verdict);
+	return verdict;
+}
+#endif  /* end CONFIG_L3_FIREWALL_CACHE */
+
 unsigned int nf_iterate(struct list_head *head,
 			struct sk_buff *skb,
+			u_int8_t pf,
 			unsigned int hook,
 			const struct net_device *indev,
 			const struct net_device *outdev,
@@ -136,6 +167,13 @@ unsigned int nf_iterate(struct list_head *head,
 		/* Optimization: we don't need to hold module
 		   reference here, since function can't sleep. --RR */
 repeat:
+#ifdef CONFIG_L3_FIREWALL_CACHE
+		if (elem->l3_cache && l3_firewall_cache_local_hook(pf, hook) &&
+		    l3_firewall_cache_stateless(pf, hook))
+			verdict = nf_hook_l3_firewall_cache(elem, pf, hook, skb,
+						indev, outdev, okfn);
+		else
+#endif  /* end CONFIG_L3_FIREWALL_CACHE */
 		verdict = elem->hook(hook, skb, indev, outdev, okfn);
 		if (verdict != NF_ACCEPT) {
 #ifdef CONFIG_NETFILTER_DEBUG
@@ -172,17 +210,17 @@ int nf_hook_slow(u_int8_t pf, unsigned int hook, struct sk_buff *skb,
 
 	elem = &nf_hooks[pf][hook];
 next_hook:
-	verdict = nf_iterate(&nf_hooks[pf][hook], skb, hook, indev,
+	verdict = nf_iterate(&nf_hooks[pf][hook], skb, pf, hook, indev,
 			     outdev, &elem, okfn, hook_thresh);
 	if (verdict == NF_ACCEPT || verdict == NF_STOP) {
 		ret = 1;
 	} else if ((verdict & NF_VERDICT_MASK) == NF_DROP) {
 #ifdef CONFIG_L3_FIREWALL_CACHE
-		/* I am only interested in IPV4 and FORWARD infomations,
-		 * others go the old path pls.
+		/* I am only interested in IPV4/IPV6 and FORWARD
+		 * infomations, others go the old path pls.
 		 * DROP action should be cached as well.
 		 */
-		if ((pf == NFPROTO_IPV4) && (hook == NF_INET_FORWARD)) {
+		if (l3_firewall_cache_forward_hook(pf, hook)) {
 			update_l3_firewall_cache(pf, hook, skb,	indev,
 					outdev, p_l3_firewall_cache, verdict);
 		}
@@ -205,12 +243,11 @@ next_hook:
 		ret = 0;
 	}
 #ifdef CONFIG_L3_FIREWALL_CACHE
-	/* I am only interested in IPV4 and FORWARD
+	/* I am only interested in IPV4/IPV6 and FORWARD
 	 * informations, others go the old path.
 	 * here, we record NF_STOP||NF_ACCEPT action
 	 */
-	if ((pf == NFPROTO_IPV4) &&
-		(hook == NF_INET_FORWARD) && (ret != -EPERM)) {
+	if (l3_firewall_cache_forward_hook(pf, hook) && (ret != -EPERM)) {
 		update_l3_firewall_cache(pf, hook, skb, indev,
 					outdev,	p_l3_firewall_cache, verdict);
 	}
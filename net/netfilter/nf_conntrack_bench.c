@@ -0,0 +1,160 @@
+/*
+ * Connection tracking setup rate benchmark.
+ *
+ * Pushes udp packets of distinct flows through nf_conntrack_in() and
+ * nf_conntrack_confirm(), then kills each new conntrack at once: every
+ * connection is allocated, hashed, unhashed and freed, which is what
+ * contends on the hash locks during connection storms. The rate, in
+ * new connections per second, goes to the kernel log, see lib/kbench.c:
+ *
+ *	modprobe nf_conntrack_bench [conns=N]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/kbench.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/netfilter.h>
+#include <net/net_namespace.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+
+static unsigned int conns = 100000;
+module_param(conns, uint, 0444);
+MODULE_PARM_DESC(conns, "connections set up by each thread");
+
+struct nf_ct_bench_worker {
+	unsigned int		failed;
+};
+
+static struct sk_buff *nf_ct_bench_skb(unsigned int id)
+{
+	struct sk_buff *skb;
+	struct iphdr *iph;
+	struct udphdr *uh;
+
+	skb = alloc_skb(sizeof(*iph) + sizeof(*uh), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	skb_reset_network_header(skb);
+	iph = (struct iphdr *)skb_put(skb, sizeof(*iph));
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(sizeof(*iph) + sizeof(*uh));
+	iph->daddr = htonl(0xc0a80001 + id);
+
+	skb_set_transport_header(skb, sizeof(*iph));
+	uh = (struct udphdr *)skb_put(skb, sizeof(*uh));
+	uh->dest = htons(53);
+	uh->len = htons(sizeof(*uh));
+	uh->check = 0;
+	return skb;
+}
+
+static void nf_ct_bench_thread(void *data, unsigned int id)
+{
+	struct nf_ct_bench_worker *w = (struct nf_ct_bench_worker *)data + id;
+	enum ip_conntrack_info ctinfo;
+	struct sk_buff *skb;
+	struct nf_conn *ct;
+	unsigned int i;
+
+	skb = nf_ct_bench_skb(id);
+	if (!skb) {
+		w->failed = conns;
+		return;
+	}
+
+	for (i = 0; i < conns; i++) {
+		ip_hdr(skb)->saddr = htonl(0x0a000000 | (id << 16) |
+					   (i >> 16));
+		udp_hdr(skb)->source = htons(i & 0xffff);
+
+		/* as if it came from the stack; LOCAL_OUT skips checksums */
+		local_bh_disable();
+		if (nf_conntrack_in(&init_net, PF_INET, NF_INET_LOCAL_OUT,
+				    skb) == NF_ACCEPT &&
+		    nf_conntrack_confirm(skb) == NF_ACCEPT &&
+		    (ct = nf_ct_get(skb, &ctinfo)) != NULL &&
+		    !nf_ct_is_untracked(ct))
+			nf_ct_kill(ct);
+		else
+			w->failed++;
+		local_bh_enable();
+
+		nf_conntrack_put(skb->nfct);
+		skb->nfct = NULL;
+		cond_resched();
+	}
+	kfree_skb(skb);
+}
+
+static int nf_ct_bench_run(void *data, unsigned int nthreads)
+{
+	struct nf_ct_bench_worker *workers = data;
+	unsigned int i, failed = 0;
+	s64 ns;
+
+	memset(workers, 0, nthreads * sizeof(*workers));
+	ns = kbench_threads("nf_ct_bench", nthreads, 1, nf_ct_bench_thread,
+			    workers);
+	if (ns < 0)
+		return ns;
+
+	for (i = 0; i < nthreads; i++)
+		failed += workers[i].failed;
+
+	pr_info("%3u threads: %llu conns/s, %u failed\n", nthreads,
+		kbench_rate((u64)nthreads * conns - failed, ns), failed);
+	return 0;
+}
+
+static int __init nf_ct_bench_init(void)
+{
+	struct nf_ct_bench_worker *workers;
+	int ret;
+
+	if (!conns)
+		return -EINVAL;
+
+	/* the IPv4 tracker, loaded if need be */
+	ret = nf_ct_l3proto_try_module_get(PF_INET);
+	if (ret < 0)
+		return ret;
+
+	workers = kcalloc(nr_cpu_ids, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	pr_info("%u connections per thread, %u buckets\n", conns,
+		init_net.ct.htable_size);
+	ret = kbench_scale(nf_ct_bench_run, workers);
+	kfree(workers);
+out:
+	nf_ct_l3proto_module_put(PF_INET);
+	return kbench_done(ret);
+}
+
+static void __exit nf_ct_bench_exit(void)
+{
+}
+
+module_init(nf_ct_bench_init);
+module_exit(nf_ct_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("connection tracking setup rate benchmark");
@@ -49,6 +49,9 @@
 
 #define NF_CONNTRACK_VERSION	"0.5.0"
 
+/* Default ratio of nf_conntrack_max to the number of buckets */
+#define NF_CONNTRACK_MAX_FACTOR	4
+
 int (*nfnetlink_parse_nat_setup_hook)(struct nf_conn *ct,
 				      enum nf_nat_manip_type manip,
 				      const struct nlattr *attr) __read_mostly;
@@ -57,6 +60,94 @@ EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 DEFINE_SPINLOCK(nf_conntrack_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
+/* nf_conntrack_lock keeps the expectations and helpers; the hash
+ * itself is serialised by these, bucket % CONNTRACK_LOCKS, so that
+ * setting up and tearing down connections on different cpus does not
+ * contend on one lock.
+ */
+spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks);
+
+static DEFINE_SPINLOCK(nf_conntrack_locks_all_lock);
+static bool nf_conntrack_locks_all;
+
+/* Serialises resizes against each other, and against the walkers */
+DEFINE_MUTEX(nf_conntrack_resize_mutex);
+EXPORT_SYMBOL_GPL(nf_conntrack_resize_mutex);
+
+void nf_conntrack_bucket_lock(spinlock_t *lock) __acquires(lock)
+{
+	spin_lock(lock);
+	if (likely(!ACCESS_ONCE(nf_conntrack_locks_all))) {
+		/* pairs with the barrier in nf_conntrack_all_unlock() */
+		smp_rmb();
+		return;
+	}
+
+	/* a resize is running: wait for it behind the global lock */
+	spin_unlock(lock);
+	spin_lock(&nf_conntrack_locks_all_lock);
+	spin_lock(lock);
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_bucket_lock);
+
+static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
+{
+	h1 %= CONNTRACK_LOCKS;
+	h2 %= CONNTRACK_LOCKS;
+	spin_unlock(&nf_conntrack_locks[h1]);
+	if (h1 != h2)
+		spin_unlock(&nf_conntrack_locks[h2]);
+}
+
+/* Returns true if the table was resized meanwhile: the caller has to
+ * compute the buckets again.
+ */
+static bool nf_conntrack_double_lock(struct net *net, unsigned int h1,
+				     unsigned int h2, unsigned int sequence)
+{
+	h1 %= CONNTRACK_LOCKS;
+	h2 %= CONNTRACK_LOCKS;
+	if (h1 <= h2) {
+		nf_conntrack_bucket_lock(&nf_conntrack_locks[h1]);
+		if (h1 != h2)
+			spin_lock_nested(&nf_conntrack_locks[h2],
+					 SINGLE_DEPTH_NESTING);
+	} else {
+		nf_conntrack_bucket_lock(&nf_conntrack_locks[h2]);
+		spin_lock_nested(&nf_conntrack_locks[h1],
+				 SINGLE_DEPTH_NESTING);
+	}
+	if (read_seqcount_retry(&net->ct.generation, sequence)) {
+		nf_conntrack_double_unlock(h1, h2);
+		return true;
+	}
+	return false;
+}
+
+/* Waits for all bucket lock holders; later ones wait for the unlock */
+static void nf_conntrack_all_lock(void)
+{
+	int i;
+
+	spin_lock(&nf_conntrack_locks_all_lock);
+	nf_conntrack_locks_all = true;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+		spin_lock(&nf_conntrack_locks[i]);
+		spin_unlock(&nf_conntrack_locks[i]);
+	}
+}
+
+static void nf_conntrack_all_unlock(void)
+{
+	/* the new table must be seen by whoever sees the flag clear */
+	smp_wmb();
+	nf_conntrack_locks_all = false;
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+
 unsigned int nf_conntrack_htable_size __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_htable_size);
 
@@ -87,21 +178,64 @@ static u32 __hash_bucket(u32 hash, unsigned int size)
 	return ((u64)hash * size) >> 32;
 }
 
-static u32 hash_bucket(u32 hash, const struct net *net)
-{
-	return __hash_bucket(hash, net->ct.htable_size);
-}
-
 static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
 				  u16 zone, unsigned int size)
 {
 	return __hash_bucket(hash_conntrack_raw(tuple, zone), size);
 }
 
-static inline u_int32_t hash_conntrack(const struct net *net, u16 zone,
-				       const struct nf_conntrack_tuple *tuple)
+/* The table, and the one a running resize moves the conntracks to */
+struct nf_ct_htables {
+	struct hlist_nulls_head	*hash, *next;
+	unsigned int		size, next_size;
+};
+
+static void nf_ct_get_htables(struct net *net, struct nf_ct_htables *t)
+{
+	unsigned int sequence;
+
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		t->hash = net->ct.hash;
+		t->size = net->ct.htable_size;
+		t->next = net->ct.hash_next;
+		t->next_size = net->ct.htable_size_next;
+	} while (read_seqcount_retry(&net->ct.generation, sequence));
+}
+
+/* Table and size that match, for lockless walkers under RCU */
+struct hlist_nulls_head *nf_conntrack_get_ht(struct net *net,
+					     unsigned int *hsize)
 {
-	return __hash_conntrack(tuple, zone, net->ct.htable_size);
+	struct nf_ct_htables t;
+
+	nf_ct_get_htables(net, &t);
+	*hsize = t.size;
+	return t.hash;
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_get_ht);
+
+/* The chain a conntrack of @hash is in, or goes to, for those that
+ * change it; *@bucket picks its lock. Call it inside a read section of
+ * the generation: while a resize runs, the buckets below hash_moved
+ * have gone over to the new table already.
+ */
+static struct hlist_nulls_head *
+hash_chain(const struct net *net, u32 hash, unsigned int *bucket)
+{
+	*bucket = __hash_bucket(hash, net->ct.htable_size);
+	if (unlikely(net->ct.hash_next) && *bucket < net->ct.hash_moved) {
+		*bucket = __hash_bucket(hash, net->ct.htable_size_next);
+		return &net->ct.hash_next[*bucket];
+	}
+	return &net->ct.hash[*bucket];
+}
+
+static inline struct hlist_nulls_head *
+hash_conntrack(const struct net *net, u16 zone,
+	       const struct nf_conntrack_tuple *tuple, unsigned int *bucket)
+{
+	return hash_chain(net, hash_conntrack_raw(tuple, zone), bucket);
 }
 
 bool
@@ -174,15 +308,55 @@ nf_ct_invert_tuple(struct nf_conntrack_tuple *inverse,
 }
 EXPORT_SYMBOL_GPL(nf_ct_invert_tuple);
 
+/* Most connections never expect others: only take nf_conntrack_lock
+ * for those whose helper did.
+ */
+static void nf_ct_remove_expectations_locked(struct nf_conn *ct)
+{
+	struct nf_conn_help *help = nfct_help(ct);
+
+	if (!help || hlist_empty(&help->expectations))
+		return;
+
+	spin_lock_bh(&nf_conntrack_lock);
+	nf_ct_remove_expectations(ct);
+	spin_unlock_bh(&nf_conntrack_lock);
+}
+
+/* We overload the first tuple to link into the unconfirmed or dying
+ * list of the cpu we run on.
+ */
+static void nf_ct_add_to_pcpu_list(struct nf_conn *ct, bool dying)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = raw_smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock_bh(&pcpu->lock);
+	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+				 dying ? &pcpu->dying : &pcpu->unconfirmed);
+	spin_unlock_bh(&pcpu->lock);
+}
+
+static void nf_ct_del_from_pcpu_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock_bh(&pcpu->lock);
+	BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
+	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock_bh(&pcpu->lock);
+}
+
 static void
 clean_from_lists(struct nf_conn *ct)
 {
 	pr_debug("clean_from_lists(%p)\n", ct);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
-
-	/* Destroy all pending expectations */
-	nf_ct_remove_expectations(ct);
 }
 
 static void
@@ -194,7 +368,6 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
-	NF_CT_ASSERT(!timer_pending(&ct->timeout));
 
 	/* To make sure we don't get any weird locking issues here:
 	 * destroy_conntrack() MUST NOT be called with a write lock
@@ -206,21 +379,18 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	rcu_read_unlock();
 
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Expectations will have been removed in clean_from_lists,
+	local_bh_disable();
+	/* Expectations will have been removed in nf_ct_delete_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
 	 * too. */
-	nf_ct_remove_expectations(ct);
+	nf_ct_remove_expectations_locked(ct);
 
-	/* We overload first tuple to link into unconfirmed list. */
-	if (!nf_ct_is_confirmed(ct)) {
-		BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
-		hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	}
+	if (!nf_ct_is_confirmed(ct))
+		nf_ct_del_from_pcpu_list(ct);
 
 	NF_CT_STAT_INC(net, delete);
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 
 	if (ct->master)
 		nf_ct_put(ct->master);
@@ -232,20 +402,37 @@ destroy_conntrack(struct nf_conntrack *nfct)
 void nf_ct_delete_from_lists(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
+	unsigned int hash, repl_hash, sequence;
+	u16 zone = nf_ct_zone(ct);
 
 	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
+
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		hash_conntrack(net, zone,
+			       &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, &hash);
+		hash_conntrack(net, zone,
+			       &ct->tuplehash[IP_CT_DIR_REPLY].tuple, &repl_hash);
+	} while (nf_conntrack_double_lock(net, hash, repl_hash, sequence));
 	/* Inside lock so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
 	NF_CT_STAT_INC(net, delete_list);
 	clean_from_lists(ct);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+
+	/* Destroy all pending expectations */
+	nf_ct_remove_expectations_locked(ct);
+	local_bh_enable();
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
 
-static void death_by_event(unsigned long ul_conntrack)
+/* Retries the destroy event of a conntrack on the dying list, whose
+ * retry timer is not pending. False if it failed again and the timer
+ * was set up for the next try.
+ */
+static bool nf_ct_dying_event(struct nf_conn *ct)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
 	struct net *net = nf_ct_net(ct);
 	struct nf_conntrack_ecache *ecache = nf_ct_ecache_find(ct);
 
@@ -256,14 +443,17 @@ static void death_by_event(unsigned long ul_conntrack)
 		ecache->timeout.expires = jiffies +
 			(random32() % net->ct.sysctl_events_retry_timeout);
 		add_timer(&ecache->timeout);
-		return;
+		return false;
 	}
-	/* we've got the event delivered, now it's dying */
-	set_bit(IPS_DYING_BIT, &ct->status);
-	spin_lock(&nf_conntrack_lock);
-	hlist_nulls_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	spin_unlock(&nf_conntrack_lock);
+	/* we've got the event delivered, let it go */
+	nf_ct_del_from_pcpu_list(ct);
 	nf_ct_put(ct);
+	return true;
+}
+
+static void death_by_event(unsigned long ul_conntrack)
+{
+	nf_ct_dying_event((struct nf_conn *)ul_conntrack);
 }
 
 void nf_ct_insert_dying_list(struct nf_conn *ct)
@@ -274,10 +464,7 @@ void nf_ct_insert_dying_list(struct nf_conn *ct)
 	BUG_ON(ecache == NULL);
 
 	/* add this conntrack to the dying list */
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			     &net->ct.dying);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_add_to_pcpu_list(ct, true);
 	/* set a new timer to retry event delivery */
 	setup_timer(&ecache->timeout, death_by_event, (unsigned long)ct);
 	ecache->timeout.expires = jiffies +
@@ -286,33 +473,60 @@ void nf_ct_insert_dying_list(struct nf_conn *ct)
 }
 EXPORT_SYMBOL_GPL(nf_ct_insert_dying_list);
 
-static void death_by_timeout(unsigned long ul_conntrack)
+/* Takes a confirmed conntrack out of the hash and drops the reference
+ * the hash held. Setting the dying bit claims it, so that of the gc
+ * worker, early drop, a protocol tracker and ctnetlink only one tears
+ * it down and sends the destroy event; false for the others.
+ */
+bool nf_ct_delete(struct nf_conn *ct, u32 pid, int report)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
 	struct nf_conn_tstamp *tstamp;
 
+	if (!nf_ct_is_confirmed(ct) ||
+	    test_and_set_bit(IPS_DYING_BIT, &ct->status))
+		return false;
+
 	tstamp = nf_conn_tstamp_find(ct);
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_to_ns(ktime_get_real());
 
-	if (!test_bit(IPS_DYING_BIT, &ct->status) &&
-	    unlikely(nf_conntrack_event(IPCT_DESTROY, ct) < 0)) {
-		/* destroy event was not delivered */
+	if (unlikely(nf_conntrack_event_report(IPCT_DESTROY, ct,
+					       pid, report) < 0)) {
+		/* destroy event was not delivered, death_by_event() retries */
 		nf_ct_delete_from_lists(ct);
 		nf_ct_insert_dying_list(ct);
-		return;
+		return true;
 	}
-	set_bit(IPS_DYING_BIT, &ct->status);
 	nf_ct_delete_from_lists(ct);
 	nf_ct_put(ct);
+	return true;
+}
+EXPORT_SYMBOL_GPL(nf_ct_delete);
+
+/* Reaps a conntrack found past its timeout. Whoever calls this must not
+ * hold any bucket lock, nor nf_conntrack_lock: the helper destroy hook
+ * and the removal of the expectations take it.
+ */
+static bool nf_ct_gc_expired(struct nf_conn *ct)
+{
+	bool reaped = false;
+
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		return false;
+
+	if (nf_ct_should_gc(ct))
+		reaped = nf_ct_kill(ct);
+
+	nf_ct_put(ct);
+	return reaped;
 }
 
 /*
  * Warning :
  * - Caller must take a reference on returned object
  *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
- * OR
- * - Caller must lock nf_conntrack_lock before calling this function
+ * - An expired conntrack that matches is skipped, and left to the gc
+ *   worker: callers such as ctnetlink hold nf_conntrack_lock here
  */
 static struct nf_conntrack_tuple_hash *
 ____nf_conntrack_find(struct net *net, u16 zone,
@@ -320,16 +534,26 @@ ____nf_conntrack_find(struct net *net, u16 zone,
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = hash_bucket(hash, net);
+	struct hlist_nulls_head *ct_hash;
+	struct nf_ct_htables t;
+	unsigned int bucket, size;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+	nf_ct_get_htables(net, &t);
+	ct_hash = t.hash;
+	size = t.size;
+lookup:
+	bucket = __hash_bucket(hash, size);
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
 		if (nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) == zone) {
+			if (unlikely(nf_ct_is_expired(
+					nf_ct_tuplehash_to_ctrack(h))))
+				continue;
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
 			return h;
@@ -345,6 +569,12 @@ begin:
 		NF_CT_STAT_INC(net, search_restart);
 		goto begin;
 	}
+	/* While a resize runs, what left the old table is in the new one */
+	if (t.next != NULL && ct_hash != t.next) {
+		ct_hash = t.next;
+		size = t.next_size;
+		goto lookup;
+	}
 	local_bh_enable();
 
 	return NULL;
@@ -398,36 +628,73 @@ nf_conntrack_find_get(struct net *net, u16 zone,
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
 static void __nf_conntrack_hash_insert(struct nf_conn *ct,
-				       unsigned int hash,
-				       unsigned int repl_hash)
+				       struct hlist_nulls_head *chain,
+				       struct hlist_nulls_head *repl_chain)
 {
-	struct net *net = nf_ct_net(ct);
-
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			   &net->ct.hash[hash]);
+			   chain);
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode,
-			   &net->ct.hash[repl_hash]);
+			   repl_chain);
 }
 
-void nf_conntrack_hash_insert(struct nf_conn *ct)
+/* Insert a conntrack set up by hand, e.g. over ctnetlink, unless one
+ * with either of its tuples is already there. Its timeout must be set.
+ * An expired one does not count, lookups skip it until the gc reaps it.
+ */
+int nf_conntrack_hash_check_insert(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
+	struct hlist_nulls_head *chain, *repl_chain;
+	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_node *n;
 	u16 zone;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
 
-	__nf_conntrack_hash_insert(ct, hash, repl_hash);
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		chain = hash_conntrack(net, zone,
+				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, &hash);
+		repl_chain = hash_conntrack(net, zone,
+				&ct->tuplehash[IP_CT_DIR_REPLY].tuple, &repl_hash);
+	} while (nf_conntrack_double_lock(net, hash, repl_hash, sequence));
+
+	/* See if there's one in the list already, including reverse */
+	hlist_nulls_for_each_entry(h, n, chain, hnnode)
+		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
+				      &h->tuple) &&
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) &&
+		    !nf_ct_is_expired(nf_ct_tuplehash_to_ctrack(h)))
+			goto out;
+	hlist_nulls_for_each_entry(h, n, repl_chain, hnnode)
+		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				      &h->tuple) &&
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) &&
+		    !nf_ct_is_expired(nf_ct_tuplehash_to_ctrack(h)))
+			goto out;
+
+	__nf_conntrack_hash_insert(ct, chain, repl_chain);
+	NF_CT_STAT_INC(net, insert);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+	return 0;
+
+out:
+	NF_CT_STAT_INC(net, insert_failed);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+	return -EEXIST;
 }
-EXPORT_SYMBOL_GPL(nf_conntrack_hash_insert);
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
 
 /* Confirm a connection given skb; places it in hash table */
 int
 __nf_conntrack_confirm(struct sk_buff *skb)
 {
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
+	struct hlist_nulls_head *chain, *repl_chain;
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct nf_conn_help *help;
@@ -448,11 +715,15 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		return NF_ACCEPT;
 
 	zone = nf_ct_zone(ct);
-	/* reuse the hash saved before */
-	hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
-	hash = hash_bucket(hash, net);
-	repl_hash = hash_conntrack(net, zone,
-				   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		/* reuse the hash saved before */
+		hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
+		chain = hash_chain(net, hash, &hash);
+		repl_chain = hash_conntrack(net, zone,
+				&ct->tuplehash[IP_CT_DIR_REPLY].tuple, &repl_hash);
+	} while (nf_conntrack_double_lock(net, hash, repl_hash, sequence));
 
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
@@ -464,40 +735,43 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	NF_CT_ASSERT(!nf_ct_is_confirmed(ct));
 	pr_debug("Confirming conntrack %p\n", ct);
 
-	spin_lock_bh(&nf_conntrack_lock);
-
-	/* We have to check the DYING flag inside the lock to prevent
-	   a race against nf_ct_get_next_corpse() possibly called from
-	   user context, else we insert an already 'dead' hash, blocking
-	   further use of that particular connection -JM */
-
-	if (unlikely(nf_ct_is_dying(ct))) {
-		spin_unlock_bh(&nf_conntrack_lock);
-		return NF_ACCEPT;
-	}
-
 	/* See if there's one in the list already, including reverse:
 	   NAT could have grabbed it without realizing, since we're
-	   not in the hash.  If there is, we lost race. */
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[hash], hnnode)
+	   not in the hash.  If there is, we lost race.  An expired one
+	   is invisible to lookups and waits for the gc worker, so it
+	   may stay next to us until then. */
+	hlist_nulls_for_each_entry(h, n, chain, hnnode)
 		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
 				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) &&
+		    !nf_ct_is_expired(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[repl_hash], hnnode)
+	hlist_nulls_for_each_entry(h, n, repl_chain, hnnode)
 		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
 				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) &&
+		    !nf_ct_is_expired(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
 	/* Remove from unconfirmed list */
-	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	nf_ct_del_from_pcpu_list(ct);
+
+	/* We have to check the DYING flag after the unlink to prevent
+	   a race against nf_ct_get_next_corpse() possibly called from
+	   user context, which sets it under the same per cpu lock, else
+	   we insert an already 'dead' hash, blocking further use of
+	   that particular connection -JM */
+	if (unlikely(nf_ct_is_dying(ct))) {
+		nf_ct_add_to_pcpu_list(ct, false);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
+		return NF_ACCEPT;
+	}
 
-	/* Timer relative to confirmation time, not original
+	/* Timeout relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	ct->timeout += jiffies;
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -510,13 +784,14 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
 	/* Since the lookup is lockless, hash insertion must be done after
-	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
+	 * setting the timeout and the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
-	__nf_conntrack_hash_insert(ct, hash, repl_hash);
+	__nf_conntrack_hash_insert(ct, chain, repl_chain);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	help = nfct_help(ct);
 	if (help && help->helper)
@@ -528,7 +803,8 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 
 out:
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return NF_DROP;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_confirm);
@@ -542,54 +818,82 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
+	struct hlist_nulls_head *ct_hash;
+	struct nf_ct_htables t;
 	struct nf_conn *ct;
 	u16 zone = nf_ct_zone(ignored_conntrack);
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	u32 hash = hash_conntrack_raw(tuple, zone);
+	unsigned int bucket, size;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	nf_ct_get_htables(net, &t);
+	ct_hash = t.hash;
+	size = t.size;
+lookup:
+	bucket = __hash_bucket(hash, size);
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (ct != ignored_conntrack &&
 		    nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(ct) == zone) {
+			/* NAT set up by ctnetlink holds nf_conntrack_lock */
+			if (unlikely(nf_ct_is_expired(ct)))
+				continue;
 			NF_CT_STAT_INC(net, found);
 			rcu_read_unlock_bh();
 			return 1;
 		}
 		NF_CT_STAT_INC(net, searched);
 	}
+	if (t.next != NULL && ct_hash != t.next) {
+		ct_hash = t.next;
+		size = t.next_size;
+		goto lookup;
+	}
 	rcu_read_unlock_bh();
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
+/* Buckets early_drop() looks at, from the one of the new conntrack */
 #define NF_CT_EVICTION_RANGE	8
 
 /* There's a small race here where we may free a just-assured
    connection.  Too bad: we're in trouble anyway. */
-static noinline int early_drop(struct net *net, unsigned int hash)
+static noinline int early_drop(struct net *net, u32 _hash)
 {
 	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
 	struct hlist_nulls_node *n;
-	unsigned int i, cnt = 0;
+	struct hlist_nulls_head *ct_hash;
+	unsigned int i, hash, size;
 	int dropped = 0;
 
 	rcu_read_lock();
-	for (i = 0; i < net->ct.htable_size; i++) {
-		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
+	ct_hash = nf_conntrack_get_ht(net, &size);
+	hash = __hash_bucket(_hash, size);
+	for (i = 0; i < NF_CT_EVICTION_RANGE; i++) {
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
+			/* the gc worker has not got there yet */
+			if (nf_ct_is_expired(tmp)) {
+				if (nf_ct_gc_expired(tmp))
+					dropped = 1;
+				continue;
+			}
 			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
 				ct = tmp;
-			cnt++;
 		}
 
+		if (dropped)
+			break;
+
 		if (ct != NULL) {
 			if (likely(!nf_ct_is_dying(ct) &&
 				   atomic_inc_not_zero(&ct->ct_general.use)))
@@ -598,18 +902,14 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 				ct = NULL;
 		}
 
-		if (cnt >= NF_CT_EVICTION_RANGE)
-			break;
-
-		hash = (hash + 1) % net->ct.htable_size;
+		hash = (hash + 1) % size;
 	}
 	rcu_read_unlock();
 
 	if (!ct)
 		return dropped;
 
-	if (del_timer(&ct->timeout)) {
-		death_by_timeout((unsigned long)ct);
+	if (nf_ct_kill(ct)) {
 		dropped = 1;
 		NF_CT_STAT_INC_ATOMIC(net, early_drop);
 	}
@@ -617,6 +917,72 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 	return dropped;
 }
 
+/* Defaults of the gc tunables of a netns, and the smallest pass */
+#define NF_CT_GC_BUDGET		8192
+#define NF_CT_GC_INTERVAL	HZ
+#define NF_CT_GC_MIN_BUDGET	64
+
+/* Walks the hash from where the previous pass stopped, and reaps the
+ * conntracks past their timeout. A pass looks at no more than
+ * sysctl_gc_budget entries and holds no lock across buckets, so that
+ * it is cut into short slices. When nearly everything it sees has
+ * expired, a backlog is building up and the next pass is run at once,
+ * otherwise it waits sysctl_gc_interval.
+ */
+static void nf_conntrack_gc_worker(struct work_struct *work)
+{
+	struct net *net = container_of(to_delayed_work(work), struct net,
+				       ct.gc_work);
+	struct nf_ct_gc_stat *stat = &net->ct.gc_stat;
+	unsigned int budget, bucket, size, scanned = 0, expired = 0;
+	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
+	struct hlist_nulls_node *n;
+	unsigned long delay;
+	ktime_t start;
+	s64 us;
+
+	budget = max_t(unsigned int, ACCESS_ONCE(net->ct.sysctl_gc_budget),
+		       NF_CT_GC_MIN_BUDGET);
+	bucket = net->ct.gc_bucket;
+	start = ktime_get();
+
+	do {
+		rcu_read_lock();
+		ct_hash = nf_conntrack_get_ht(net, &size);
+		if (bucket >= size)
+			bucket = 0;
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
+			struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
+
+			scanned++;
+			/* each conntrack is hashed twice, reap it once */
+			if (NF_CT_DIRECTION(h) == IP_CT_DIR_ORIGINAL &&
+			    nf_ct_is_expired(ct) && nf_ct_gc_expired(ct))
+				expired++;
+		}
+		rcu_read_unlock();
+		bucket++;
+		cond_resched();
+	} while (scanned < budget && bucket < size);
+
+	net->ct.gc_bucket = bucket;
+
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	stat->passes++;
+	stat->scanned += scanned;
+	stat->expired += expired;
+	stat->last_us = min_t(s64, us, UINT_MAX);
+	if (stat->last_us > stat->max_us)
+		stat->max_us = stat->last_us;
+
+	/* at least 90% expired; scanned counts both tuples */
+	delay = ACCESS_ONCE(net->ct.sysctl_gc_interval);
+	if (scanned && expired * 2 * 10 >= scanned * 9)
+		delay = 0;
+	schedule_delayed_work(&net->ct.gc_work, delay);
+}
+
 void init_nf_conntrack_hash_rnd(void)
 {
 	unsigned int rand;
@@ -651,7 +1017,7 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 
 	if (nf_conntrack_max &&
 	    unlikely(atomic_read(&net->ct.count) > nf_conntrack_max)) {
-		if (!early_drop(net, hash_bucket(hash, net))) {
+		if (!early_drop(net, hash)) {
 			atomic_dec(&net->ct.count);
 			if (net_ratelimit())
 				printk(KERN_WARNING
@@ -684,8 +1050,7 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 	ct->tuplehash[IP_CT_DIR_REPLY].tuple = *repl;
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
-	/* Don't set timer yet: wait for confirmation */
-	setup_timer(&ct->timeout, death_by_timeout, (unsigned long)ct);
+	/* The timeout stays relative until confirmation */
 	write_pnet(&ct->ct_net, net);
 #ifdef CONFIG_NF_CONNTRACK_ZONES
 	if (zone) {
@@ -745,7 +1110,7 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 	struct nf_conn_help *help;
 	struct nf_conntrack_tuple repl_tuple;
 	struct nf_conntrack_ecache *ecache;
-	struct nf_conntrack_expect *exp;
+	struct nf_conntrack_expect *exp = NULL;
 	u16 zone = tmpl ? nf_ct_zone(tmpl) : NF_CT_DEFAULT_ZONE;
 
 	if (!nf_ct_invert_tuple(&repl_tuple, tuple, l3proto, l4proto)) {
@@ -774,38 +1139,43 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 				 ecache ? ecache->expmask : 0,
 			     GFP_ATOMIC);
 
-	spin_lock_bh(&nf_conntrack_lock);
-	exp = nf_ct_find_expectation(net, zone, tuple);
-	if (exp) {
-		pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
-			 ct, exp);
-		/* Welcome, Mr. Bond.  We've been expecting you... */
-		__set_bit(IPS_EXPECTED_BIT, &ct->status);
-		ct->master = exp->master;
-		if (exp->helper) {
-			help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
-			if (help)
-				rcu_assign_pointer(help->helper, exp->helper);
-		}
+	local_bh_disable();
+	/* Only look for an expectation under the lock if there are any */
+	if (net->ct.expect_count) {
+		spin_lock(&nf_conntrack_lock);
+		exp = nf_ct_find_expectation(net, zone, tuple);
+		if (exp) {
+			pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
+				 ct, exp);
+			/* Welcome, Mr. Bond.  We've been expecting you... */
+			__set_bit(IPS_EXPECTED_BIT, &ct->status);
+			ct->master = exp->master;
+			if (exp->helper) {
+				help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
+				if (help)
+					rcu_assign_pointer(help->helper,
+							   exp->helper);
+			}
 
 #ifdef CONFIG_NF_CONNTRACK_MARK
-		ct->mark = exp->master->mark;
+			ct->mark = exp->master->mark;
 #endif
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
-		ct->secmark = exp->master->secmark;
+			ct->secmark = exp->master->secmark;
 #endif
-		nf_conntrack_get(&ct->master->ct_general);
-		NF_CT_STAT_INC(net, expect_new);
-	} else {
+			nf_conntrack_get(&ct->master->ct_general);
+			NF_CT_STAT_INC(net, expect_new);
+		}
+		spin_unlock(&nf_conntrack_lock);
+	}
+	if (!exp) {
 		__nf_ct_try_assign_helper(ct, tmpl, GFP_ATOMIC);
 		NF_CT_STAT_INC(net, new);
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-		       &net->ct.unconfirmed);
-
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_add_to_pcpu_list(ct, false);
+	local_bh_enable();
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1027,24 +1397,23 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
-	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
 	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
 		goto acct;
 
-	/* If not in hash table, timer will not be active yet */
+	/* If not in hash table, the timeout is still relative */
 	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
+		ct->timeout = extra_jiffies;
 	} else {
 		unsigned long newtime = jiffies + extra_jiffies;
 
 		/* Only update the timeout if the new timeout is at least
-		   HZ jiffies from the old timeout. Need del_timer for race
-		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
-			mod_timer_pending(&ct->timeout, newtime);
+		   HZ jiffies from the old timeout, which spares writes to
+		   a shared cache line. Harmless if it is already dying. */
+		if (newtime - ct->timeout >= HZ)
+			ct->timeout = newtime;
 	}
 
 acct:
@@ -1080,11 +1449,7 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->timeout.function((unsigned long)ct);
-		return true;
-	}
-	return false;
+	return nf_ct_delete(ct, 0, 0);
 }
 EXPORT_SYMBOL_GPL(__nf_ct_kill_acct);
 
@@ -1170,69 +1535,67 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	spinlock_t *lockp;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
 	for (; *bucket < net->ct.htable_size; (*bucket)++) {
-		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket], hnnode) {
+		lockp = &nf_conntrack_locks[*bucket % CONNTRACK_LOCKS];
+		local_bh_disable();
+		nf_conntrack_bucket_lock(lockp);
+		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket],
+					   hnnode) {
 			ct = nf_ct_tuplehash_to_ctrack(h);
 			if (iter(ct, data))
 				goto found;
 		}
+		spin_unlock(lockp);
+		local_bh_enable();
 	}
-	hlist_nulls_for_each_entry(h, n, &net->ct.unconfirmed, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (iter(ct, data))
-			set_bit(IPS_DYING_BIT, &ct->status);
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->unconfirmed, hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			if (iter(ct, data))
+				set_bit(IPS_DYING_BIT, &ct->status);
+		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 	return NULL;
 found:
 	atomic_inc(&ct->ct_general.use);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock(lockp);
+	local_bh_enable();
 	return ct;
 }
 
-void nf_ct_iterate_cleanup(struct net *net,
-			   int (*iter)(struct nf_conn *i, void *data),
-			   void *data)
+static void __nf_ct_iterate_cleanup(struct net *net,
+				    int (*iter)(struct nf_conn *i, void *data),
+				    void *data, u32 pid, int report)
 {
 	struct nf_conn *ct;
 	unsigned int bucket = 0;
 
+	mutex_lock(&nf_conntrack_resize_mutex);
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			death_by_timeout((unsigned long)ct);
-		/* ... else the timer will get him soon. */
+		nf_ct_delete(ct, pid, report);
+		/* ... unless someone else got him first. */
 
 		nf_ct_put(ct);
 	}
+	mutex_unlock(&nf_conntrack_resize_mutex);
 }
-EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
-struct __nf_ct_flush_report {
-	u32 pid;
-	int report;
-};
-
-static int kill_report(struct nf_conn *i, void *data)
+void nf_ct_iterate_cleanup(struct net *net,
+			   int (*iter)(struct nf_conn *i, void *data),
+			   void *data)
 {
-	struct __nf_ct_flush_report *fr = (struct __nf_ct_flush_report *)data;
-	struct nf_conn_tstamp *tstamp;
-
-	tstamp = nf_conn_tstamp_find(i);
-	if (tstamp && tstamp->stop == 0)
-		tstamp->stop = ktime_to_ns(ktime_get_real());
-
-	/* If we fail to deliver the event, death_by_timeout() will retry */
-	if (nf_conntrack_event_report(IPCT_DESTROY, i,
-				      fr->pid, fr->report) < 0)
-		return 1;
-
-	/* Avoid the delivery of the destroy event in death_by_timeout(). */
-	set_bit(IPS_DYING_BIT, &i->status);
-	return 1;
+	__nf_ct_iterate_cleanup(net, iter, data, 0, 0);
 }
+EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
 static int kill_all(struct nf_conn *i, void *data)
 {
@@ -1251,27 +1614,41 @@ EXPORT_SYMBOL_GPL(nf_ct_free_hashtable);
 
 void nf_conntrack_flush_report(struct net *net, u32 pid, int report)
 {
-	struct __nf_ct_flush_report fr = {
-		.pid 	= pid,
-		.report = report,
-	};
-	nf_ct_iterate_cleanup(net, kill_report, &fr);
+	__nf_ct_iterate_cleanup(net, kill_all, NULL, pid, report);
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_flush_report);
 
+/* The conntracks on the dying list are already out of the hash and
+ * only wait for their destroy event. Send it now rather than when the
+ * retry timer fires; it goes through unless a listener is still there,
+ * in which case the timer is left to try again.
+ */
 static void nf_ct_release_dying_list(struct net *net)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_for_each_entry(h, n, &net->ct.dying, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* never fails to remove them, no listeners at this point */
-		nf_ct_kill(ct);
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		do {
+			struct nf_conn *found = NULL;
+
+			spin_lock_bh(&pcpu->lock);
+			hlist_nulls_for_each_entry(h, n, &pcpu->dying, hnnode) {
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				/* a pending timer holds it until we are done */
+				if (del_timer(&nf_ct_ecache_find(ct)->timeout)) {
+					found = ct;
+					break;
+				}
+			}
+			spin_unlock_bh(&pcpu->lock);
+			ct = found;
+		} while (ct && nf_ct_dying_event(ct));
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 }
 
 static int untrack_refs(void)
@@ -1300,6 +1677,7 @@ static void nf_conntrack_cleanup_init_net(void)
 
 static void nf_conntrack_cleanup_net(struct net *net)
 {
+	cancel_delayed_work_sync(&net->ct.gc_work);
  i_see_dead_people:
 	nf_ct_iterate_cleanup(net, kill_all, NULL);
 	nf_ct_release_dying_list(net);
@@ -1316,6 +1694,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	kmem_cache_destroy(net->ct.nf_conntrack_cachep);
 	kfree(net->ct.slabname);
 	free_percpu(net->ct.stat);
+	free_percpu(net->ct.pcpu_lists);
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1363,58 +1742,137 @@ void *nf_ct_alloc_hashtable(unsigned int *sizep, int nulls)
 }
 EXPORT_SYMBOL_GPL(nf_ct_alloc_hashtable);
 
-int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+/* Old buckets moved per round of nf_conntrack_hash_resize() */
+#define NF_CT_RESIZE_BATCH	256
+
+/* Move the conntracks of init_net to a table of @hashsize buckets.
+ *
+ * Lookups go on locklessly all along: while the conntracks move they
+ * search the new table after the old one. The move goes in rounds of
+ * NF_CT_RESIZE_BATCH buckets, each under all the bucket locks, with BH
+ * enabled in between. Insertions and removals that wait on a lock find
+ * the generation changed and compute their chains again, in the new
+ * table for the buckets moved so far.
+ */
+static int nf_conntrack_hash_resize(unsigned int hashsize)
 {
-	int i, bucket;
-	unsigned int hashsize, old_size;
+	int i, end, bucket;
+	unsigned int old_size;
 	struct hlist_nulls_head *hash, *old_hash;
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 
-	if (current->nsproxy->net_ns != &init_net)
-		return -EOPNOTSUPP;
-
-	/* On boot, we can set this without any fancy locking. */
-	if (!nf_conntrack_htable_size)
-		return param_set_uint(val, kp);
-
-	hashsize = simple_strtoul(val, NULL, 0);
-	if (!hashsize)
-		return -EINVAL;
-
 	hash = nf_ct_alloc_hashtable(&hashsize, 1);
 	if (!hash)
 		return -ENOMEM;
 
-	/* Lookups in the old hash might happen in parallel, which means we
-	 * might get false negatives during connection lookup. New connections
-	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the lock.
-	 */
-	spin_lock_bh(&nf_conntrack_lock);
-	for (i = 0; i < init_net.ct.htable_size; i++) {
-		while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
-			h = hlist_nulls_entry(init_net.ct.hash[i].first,
+	mutex_lock(&nf_conntrack_resize_mutex);
+	old_size = init_net.ct.htable_size;
+	if (hashsize == old_size) {
+		mutex_unlock(&nf_conntrack_resize_mutex);
+		nf_ct_free_hashtable(hash, hashsize);
+		return 0;
+	}
+
+	local_bh_disable();
+	nf_conntrack_all_lock();
+	write_seqcount_begin(&init_net.ct.generation);
+	init_net.ct.hash_next = hash;
+	init_net.ct.htable_size_next = hashsize;
+	init_net.ct.hash_moved = 0;
+	write_seqcount_end(&init_net.ct.generation);
+	nf_conntrack_all_unlock();
+	local_bh_enable();
+
+	for (i = 0; i < old_size; ) {
+		end = min_t(unsigned int, i + NF_CT_RESIZE_BATCH, old_size);
+
+		local_bh_disable();
+		nf_conntrack_all_lock();
+		for (; i < end; i++) {
+			while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
+				h = hlist_nulls_entry(init_net.ct.hash[i].first,
 					struct nf_conntrack_tuple_hash, hnnode);
-			ct = nf_ct_tuplehash_to_ctrack(h);
-			hlist_nulls_del_rcu(&h->hnnode);
-			bucket = __hash_conntrack(&h->tuple, nf_ct_zone(ct),
-						  hashsize);
-			hlist_nulls_add_head_rcu(&h->hnnode, &hash[bucket]);
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				hlist_nulls_del_rcu(&h->hnnode);
+				bucket = __hash_conntrack(&h->tuple,
+							  nf_ct_zone(ct),
+							  hashsize);
+				hlist_nulls_add_head_rcu(&h->hnnode,
+							 &hash[bucket]);
+			}
 		}
+		write_seqcount_begin(&init_net.ct.generation);
+		init_net.ct.hash_moved = end;
+		write_seqcount_end(&init_net.ct.generation);
+		nf_conntrack_all_unlock();
+		local_bh_enable();
+		cond_resched();
 	}
-	old_size = init_net.ct.htable_size;
 	old_hash = init_net.ct.hash;
 
+	local_bh_disable();
+	nf_conntrack_all_lock();
+	write_seqcount_begin(&init_net.ct.generation);
 	init_net.ct.htable_size = nf_conntrack_htable_size = hashsize;
 	init_net.ct.hash = hash;
-	spin_unlock_bh(&nf_conntrack_lock);
+	init_net.ct.hash_next = NULL;
+	init_net.ct.htable_size_next = 0;
+	init_net.ct.hash_moved = 0;
+	write_seqcount_end(&init_net.ct.generation);
+	nf_conntrack_all_unlock();
+	local_bh_enable();
+	mutex_unlock(&nf_conntrack_resize_mutex);
 
+	/* lookups under rcu_read_lock() and rcu_read_lock_bh() alike */
+	synchronize_net();
+	synchronize_rcu_bh();
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
 }
+
+int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+{
+	unsigned int hashsize;
+
+	if (current->nsproxy->net_ns != &init_net)
+		return -EOPNOTSUPP;
+
+	/* On boot, we can set this without any fancy locking. */
+	if (!nf_conntrack_htable_size)
+		return param_set_uint(val, kp);
+
+	hashsize = simple_strtoul(val, NULL, 0);
+	if (!hashsize)
+		return -EINVAL;
+
+	return nf_conntrack_hash_resize(hashsize);
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_set_hashsize);
 
+/* Raising nf_conntrack_max grows the table with it, so that chains
+ * stay about as short as with the default sizing. It never shrinks
+ * on its own; the hashsize parameter still sets any size.
+ */
+int nf_conntrack_max_sysctl(struct ctl_table *table, int write,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	unsigned int hashsize;
+	int ret;
+
+	ret = proc_dointvec(table, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	hashsize = nf_conntrack_max / NF_CONNTRACK_MAX_FACTOR;
+	if (hashsize > init_net.ct.htable_size &&
+	    nf_conntrack_hash_resize(hashsize) < 0)
+		printk(KERN_WARNING "nf_conntrack: could not grow the table "
+		       "to %u buckets\n", hashsize);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_max_sysctl);
+
 module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
 		  &nf_conntrack_htable_size, 0600);
 
@@ -1430,7 +1888,10 @@ EXPORT_SYMBOL_GPL(nf_ct_untracked_status_or);
 static int nf_conntrack_init_init_net(void)
 {
 	int max_factor = 8;
-	int ret, cpu;
+	int ret, cpu, i;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
 	 * machine has 512 buckets. >= 1GB machines have 16384 buckets. */
@@ -1447,7 +1908,7 @@ static int nf_conntrack_init_init_net(void)
 		 * with the old struct list_heads. When a table size is given
 		 * we use the old value of 8 to avoid reducing the max.
 		 * entries. */
-		max_factor = 4;
+		max_factor = NF_CONNTRACK_MAX_FACTOR;
 	}
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
 
@@ -1496,11 +1957,24 @@ err_proto:
 
 static int nf_conntrack_init_net(struct net *net)
 {
-	int ret;
+	int ret, cpu;
 
 	atomic_set(&net->ct.count, 0);
-	INIT_HLIST_NULLS_HEAD(&net->ct.unconfirmed, UNCONFIRMED_NULLS_VAL);
-	INIT_HLIST_NULLS_HEAD(&net->ct.dying, DYING_NULLS_VAL);
+	seqcount_init(&net->ct.generation);
+
+	net->ct.pcpu_lists = alloc_percpu(struct ct_pcpu);
+	if (!net->ct.pcpu_lists) {
+		ret = -ENOMEM;
+		goto err_pcpu_lists;
+	}
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_init(&pcpu->lock);
+		INIT_HLIST_NULLS_HEAD(&pcpu->unconfirmed, UNCONFIRMED_NULLS_VAL);
+		INIT_HLIST_NULLS_HEAD(&pcpu->dying, DYING_NULLS_VAL);
+	}
+
 	net->ct.stat = alloc_percpu(struct ip_conntrack_stat);
 	if (!net->ct.stat) {
 		ret = -ENOMEM;
@@ -1542,6 +2016,10 @@ static int nf_conntrack_init_net(struct net *net)
 	if (ret < 0)
 		goto err_ecache;
 
+	net->ct.sysctl_gc_budget = NF_CT_GC_BUDGET;
+	net->ct.sysctl_gc_interval = NF_CT_GC_INTERVAL;
+	INIT_DELAYED_WORK(&net->ct.gc_work, nf_conntrack_gc_worker);
+	schedule_delayed_work(&net->ct.gc_work, net->ct.sysctl_gc_interval);
 	return 0;
 
 err_ecache:
@@ -1559,6 +2037,8 @@ err_cache:
 err_slabname:
 	free_percpu(net->ct.stat);
 err_stat:
+	free_percpu(net->ct.pcpu_lists);
+err_pcpu_lists:
 	return ret;
 }
 
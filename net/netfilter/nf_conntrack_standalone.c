@@ -54,12 +54,13 @@ static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
 	struct hlist_nulls_node *n;
+	unsigned int size;
 
-	for (st->bucket = 0;
-	     st->bucket < net->ct.htable_size;
-	     st->bucket++) {
-		n = rcu_dereference(hlist_nulls_first_rcu(&net->ct.hash[st->bucket]));
+	hash = nf_conntrack_get_ht(net, &size);
+	for (st->bucket = 0; st->bucket < size; st->bucket++) {
+		n = rcu_dereference(hlist_nulls_first_rcu(&hash[st->bucket]));
 		if (!is_a_nulls(n))
 			return n;
 	}
@@ -71,16 +72,20 @@ static struct hlist_nulls_node *ct_get_next(struct seq_file *seq,
 {
 	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
+	struct hlist_nulls_head *hash;
+	unsigned int size;
 
 	head = rcu_dereference(hlist_nulls_next_rcu(head));
 	while (is_a_nulls(head)) {
+		hash = nf_conntrack_get_ht(net, &size);
 		if (likely(get_nulls_value(head) == st->bucket)) {
-			if (++st->bucket >= net->ct.htable_size)
+			if (++st->bucket >= size)
 				return NULL;
 		}
-		head = rcu_dereference(
-				hlist_nulls_first_rcu(
-					&net->ct.hash[st->bucket]));
+		/* the table may have been resized under us */
+		if (st->bucket >= size)
+			return NULL;
+		head = rcu_dereference(hlist_nulls_first_rcu(&hash[st->bucket]));
 	}
 	return head;
 }
@@ -194,8 +199,7 @@ static int ct_seq_show(struct seq_file *s, void *v)
 	if (seq_printf(s, "%-8s %u %-8s %u %ld ",
 		       l3proto->name, nf_ct_l3num(ct),
 		       l4proto->name, nf_ct_protonum(ct),
-		       timer_pending(&ct->timeout)
-		       ? (long)(ct->timeout.expires - jiffies)/HZ : 0) != 0)
+		       (long)nf_ct_expires(ct) / HZ) != 0)
 		goto release;
 
 	if (l4proto->print_conntrack && l4proto->print_conntrack(s, ct))
@@ -362,6 +366,30 @@ static const struct file_operations ct_cpu_seq_fops = {
 	.release = seq_release_net,
 };
 
+static int ct_gc_seq_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq->private;
+	const struct nf_ct_gc_stat *st = &net->ct.gc_stat;
+
+	seq_printf(seq, "passes scanned expired last_us max_us\n");
+	seq_printf(seq, "%lu %lu %lu %u %u\n", st->passes, st->scanned,
+		   st->expired, st->last_us, st->max_us);
+	return 0;
+}
+
+static int ct_gc_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, ct_gc_seq_show);
+}
+
+static const struct file_operations ct_gc_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = ct_gc_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release_net,
+};
+
 static int nf_conntrack_standalone_init_proc(struct net *net)
 {
 	struct proc_dir_entry *pde;
@@ -374,8 +402,15 @@ static int nf_conntrack_standalone_init_proc(struct net *net)
 			  &ct_cpu_seq_fops);
 	if (!pde)
 		goto out_stat_nf_conntrack;
+
+	pde = proc_create("nf_conntrack_gc", S_IRUGO, net->proc_net_stat,
+			  &ct_gc_seq_fops);
+	if (!pde)
+		goto out_stat_nf_conntrack_gc;
 	return 0;
 
+out_stat_nf_conntrack_gc:
+	remove_proc_entry("nf_conntrack", net->proc_net_stat);
 out_stat_nf_conntrack:
 	proc_net_remove(net, "nf_conntrack");
 out_nf_conntrack:
@@ -384,6 +419,7 @@ out_nf_conntrack:
 
 static void nf_conntrack_standalone_fini_proc(struct net *net)
 {
+	remove_proc_entry("nf_conntrack_gc", net->proc_net_stat);
 	remove_proc_entry("nf_conntrack", net->proc_net_stat);
 	proc_net_remove(net, "nf_conntrack");
 }
@@ -413,7 +449,7 @@ static ctl_table nf_ct_sysctl_table[] = {
 		.data		= &nf_conntrack_max,
 		.maxlen		= sizeof(int),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec,
+		.proc_handler	= nf_conntrack_max_sysctl,
 	},
 	{
 		.procname	= "nf_conntrack_count",
@@ -452,6 +488,20 @@ static ctl_table nf_ct_sysctl_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "nf_conntrack_gc_budget",
+		.data		= &init_net.ct.sysctl_gc_budget,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec,
+	},
+	{
+		.procname	= "nf_conntrack_gc_interval_ms",
+		.data		= &init_net.ct.sysctl_gc_interval,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_ms_jiffies,
+	},
 	{ }
 };
 
@@ -463,7 +513,7 @@ static ctl_table nf_ct_netfilter_table[] = {
 		.data		= &nf_conntrack_max,
 		.maxlen		= sizeof(int),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec,
+		.proc_handler	= nf_conntrack_max_sysctl,
 	},
 	{ }
 };
@@ -493,6 +543,13 @@ static int nf_conntrack_standalone_init_sysctl(struct net *net)
 	table[2].data = &net->ct.htable_size;
 	table[3].data = &net->ct.sysctl_checksum;
 	table[4].data = &net->ct.sysctl_log_invalid;
+	table[6].data = &net->ct.sysctl_gc_budget;
+	table[7].data = &net->ct.sysctl_gc_interval;
+
+	/* nf_conntrack_max and the table it sizes are init_net's: other
+	 * namespaces may only read it */
+	if (!net_eq(net, &init_net))
+		table[0].mode = 0444;
 
 	net->ct.sysctl_header = register_net_sysctl_table(net,
 					nf_net_netfilter_sysctl_path, table);
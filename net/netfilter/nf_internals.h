@@ -15,6 +15,7 @@
 /* core.c */
 extern unsigned int nf_iterate(struct list_head *head,
 				struct sk_buff *skb,
+				u_int8_t pf,
 				unsigned int hook,
 				const struct net_device *indev,
 				const struct net_device *outdev,
@@ -697,6 +697,10 @@ void xt_free_table_info(struct xt_table_info *info)
 {
 	int cpu;
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	vfree(info->classifier);
+#endif
+
 	for_each_possible_cpu(cpu) {
 		if (info->size <= PAGE_SIZE)
 			kfree(info->entries[cpu]);
@@ -1246,6 +1250,9 @@ struct nf_hook_ops *xt_hook_link(const struct xt_table *table, nf_hookfn *fn)
 		ops[i].pf       = table->af;
 		ops[i].hooknum  = hooknum;
 		ops[i].priority = table->priority;
+#ifdef CONFIG_L3_FIREWALL_CACHE
+		ops[i].l3_cache = table->l3_cache;
+#endif
 		++i;
 	}
 
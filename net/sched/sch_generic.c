@@ -258,7 +258,7 @@ static void dev_watchdog(unsigned long arg)
 				else
 					trans_start = txq->trans_start ? :
 						dev->trans_start;
-				if (netif_tx_queue_stopped(txq) &&
+				if (netif_xmit_stopped(txq) &&
 				    time_after(jiffies, (trans_start +
 							 dev->watchdog_timeo))) {
 					some_queue_timedout = 1;
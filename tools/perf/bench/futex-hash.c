@@ -0,0 +1,178 @@
+/*
+ * futex-hash.c
+ *
+ * hash: Throughput of the futex hash table and its bucket locks
+ *
+ * Each thread calls FUTEX_WAIT on futexes of its own, always with a
+ * value that does not match, so that every call returns right after the
+ * hash bucket lookup under the bucket lock. With many threads and
+ * futexes the rate shows how often the buckets collide.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int runtime = 10;
+static bool fshared;
+static int futex_flag;
+
+static volatile int done;
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t		thread;
+	u_int32_t		*futex;
+	unsigned long		ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads, default: online cpus"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime in seconds"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i;
+	int ret;
+
+	pthread_barrier_wait(&start_barrier);
+
+	do {
+		for (i = 0; i < nfutexes; i++, w->ops++) {
+			/* the futexes are 0, so this fails right away */
+			ret = futex_wait(&w->futex[i], 1234, NULL, futex_flag);
+			if (!ret || (errno != EAGAIN && errno != EWOULDBLOCK))
+				warn("futex_wait");
+		}
+	} while (!done);
+
+	return NULL;
+}
+
+/* spread the threads over the online cpus */
+static void start_worker(struct worker *w, unsigned int i, long ncpus)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpu;
+
+	pthread_attr_init(&attr);
+	CPU_ZERO(&cpu);
+	CPU_SET(i % ncpus, &cpu);
+	if (pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu))
+		err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+	if (pthread_create(&w->thread, &attr, workerfn, w))
+		err(EXIT_FAILURE, "pthread_create");
+	pthread_attr_destroy(&attr);
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned long total = 0, min = ~0UL, max = 0;
+	struct timeval start, stop, diff;
+	struct worker *worker;
+	double secs;
+	unsigned int i;
+	long ncpus;
+
+	argc = parse_options(argc, argv, options, bench_futex_hash_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads)
+		nthreads = ncpus;
+	if (!nfutexes || !runtime)
+		usage_with_options(bench_futex_hash_usage, options);
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads, %u %s futexes each (%lu KB), "
+		       "for %u secs\n\n", nthreads, nfutexes,
+		       fshared ? "shared" : "private",
+		       (unsigned long)(nfutexes * sizeof(u_int32_t) / 1024),
+		       runtime);
+
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		worker[i].futex = calloc(nfutexes, sizeof(u_int32_t));
+		if (!worker[i].futex)
+			err(EXIT_FAILURE, "calloc");
+		start_worker(&worker[i], i, ncpus);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	gettimeofday(&start, NULL);
+	sleep(runtime);
+	done = 1;
+	gettimeofday(&stop, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1e6;
+	for (i = 0; i < nthreads; i++) {
+		total += worker[i].ops;
+		if (worker[i].ops < min)
+			min = worker[i].ops;
+		if (worker[i].ops > max)
+			max = worker[i].ops;
+		free(worker[i].futex);
+	}
+	free(worker);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14.0f ops/sec in all\n", total / secs);
+		printf(" %14.0f ops/sec per thread, %.0f to %.0f\n",
+		       total / secs / nthreads, min / secs, max / secs);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
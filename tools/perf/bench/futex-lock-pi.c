@@ -0,0 +1,190 @@
+/*
+ * futex-lock-pi.c
+ *
+ * lock-pi: Throughput of PI futexes taken and released in the kernel
+ *
+ * Each thread loops over FUTEX_LOCK_PI and FUTEX_UNLOCK_PI, on one
+ * futex they all share or, with -M, on one of its own. Both calls go to
+ * the kernel every time, there is no user space fast path, so this
+ * covers the hash bucket lock, the pi_state and the rt_mutex handoff
+ * to the waiters.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int runtime = 10;
+static bool multi;
+static bool fshared;
+static int futex_flag;
+
+static u_int32_t global_futex;
+static volatile int done;
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t		thread;
+	u_int32_t		*futex;
+	unsigned long		ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads, default: online cpus"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime in seconds"),
+	OPT_BOOLEAN('M', "multi", &multi,
+		    "Use a futex per thread instead of a shared one"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_lock_pi_usage[] = {
+	"perf bench futex lock-pi <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	int ret;
+
+	pthread_barrier_wait(&start_barrier);
+
+	do {
+		ret = futex_lock_pi(w->futex, NULL, 0, futex_flag);
+		if (ret) {
+			/* interrupted, or the futex is broken */
+			if (errno != EINTR)
+				warn("futex_lock_pi");
+			continue;
+		}
+		/* a little while in the critical section */
+		usleep(1);
+		ret = futex_unlock_pi(w->futex, futex_flag);
+		if (ret)
+			warn("futex_unlock_pi");
+		w->ops++;
+	} while (!done);
+
+	return NULL;
+}
+
+static void start_worker(struct worker *w, unsigned int i, long ncpus)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpu;
+
+	pthread_attr_init(&attr);
+	CPU_ZERO(&cpu);
+	CPU_SET(i % ncpus, &cpu);
+	if (pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu))
+		err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+	if (pthread_create(&w->thread, &attr, workerfn, w))
+		err(EXIT_FAILURE, "pthread_create");
+	pthread_attr_destroy(&attr);
+}
+
+int bench_futex_lock_pi(int argc, const char **argv,
+			const char *prefix __used)
+{
+	unsigned long total = 0, min = ~0UL, max = 0;
+	struct timeval start, stop, diff;
+	struct worker *worker;
+	unsigned int i;
+	double secs;
+	long ncpus;
+
+	argc = parse_options(argc, argv, options, bench_futex_lock_pi_usage,
+			     0);
+	if (argc)
+		usage_with_options(bench_futex_lock_pi_usage, options);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads)
+		nthreads = ncpus;
+	if (!runtime)
+		usage_with_options(bench_futex_lock_pi_usage, options);
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads on %s %s PI futex%s, for %u secs\n\n",
+		       nthreads, multi ? "their own" : "one",
+		       fshared ? "shared" : "private", multi ? "es" : "",
+		       runtime);
+
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		if (multi) {
+			worker[i].futex = calloc(1, sizeof(u_int32_t));
+			if (!worker[i].futex)
+				err(EXIT_FAILURE, "calloc");
+		} else {
+			worker[i].futex = &global_futex;
+		}
+		start_worker(&worker[i], i, ncpus);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	gettimeofday(&start, NULL);
+	sleep(runtime);
+	done = 1;
+	gettimeofday(&stop, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1e6;
+	for (i = 0; i < nthreads; i++) {
+		total += worker[i].ops;
+		if (worker[i].ops < min)
+			min = worker[i].ops;
+		if (worker[i].ops > max)
+			max = worker[i].ops;
+		if (multi)
+			free(worker[i].futex);
+	}
+	free(worker);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14.0f lock/unlock per sec in all\n", total / secs);
+		printf(" %14.0f per thread, %.0f to %.0f\n",
+		       total / secs / nthreads, min / secs, max / secs);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
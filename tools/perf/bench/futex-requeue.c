@@ -0,0 +1,171 @@
+/*
+ * futex-requeue.c
+ *
+ * requeue: Time to requeue the threads blocked on a futex to another
+ *
+ * The threads block in FUTEX_WAIT on a first futex, the main thread
+ * then moves them to a second one with FUTEX_CMP_REQUEUE, a few at a
+ * time, without waking any, as pthread_cond_broadcast() does. The time
+ * it takes to requeue them all is measured, with both hash bucket locks
+ * held for each call. They are woken up from the second futex after.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nrequeue = 1;
+static unsigned int iterations = 10;
+static bool fshared;
+static int futex_flag;
+
+static u_int32_t futex1, futex2;
+static pthread_barrier_t start_barrier;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads, default: online cpus"),
+	OPT_UINTEGER('q', "nrequeue", &nrequeue,
+		     "Specify number of threads to requeue per call"),
+	OPT_UINTEGER('i', "iterations", &iterations,
+		     "Specify number of times to requeue them all"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_requeue_usage[] = {
+	"perf bench futex requeue <options>",
+	NULL
+};
+
+static void *workerfn(void *arg __used)
+{
+	pthread_barrier_wait(&start_barrier);
+
+	/* only a wakeup ends the wait, the values stay 0 */
+	while (futex_wait(&futex1, 0, NULL, futex_flag) && errno == EINTR)
+		;
+	return NULL;
+}
+
+static void start_workers(pthread_t *thread, long ncpus)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpu;
+	unsigned int i;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_attr_init(&attr);
+		CPU_ZERO(&cpu);
+		CPU_SET(i % ncpus, &cpu);
+		if (pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu))
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+		if (pthread_create(&thread[i], &attr, workerfn, NULL))
+			err(EXIT_FAILURE, "pthread_create");
+		pthread_attr_destroy(&attr);
+	}
+}
+
+int bench_futex_requeue(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	double usecs, total = 0, min = 0, max = 0;
+	unsigned int i, j, moved;
+	pthread_t *thread;
+	long ncpus;
+	int ret;
+
+	argc = parse_options(argc, argv, options, bench_futex_requeue_usage,
+			     0);
+	if (argc)
+		usage_with_options(bench_futex_requeue_usage, options);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads)
+		nthreads = ncpus;
+	if (!nrequeue || !iterations)
+		usage_with_options(bench_futex_requeue_usage, options);
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	thread = calloc(nthreads, sizeof(*thread));
+	if (!thread)
+		err(EXIT_FAILURE, "calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads on a %s futex, %u requeued per call, "
+		       "%u iterations\n\n", nthreads,
+		       fshared ? "shared" : "private", nrequeue, iterations);
+
+	for (j = 0; j < iterations; j++) {
+		pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+		start_workers(thread, ncpus);
+		pthread_barrier_wait(&start_barrier);
+		/* give them time to block */
+		usleep(100000);
+
+		gettimeofday(&start, NULL);
+		for (moved = 0; moved < nthreads; moved += ret) {
+			ret = futex_cmp_requeue(&futex1, 0, &futex2, 0,
+						nrequeue, futex_flag);
+			if (ret < 0)
+				err(EXIT_FAILURE, "futex_cmp_requeue");
+		}
+		gettimeofday(&stop, NULL);
+
+		for (moved = 0; moved < nthreads; moved += ret) {
+			ret = futex_wake(&futex2, nthreads, futex_flag);
+			if (ret < 0)
+				err(EXIT_FAILURE, "futex_wake");
+		}
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(thread[i], NULL))
+				err(EXIT_FAILURE, "pthread_join");
+		}
+		pthread_barrier_destroy(&start_barrier);
+
+		timersub(&stop, &start, &diff);
+		usecs = diff.tv_sec * 1e6 + diff.tv_usec;
+		total += usecs;
+		if (!j || usecs < min)
+			min = usecs;
+		if (usecs > max)
+			max = usecs;
+	}
+	free(thread);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14.3f msecs to requeue %u threads, %.3f to %.3f\n",
+		       total / iterations / 1e3, nthreads, min / 1e3,
+		       max / 1e3);
+		printf(" %14.3f usecs per thread\n",
+		       total / iterations / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3f\n", total / iterations / 1e3);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
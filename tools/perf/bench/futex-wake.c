@@ -0,0 +1,164 @@
+/*
+ * futex-wake.c
+ *
+ * wake: Time to wake up the threads blocked on a futex
+ *
+ * The threads block in FUTEX_WAIT on one futex, the main thread then
+ * wakes them with FUTEX_WAKE, a few at a time, and the time it takes
+ * to wake them all is measured. All the waiters are on one hash
+ * bucket, so this is about the length of its chain and the hold time
+ * of its lock.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nwakes = 1;
+static unsigned int iterations = 10;
+static bool fshared;
+static int futex_flag;
+
+static u_int32_t futex1;
+static pthread_barrier_t start_barrier;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads, default: online cpus"),
+	OPT_UINTEGER('w', "nwakes", &nwakes,
+		     "Specify number of threads to wake up per call"),
+	OPT_UINTEGER('i', "iterations", &iterations,
+		     "Specify number of times to wake them all"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static void *workerfn(void *arg __used)
+{
+	pthread_barrier_wait(&start_barrier);
+
+	/* only a wakeup ends the wait, the value stays 0 */
+	while (futex_wait(&futex1, 0, NULL, futex_flag) && errno == EINTR)
+		;
+	return NULL;
+}
+
+static void start_workers(pthread_t *thread, long ncpus)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpu;
+	unsigned int i;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_attr_init(&attr);
+		CPU_ZERO(&cpu);
+		CPU_SET(i % ncpus, &cpu);
+		if (pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu))
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+		if (pthread_create(&thread[i], &attr, workerfn, NULL))
+			err(EXIT_FAILURE, "pthread_create");
+		pthread_attr_destroy(&attr);
+	}
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	double usecs, total = 0, min = 0, max = 0;
+	unsigned int i, j, woken;
+	pthread_t *thread;
+	long ncpus;
+	int ret;
+
+	argc = parse_options(argc, argv, options, bench_futex_wake_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_wake_usage, options);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads)
+		nthreads = ncpus;
+	if (!nwakes || !iterations)
+		usage_with_options(bench_futex_wake_usage, options);
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	thread = calloc(nthreads, sizeof(*thread));
+	if (!thread)
+		err(EXIT_FAILURE, "calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads on a %s futex, %u woken per call, "
+		       "%u iterations\n\n", nthreads,
+		       fshared ? "shared" : "private", nwakes, iterations);
+
+	for (j = 0; j < iterations; j++) {
+		pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+		start_workers(thread, ncpus);
+		pthread_barrier_wait(&start_barrier);
+		/* give them time to block */
+		usleep(100000);
+
+		gettimeofday(&start, NULL);
+		for (woken = 0; woken < nthreads; woken += ret) {
+			ret = futex_wake(&futex1, nwakes, futex_flag);
+			if (ret < 0)
+				err(EXIT_FAILURE, "futex_wake");
+		}
+		gettimeofday(&stop, NULL);
+
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(thread[i], NULL))
+				err(EXIT_FAILURE, "pthread_join");
+		}
+		pthread_barrier_destroy(&start_barrier);
+
+		timersub(&stop, &start, &diff);
+		usecs = diff.tv_sec * 1e6 + diff.tv_usec;
+		total += usecs;
+		if (!j || usecs < min)
+			min = usecs;
+		if (usecs > max)
+			max = usecs;
+	}
+	free(thread);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14.3f msecs to wake %u threads, %.3f to %.3f\n",
+		       total / iterations / 1e3, nthreads, min / 1e3,
+		       max / 1e3);
+		printf(" %14.3f usecs per thread\n",
+		       total / iterations / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3f\n", total / iterations / 1e3);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}